@@ -10,6 +10,10 @@
 // Nice terrain material tutorial series for Unreal Engine: https://www.youtube.com/watch?v=yCRzOdo4b68&t=8s&ab_channel=UnrealSensei
 #version 460 core
 
+// Permutation defines are added by the shader manager, see Terrain::getShaderDefines
+// TERRAIN_FOG: distance fog
+// TERRAIN_DEBUG_COLORS: pieces of the clipmap are drawn with their debug colors
+
 struct Color
 {
     vec3 albedo;
@@ -23,134 +27,152 @@ in vec3 WorldPos;
 in vec3 Normal;
 in vec2 TexCoords;
 in mat3 TBN;
+in float Scale;
+in float Level;
 in vec3 debugColor;
 
 out vec4 FragColor;
 
 const float PI = 3.14159265359;
 
-uniform vec3 camPos;
-
 //uniform samplerCube irradianceMap;
 
 // TODO: ADD LIGHT EMISSION
 
-// Extra color
-uniform sampler2D macroTexture;
-uniform sampler2D noiseTexture;
-
-uniform sampler2D albedoT0;
-uniform sampler2D albedoT1;
-uniform sampler2D albedoT2;
-uniform sampler2D albedoT3;
-uniform sampler2D albedoT4;
-uniform sampler2D albedoT5;
-uniform sampler2D albedoT6;
-
-uniform sampler2D normalT0;
-uniform sampler2D normalT1;
-uniform sampler2D normalT2;
-uniform sampler2D normalT3;
-uniform sampler2D normalT4;
-uniform sampler2D normalT5;
-uniform sampler2D normalT6;
-uniform sampler2D normalT7;
-uniform sampler2D normalT8;
+// Layers of the texture arrays, in the order of resources/textures/terrain/layers.xml
+#define LAYER_GRASSLAWN 0
+#define LAYER_GRASSWILD 1
+#define LAYER_SOILMULCH 2
+#define LAYER_GROUNDFOREST 3
+#define LAYER_GROUNDSANDY 4
+#define LAYER_CLIFFGRANITE 5
+#define LAYER_LICHENEDROCK 6
+#define LAYER_SNOWPURE 7
+#define LAYER_SNOWFRESH 8
+
+#define UTILITY_MACRO 0
+#define UTILITY_NOISE 1
+
+// The same as CLIPMAP_LEVEL in terrain.h, size of the level bounds of TerrainFrame
+#define CLIPMAP_LEVEL 4
+
+// Material groups, the same as SPLAT_GROUP_* in splatbaker.h. The splat map holds the blend factors of the chain in RGBA.
+#define SPLAT_GROUP_GRASS 0
+#define SPLAT_GROUP_MUD 1
+#define SPLAT_GROUP_STONE 2
+#define SPLAT_GROUP_CLIFF 3
+#define SPLAT_GROUP_SNOW 4
+#define SPLAT_GROUP_COUNT 5
+// Groups below one step of the splat map are not sampled
+#define SPLAT_MIN_WEIGHT (1.0 / 255)
+
+// Albedo with ambient occlusion in alpha, normal, and macro/noise maps in red. Units are bound in Terrain::onDraw.
+layout (binding = 1) uniform sampler2DArray albedoArray;
+layout (binding = 2) uniform sampler2DArray normalArray;
+layout (binding = 3) uniform sampler2DArray utilityArray;
+// Baked group weights, in the toroidal layout of the heightmap array
+layout (binding = 4) uniform sampler2DArray splatMapArray;
 
 uniform sampler2D aoT0;
 
-// Snow Color
-uniform vec3 color0;
-uniform vec3 color1;
-
-// Landscape parameters
-uniform vec3 lightDirection;
-uniform float lightPow;
-uniform float ambientAmount;
-uniform float specularAmount;
-uniform float specularPower;
-
-uniform	float blendDistance;
-uniform	float blendAmount;
-
-uniform	float scale_color0_dist0;
-uniform	float scale_color0_dist1;
-
-uniform	float scale_color1_dist0;
-uniform	float scale_color1_dist1;
-
-uniform	float scale_color2_dist0;
-uniform	float scale_color2_dist1;
-
-uniform	float scale_color3_dist0;
-uniform	float scale_color3_dist1;
-
-uniform	float scale_color4_dist0;
-uniform	float scale_color4_dist1;
-
-uniform	float scale_color5_dist0;
-uniform	float scale_color5_dist1;
-
-uniform	float scale_color6_dist0;
-uniform	float scale_color6_dist1;
-
-uniform	float scale_color7_dist0;
-uniform	float scale_color7_dist1;
-
-uniform	float scale_color8_dist0;
-uniform	float scale_color8_dist1;
-
-uniform	float macroScale_0;
-uniform	float macroScale_1;
-uniform	float macroScale_2;
-uniform	float macroPower;
-uniform	float macroOpacity;
-uniform	float macroAmountLayer0;
-uniform	float macroAmountLayer1;
-uniform	float macroAmountLayer2;
-uniform	float macroAmountLayer3;
-uniform	float macroAmountLayer4;
-
-uniform	float overlayBlendScale0;
-uniform	float overlayBlendAmount0;
-uniform	float overlayBlendPower0;
-uniform	float overlayBlendOpacity0;
-
-uniform	float overlayBlendScale1;
-uniform	float overlayBlendAmount1;
-uniform	float overlayBlendPower1;
-uniform	float overlayBlendOpacity1;
-
-uniform	float overlayBlendScale2;
-uniform	float overlayBlendAmount2;
-uniform	float overlayBlendPower2;
-uniform	float overlayBlendOpacity2;
-
-uniform	float overlayBlendScale3;
-uniform	float overlayBlendAmount3;
-uniform	float overlayBlendPower3;
-uniform	float overlayBlendOpacity3;
-
-uniform	float slopeSharpness0;
-uniform	float slopeSharpness1;
-uniform	float slopeSharpness2;
-
-uniform	float slopeBias0;
-uniform	float slopeBias1;
-uniform	float slopeBias2;
+// Both blocks mirror TerrainFrameUniforms and TerrainMaterialUniforms in terrain.h
+layout (std140, binding = 0) uniform TerrainFrame
+{
+    mat4 PV;
+    vec3 camPos;
+    float texSize;
+    vec4 levelBounds[CLIPMAP_LEVEL];
+};
 
-uniform	float heightBias0;
-uniform	float heightSharpness0;
+layout (std140, binding = 1) uniform TerrainMaterial
+{
+    // Landscape parameters
+    vec3 lightDirection;
+    float lightPow;
+    // Snow Color
+    vec3 color0;
+    float ambientAmount;
+    vec3 color1;
+    float specularAmount;
+    vec3 fogColor;
+    float specularPower;
+
+    float blendDistance;
+    float blendAmount;
+
+    float scale_color0_dist0;
+    float scale_color0_dist1;
+    float scale_color1_dist0;
+    float scale_color1_dist1;
+    float scale_color2_dist0;
+    float scale_color2_dist1;
+    float scale_color3_dist0;
+    float scale_color3_dist1;
+    float scale_color4_dist0;
+    float scale_color4_dist1;
+    float scale_color5_dist0;
+    float scale_color5_dist1;
+    float scale_color6_dist0;
+    float scale_color6_dist1;
+    float scale_color7_dist0;
+    float scale_color7_dist1;
+    float scale_color8_dist0;
+    float scale_color8_dist1;
+
+    float macroScale_0;
+    float macroScale_1;
+    float macroScale_2;
+    float macroPower;
+    float macroOpacity;
+    float macroAmountLayer0;
+    float macroAmountLayer1;
+    float macroAmountLayer2;
+    float macroAmountLayer3;
+    float macroAmountLayer4;
+
+    float overlayBlendScale0;
+    float overlayBlendAmount0;
+    float overlayBlendPower0;
+    float overlayBlendOpacity0;
+    float overlayBlendScale1;
+    float overlayBlendAmount1;
+    float overlayBlendPower1;
+    float overlayBlendOpacity1;
+    float overlayBlendScale2;
+    float overlayBlendAmount2;
+    float overlayBlendPower2;
+    float overlayBlendOpacity2;
+    float overlayBlendScale3;
+    float overlayBlendAmount3;
+    float overlayBlendPower3;
+    float overlayBlendOpacity3;
+
+    float slopeSharpness0;
+    float slopeSharpness1;
+    float slopeSharpness2;
+    float slopeBias0;
+    float slopeBias1;
+    float slopeBias2;
+
+    float heightBias0;
+    float heightSharpness0;
+
+    float distanceNear;
+    float fogBlendDistance;
+    float maxFog;
+};
 
-uniform float distanceNear;
-uniform float fogBlendDistance;
-uniform vec3 fogColor;
-uniform float maxFog;
+// Derivatives of TexCoords, taken before the groups are branched on, so sampling inside a branch keeps its mip level
+vec2 texCoordsDx;
+vec2 texCoordsDy;
 
 vec3 PbrMaterialWorkflow(vec3 albedo, vec3 normal, float specular, float ao){
 
     albedo = pow(albedo, vec3(2.2));
-    normal = normal * 2 - 1;
+
+    // Cooked normal arrays are BC5 and keep only x and y, z is found from them for both kinds of arrays
+    normal.xy = normal.xy * 2 - 1;
+    normal.z = sqrt(max(1 - dot(normal.xy, normal.xy), 0));
     vec3 N = TBN * normal;
 
     vec3 lightDir = lightDirection;
@@ -178,9 +200,9 @@ float LinearizeDepth(float depth)
 
 float GetMacroValue(){
 
-    float macro0 = texture(macroTexture, TexCoords * macroScale_0).r + 0.2;
-    float macro1 = texture(macroTexture, TexCoords * macroScale_1).r + 0.2;
-    float macro2 = texture(macroTexture, TexCoords * macroScale_2).r + 0.2;
+    float macro0 = texture(utilityArray, vec3(TexCoords * macroScale_0, UTILITY_MACRO)).r + 0.2;
+    float macro1 = texture(utilityArray, vec3(TexCoords * macroScale_1, UTILITY_MACRO)).r + 0.2;
+    float macro2 = texture(utilityArray, vec3(TexCoords * macroScale_2, UTILITY_MACRO)).r + 0.2;
     float macro = macro0 * macro1 * macro2;
     macro = 1 - macro;
     macro *= macroOpacity;
@@ -191,9 +213,9 @@ float GetMacroValue(){
 
 float GetNoiseValue(float overlayBlendScale, float overlayBlendAmount, float overlayBlendPower, float overlayBlendOpacity){
 
-    float noiseVal = texture(noiseTexture, TexCoords * overlayBlendScale).r;
-    noiseVal += texture(noiseTexture, TexCoords * overlayBlendScale * 0.2).r;
-    noiseVal += texture(noiseTexture, TexCoords * overlayBlendScale * 0.05).r;
+    float noiseVal = textureGrad(utilityArray, vec3(TexCoords * overlayBlendScale, UTILITY_NOISE), texCoordsDx * overlayBlendScale, texCoordsDy * overlayBlendScale).r;
+    noiseVal += textureGrad(utilityArray, vec3(TexCoords * overlayBlendScale * 0.2, UTILITY_NOISE), texCoordsDx * overlayBlendScale * 0.2, texCoordsDy * overlayBlendScale * 0.2).r;
+    noiseVal += textureGrad(utilityArray, vec3(TexCoords * overlayBlendScale * 0.05, UTILITY_NOISE), texCoordsDx * overlayBlendScale * 0.05, texCoordsDy * overlayBlendScale * 0.05).r;
     noiseVal * 0.33;
 
     noiseVal *= overlayBlendAmount;
@@ -201,17 +223,17 @@ float GetNoiseValue(float overlayBlendScale, float overlayBlendAmount, float ove
     return noiseVal;
 }
 
-vec4 getColorDistanceBlendedRGBA(float dist0, float dist1, float distanceBlend, sampler2D textureUnit){
+vec4 getColorDistanceBlendedRGBA(float dist0, float dist1, float distanceBlend, sampler2DArray textureArray, int layer){
 
-    vec4 textureUnit_dist_0 = texture(textureUnit, vec2(TexCoords * dist0)).rgba;
-    vec4 textureUnit_dist_1 = texture(textureUnit, vec2(TexCoords * dist1)).rgba;
+    vec4 textureUnit_dist_0 = textureGrad(textureArray, vec3(TexCoords * dist0, layer), texCoordsDx * dist0, texCoordsDy * dist0).rgba;
+    vec4 textureUnit_dist_1 = textureGrad(textureArray, vec3(TexCoords * dist1, layer), texCoordsDx * dist1, texCoordsDy * dist1).rgba;
     return mix(textureUnit_dist_1, textureUnit_dist_0, distanceBlend);
 }
 
-vec3 getColorDistanceBlendedRGB(float dist0, float dist1, float distanceBlend, sampler2D textureUnit){
+vec3 getColorDistanceBlendedRGB(float dist0, float dist1, float distanceBlend, sampler2DArray textureArray, int layer){
 
-    vec3 textureUnit_dist_0 = texture(textureUnit, vec2(TexCoords * dist0)).rgb;
-    vec3 textureUnit_dist_1 = texture(textureUnit, vec2(TexCoords * dist1)).rgb;
+    vec3 textureUnit_dist_0 = textureGrad(textureArray, vec3(TexCoords * dist0, layer), texCoordsDx * dist0, texCoordsDy * dist0).rgb;
+    vec3 textureUnit_dist_1 = textureGrad(textureArray, vec3(TexCoords * dist1, layer), texCoordsDx * dist1, texCoordsDy * dist1).rgb;
     return mix(textureUnit_dist_1, textureUnit_dist_0, distanceBlend);
 }
 
@@ -219,10 +241,10 @@ vec3 getColorDistanceBlendedRGB(float dist0, float dist1, float distanceBlend, s
 * Gets albedo, normal and specular color calculated with distance blending. 
 * Same texture is blended according to distance with different scale values to get rid of tiling.
 */
-Color getColorDistanceBlended(float distanceBlend, float dist0, float dist1, sampler2D albedoTexture, sampler2D normalTexture){
+Color getColorDistanceBlended(float distanceBlend, float dist0, float dist1, int layer){
     
-    vec4 albedo = getColorDistanceBlendedRGBA(dist0, dist1, distanceBlend, albedoTexture);
-    vec3 normal = getColorDistanceBlendedRGB(dist0, dist1, distanceBlend, normalTexture);
+    vec4 albedo = getColorDistanceBlendedRGBA(dist0, dist1, distanceBlend, albedoArray, layer);
+    vec3 normal = getColorDistanceBlendedRGB(dist0, dist1, distanceBlend, normalArray, layer);
     float specular = clamp(albedo.r, 0, 0.75) * 0.75;
 
     Color color;
@@ -256,6 +278,24 @@ Color blendLayersWithNoise(Color color0, Color color1, float overlayBlendScale,
     return blendColors(color0, color1, noiseVal);
 }
 
+void accumulateColor(inout Color color, Color layer, float weight){
+
+    color.albedo += layer.albedo * weight;
+    color.normal += layer.normal * weight;
+    color.specular += layer.specular * weight;
+    color.ao += layer.ao * weight;
+}
+
+/*
+* Blend factors of the geometry for the fragment, mud, snow, stone and cliff. They are baked per texel of the level, see splatbaker.h.
+* Factors are sampled at texel centers, texel k of a level is at world position k * Scale.
+*/
+vec4 getSplatFactors(){
+
+    vec2 splatCoords = (mod(WorldPos.xz / Scale, texSize) + 0.5) / texSize;
+    return texture(splatMapArray, vec3(splatCoords, Level));
+}
+
 float getSlopeBlend(vec3 normal, float worldSpaceSlope, float slopeBias, float slopeSharpness){
 
     float worldSpaceSlopeBlend = clamp((slopeBias - worldSpaceSlope) / slopeSharpness + 0.5, 0, 1);
@@ -266,6 +306,31 @@ float getSlopeBlend(vec3 normal, float worldSpaceSlope, float slopeBias, float s
     return slopeBlend;
 }
 
+/*
+* getSlopeBlend from a baked slope factor. A fractional factor gives back the world slope, a full one only needs the
+* slope of the normal map and a zero one stays zero. Same as SplatBaker::refineBlendFactors.
+*/
+float refineSplatFactor(float factor, vec3 normal, float slopeBias, float slopeSharpness){
+
+    if (factor <= 0)
+        return 0;
+    float worldSpaceSlope = slopeBias - (factor - 0.5) * slopeSharpness;
+    return getSlopeBlend(normal, worldSpaceSlope, slopeBias, slopeSharpness);
+}
+
+/*
+* Closed form of the blend chain, the weight of a group is its factor times one minus the factors of every later blend
+*/
+float[SPLAT_GROUP_COUNT] getSplatWeights(float slopeBlend1, float heightBlend0, float slopeBlend2, float slopeBlend3){
+
+    float rest = 1 - slopeBlend3;
+    float stone = slopeBlend2 * rest;
+    rest *= 1 - slopeBlend2;
+    float snow = heightBlend0 * rest;
+    rest *= 1 - heightBlend0;
+    return float[](rest * (1 - slopeBlend1), rest * slopeBlend1, stone, slopeBlend3, snow);
+}
+
 float getDistanceBlend(){
 
     float cameraToFragDist = distance(camPos, WorldPos);
@@ -282,61 +347,112 @@ vec3 getColorAfterFogFilter(vec3 color){
 
 void main(){
 
-    float distanceBlend = getDistanceBlend();
-    Color c0 = getColorDistanceBlended(distanceBlend, scale_color0_dist0, scale_color0_dist1, albedoT0, normalT0); // grasslawn
-    Color c1 = getColorDistanceBlended(distanceBlend, scale_color1_dist0, scale_color1_dist1, albedoT1, normalT1); // grasswild
-    Color c2 = getColorDistanceBlended(distanceBlend, scale_color2_dist0, scale_color2_dist1, albedoT2, normalT2); // soilmulch
-    Color c3 = getColorDistanceBlended(distanceBlend, scale_color3_dist0, scale_color3_dist1, albedoT3, normalT3); // groundforest
-    Color c4 = getColorDistanceBlended(distanceBlend, scale_color4_dist0, scale_color4_dist1, albedoT4, normalT4); // groundsandy
-    Color c5 = getColorDistanceBlended(distanceBlend, scale_color5_dist0, scale_color5_dist1, albedoT5, normalT5); // cliffgranite
-    Color c6 = getColorDistanceBlended(distanceBlend, scale_color6_dist0, scale_color6_dist1, albedoT6, normalT6); // lichenedrock
-
-    Color c7;
-    c7.albedo = color0;
-    c7.specular = clamp(c7.albedo.r, 0, 0.5) * 0.5;
-    c7.normal = getColorDistanceBlendedRGB(distanceBlend, scale_color7_dist0, scale_color7_dist1, normalT7);           // snowpure 
-    c7.ao = 1.f;
-
-    Color c8;
-    c8.albedo = color1;
-    c8.specular = clamp(c8.albedo.r, 0, 0.5) * 0.5;
-    c8.normal = getColorDistanceBlendedRGB(distanceBlend, scale_color8_dist0, scale_color8_dist1, normalT8);           // snowfresh 
-    c8.ao = 1.f;
-
-    Color layer0 = blendLayersWithNoise(c0, c1, overlayBlendScale0, overlayBlendAmount0, overlayBlendPower0, overlayBlendOpacity0); // grass
-    //Color layer0 = blendLayersWithNoise(c7, c8, overlayBlendScale3, overlayBlendAmount3, overlayBlendPower3, overlayBlendOpacity3); // snow
-
-    Color layer1 = blendLayersWithNoise(c2, c3, overlayBlendScale1, overlayBlendAmount1, overlayBlendPower1, overlayBlendOpacity1); // mud
-    Color layer2 = c4;                                                                                                              // stone
-    Color layer3 = blendLayersWithNoise(c5, c6, overlayBlendScale2, overlayBlendAmount2, overlayBlendPower2, overlayBlendOpacity2); // cliff
-    Color layer4 = blendLayersWithNoise(c7, c8, overlayBlendScale3, overlayBlendAmount3, overlayBlendPower3, overlayBlendOpacity3); // snow 
+    texCoordsDx = dFdx(TexCoords);
+    texCoordsDy = dFdy(TexCoords);
 
+    vec4 factors = getSplatFactors();
+    float distanceBlend = getDistanceBlend();
     float macro = GetMacroValue();
-    layer0.albedo *= mix(1, macro, macroAmountLayer0);
-    layer1.albedo *= mix(1, macro, macroAmountLayer1);
-    layer2.albedo *= mix(1, macro, macroAmountLayer2);
-    layer3.albedo *= mix(1, macro, macroAmountLayer3);
-    layer4.albedo *= mix(1, macro, macroAmountLayer4);
-
-    // SLOPES AND HEIGHTS
-    float worldSpaceSlope = dot(Normal, vec3(0,1,0));
-    float slopeBlend1 = getSlopeBlend(layer1.normal, worldSpaceSlope, slopeBias0, slopeSharpness0);
-    float slopeBlend2 = getSlopeBlend(layer3.normal, worldSpaceSlope, slopeBias1, slopeSharpness1); // layer2: store, layer3: cliff
-    float slopeBlend3 = getSlopeBlend(layer3.normal, worldSpaceSlope, slopeBias2, slopeSharpness2);
-    float heightBlend0 = clamp((WorldPos.y - heightBias0) / heightSharpness0 + 0.5, 0, 1);
-
-    Color final = blendColors(layer0, layer1, slopeBlend1);
-    final = blendColors(final, layer4, heightBlend0);
-    final = blendColors(final, layer2, slopeBlend2);
-    final = blendColors(final, layer3, slopeBlend3);
+
+    Color final;
+    final.albedo = vec3(0);
+    final.normal = vec3(0);
+    final.specular = 0;
+    final.ao = 0;
+    float totalWeight = 0;
+
+    // Slope blends of stone and cliff use the cliff normal, the one of mud the mud normal, like the blend chain always did
+    float slopeBlend3 = factors.a;
+    float slopeBlend2 = factors.b;
+    Color layer3;
+    if (slopeBlend2 > 0 || slopeBlend3 > 0) {
+        Color c5 = getColorDistanceBlended(distanceBlend, scale_color5_dist0, scale_color5_dist1, LAYER_CLIFFGRANITE);
+        Color c6 = getColorDistanceBlended(distanceBlend, scale_color6_dist0, scale_color6_dist1, LAYER_LICHENEDROCK);
+        layer3 = blendLayersWithNoise(c5, c6, overlayBlendScale2, overlayBlendAmount2, overlayBlendPower2, overlayBlendOpacity2);
+        layer3.albedo *= mix(1, macro, macroAmountLayer3);
+        slopeBlend2 = refineSplatFactor(slopeBlend2, layer3.normal, slopeBias1, slopeSharpness1);
+        slopeBlend3 = refineSplatFactor(slopeBlend3, layer3.normal, slopeBias2, slopeSharpness2);
+    }
+
+    float slopeBlend1 = factors.r;
+    Color layer1;
+    if (slopeBlend1 > 0 && (1 - slopeBlend3) * (1 - slopeBlend2) * (1 - factors.g) > SPLAT_MIN_WEIGHT) {
+        Color c2 = getColorDistanceBlended(distanceBlend, scale_color2_dist0, scale_color2_dist1, LAYER_SOILMULCH);
+        Color c3 = getColorDistanceBlended(distanceBlend, scale_color3_dist0, scale_color3_dist1, LAYER_GROUNDFOREST);
+        layer1 = blendLayersWithNoise(c2, c3, overlayBlendScale1, overlayBlendAmount1, overlayBlendPower1, overlayBlendOpacity1);
+        layer1.albedo *= mix(1, macro, macroAmountLayer1);
+        slopeBlend1 = refineSplatFactor(slopeBlend1, layer1.normal, slopeBias0, slopeSharpness0);
+    }
+    else
+        slopeBlend1 = 0;
+
+    float weights[SPLAT_GROUP_COUNT] = getSplatWeights(slopeBlend1, factors.g, slopeBlend2, slopeBlend3);
+
+    // Only groups that are visible on the fragment are sampled
+    if (weights[SPLAT_GROUP_GRASS] > SPLAT_MIN_WEIGHT) {
+        Color c0 = getColorDistanceBlended(distanceBlend, scale_color0_dist0, scale_color0_dist1, LAYER_GRASSLAWN);
+        Color c1 = getColorDistanceBlended(distanceBlend, scale_color1_dist0, scale_color1_dist1, LAYER_GRASSWILD);
+        Color layer0 = blendLayersWithNoise(c0, c1, overlayBlendScale0, overlayBlendAmount0, overlayBlendPower0, overlayBlendOpacity0);
+        layer0.albedo *= mix(1, macro, macroAmountLayer0);
+        accumulateColor(final, layer0, weights[SPLAT_GROUP_GRASS]);
+        totalWeight += weights[SPLAT_GROUP_GRASS];
+    }
+
+    if (weights[SPLAT_GROUP_MUD] > SPLAT_MIN_WEIGHT) {
+        accumulateColor(final, layer1, weights[SPLAT_GROUP_MUD]);
+        totalWeight += weights[SPLAT_GROUP_MUD];
+    }
+
+    if (weights[SPLAT_GROUP_STONE] > SPLAT_MIN_WEIGHT) {
+        Color layer2 = getColorDistanceBlended(distanceBlend, scale_color4_dist0, scale_color4_dist1, LAYER_GROUNDSANDY);
+        layer2.albedo *= mix(1, macro, macroAmountLayer2);
+        accumulateColor(final, layer2, weights[SPLAT_GROUP_STONE]);
+        totalWeight += weights[SPLAT_GROUP_STONE];
+    }
+
+    if (weights[SPLAT_GROUP_CLIFF] > SPLAT_MIN_WEIGHT) {
+        accumulateColor(final, layer3, weights[SPLAT_GROUP_CLIFF]);
+        totalWeight += weights[SPLAT_GROUP_CLIFF];
+    }
+
+    if (weights[SPLAT_GROUP_SNOW] > SPLAT_MIN_WEIGHT) {
+        Color c7;
+        c7.albedo = color0;
+        c7.specular = clamp(c7.albedo.r, 0, 0.5) * 0.5;
+        c7.normal = getColorDistanceBlendedRGB(distanceBlend, scale_color7_dist0, scale_color7_dist1, normalArray, LAYER_SNOWPURE);           // snowpure 
+        c7.ao = 1.f;
+
+        Color c8;
+        c8.albedo = color1;
+        c8.specular = clamp(c8.albedo.r, 0, 0.5) * 0.5;
+        c8.normal = getColorDistanceBlendedRGB(distanceBlend, scale_color8_dist0, scale_color8_dist1, normalArray, LAYER_SNOWFRESH);           // snowfresh 
+        c8.ao = 1.f;
+
+        Color layer4 = blendLayersWithNoise(c7, c8, overlayBlendScale3, overlayBlendAmount3, overlayBlendPower3, overlayBlendOpacity3);
+        layer4.albedo *= mix(1, macro, macroAmountLayer4);
+        accumulateColor(final, layer4, weights[SPLAT_GROUP_SNOW]);
+        totalWeight += weights[SPLAT_GROUP_SNOW];
+    }
+
+    // Skipped groups are below a step of the splat map, the rest is scaled back to one
+    float normalization = 1 / max(totalWeight, SPLAT_MIN_WEIGHT);
+    final.albedo *= normalization;
+    final.normal *= normalization;
+    final.specular *= normalization;
+    final.ao *= normalization;
 
     vec3 color = PbrMaterialWorkflow(final.albedo, final.normal, final.specular, final.ao);
+#ifdef TERRAIN_FOG
     color = getColorAfterFogFilter(color);
+#endif
 
     // ---- GAMMA CORRECT
     color = pow(color, vec3(1.0/2.2));
 
     // ---- OUTPUT
+#ifdef TERRAIN_DEBUG_COLORS
+    FragColor = vec4(debugColor, 1.f);
+#else
     FragColor = vec4(color, 1.f);
-    //FragColor = vec4(debugColor, 1.f);
-}
+#endif
+}
\ No newline at end of file
@@ -12,17 +12,32 @@
 #version 460 core
 
 #define MAX_HEIGHT 150.f
-#define TERRAIN_INSTANCED_RENDERING
+// The same as CLIPMAP_LEVEL and CLIPMAP_MORPH_WIDTH in terrain.h
+#define CLIPMAP_LEVEL 4
+#define MORPH_WIDTH 30.f
+// Permutation defines are added by the shader manager, see Terrain::getShaderDefines
 
 #ifdef TERRAIN_INSTANCED_RENDERING
 
 layout (location = 0) in vec2 position;
 layout (location = 1) in vec2 position_instance;
-layout (location = 2) in float level_instance;
-layout (location = 3) in mat4 model_instance;
-layout (location = 7) in vec3 color_instance;
+layout (location = 2) in uint level_instance;
+layout (location = 3) in uint packed_instance; // rotation code | color index << 8
 
-uniform mat4 PV;
+// cos and sin of quarter turns around Y axis
+const vec2 rotations[4] = vec2[](vec2(1, 0), vec2(0, 1), vec2(-1, 0), vec2(0, -1));
+
+// BLOCK, FIXUP_VERTICAL, FIXUP_HORIZONTAL, INTERIOR_TRIM, OUTER_DEGENERATE, SMALL_SQUARE
+const vec3 debugColors[6] = vec3[](vec3(1, 1, 1), vec3(1, 1, 0), vec3(1, 0, 1), vec3(0, 1, 1), vec3(1, 0, 0), vec3(0, 1, 0));
+
+// Mirrors TerrainFrameUniforms in terrain.h
+layout (std140, binding = 0) uniform TerrainFrame
+{
+    mat4 PV;
+    vec3 camPos;
+    float texSize;
+    vec4 levelBounds[CLIPMAP_LEVEL];
+};
 
 out vec3 WorldPos;
 out vec3 Normal;
@@ -34,15 +49,39 @@ out float Scale;
 out float Level;
 out vec3 debugColor;
 
-uniform sampler2DArray heightmapArray;
-uniform float texSize;
-uniform vec3 camPos;
+layout (binding = 0) uniform sampler2DArray heightmapArray;
+
+float getHeight(ivec2 texel, float level)
+{
+    vec2 heightSample = texelFetch(heightmapArray, ivec3(texel, level), 0).rg;
+    return (heightSample.r * 255 * 256 + heightSample.g * 255) * (MAX_HEIGHT / (256 * 256 - 1));
+}
+
+// Height of the next level at a vertex, interpolated along the coarse triangles like its geometry.
+// Vertices on an edge of the coarse grid get the mean of its two ends, the ones on the outer border of a level are all on one.
+float getCoarseHeight(vec2 position, float level)
+{
+    vec2 coarse = position / pow(2, level + 1);
+    vec2 base = floor(coarse);
+    vec2 f = coarse - base;
+    ivec2 t0 = ivec2(mod(base, texSize));
+    ivec2 t1 = ivec2(mod(base + 1, texSize));
+
+    float h00 = getHeight(t0, level + 1);
+    float h10 = getHeight(ivec2(t1.x, t0.y), level + 1);
+    float h01 = getHeight(ivec2(t0.x, t1.y), level + 1);
+    float h11 = getHeight(t1, level + 1);
+    return mix(mix(h00, h10, f.x), mix(h01, h11, f.x), f.y);
+}
 
 void main(void)
 {
+    float level = float(level_instance);
+
     // set position in xz plane
-    vec3 p = vec3(model_instance * vec4(position.x, 0, position.y, 1));
-    float scale = pow(2, float(level_instance));
+    vec2 rotation = rotations[packed_instance & 3u];
+    vec3 p = vec3(rotation.x * position.x + rotation.y * position.y, 0, rotation.x * position.y - rotation.y * position.x);
+    float scale = pow(2, level);
     vec3 pos = vec3(position_instance.x, 0, position_instance.y) + scale * p;
 
     // set texture coordinates
@@ -50,13 +89,24 @@ void main(void)
     vec2 texCoords = mod(vec2(pos.x, pos.z), terrainClipSize);
     texCoords /= terrainClipSize;
 
-    vec2 heightSample = texture(heightmapArray, vec3(texCoords.xy, level_instance)).rg;
-    vec2 index0 = textureOffset(heightmapArray, vec3(texCoords.xy, level_instance), ivec2(0, -1)).rg;
-    vec2 index1 = textureOffset(heightmapArray, vec3(texCoords.xy, level_instance), ivec2(-1, 0)).rg;
-    vec2 index2 = textureOffset(heightmapArray, vec3(texCoords.xy, level_instance), ivec2(1, 0)).rg;
-    vec2 index3 = textureOffset(heightmapArray, vec3(texCoords.xy, level_instance), ivec2(0, 1)).rg;
+    vec2 heightSample = texture(heightmapArray, vec3(texCoords.xy, level)).rg;
+    vec2 index0 = textureOffset(heightmapArray, vec3(texCoords.xy, level), ivec2(0, -1)).rg;
+    vec2 index1 = textureOffset(heightmapArray, vec3(texCoords.xy, level), ivec2(-1, 0)).rg;
+    vec2 index2 = textureOffset(heightmapArray, vec3(texCoords.xy, level), ivec2(1, 0)).rg;
+    vec2 index3 = textureOffset(heightmapArray, vec3(texCoords.xy, level), ivec2(0, 1)).rg;
 
     float height = (heightSample.r * 255 * 256 + heightSample.g * 255) * (MAX_HEIGHT / (256 * 256 - 1));
+
+    // Geomorphing: outer vertices of a level blend to the next level, at the border they are on its geometry,
+    // so a level meets the coarser one without cracks whatever filter made the coarser heights
+    if (level_instance < uint(CLIPMAP_LEVEL - 1))
+    {
+        vec4 bounds = levelBounds[level_instance];
+        vec2 border = min(pos.xz - bounds.xy, bounds.zw - pos.xz);
+        float alpha = clamp(1 - min(border.x, border.y) / (scale * MORPH_WIDTH), 0, 1);
+        if (alpha > 0)
+            height = mix(height, getCoarseHeight(pos.xz, level), alpha);
+    }
     pos.y = height;
     //pos.y = 0;
 
@@ -88,8 +138,8 @@ void main(void)
     TexCoords.y = pos.z;
     Scale = scale;
     Normal = normal;
-    Level = level_instance;
-    debugColor = color_instance;
+    Level = level;
+    debugColor = debugColors[(packed_instance >> 8) & 255u];
 
     gl_Position =  PV * vec4(pos, 1.0);
 }
@@ -0,0 +1,22 @@
+#include "pch.h"
+#include "corecontext.h"
+#include "benchmarks.h"
+
+using namespace Core;
+
+// Terrain reads it when there is a window, benchmarks run without one
+CoreContext* CoreContext::instance;
+
+/*
+* Entry point of the headless benchmark executable of CMakeLists.txt, it only runs the flags of Benchmarks.
+*/
+int main(int argc, char** argv) {
+
+	int exitCode;
+	if (Benchmarks::run(argc, argv, exitCode))
+		return exitCode;
+
+	std::cout << "Usage: " << argv[0] << " --benchmark-terrain|--benchmark-culling|--benchmark-tilecache|--benchmark-streaming|"
+		"--benchmark-mips|--benchmark-bounds|--benchmark-splat|--benchmark-bc|--cook-textures [arguments], see the README" << std::endl;
+	return 1;
+}
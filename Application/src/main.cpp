@@ -1,6 +1,10 @@
 #include "pch.h"
 #include "corecontext.h"
 #include "editorcontext.h"
+#include "benchmarks.h"
+#include "component/heightmapcache.h"
+#include "gldispatch.h"
+#include "profiler.h"
 
 using namespace Core;
 using namespace Editor;
@@ -8,7 +12,28 @@ using namespace Editor;
 EditorContext* EditorContext::instance;
 CoreContext* CoreContext::instance;
 
-int main() {
+int main(int argc, char** argv) {
+
+	std::string tracePath;
+
+	int exitCode;
+	if (Benchmarks::run(argc, argv, exitCode))
+		return exitCode;
+
+	for (int i = 1; i < argc; i++) {
+
+		// Terrain loads the heightmap both from png and from the cooked cache and prints the timings
+		if (std::string(argv[i]) == "--benchmark-heightmap")
+			HeightmapCache::benchmarkOnLoad = true;
+
+		// GL calls, state changes, uniform updates and uploaded bytes are counted every frame and shown in the terrain panel
+		if (std::string(argv[i]) == "--record-gl")
+			GLDispatch::recording = true;
+
+		// Scopes that are still in the profiler rings are written as a Chrome trace on exit: --profile-trace [output json]
+		if (std::string(argv[i]) == "--profile-trace")
+			tracePath = i + 1 < argc && argv[i + 1][0] != '-' ? argv[i + 1] : "profile_trace.json";
+	}
 
 	std::cout << "Program started." << std::endl;
 
@@ -39,6 +64,9 @@ int main() {
 
 	} while (CoreContext::instance->glfwContext->getOpen());
 
+	if (!tracePath.empty())
+		std::cout << (Profiler::exportChromeTrace(tracePath) ? "Profile trace written to " : "Profile trace could not be written to ") << tracePath << std::endl;
+
 	delete EditorContext::instance;
 	delete CoreContext::instance;
 
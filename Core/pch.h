@@ -8,11 +8,16 @@
 #define PCH_H
 
 // add headers that you want to pre-compile here
+#ifdef _WIN32
 #include <windows.h>
+#include <shlobj.h>
+#else
+// Headless build of CMakeLists.txt, classes are exported the MSVC way
+#define __declspec(x)
+#endif
 #include <iostream>
 #include <fstream>
 #include <filesystem>
-#include <shlobj.h>
 #include <string>
 #include <vector>
 #include <map>
@@ -0,0 +1,87 @@
+#include "pch.h"
+#include "benchmarks.h"
+#include "frustumculler.h"
+#include "mipgenerator.h"
+#include "blockencoder.h"
+#include "component/terraintilecache.h"
+#include "component/terrainstreamer.h"
+#include "component/heightpyramid.h"
+#include "component/splatbaker.h"
+#include "component/terrain.h"
+#include "component/terraintexturecooker.h"
+#include "component/terrainbenchmark.h"
+
+namespace Core {
+
+	/*
+	* Runs the first benchmark flag of argv. Returns false if there is none, exitCode is only set when one ran.
+	*/
+	bool Benchmarks::run(int argc, char** argv, int& exitCode) {
+
+		for (int i = 1; i < argc; i++) {
+
+			// Microbenchmark of the frustum culling paths: --benchmark-culling
+			if (std::string(argv[i]) == "--benchmark-culling") {
+				exitCode = FrustumCuller::benchmark(100000, 100) ? 0 : 1;
+				return true;
+			}
+
+			// Streams a synthetic map through the out of core tile cache: --benchmark-tilecache [map size] [cache size in MB]
+			if (std::string(argv[i]) == "--benchmark-tilecache") {
+				int mapSize = i + 1 < argc ? atoi(argv[i + 1]) : 16384;
+				unsigned long long capacity = (i + 2 < argc ? atoi(argv[i + 2]) : 64) * 1024ull * 1024;
+				TerrainTileCache::benchmark(mapSize, capacity);
+				exitCode = 0;
+				return true;
+			}
+
+			// Tile gathering speed of the streamer with the old and the current heightmap stack layouts, and reuse of its staging ring
+			if (std::string(argv[i]) == "--benchmark-streaming") {
+				exitCode = TerrainStreamer::benchmark(20) ? 0 : 1;
+				return true;
+			}
+
+			// Filters of the heightmap mip chain on every instruction set and thread count: --benchmark-mips [size]
+			if (std::string(argv[i]) == "--benchmark-mips") {
+				exitCode = MipGenerator::benchmark(i + 1 < argc ? atoi(argv[i + 1]) : 4096, 5) ? 0 : 1;
+				return true;
+			}
+
+			// Block bounds from a full window scan and from the sliding window, they have to match: --benchmark-bounds [size]
+			if (std::string(argv[i]) == "--benchmark-bounds") {
+				exitCode = HeightPyramid::benchmark(i + 1 < argc ? atoi(argv[i + 1]) : 4096, 200000) ? 0 : 1;
+				return true;
+			}
+
+			// Baked splat weights against the blend chain of terrain.frag, and bake throughput: --benchmark-splat
+			if (std::string(argv[i]) == "--benchmark-splat") {
+				exitCode = SplatBaker::benchmark(5) ? 0 : 1;
+				return true;
+			}
+
+			// Encoder throughput of every block format on the scalar and the SSE path, and quality of the blocks: --benchmark-bc [size]
+			if (std::string(argv[i]) == "--benchmark-bc") {
+				exitCode = BlockEncoder::benchmark(i + 1 < argc ? atoi(argv[i + 1]) : 1024, 3) ? 0 : 1;
+				return true;
+			}
+
+			// Cooks the terrain layers to block compressed arrays and checks the written files against them: --cook-textures [bc1|bc3|bc7]
+			if (std::string(argv[i]) == "--cook-textures") {
+				std::string format = i + 1 < argc ? argv[i + 1] : "bc3";
+				int albedoFormat = format == "bc7" ? BLOCK_FORMAT_BC7 : (format == "bc1" ? BLOCK_FORMAT_BC1 : BLOCK_FORMAT_BC3);
+				exitCode = TerrainTextureCooker::cook(TERRAIN_LAYERS_PATH, albedoFormat) ? 0 : 1;
+				return true;
+			}
+
+			// CPU pipeline of the terrain on camera paths with a null GL backend: --benchmark-terrain [output json] [camera path]
+			if (std::string(argv[i]) == "--benchmark-terrain") {
+				std::string outputPath = i + 1 < argc ? argv[i + 1] : "terrain_benchmark.json";
+				std::string cameraPath = i + 2 < argc ? argv[i + 2] : "";
+				exitCode = TerrainBenchmark::run(outputPath, cameraPath) ? 0 : 1;
+				return true;
+			}
+		}
+
+		return false;
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+namespace Core {
+
+	/*
+	* Command line flags of the benchmarks and the texture cooker, shared by Application and the headless benchmark
+	* executable of CMakeLists.txt. They run without a window and the ones that check their results fail with exit code 1.
+	*/
+	class __declspec(dllexport) Benchmarks {
+
+	private:
+
+	public:
+
+		static bool run(int argc, char** argv, int& exitCode);
+	};
+}
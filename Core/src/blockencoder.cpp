@@ -0,0 +1,929 @@
+#include "pch.h"
+#include "blockencoder.h"
+#include "cpufeatures.h"
+#include "threadpool.h"
+#include <immintrin.h>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <climits>
+#include <cfloat>
+#include <algorithm>
+
+namespace Core {
+
+	const char* BlockEncoder::formatNames[BLOCK_FORMAT_COUNT] = { "BC1", "BC3", "BC4", "BC5", "BC7" };
+
+	// Weight of the first endpoint for each 2 bit color index of BC1
+	static const float colorWeights[4] = { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+
+	// Weight of the second endpoint for each 4 bit index of BC7, out of 64
+	static const int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	static inline int clampInt(int value, int low, int high) {
+
+		return value < low ? low : (value > high ? high : value);
+	}
+
+	/*
+	* Mean of the texels and the unit direction they vary the most along, by power iteration on their covariance.
+	* Axis is zero if every texel is the same. Texels are RGBA, first channels are used.
+	*/
+	static void getPrincipalAxis(const unsigned char* texels, int channels, float* mean, float* axis) {
+
+		for (int c = 0; c < channels; c++) {
+			mean[c] = 0.f;
+			for (int i = 0; i < 16; i++)
+				mean[c] += texels[i * 4 + c];
+			mean[c] /= 16.f;
+		}
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++)
+			for (int a = 0; a < channels; a++)
+				for (int b = 0; b < channels; b++)
+					covariance[a][b] += (texels[i * 4 + a] - mean[a]) * (texels[i * 4 + b] - mean[b]);
+
+		// Column of the largest variance is a start that is never orthogonal to the axis
+		int largest = 0;
+		for (int c = 1; c < channels; c++)
+			if (covariance[c][c] > covariance[largest][largest])
+				largest = c;
+		for (int c = 0; c < channels; c++)
+			axis[c] = covariance[c][largest];
+
+		for (int iteration = 0; iteration < 8; iteration++) {
+
+			float next[4] = {};
+			float length = 0.f;
+			for (int a = 0; a < channels; a++) {
+				for (int b = 0; b < channels; b++)
+					next[a] += covariance[a][b] * axis[b];
+				length = std::max(length, std::abs(next[a]));
+			}
+
+			if (length == 0.f)
+				break;
+			for (int c = 0; c < channels; c++)
+				axis[c] = next[c] / length;
+		}
+
+		float length = 0.f;
+		for (int c = 0; c < channels; c++)
+			length += axis[c] * axis[c];
+		length = std::sqrt(length);
+		for (int c = 0; c < channels; c++)
+			axis[c] = length > 0.f ? axis[c] / length : 0.f;
+	}
+
+	/*
+	* Range of the texels along the axis, relative to the mean.
+	*/
+	static void getAxisRange(const unsigned char* texels, int channels, const float* mean, const float* axis, float& minT, float& maxT) {
+
+		minT = 0.f;
+		maxT = 0.f;
+		for (int i = 0; i < 16; i++) {
+			float t = 0.f;
+			for (int c = 0; c < channels; c++)
+				t += (texels[i * 4 + c] - mean[c]) * axis[c];
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+	}
+
+	static inline unsigned short packColor(const float* color) {
+
+		int r = (int)(std::min(std::max(color[0], 0.f), 255.f) * 31.f / 255.f + 0.5f);
+		int g = (int)(std::min(std::max(color[1], 0.f), 255.f) * 63.f / 255.f + 0.5f);
+		int b = (int)(std::min(std::max(color[2], 0.f), 255.f) * 31.f / 255.f + 0.5f);
+		return (unsigned short)(r << 11 | g << 5 | b);
+	}
+
+	static inline void unpackColor(unsigned short color, int* rgb) {
+
+		int r = color >> 11 & 31;
+		int g = color >> 5 & 63;
+		int b = color & 31;
+		rgb[0] = r << 3 | r >> 2;
+		rgb[1] = g << 2 | g >> 4;
+		rgb[2] = b << 3 | b >> 2;
+	}
+
+	/*
+	* Four colors if c0 > c1 or if the block is the color of a BC3 block, otherwise three colors and black.
+	*/
+	static void getColorPalette(unsigned short c0, unsigned short c1, bool fourColors, int palette[4][3]) {
+
+		unpackColor(c0, palette[0]);
+		unpackColor(c1, palette[1]);
+
+		for (int c = 0; c < 3; c++) {
+			if (fourColors || c0 > c1) {
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+			else {
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+	}
+
+	static void getAlphaPalette(int e0, int e1, int* palette) {
+
+		palette[0] = e0;
+		palette[1] = e1;
+
+		if (e0 > e1) {
+			for (int i = 1; i < 7; i++)
+				palette[i + 1] = ((7 - i) * e0 + i * e1 + 3) / 7;
+		}
+		else {
+			for (int i = 1; i < 5; i++)
+				palette[i + 1] = ((5 - i) * e0 + i * e1 + 2) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	/*
+	* Nearest palette color of every texel, ties go to the lower index. Returns the squared error of the block.
+	*/
+	static unsigned int selectColorIndicesScalar(const unsigned char* texels, const int palette[4][3], unsigned int& indices) {
+
+		unsigned int error = 0;
+		indices = 0;
+
+		for (int i = 0; i < 16; i++) {
+
+			int best = 0;
+			int bestDistance = INT_MAX;
+			for (int j = 0; j < 4; j++) {
+				int dr = texels[i * 4 + 0] - palette[j][0];
+				int dg = texels[i * 4 + 1] - palette[j][1];
+				int db = texels[i * 4 + 2] - palette[j][2];
+				int distance = dr * dr + dg * dg + db * db;
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					best = j;
+				}
+			}
+
+			indices |= best << (2 * i);
+			error += bestDistance;
+		}
+		return error;
+	}
+
+	/*
+	* Four texels per register. Red and green are 16 bit halves of a lane, so one madd gives dr * dr + dg * dg.
+	*/
+	static unsigned int selectColorIndicesSSE(const unsigned char* texels, const int palette[4][3], unsigned int& indices) {
+
+		__m128i byteMask = _mm_set1_epi32(0xFF);
+		__m128i paletteRG[4];
+		__m128i paletteB[4];
+		for (int j = 0; j < 4; j++) {
+			paletteRG[j] = _mm_set1_epi32(palette[j][0] | palette[j][1] << 16);
+			paletteB[j] = _mm_set1_epi32(palette[j][2]);
+		}
+
+		unsigned int error = 0;
+		indices = 0;
+
+		for (int i = 0; i < 16; i += 4) {
+
+			__m128i texel = _mm_loadu_si128((const __m128i*)&texels[i * 4]);
+			__m128i rg = _mm_or_si128(_mm_and_si128(texel, byteMask), _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(texel, 8), byteMask), 16));
+			__m128i b = _mm_and_si128(_mm_srli_epi32(texel, 16), byteMask);
+
+			__m128i best = _mm_setzero_si128();
+			__m128i index = _mm_setzero_si128();
+			for (int j = 0; j < 4; j++) {
+				__m128i drg = _mm_sub_epi16(rg, paletteRG[j]);
+				__m128i db = _mm_sub_epi16(b, paletteB[j]);
+				__m128i distance = _mm_add_epi32(_mm_madd_epi16(drg, drg), _mm_madd_epi16(db, db));
+				if (j == 0) {
+					best = distance;
+					continue;
+				}
+				__m128i less = _mm_cmplt_epi32(distance, best);
+				best = _mm_or_si128(_mm_and_si128(less, distance), _mm_andnot_si128(less, best));
+				index = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(j)), _mm_andnot_si128(less, index));
+			}
+
+			int bestDistances[4];
+			int bestIndices[4];
+			_mm_storeu_si128((__m128i*)bestDistances, best);
+			_mm_storeu_si128((__m128i*)bestIndices, index);
+			for (int k = 0; k < 4; k++) {
+				indices |= bestIndices[k] << (2 * (i + k));
+				error += bestDistances[k];
+			}
+		}
+		return error;
+	}
+
+	static inline unsigned int selectColorIndices(const unsigned char* texels, const int palette[4][3], unsigned int& indices, int instructionSet) {
+
+		if (instructionSet == INSTRUCTION_SET_SCALAR)
+			return selectColorIndicesScalar(texels, palette, indices);
+		return selectColorIndicesSSE(texels, palette, indices);
+	}
+
+	static void selectAlphaIndicesScalar(const unsigned char* values, const int* palette, unsigned char* distances, unsigned char* indices) {
+
+		for (int i = 0; i < 16; i++) {
+
+			int best = 0;
+			int bestDistance = std::abs(values[i] - palette[0]);
+			for (int j = 1; j < 8; j++) {
+				int distance = std::abs(values[i] - palette[j]);
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					best = j;
+				}
+			}
+
+			distances[i] = (unsigned char)bestDistance;
+			indices[i] = (unsigned char)best;
+		}
+	}
+
+	/*
+	* The 16 values of a block are one register. Distances are unsigned bytes, best > distance if their saturated difference is not zero.
+	*/
+	static void selectAlphaIndicesSSE(const unsigned char* values, const int* palette, unsigned char* distances, unsigned char* indices) {
+
+		__m128i value = _mm_loadu_si128((const __m128i*)values);
+		__m128i zero = _mm_setzero_si128();
+		__m128i best = zero;
+		__m128i index = zero;
+
+		for (int j = 0; j < 8; j++) {
+
+			__m128i entry = _mm_set1_epi8((char)palette[j]);
+			__m128i distance = _mm_or_si128(_mm_subs_epu8(value, entry), _mm_subs_epu8(entry, value));
+			if (j == 0) {
+				best = distance;
+				continue;
+			}
+
+			__m128i less = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(best, distance), zero), _mm_set1_epi8(-1));
+			best = _mm_min_epu8(best, distance);
+			index = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi8((char)j)), _mm_andnot_si128(less, index));
+		}
+
+		_mm_storeu_si128((__m128i*)distances, best);
+		_mm_storeu_si128((__m128i*)indices, index);
+	}
+
+	static inline void selectAlphaIndices(const unsigned char* values, const int* palette, unsigned char* distances, unsigned char* indices, int instructionSet) {
+
+		if (instructionSet == INSTRUCTION_SET_SCALAR)
+			selectAlphaIndicesScalar(values, palette, distances, indices);
+		else
+			selectAlphaIndicesSSE(values, palette, distances, indices);
+	}
+
+	/*
+	* Quantizes the endpoints to 565, puts the larger first for four colors and finds the indices. Returns the squared error.
+	*/
+	static unsigned int fitColorEndpoints(const unsigned char* texels, const float endpoints[2][3], unsigned short* colors, unsigned int& indices, int instructionSet) {
+
+		colors[0] = packColor(endpoints[0]);
+		colors[1] = packColor(endpoints[1]);
+		if (colors[0] < colors[1])
+			std::swap(colors[0], colors[1]);
+
+		// Equal endpoints are three color mode in BC1, every index is 0 then and that is still the first color
+		int palette[4][3];
+		getColorPalette(colors[0], colors[1], true, palette);
+		return selectColorIndices(texels, palette, indices, instructionSet);
+	}
+
+	/*
+	* BC1 color block in four color mode, also the color part of BC3.
+	*/
+	void BlockEncoder::encodeColorBlock(const unsigned char* texels, unsigned char* block, int instructionSet) {
+
+		float mean[4];
+		float axis[4];
+		float minT, maxT;
+		getPrincipalAxis(texels, 3, mean, axis);
+		getAxisRange(texels, 3, mean, axis, minT, maxT);
+
+		// Endpoints are inset a little, extremes are rarely worth a palette entry of their own
+		float inset = (maxT - minT) / 16.f;
+		float endpoints[2][3];
+		for (int c = 0; c < 3; c++) {
+			endpoints[0][c] = mean[c] + axis[c] * (maxT - inset);
+			endpoints[1][c] = mean[c] + axis[c] * (minT + inset);
+		}
+
+		unsigned short colors[2];
+		unsigned int indices;
+		unsigned int error = fitColorEndpoints(texels, endpoints, colors, indices, instructionSet);
+
+		// Least squares endpoints for the indices that were found
+		float alpha2 = 0.f, beta2 = 0.f, alphaBeta = 0.f;
+		float alphaX[3] = {};
+		float betaX[3] = {};
+		for (int i = 0; i < 16; i++) {
+			float alpha = colorWeights[indices >> (2 * i) & 3];
+			float beta = 1.f - alpha;
+			alpha2 += alpha * alpha;
+			beta2 += beta * beta;
+			alphaBeta += alpha * beta;
+			for (int c = 0; c < 3; c++) {
+				alphaX[c] += alpha * texels[i * 4 + c];
+				betaX[c] += beta * texels[i * 4 + c];
+			}
+		}
+
+		float determinant = alpha2 * beta2 - alphaBeta * alphaBeta;
+		if (error > 0 && std::abs(determinant) > 1e-6f) {
+
+			float refined[2][3];
+			for (int c = 0; c < 3; c++) {
+				refined[0][c] = (alphaX[c] * beta2 - betaX[c] * alphaBeta) / determinant;
+				refined[1][c] = (betaX[c] * alpha2 - alphaX[c] * alphaBeta) / determinant;
+			}
+
+			unsigned short refinedColors[2];
+			unsigned int refinedIndices;
+			if (fitColorEndpoints(texels, refined, refinedColors, refinedIndices, instructionSet) < error) {
+				colors[0] = refinedColors[0];
+				colors[1] = refinedColors[1];
+				indices = refinedIndices;
+			}
+		}
+
+		block[0] = colors[0] & 255;
+		block[1] = colors[0] >> 8;
+		block[2] = colors[1] & 255;
+		block[3] = colors[1] >> 8;
+		for (int i = 0; i < 4; i++)
+			block[4 + i] = indices >> (8 * i) & 255;
+	}
+
+	/*
+	* BC4 block of one channel of the texels in eight value mode. Endpoints are searched around the range of the block.
+	*/
+	void BlockEncoder::encodeAlphaBlock(const unsigned char* texels, int channel, unsigned char* block, int instructionSet) {
+
+		unsigned char values[16];
+		int minValue = 255;
+		int maxValue = 0;
+		for (int i = 0; i < 16; i++) {
+			values[i] = texels[i * 4 + channel];
+			minValue = std::min(minValue, (int)values[i]);
+			maxValue = std::max(maxValue, (int)values[i]);
+		}
+
+		memset(block, 0, 8);
+		block[0] = maxValue;
+		block[1] = minValue;
+		if (minValue == maxValue)
+			return;
+
+		unsigned int bestError = UINT_MAX;
+		unsigned char bestIndices[16];
+
+		for (int e0 = maxValue; e0 >= std::max(maxValue - 2, 0); e0--) {
+			for (int e1 = minValue; e1 <= std::min(minValue + 2, 255); e1++) {
+
+				if (e0 <= e1)
+					continue;
+
+				int palette[8];
+				unsigned char distances[16];
+				unsigned char indices[16];
+				getAlphaPalette(e0, e1, palette);
+				selectAlphaIndices(values, palette, distances, indices, instructionSet);
+
+				unsigned int error = 0;
+				for (int i = 0; i < 16; i++)
+					error += distances[i] * distances[i];
+
+				if (error < bestError) {
+					bestError = error;
+					block[0] = e0;
+					block[1] = e1;
+					memcpy(bestIndices, indices, 16);
+				}
+			}
+		}
+
+		unsigned long long bits = 0;
+		for (int i = 0; i < 16; i++)
+			bits |= (unsigned long long)bestIndices[i] << (3 * i);
+		for (int i = 0; i < 6; i++)
+			block[2 + i] = bits >> (8 * i) & 255;
+	}
+
+	/*
+	* 7 bit endpoint with the p bit that is closer to it, as the 8 bit value the decoder expands it to.
+	*/
+	static void quantizeBC7Endpoint(const float* endpoint, int* quantized, int& pbit) {
+
+		float bestError = FLT_MAX;
+		for (int p = 0; p < 2; p++) {
+
+			int values[4];
+			float error = 0.f;
+			for (int c = 0; c < 4; c++) {
+				int q = clampInt((int)std::floor((endpoint[c] - p) * 0.5f + 0.5f), 0, 127);
+				values[c] = q << 1 | p;
+				error += (values[c] - endpoint[c]) * (values[c] - endpoint[c]);
+			}
+
+			if (error < bestError) {
+				bestError = error;
+				pbit = p;
+				memcpy(quantized, values, sizeof(values));
+			}
+		}
+	}
+
+	static unsigned int selectBC7IndicesScalar(const unsigned char* texels, const int palette[16][4], unsigned char* indices) {
+
+		unsigned int error = 0;
+		for (int i = 0; i < 16; i++) {
+
+			int best = 0;
+			int bestDistance = INT_MAX;
+			for (int j = 0; j < 16; j++) {
+				int distance = 0;
+				for (int c = 0; c < 4; c++)
+					distance += (texels[i * 4 + c] - palette[j][c]) * (texels[i * 4 + c] - palette[j][c]);
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					best = j;
+				}
+			}
+
+			indices[i] = (unsigned char)best;
+			error += bestDistance;
+		}
+		return error;
+	}
+
+	/*
+	* Four texels per register like the BC1 search, red and green then blue and alpha are the 16 bit halves of a lane.
+	*/
+	static unsigned int selectBC7IndicesSSE(const unsigned char* texels, const int palette[16][4], unsigned char* indices) {
+
+		__m128i halfMask = _mm_set1_epi32(0xFF00FF);
+		__m128i paletteRG[16];
+		__m128i paletteBA[16];
+		for (int j = 0; j < 16; j++) {
+			paletteRG[j] = _mm_set1_epi32(palette[j][0] | palette[j][1] << 16);
+			paletteBA[j] = _mm_set1_epi32(palette[j][2] | palette[j][3] << 16);
+		}
+
+		unsigned int error = 0;
+
+		for (int i = 0; i < 16; i += 4) {
+
+			// r0g0b0a0 bytes become r0 | b0 << 16 and g0 | a0 << 16, unpacking those lanes gives the pairs madd needs
+			__m128i texel = _mm_loadu_si128((const __m128i*)&texels[i * 4]);
+			__m128i rb = _mm_and_si128(texel, halfMask);
+			__m128i ga = _mm_and_si128(_mm_srli_epi32(texel, 8), halfMask);
+			__m128i rg = _mm_or_si128(_mm_and_si128(rb, _mm_set1_epi32(0xFFFF)), _mm_slli_epi32(ga, 16));
+			__m128i ba = _mm_or_si128(_mm_srli_epi32(rb, 16), _mm_andnot_si128(_mm_set1_epi32(0xFFFF), ga));
+
+			__m128i best = _mm_setzero_si128();
+			__m128i index = _mm_setzero_si128();
+			for (int j = 0; j < 16; j++) {
+				__m128i drg = _mm_sub_epi16(rg, paletteRG[j]);
+				__m128i dba = _mm_sub_epi16(ba, paletteBA[j]);
+				__m128i distance = _mm_add_epi32(_mm_madd_epi16(drg, drg), _mm_madd_epi16(dba, dba));
+				if (j == 0) {
+					best = distance;
+					continue;
+				}
+				__m128i less = _mm_cmplt_epi32(distance, best);
+				best = _mm_or_si128(_mm_and_si128(less, distance), _mm_andnot_si128(less, best));
+				index = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(j)), _mm_andnot_si128(less, index));
+			}
+
+			int bestDistances[4];
+			int bestIndices[4];
+			_mm_storeu_si128((__m128i*)bestDistances, best);
+			_mm_storeu_si128((__m128i*)bestIndices, index);
+			for (int k = 0; k < 4; k++) {
+				indices[i + k] = (unsigned char)bestIndices[k];
+				error += bestDistances[k];
+			}
+		}
+		return error;
+	}
+
+	static unsigned int fitBC7Endpoints(const unsigned char* texels, const float endpoints[2][4], int quantized[2][4], int* pbits, unsigned char* indices, int instructionSet) {
+
+		quantizeBC7Endpoint(endpoints[0], quantized[0], pbits[0]);
+		quantizeBC7Endpoint(endpoints[1], quantized[1], pbits[1]);
+
+		int palette[16][4];
+		for (int j = 0; j < 16; j++)
+			for (int c = 0; c < 4; c++)
+				palette[j][c] = ((64 - bc7Weights[j]) * quantized[0][c] + bc7Weights[j] * quantized[1][c] + 32) >> 6;
+
+		if (instructionSet == INSTRUCTION_SET_SCALAR)
+			return selectBC7IndicesScalar(texels, palette, indices);
+		return selectBC7IndicesSSE(texels, palette, indices);
+	}
+
+	/*
+	* BC7 mode 6, one RGBA subset with 7 bit endpoints, a p bit each and 4 bit indices.
+	*/
+	void BlockEncoder::encodeBC7Block(const unsigned char* texels, unsigned char* block, int instructionSet) {
+
+		float mean[4];
+		float axis[4];
+		float minT, maxT;
+		getPrincipalAxis(texels, 4, mean, axis);
+		getAxisRange(texels, 4, mean, axis, minT, maxT);
+
+		float endpoints[2][4];
+		for (int c = 0; c < 4; c++) {
+			endpoints[0][c] = mean[c] + axis[c] * minT;
+			endpoints[1][c] = mean[c] + axis[c] * maxT;
+		}
+
+		int quantized[2][4];
+		int pbits[2];
+		unsigned char indices[16];
+		unsigned int error = fitBC7Endpoints(texels, endpoints, quantized, pbits, indices, instructionSet);
+
+		float alpha2 = 0.f, beta2 = 0.f, alphaBeta = 0.f;
+		float alphaX[4] = {};
+		float betaX[4] = {};
+		for (int i = 0; i < 16; i++) {
+			float beta = bc7Weights[indices[i]] / 64.f;
+			float alpha = 1.f - beta;
+			alpha2 += alpha * alpha;
+			beta2 += beta * beta;
+			alphaBeta += alpha * beta;
+			for (int c = 0; c < 4; c++) {
+				alphaX[c] += alpha * texels[i * 4 + c];
+				betaX[c] += beta * texels[i * 4 + c];
+			}
+		}
+
+		float determinant = alpha2 * beta2 - alphaBeta * alphaBeta;
+		if (error > 0 && std::abs(determinant) > 1e-6f) {
+
+			float refined[2][4];
+			for (int c = 0; c < 4; c++) {
+				refined[0][c] = std::min(std::max((alphaX[c] * beta2 - betaX[c] * alphaBeta) / determinant, 0.f), 255.f);
+				refined[1][c] = std::min(std::max((betaX[c] * alpha2 - alphaX[c] * alphaBeta) / determinant, 0.f), 255.f);
+			}
+
+			int refinedQuantized[2][4];
+			int refinedPbits[2];
+			unsigned char refinedIndices[16];
+			if (fitBC7Endpoints(texels, refined, refinedQuantized, refinedPbits, refinedIndices, instructionSet) < error) {
+				memcpy(quantized, refinedQuantized, sizeof(quantized));
+				memcpy(pbits, refinedPbits, sizeof(pbits));
+				memcpy(indices, refinedIndices, sizeof(indices));
+			}
+		}
+
+		// Most significant bit of the first index is implied zero
+		if (indices[0] & 8) {
+			for (int c = 0; c < 4; c++)
+				std::swap(quantized[0][c], quantized[1][c]);
+			std::swap(pbits[0], pbits[1]);
+			for (int i = 0; i < 16; i++)
+				indices[i] = 15 - indices[i];
+		}
+
+		memset(block, 0, 16);
+		int position = 0;
+		auto write = [&](unsigned int value, int bits) {
+			for (int i = 0; i < bits; i++, position++)
+				block[position >> 3] |= (value >> i & 1) << (position & 7);
+		};
+
+		write(1 << 6, 7);
+		for (int c = 0; c < 4; c++) {
+			write(quantized[0][c] >> 1, 7);
+			write(quantized[1][c] >> 1, 7);
+		}
+		write(pbits[0], 1);
+		write(pbits[1], 1);
+		write(indices[0], 3);
+		for (int i = 1; i < 16; i++)
+			write(indices[i], 4);
+	}
+
+	void BlockEncoder::decodeColorBlock(const unsigned char* block, bool alwaysFourColors, unsigned char* texels) {
+
+		unsigned short c0 = block[0] | block[1] << 8;
+		unsigned short c1 = block[2] | block[3] << 8;
+		unsigned int indices = block[4] | block[5] << 8 | block[6] << 16 | (unsigned int)block[7] << 24;
+
+		int palette[4][3];
+		getColorPalette(c0, c1, alwaysFourColors, palette);
+
+		for (int i = 0; i < 16; i++) {
+			int index = indices >> (2 * i) & 3;
+			for (int c = 0; c < 3; c++)
+				texels[i * 4 + c] = palette[index][c];
+		}
+	}
+
+	void BlockEncoder::decodeAlphaBlock(const unsigned char* block, int channel, unsigned char* texels) {
+
+		int palette[8];
+		getAlphaPalette(block[0], block[1], palette);
+
+		unsigned long long bits = 0;
+		for (int i = 0; i < 6; i++)
+			bits |= (unsigned long long)block[2 + i] << (8 * i);
+
+		for (int i = 0; i < 16; i++)
+			texels[i * 4 + channel] = palette[bits >> (3 * i) & 7];
+	}
+
+	/*
+	* Only mode 6 is decoded, it is the only mode the encoder writes. Blocks of other modes are black.
+	*/
+	void BlockEncoder::decodeBC7Block(const unsigned char* block, unsigned char* texels) {
+
+		int position = 0;
+		auto read = [&](int bits) {
+			unsigned int value = 0;
+			for (int i = 0; i < bits; i++, position++)
+				value |= (block[position >> 3] >> (position & 7) & 1) << i;
+			return value;
+		};
+
+		if (read(7) != 1 << 6) {
+			memset(texels, 0, 64);
+			return;
+		}
+
+		int endpoints[2][4];
+		for (int c = 0; c < 4; c++) {
+			endpoints[0][c] = read(7) << 1;
+			endpoints[1][c] = read(7) << 1;
+		}
+		int p0 = read(1);
+		int p1 = read(1);
+		for (int c = 0; c < 4; c++) {
+			endpoints[0][c] |= p0;
+			endpoints[1][c] |= p1;
+		}
+
+		for (int i = 0; i < 16; i++) {
+			int weight = bc7Weights[read(i == 0 ? 3 : 4)];
+			for (int c = 0; c < 4; c++)
+				texels[i * 4 + c] = ((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6;
+		}
+	}
+
+	int BlockEncoder::getBlockBytes(int format) {
+
+		return (format == BLOCK_FORMAT_BC1 || format == BLOCK_FORMAT_BC4) ? 8 : 16;
+	}
+
+	size_t BlockEncoder::getImageBytes(int format, int width, int height) {
+
+		return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockEncoder::getBlockBytes(format);
+	}
+
+	/*
+	* Texels are 16 RGBA texels of a 4x4 block in rows.
+	*/
+	void BlockEncoder::encodeBlock(const unsigned char* texels, int format, unsigned char* block, int instructionSet) {
+
+		switch (format) {
+		case BLOCK_FORMAT_BC1:
+			BlockEncoder::encodeColorBlock(texels, block, instructionSet);
+			break;
+		case BLOCK_FORMAT_BC3:
+			BlockEncoder::encodeAlphaBlock(texels, 3, block, instructionSet);
+			BlockEncoder::encodeColorBlock(texels, block + 8, instructionSet);
+			break;
+		case BLOCK_FORMAT_BC4:
+			BlockEncoder::encodeAlphaBlock(texels, 0, block, instructionSet);
+			break;
+		case BLOCK_FORMAT_BC5:
+			BlockEncoder::encodeAlphaBlock(texels, 0, block, instructionSet);
+			BlockEncoder::encodeAlphaBlock(texels, 1, block + 8, instructionSet);
+			break;
+		case BLOCK_FORMAT_BC7:
+			BlockEncoder::encodeBC7Block(texels, block, instructionSet);
+			break;
+		}
+	}
+
+	/*
+	* Channels a format does not have are 0, alpha is 255.
+	*/
+	void BlockEncoder::decodeBlock(const unsigned char* block, int format, unsigned char* texels) {
+
+		for (int i = 0; i < 16; i++) {
+			texels[i * 4 + 0] = texels[i * 4 + 1] = texels[i * 4 + 2] = 0;
+			texels[i * 4 + 3] = 255;
+		}
+
+		switch (format) {
+		case BLOCK_FORMAT_BC1:
+			BlockEncoder::decodeColorBlock(block, false, texels);
+			break;
+		case BLOCK_FORMAT_BC3:
+			BlockEncoder::decodeAlphaBlock(block, 3, texels);
+			BlockEncoder::decodeColorBlock(block + 8, true, texels);
+			break;
+		case BLOCK_FORMAT_BC4:
+			BlockEncoder::decodeAlphaBlock(block, 0, texels);
+			break;
+		case BLOCK_FORMAT_BC5:
+			BlockEncoder::decodeAlphaBlock(block, 0, texels);
+			BlockEncoder::decodeAlphaBlock(block + 8, 1, texels);
+			break;
+		case BLOCK_FORMAT_BC7:
+			BlockEncoder::decodeBC7Block(block, texels);
+			break;
+		}
+	}
+
+	/*
+	* Encodes an image of 1 to 4 channels, blocks are in rows. Edge blocks of images that are not a multiple of 4 repeat the last texels,
+	* one channel images are gray. Rows of blocks are encoded on the pool if there is one.
+	*/
+	void BlockEncoder::encode(const unsigned char* texels, int width, int height, int channels, int format, unsigned char* blocks, ThreadPool* pool, int instructionSet) {
+
+		int blocksX = (width + 3) / 4;
+		int blocksY = (height + 3) / 4;
+		int blockBytes = BlockEncoder::getBlockBytes(format);
+
+		auto encodeRow = [=](int by) {
+
+			unsigned char block[64];
+			for (int bx = 0; bx < blocksX; bx++) {
+
+				for (int y = 0; y < 4; y++) {
+					for (int x = 0; x < 4; x++) {
+
+						int sx = std::min(bx * 4 + x, width - 1);
+						int sy = std::min(by * 4 + y, height - 1);
+						const unsigned char* source = &texels[((size_t)sy * width + sx) * channels];
+						unsigned char* texel = &block[(y * 4 + x) * 4];
+
+						texel[0] = source[0];
+						texel[1] = channels > 1 ? source[1] : source[0];
+						texel[2] = channels > 2 ? source[2] : (channels == 1 ? source[0] : 0);
+						texel[3] = channels > 3 ? source[3] : 255;
+					}
+				}
+
+				BlockEncoder::encodeBlock(block, format, &blocks[((size_t)by * blocksX + bx) * blockBytes], instructionSet);
+			}
+		};
+
+		if (!pool || blocksY == 1) {
+			for (int by = 0; by < blocksY; by++)
+				encodeRow(by);
+			return;
+		}
+
+		for (int by = 0; by < blocksY; by++)
+			pool->submit([=]() { encodeRow(by); });
+		pool->wait();
+	}
+
+	/*
+	* Decodes blocks in rows to an RGBA image.
+	*/
+	void BlockEncoder::decode(const unsigned char* blocks, int width, int height, int format, unsigned char* texels) {
+
+		int blocksX = (width + 3) / 4;
+		int blocksY = (height + 3) / 4;
+		int blockBytes = BlockEncoder::getBlockBytes(format);
+		unsigned char block[64];
+
+		for (int by = 0; by < blocksY; by++) {
+			for (int bx = 0; bx < blocksX; bx++) {
+
+				BlockEncoder::decodeBlock(&blocks[((size_t)by * blocksX + bx) * blockBytes], format, block);
+
+				for (int y = 0; y < 4 && by * 4 + y < height; y++)
+					for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+						memcpy(&texels[((size_t)(by * 4 + y) * width + bx * 4 + x) * 4], &block[(y * 4 + x) * 4], 4);
+			}
+		}
+	}
+
+	/*
+	* Peak signal to noise ratio of the first comparedChannels of an image and its decoded RGBA image.
+	*/
+	double BlockEncoder::getPSNR(const unsigned char* texels, int channels, const unsigned char* decoded, int width, int height, int comparedChannels) {
+
+		double squaredError = 0.0;
+		size_t count = (size_t)width * height;
+
+		for (size_t i = 0; i < count; i++) {
+			for (int c = 0; c < comparedChannels; c++) {
+				double difference = (double)texels[i * channels + c] - decoded[i * 4 + c];
+				squaredError += difference * difference;
+			}
+		}
+
+		double meanError = squaredError / (count * comparedChannels);
+		return meanError == 0.0 ? 99.0 : 10.0 * std::log10(255.0 * 255.0 / meanError);
+	}
+
+	/*
+	* Encodes synthetic albedo, normal and mask images in every format on the scalar and the SSE path and on all threads.
+	* Blocks of every path have to be the same. Quality is the PSNR of the decoded blocks against the source.
+	* Fails if the paths give other blocks or a format is under BLOCK_ENCODER_BENCHMARK_MIN_PSNR.
+	*/
+	bool BlockEncoder::benchmark(int size, int iterations) {
+
+		std::vector<unsigned char> albedo((size_t)size * size * 4);
+		std::vector<unsigned char> normal((size_t)size * size * 3);
+		std::vector<unsigned char> mask((size_t)size * size);
+
+		auto heightAt = [](int x, int y) {
+			return 0.5f * sin(x * 0.031f) * cos(y * 0.027f) + 0.25f * sin((x + y) * 0.11f) + 0.1f * cos(x * 0.37f - y * 0.21f);
+		};
+
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+
+				size_t i = (size_t)y * size + x;
+				unsigned int hash = (unsigned int)i * 2654435761u;
+				float h = heightAt(x, y);
+				int noise = (int)(hash >> 27) - 16;
+
+				albedo[i * 4 + 0] = clampInt((int)(120 + 60 * h) + noise, 0, 255);
+				albedo[i * 4 + 1] = clampInt((int)(100 + 40 * h + 20 * sin(x * 0.05f)) + noise, 0, 255);
+				albedo[i * 4 + 2] = clampInt((int)(70 + 30 * h) + noise / 2, 0, 255);
+				albedo[i * 4 + 3] = clampInt((int)(200 + 50 * h) + noise, 0, 255);
+
+				float nx = (heightAt(x - 1, y) - heightAt(x + 1, y)) * 4.f;
+				float nz = (heightAt(x, y - 1) - heightAt(x, y + 1)) * 4.f;
+				float length = std::sqrt(nx * nx + nz * nz + 1.f);
+				normal[i * 3 + 0] = (unsigned char)((nx / length * 0.5f + 0.5f) * 255.f + 0.5f);
+				normal[i * 3 + 1] = (unsigned char)((nz / length * 0.5f + 0.5f) * 255.f + 0.5f);
+				normal[i * 3 + 2] = (unsigned char)((1.f / length * 0.5f + 0.5f) * 255.f + 0.5f);
+
+				mask[i] = clampInt((int)(128 + 120 * h) + noise / 4, 0, 255);
+			}
+		}
+
+		const unsigned char* sources[BLOCK_FORMAT_COUNT] = { &albedo[0], &albedo[0], &mask[0], &normal[0], &albedo[0] };
+		const int sourceChannels[BLOCK_FORMAT_COUNT] = { 4, 4, 1, 3, 4 };
+		const int comparedChannels[BLOCK_FORMAT_COUNT] = { 3, 4, 1, 2, 4 };
+
+		ThreadPool pool;
+		double texels = (double)size * size * iterations;
+		std::vector<unsigned char> decoded((size_t)size * size * 4);
+		bool passed = true;
+
+		printf("Block encoder benchmark, %dx%d, %d iterations\n", size, size, iterations);
+		printf("  format   scalar Mtexels/s   SSE Mtexels/s   %2u threads Mtexels/s   PSNR dB\n", pool.getThreadCount());
+
+		for (int format = 0; format < BLOCK_FORMAT_COUNT; format++) {
+
+			size_t bytes = BlockEncoder::getImageBytes(format, size, size);
+			std::vector<unsigned char> reference(bytes);
+			std::vector<unsigned char> blocks(bytes);
+			double seconds[3];
+			bool match = true;
+
+			for (int path = 0; path < 3; path++) {
+
+				int instructionSet = path == 0 ? INSTRUCTION_SET_SCALAR : INSTRUCTION_SET_SSE;
+				std::vector<unsigned char>& output = path == 0 ? reference : blocks;
+
+				auto begin = std::chrono::high_resolution_clock::now();
+				for (int iteration = 0; iteration < iterations; iteration++)
+					BlockEncoder::encode(sources[format], size, size, sourceChannels[format], format, &output[0], path == 2 ? &pool : NULL, instructionSet);
+				auto end = std::chrono::high_resolution_clock::now();
+				seconds[path] = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 1e-6;
+
+				if (path > 0 && blocks != reference)
+					match = false;
+			}
+
+			BlockEncoder::decode(&reference[0], size, size, format, &decoded[0]);
+			double psnr = BlockEncoder::getPSNR(sources[format], sourceChannels[format], &decoded[0], size, size, comparedChannels[format]);
+
+			printf("  %-6s %16.1f %15.1f %21.1f %9.2f %s\n", formatNames[format], texels / seconds[0] * 1e-6, texels / seconds[1] * 1e-6,
+				texels / seconds[2] * 1e-6, psnr, match ? "" : "MISMATCH");
+
+			if (!match || psnr < BLOCK_ENCODER_BENCHMARK_MIN_PSNR)
+				passed = false;
+		}
+
+		printf("%s, PSNR bound is %.1f dB\n", passed ? "Passed" : "FAILED", BLOCK_ENCODER_BENCHMARK_MIN_PSNR);
+		return passed;
+	}
+}
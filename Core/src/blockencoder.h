@@ -0,0 +1,49 @@
+#pragma once
+#include "cpufeatures.h"
+
+// Block compressed formats of the encoder. Blocks are 4x4 texels.
+#define BLOCK_FORMAT_BC1 0		// RGB, 8 bytes
+#define BLOCK_FORMAT_BC3 1		// RGBA, 16 bytes, alpha as a BC4 block
+#define BLOCK_FORMAT_BC4 2		// R, 8 bytes
+#define BLOCK_FORMAT_BC5 3		// RG, 16 bytes, two BC4 blocks
+#define BLOCK_FORMAT_BC7 4		// RGBA, 16 bytes, mode 6 only
+#define BLOCK_FORMAT_COUNT 5
+
+// Lowest PSNR of the benchmark images in any format, every format is over 39 dB on them
+#define BLOCK_ENCODER_BENCHMARK_MIN_PSNR 35.0
+
+namespace Core {
+
+	class ThreadPool;
+
+	/*
+	* CPU encoder and decoder of BC1, BC3, BC4, BC5 and BC7 blocks. It has no GL dependency, so textures can be cooked
+	* headless. Endpoints are found along the principal axis of the block and refined once with least squares.
+	* Index search has an SSE path, CPUFeatures::instructionSet unless another one is passed, it gives the same blocks as the scalar one.
+	* Decoders follow the D3D rules and are used to verify cooked textures.
+	*/
+	class __declspec(dllexport) BlockEncoder {
+
+	private:
+
+		static void encodeColorBlock(const unsigned char* texels, unsigned char* block, int instructionSet);
+		static void encodeAlphaBlock(const unsigned char* texels, int channel, unsigned char* block, int instructionSet);
+		static void encodeBC7Block(const unsigned char* texels, unsigned char* block, int instructionSet);
+		static void decodeColorBlock(const unsigned char* block, bool alwaysFourColors, unsigned char* texels);
+		static void decodeAlphaBlock(const unsigned char* block, int channel, unsigned char* texels);
+		static void decodeBC7Block(const unsigned char* block, unsigned char* texels);
+
+	public:
+
+		static const char* formatNames[BLOCK_FORMAT_COUNT];
+
+		static int getBlockBytes(int format);
+		static size_t getImageBytes(int format, int width, int height);
+		static void encodeBlock(const unsigned char* texels, int format, unsigned char* block, int instructionSet = CPUFeatures::instructionSet);
+		static void decodeBlock(const unsigned char* block, int format, unsigned char* texels);
+		static void encode(const unsigned char* texels, int width, int height, int channels, int format, unsigned char* blocks, ThreadPool* pool = NULL, int instructionSet = CPUFeatures::instructionSet);
+		static void decode(const unsigned char* blocks, int width, int height, int format, unsigned char* texels);
+		static double getPSNR(const unsigned char* texels, int channels, const unsigned char* decoded, int width, int height, int comparedChannels);
+		static bool benchmark(int size, int iterations);
+	};
+}
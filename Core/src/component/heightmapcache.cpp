@@ -0,0 +1,468 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "pch.h"
+#include "heightmapcache.h"
+#include "heightpyramid.h"
+#include "terrain.h"
+#include "terraintilecache.h"
+#include <chrono>
+#include <cstring>
+#include <cmath>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Core {
+
+	bool HeightmapCache::benchmarkOnLoad = false;
+
+	HeightmapCache::HeightmapCache() { }
+
+	HeightmapCache::~HeightmapCache() {
+
+		HeightmapCache::unmap();
+	}
+
+	bool HeightmapCache::map(const std::string& path) {
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		GetFileSizeEx(file, &size);
+
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) {
+			CloseHandle(file);
+			return false;
+		}
+
+		mappedData = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (mappedData == NULL) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+
+		fileHandle = file;
+		mappingHandle = mapping;
+		mappedSize = size.QuadPart;
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+			return false;
+
+		struct stat info;
+		fstat(file, &info);
+
+		void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		close(file);
+		if (data == MAP_FAILED)
+			return false;
+
+		mappedData = (unsigned char*)data;
+		mappedSize = info.st_size;
+#endif
+		return true;
+	}
+
+	void HeightmapCache::unmap() {
+
+		if (mappedData == NULL)
+			return;
+
+#ifdef _WIN32
+		UnmapViewOfFile(mappedData);
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+		mappingHandle = NULL;
+		fileHandle = NULL;
+#else
+		munmap(mappedData, mappedSize);
+#endif
+		mappedData = NULL;
+		mappedSize = 0;
+	}
+
+	/*
+	* Asks the os to page in a range of the mapping in the background, so the first touch does not wait for the disk.
+	*/
+	void HeightmapCache::prefetch(const unsigned char* data, size_t bytes) {
+
+		if (mappedData == NULL || data < mappedData || data + bytes > mappedData + mappedSize)
+			return;
+
+#ifdef _WIN32
+		WIN32_MEMORY_RANGE_ENTRY range;
+		range.VirtualAddress = (void*)data;
+		range.NumberOfBytes = bytes;
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+		// madvise takes a page aligned address, mapping itself starts at a page
+		size_t alignment = (size_t)(data - mappedData) % HEIGHTMAP_CACHE_ALIGNMENT;
+		madvise((void*)(data - alignment), bytes + alignment, MADV_WILLNEED);
+#endif
+	}
+
+	void HeightmapCache::getSourceStamp(const std::string& sourcePath, uint64_t& size, int64_t& writeTime) {
+
+		std::error_code error;
+		size = std::filesystem::file_size(sourcePath, error);
+		writeTime = std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count();
+	}
+
+	bool HeightmapCache::isCompatible(const HeightmapCacheHeader& header) {
+
+		return header.magic == HEIGHTMAP_CACHE_MAGIC && header.version == HEIGHTMAP_CACHE_VERSION &&
+			header.levelCount == CLIPMAP_LEVEL && header.tileSize == TILE_SIZE && header.channels == TERRAIN_STACK_NUM_CHANNELS &&
+			header.pyramidCellPower == HEIGHT_PYRAMID_CELL_POWER;
+	}
+
+	/*
+	* Every level table, tile and pyramid mip must be inside the mapping and tiles must be in stack order,
+	* since the stack points into the mapping. A cook that was cut off leaves a file that fails here.
+	*/
+	bool HeightmapCache::validate() const {
+
+		const HeightmapCacheLevel* levels = (const HeightmapCacheLevel*)(mappedData + sizeof(HeightmapCacheHeader));
+
+		// size bytes starting at offset are in the mapping, without overflowing
+		auto inside = [this](uint64_t offset, uint64_t size) {
+			return offset <= mappedSize && size <= mappedSize - offset;
+		};
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+			const HeightmapCacheLevel& entry = levels[level];
+			if (entry.endTile <= entry.startTile || entry.endTile - entry.startTile > HEIGHTMAP_CACHE_MAX_TILES_PER_SIDE)
+				return false;
+
+			uint64_t tilesPerSide = entry.endTile - entry.startTile;
+			uint64_t tileCount = tilesPerSide * tilesPerSide;
+			if (!inside(entry.tileDirectoryOffset, tileCount * sizeof(uint64_t)))
+				return false;
+
+			const uint64_t* tileDirectory = (const uint64_t*)(mappedData + entry.tileDirectoryOffset);
+			if (!inside(tileDirectory[0], tileCount * TERRAIN_TILE_BYTES))
+				return false;
+
+			for (uint64_t i = 0; i < tileCount; i++)
+				if (tileDirectory[i] != tileDirectory[0] + i * TERRAIN_TILE_BYTES)
+					return false;
+
+			if (entry.pyramidMipCount > HEIGHTMAP_CACHE_MAX_PYRAMID_MIPS)
+				return false;
+
+			uint64_t mip = entry.pyramidOffset;
+			for (unsigned int i = 0; i < entry.pyramidMipCount; i++) {
+
+				if (!inside(mip, sizeof(int32_t)))
+					return false;
+
+				int32_t mipSize = *(const int32_t*)(mappedData + mip);
+				uint64_t mipBytes = (uint64_t)mipSize * mipSize * 2 * sizeof(unsigned short);
+				if (mipSize <= 0 || mipSize > HEIGHTMAP_CACHE_MAX_TILES_PER_SIDE * TILE_SIZE || !inside(mip + sizeof(int32_t), mipBytes))
+					return false;
+
+				mip += sizeof(int32_t) + mipBytes;
+			}
+		}
+
+		return true;
+	}
+
+	/*
+	* Fills heightmap stack and height pyramids of the terrain from the cache.
+	* Returns false if there is no cache, it is from another version, it is damaged or the source has changed since it was cooked.
+	* A cache without its source is used as it is, large maps are only shipped cooked.
+	* If the stack does not fit the tile cache budget of the terrain, tiles are paged from the file by the tile cache
+	* and only the pyramid pages of the mapping are touched.
+	*/
+	bool HeightmapCache::load(Terrain* terrain, const std::string& sourcePath, const std::string& cachePath) {
+
+		HeightmapCache::unmap();
+		if (!HeightmapCache::map(cachePath))
+			return false;
+
+		const HeightmapCacheHeader* header = (const HeightmapCacheHeader*)mappedData;
+
+		if (mappedSize < sizeof(HeightmapCacheHeader) + CLIPMAP_LEVEL * sizeof(HeightmapCacheLevel) || !HeightmapCache::isCompatible(*header)) {
+			HeightmapCache::unmap();
+			return false;
+		}
+
+		if (std::filesystem::exists(sourcePath)) {
+
+			uint64_t sourceSize;
+			int64_t sourceWriteTime;
+			HeightmapCache::getSourceStamp(sourcePath, sourceSize, sourceWriteTime);
+
+			if (header->sourceFileSize != sourceSize || header->sourceWriteTime != sourceWriteTime || header->mipFilter != (uint32_t)terrain->mipFilter) {
+				HeightmapCache::unmap();
+				return false;
+			}
+		}
+
+		if (!HeightmapCache::validate()) {
+			std::cout << "Heightmap cache is damaged, it is cooked again: " << cachePath << std::endl;
+			HeightmapCache::unmap();
+			return false;
+		}
+
+		const HeightmapCacheLevel* levels = (const HeightmapCacheLevel*)(mappedData + sizeof(HeightmapCacheHeader));
+
+		uint64_t stackBytes = 0;
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+			uint64_t tilesPerSide = levels[level].endTile - levels[level].startTile;
+			stackBytes += tilesPerSide * tilesPerSide * TERRAIN_TILE_BYTES;
+		}
+
+		terrain->mapSize = header->mapSize;
+
+		bool outOfCore = stackBytes > terrain->tileCacheSize;
+		if (outOfCore) {
+
+			terrain->tileCache = new TerrainTileCache(terrain->tileCacheSize);
+			if (!terrain->tileCache->open(cachePath)) {
+				delete terrain->tileCache;
+				terrain->tileCache = NULL;
+				HeightmapCache::unmap();
+				return false;
+			}
+		}
+		else {
+			terrain->heightmapStack = new unsigned char* [CLIPMAP_LEVEL];
+			terrain->heightmapStackMapped = true;
+		}
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+			const HeightmapCacheLevel& entry = levels[level];
+			terrain->clipmapStartIndices[level] = glm::ivec2(entry.startTile, entry.endTile);
+
+			int tilesPerSide = entry.endTile - entry.startTile;
+			int size = tilesPerSide * TILE_SIZE;
+			const uint64_t* tileDirectory = (const uint64_t*)(mappedData + entry.tileDirectoryOffset);
+
+			// Tiles are written in the order of the stack, so the stack points into the mapping without a copy
+			if (!outOfCore)
+				terrain->heightmapStack[level] = mappedData + tileDirectory[0];
+
+			HeightPyramid* pyramid = new HeightPyramid();
+			pyramid->size = size;
+			pyramid->cellPower = header->pyramidCellPower;
+
+			// Pyramids point into the mapping like the stack, out of core too, so they are paged by the system and not copied
+			const unsigned char* mip = mappedData + entry.pyramidOffset;
+			for (unsigned int i = 0; i < entry.pyramidMipCount; i++) {
+
+				int mipSize = *(const int32_t*)mip;
+				const unsigned short* mins = (const unsigned short*)(mip + sizeof(int32_t));
+				const unsigned short* maxs = mins + mipSize * mipSize;
+
+				pyramid->mipSizes.push_back(mipSize);
+				pyramid->minMips.push_back(mins);
+				pyramid->maxMips.push_back(maxs);
+				mip += sizeof(int32_t) + mipSize * mipSize * 2 * sizeof(unsigned short);
+			}
+
+			terrain->heightPyramids[level] = pyramid;
+		}
+
+		return true;
+	}
+
+	/*
+	* Writes the heightmap stack and height pyramids of the terrain.
+	*/
+	bool HeightmapCache::cook(Terrain* terrain, const std::string& sourcePath, const std::string& cachePath) {
+
+		HeightmapCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		header.mapSize = terrain->mapSize;
+		header.mipFilter = terrain->mipFilter;
+		HeightmapCache::getSourceStamp(sourcePath, header.sourceFileSize, header.sourceWriteTime);
+
+		return HeightmapCache::write(cachePath, header, terrain->clipmapStartIndices, terrain->heightPyramids, [terrain](int level, int tileX, int tileZ, unsigned char* tile) {
+
+			glm::ivec2 tileStart = glm::ivec2(tileX, tileZ) + terrain->clipmapStartIndices[level].x;
+			memcpy(tile, terrain->getStackTile(level, tileStart), TERRAIN_TILE_BYTES);
+		});
+	}
+
+	/*
+	* Writes a procedural map of any size tile by tile, without holding it in memory. It has no pyramids,
+	* so it is only for exercising the tile cache.
+	*/
+	bool HeightmapCache::cookSynthetic(const std::string& cachePath, int mapSize) {
+
+		HeightmapCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		header.mapSize = mapSize;
+
+		glm::ivec2 startIndices[CLIPMAP_LEVEL];
+		Terrain::getClipmapStartIndices(mapSize, startIndices);
+
+		return HeightmapCache::write(cachePath, header, startIndices, NULL, [mapSize, &startIndices](int level, int tileX, int tileZ, unsigned char* tile) {
+
+			for (int i = 0; i < TILE_SIZE; i++) {
+				for (int j = 0; j < TILE_SIZE; j++) {
+
+					// Texel in the map at level 0, the map starts at mapSize * 2 in the virtual heightmap
+					int x = (((startIndices[level].x + tileX) * TILE_SIZE + j) << level) - mapSize * 2;
+					int z = (((startIndices[level].x + tileZ) * TILE_SIZE + i) << level) - mapSize * 2;
+
+					unsigned short height = 0;
+					if (x >= 0 && z >= 0 && x < mapSize && z < mapSize)
+						height = (unsigned short)(32768 + 16384 * sin(x * 0.0011) * cos(z * 0.0007) + 8192 * sin((x + z) * 0.0031));
+
+					tile[(i * TILE_SIZE + j) * TERRAIN_STACK_NUM_CHANNELS] = height >> 8;
+					tile[(i * TILE_SIZE + j) * TERRAIN_STACK_NUM_CHANNELS + 1] = height & 255;
+				}
+			}
+		});
+	}
+
+	/*
+	* Offsets are decided before writing, tiles start at aligned offsets. Tiles are requested one by one in file order.
+	* The file is written next to the cache and renamed over it once it is complete, so a cut off cook never leaves a cache with a valid header.
+	*/
+	bool HeightmapCache::write(const std::string& cachePath, HeightmapCacheHeader& header, const glm::ivec2* startIndices, HeightPyramid** pyramids, std::function<void(int level, int tileX, int tileZ, unsigned char* tile)> readTile) {
+
+		std::string tempPath = cachePath + ".tmp";
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cout << "Heightmap cache could not be written: " << cachePath << std::endl;
+			return false;
+		}
+
+		header.magic = HEIGHTMAP_CACHE_MAGIC;
+		header.version = HEIGHTMAP_CACHE_VERSION;
+		header.levelCount = CLIPMAP_LEVEL;
+		header.tileSize = TILE_SIZE;
+		header.channels = TERRAIN_STACK_NUM_CHANNELS;
+		header.pyramidCellPower = HEIGHT_PYRAMID_CELL_POWER;
+
+		HeightmapCacheLevel levels[CLIPMAP_LEVEL];
+		memset(levels, 0, sizeof(levels));
+
+		uint64_t offset = sizeof(HeightmapCacheHeader) + sizeof(levels);
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+			uint64_t tilesPerSide = startIndices[level].y - startIndices[level].x;
+
+			levels[level].startTile = startIndices[level].x;
+			levels[level].endTile = startIndices[level].y;
+			levels[level].tileDirectoryOffset = offset;
+			offset += tilesPerSide * tilesPerSide * sizeof(uint64_t);
+			offset = (offset + HEIGHTMAP_CACHE_ALIGNMENT - 1) / HEIGHTMAP_CACHE_ALIGNMENT * HEIGHTMAP_CACHE_ALIGNMENT;
+			offset += tilesPerSide * tilesPerSide * TERRAIN_TILE_BYTES;
+
+			levels[level].pyramidOffset = offset;
+			if (pyramids) {
+				levels[level].pyramidMipCount = pyramids[level]->mipSizes.size();
+				for (int mipSize : pyramids[level]->mipSizes)
+					offset += sizeof(int32_t) + mipSize * mipSize * 2 * sizeof(unsigned short);
+			}
+		}
+
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)levels, sizeof(levels));
+
+		std::vector<char> padding(HEIGHTMAP_CACHE_ALIGNMENT, 0);
+		std::vector<unsigned char> tile(TERRAIN_TILE_BYTES);
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+			uint64_t tilesPerSide = levels[level].endTile - levels[level].startTile;
+
+			uint64_t tileStart = levels[level].tileDirectoryOffset + tilesPerSide * tilesPerSide * sizeof(uint64_t);
+			tileStart = (tileStart + HEIGHTMAP_CACHE_ALIGNMENT - 1) / HEIGHTMAP_CACHE_ALIGNMENT * HEIGHTMAP_CACHE_ALIGNMENT;
+
+			std::vector<uint64_t> tileDirectory(tilesPerSide * tilesPerSide);
+			for (uint64_t i = 0; i < tilesPerSide * tilesPerSide; i++)
+				tileDirectory[i] = tileStart + i * TERRAIN_TILE_BYTES;
+
+			file.write((const char*)&tileDirectory[0], tileDirectory.size() * sizeof(uint64_t));
+			file.write(&padding[0], tileStart - (levels[level].tileDirectoryOffset + tileDirectory.size() * sizeof(uint64_t)));
+
+			for (uint64_t tileZ = 0; tileZ < tilesPerSide; tileZ++) {
+				for (uint64_t tileX = 0; tileX < tilesPerSide; tileX++) {
+					readTile(level, (int)tileX, (int)tileZ, &tile[0]);
+					file.write((const char*)&tile[0], TERRAIN_TILE_BYTES);
+				}
+			}
+
+			if (pyramids == NULL)
+				continue;
+
+			HeightPyramid* pyramid = pyramids[level];
+			for (unsigned int i = 0; i < pyramid->mipSizes.size(); i++) {
+
+				int32_t mipSize = pyramid->mipSizes[i];
+				file.write((const char*)&mipSize, sizeof(int32_t));
+				file.write((const char*)pyramid->minMips[i], mipSize * mipSize * sizeof(unsigned short));
+				file.write((const char*)pyramid->maxMips[i], mipSize * mipSize * sizeof(unsigned short));
+			}
+		}
+
+		file.close();
+
+		std::error_code error;
+		bool written = !file.fail();
+		if (written)
+			std::filesystem::rename(tempPath, cachePath, error);
+
+		if (!written || error) {
+			std::cout << "Heightmap cache could not be written: " << cachePath << std::endl;
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+
+		return true;
+	}
+
+	/*
+	* Loads the heightmap through both paths and prints how long each takes. Terrain is left with the cached data.
+	*/
+	void HeightmapCache::benchmark(Terrain* terrain, const std::string& sourcePath, const std::string& cachePath) {
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		terrain->initHeightmapStack(sourcePath);
+		terrain->createHeightPyramids();
+		auto end = std::chrono::high_resolution_clock::now();
+		double sourceDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001;
+
+		begin = std::chrono::high_resolution_clock::now();
+		HeightmapCache::cook(terrain, sourcePath, cachePath);
+		end = std::chrono::high_resolution_clock::now();
+		double cookDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001;
+
+		terrain->releaseHeightmapStack();
+
+		begin = std::chrono::high_resolution_clock::now();
+		bool loaded = terrain->heightmapCache->load(terrain, sourcePath, cachePath);
+		end = std::chrono::high_resolution_clock::now();
+		double cacheDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001;
+
+		printf("Heightmap startup benchmark\n");
+		printf("  png decode and resample : %10.3f ms\n", sourceDuration);
+		printf("  cook cache              : %10.3f ms\n", cookDuration);
+		printf("  load cache (mmap)       : %10.3f ms %s\n", cacheDuration, loaded ? "" : "(failed)");
+
+		if (!loaded) {
+			terrain->initHeightmapStack(sourcePath);
+			terrain->createHeightPyramids();
+		}
+	}
+}
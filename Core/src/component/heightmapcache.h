@@ -0,0 +1,91 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+// Heightmap Cache Class
+// Cooked form of the heightmap stack. It is produced once from the png and memory mapped on the next starts,
+// so loading does not pay for png decoding and resampling. Tiles are in the order of the heightmap stack,
+// so the stack of a resident map points into the mapping. Height pyramids always point into it, it has to live as long as they do.
+//
+// Layout:
+// HeightmapCacheHeader
+// HeightmapCacheLevel[levelCount]
+// for each level: tile directory (offset of every tile, row by row), tiles, min/max pyramid
+// A tile is TILE_SIZE * TILE_SIZE texels of TERRAIN_STACK_NUM_CHANNELS bytes, the same layout glTexSubImage3D takes.
+// A pyramid mip is its size followed by min and max arrays of 16 bit heights.
+// Maps whose stack is bigger than the tile cache budget of the terrain are not loaded, their tiles are paged from this file
+// by the tile cache and only their pyramids are read through the mapping.
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include "glm/glm.hpp"
+
+#define HEIGHTMAP_CACHE_MAGIC 0x43504854 // "THPC"
+#define HEIGHTMAP_CACHE_VERSION 2
+#define HEIGHTMAP_CACHE_ALIGNMENT 4096
+// Bounds of a sane level, anything above is a damaged file
+#define HEIGHTMAP_CACHE_MAX_TILES_PER_SIDE 65536
+#define HEIGHTMAP_CACHE_MAX_PYRAMID_MIPS 32
+
+namespace Core {
+
+	class Terrain;
+	class HeightPyramid;
+
+	struct HeightmapCacheHeader {
+
+		uint32_t magic;
+		uint32_t version;
+		uint32_t levelCount;
+		uint32_t tileSize;
+		uint32_t channels;
+		uint32_t pyramidCellPower;
+		uint32_t mapSize;
+		uint32_t mipFilter;
+		uint64_t sourceFileSize;	// to detect a changed source
+		int64_t sourceWriteTime;
+	};
+
+	struct HeightmapCacheLevel {
+
+		int32_t startTile;		// clipmapStartIndices of the level
+		int32_t endTile;
+		uint64_t tileDirectoryOffset;
+		uint64_t pyramidOffset;
+		uint32_t pyramidMipCount;
+		uint32_t padding;
+	};
+
+	class __declspec(dllexport) HeightmapCache {
+
+	private:
+
+		unsigned char* mappedData = NULL;
+		uint64_t mappedSize = 0;
+#ifdef _WIN32
+		void* fileHandle = NULL;
+		void* mappingHandle = NULL;
+#endif
+
+		bool map(const std::string& path);
+		void unmap();
+		bool validate() const;
+		static bool write(const std::string& cachePath, HeightmapCacheHeader& header, const glm::ivec2* startIndices, HeightPyramid** pyramids, std::function<void(int level, int tileX, int tileZ, unsigned char* tile)> readTile);
+
+	public:
+
+		static bool benchmarkOnLoad;
+
+		HeightmapCache();
+		~HeightmapCache();
+		bool load(Terrain* terrain, const std::string& sourcePath, const std::string& cachePath);
+		static bool cook(Terrain* terrain, const std::string& sourcePath, const std::string& cachePath);
+		static bool cookSynthetic(const std::string& cachePath, int mapSize);
+		static bool isCompatible(const HeightmapCacheHeader& header);
+		void prefetch(const unsigned char* data, size_t bytes);
+		static void benchmark(Terrain* terrain, const std::string& sourcePath, const std::string& cachePath);
+		static void getSourceStamp(const std::string& sourcePath, uint64_t& size, int64_t& writeTime);
+	};
+}
@@ -0,0 +1,339 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "pch.h"
+#include "heightpyramid.h"
+#include "terrain.h"
+#include <chrono>
+
+namespace Core {
+
+	HeightPyramid::HeightPyramid() {
+
+		size = 0;
+		cellPower = 0;
+	}
+
+	/*
+	* Heights are 16 bit big endian values with TERRAIN_STACK_NUM_CHANNELS bytes per texel, stored tile by tile like the heightmap stack.
+	* Size is a multiple of TILE_SIZE.
+	*/
+	HeightPyramid::HeightPyramid(const unsigned char* heights, int size, int cellPower) {
+
+		this->size = size;
+		this->cellPower = cellPower;
+
+		int cellSize = 1 << cellPower;
+		int mipSize = (size + cellSize - 1) >> cellPower;
+
+		mipSizes.push_back(mipSize);
+		minMipStorage.push_back(std::vector<unsigned short>(mipSize * mipSize, 65535));
+		maxMipStorage.push_back(std::vector<unsigned short>(mipSize * mipSize, 0));
+
+		int tilesPerSide = size / TILE_SIZE;
+
+		for (int i = 0; i < size; i++) {
+
+			unsigned short* minRow = &minMipStorage[0][(i >> cellPower) * mipSize];
+			unsigned short* maxRow = &maxMipStorage[0][(i >> cellPower) * mipSize];
+
+			for (int tileX = 0; tileX < tilesPerSide; tileX++) {
+
+				const unsigned char* row = &heights[(size_t)((i / TILE_SIZE) * tilesPerSide + tileX) * TERRAIN_TILE_BYTES + (i % TILE_SIZE) * TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS];
+
+				for (int j = 0; j < TILE_SIZE; j++) {
+
+					const unsigned char* texel = &row[j * TERRAIN_STACK_NUM_CHANNELS];
+					unsigned short height = texel[0] << 8 | texel[1];
+					int cell = (tileX * TILE_SIZE + j) >> cellPower;
+
+					if (height < minRow[cell])
+						minRow[cell] = height;
+					if (height > maxRow[cell])
+						maxRow[cell] = height;
+				}
+			}
+		}
+
+		// Odd sized mips fold the last row and column into the last cell
+		while (mipSize > 1) {
+
+			int finerSize = mipSize;
+			mipSize = (mipSize + 1) >> 1;
+
+			std::vector<unsigned short>& finerMin = minMipStorage.back();
+			std::vector<unsigned short>& finerMax = maxMipStorage.back();
+			std::vector<unsigned short> coarserMin(mipSize * mipSize, 65535);
+			std::vector<unsigned short> coarserMax(mipSize * mipSize, 0);
+
+			for (int i = 0; i < finerSize; i++) {
+				for (int j = 0; j < finerSize; j++) {
+
+					int finer = i * finerSize + j;
+					int coarser = (i >> 1) * mipSize + (j >> 1);
+					coarserMin[coarser] = std::min(coarserMin[coarser], finerMin[finer]);
+					coarserMax[coarser] = std::max(coarserMax[coarser], finerMax[finer]);
+				}
+			}
+
+			mipSizes.push_back(mipSize);
+			minMipStorage.push_back(std::move(coarserMin));
+			maxMipStorage.push_back(std::move(coarserMax));
+		}
+
+		for (size_t i = 0; i < mipSizes.size(); i++) {
+			minMips.push_back(&minMipStorage[i][0]);
+			maxMips.push_back(&maxMipStorage[i][0]);
+		}
+	}
+
+	HeightPyramid::~HeightPyramid() { }
+
+	/*
+	* Min and max bytes of every mip, whether they are stored here or mapped.
+	*/
+	unsigned long long HeightPyramid::getMipBytes() {
+
+		unsigned long long bytes = 0;
+		for (int mipSize : mipSizes)
+			bytes += (unsigned long long)mipSize * mipSize * 2 * sizeof(unsigned short);
+		return bytes;
+	}
+
+	/*
+	* Lowest and highest height of the texels in [start, end] (inclusive). Parts outside of the heightmap are ignored.
+	* We go up until the rectangle touches at most 2x2 cells, then those cells are read.
+	*/
+	void HeightPyramid::getMinMax(glm::ivec2 start, glm::ivec2 end, unsigned short& min, unsigned short& max) {
+
+		start = glm::clamp(start, glm::ivec2(0), glm::ivec2(size - 1));
+		end = glm::clamp(end, glm::ivec2(0), glm::ivec2(size - 1));
+
+		glm::ivec2 cellStart = start >> cellPower;
+		glm::ivec2 cellEnd = end >> cellPower;
+		int mip = 0;
+
+		while (mip < (int)mipSizes.size() - 1 && (cellEnd.x - cellStart.x > 1 || cellEnd.y - cellStart.y > 1)) {
+			cellStart >>= 1;
+			cellEnd >>= 1;
+			mip++;
+		}
+
+		min = 65535;
+		max = 0;
+
+		for (int i = cellStart.y; i <= cellEnd.y; i++) {
+			for (int j = cellStart.x; j <= cellEnd.x; j++) {
+
+				int cell = i * mipSizes[mip] + j;
+				min = std::min(min, minMips[mip][cell]);
+				max = std::max(max, maxMips[mip][cell]);
+			}
+		}
+	}
+
+	/*
+	* Cells of the first mip that a range of texels can touch, whatever its alignment is.
+	*/
+	int HeightPyramid::getWindowCells(int texels, int cellPower) {
+
+		return ((texels + (1 << cellPower) - 2) >> cellPower) + 1;
+	}
+
+	/*
+	* Level of a sparse table along the columns of the first mip. Each cell keeps the min/max of columnSpanRows cells
+	* from its row down, the largest power of two not over the window. Spans are doubled in place from single cells,
+	* a cell reads the one half a span below before that one is updated. A window of rows is covered by the span
+	* at its first row and the span that ends at its last row, they overlap, which does not change a min or a max.
+	* It is a table of each of min and max, the size of the first mip.
+	*/
+	void HeightPyramid::buildColumnWindows(int cells) {
+
+		int mipSize = mipSizes[0];
+		windowCells = std::min(cells, mipSize);
+
+		columnSpanMin.assign(minMips[0], minMips[0] + mipSize * mipSize);
+		columnSpanMax.assign(maxMips[0], maxMips[0] + mipSize * mipSize);
+
+		for (columnSpanRows = 1; columnSpanRows * 2 <= windowCells; columnSpanRows *= 2) {
+
+			size_t half = (size_t)columnSpanRows * mipSize;
+			size_t cellCount = (size_t)(mipSize - columnSpanRows * 2 + 1) * mipSize;
+
+			for (size_t cell = 0; cell < cellCount; cell++) {
+				columnSpanMin[cell] = std::min(columnSpanMin[cell], columnSpanMin[cell + half]);
+				columnSpanMax[cell] = std::max(columnSpanMax[cell], columnSpanMax[cell + half]);
+			}
+		}
+	}
+
+	/*
+	* First cell of the window over texels starting at texelStart. Window is kept in the first mip.
+	*/
+	glm::ivec2 HeightPyramid::getWindowStart(glm::ivec2 texelStart) {
+
+		glm::ivec2 cellStart = glm::clamp(texelStart, glm::ivec2(0), glm::ivec2(size - 1)) >> cellPower;
+		return glm::min(cellStart, glm::ivec2(mipSizes[0] - windowCells));
+	}
+
+	/*
+	* Min/max of cells [row, row + windowCells - 1] of a column.
+	*/
+	void HeightPyramid::getColumnMinMax(int column, int row, unsigned short& min, unsigned short& max) {
+
+		int mipSize = mipSizes[0];
+		int first = row * mipSize + column;
+		int last = (row + windowCells - columnSpanRows) * mipSize + column;
+		min = std::min(columnSpanMin[first], columnSpanMin[last]);
+		max = std::max(columnSpanMax[first], columnSpanMax[last]);
+	}
+
+	/*
+	* Min/max of the window by reading every cell of it.
+	*/
+	void HeightPyramid::getWindowMinMax(glm::ivec2 cellStart, unsigned short& min, unsigned short& max) {
+
+		int mipSize = mipSizes[0];
+		min = 65535;
+		max = 0;
+
+		for (int i = cellStart.y; i < cellStart.y + windowCells; i++) {
+			for (int j = cellStart.x; j < cellStart.x + windowCells; j++) {
+				min = std::min(min, minMips[0][i * mipSize + j]);
+				max = std::max(max, maxMips[0][i * mipSize + j]);
+			}
+		}
+	}
+
+	/*
+	* Walks a window of a block of the finest level over a synthetic heightmap with the camera speeds of the editor,
+	* reading every cell of it and sliding it. Both have to give the same bounds, it fails otherwise.
+	*/
+	bool HeightPyramid::benchmark(int size, int steps) {
+
+		size = (size + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+		int tilesPerSide = size / TILE_SIZE;
+		unsigned char* heights = new unsigned char[(size_t)size * size * TERRAIN_STACK_NUM_CHANNELS];
+
+		for (int i = 0; i < size; i++) {
+			for (int j = 0; j < size; j++) {
+				unsigned short height = (unsigned short)(32767 + 16000 * sin(j * 0.013) * cos(i * 0.007) + 8000 * sin((i + j) * 0.041) + ((i * 7919 + j * 104729) & 1023));
+				unsigned char* texel = &heights[(size_t)((i / TILE_SIZE) * tilesPerSide + j / TILE_SIZE) * TERRAIN_TILE_BYTES + ((i % TILE_SIZE) * TILE_SIZE + j % TILE_SIZE) * TERRAIN_STACK_NUM_CHANNELS];
+				texel[0] = height >> 8;
+				texel[1] = height & 255;
+			}
+		}
+
+		HeightPyramid pyramid(heights, size, HEIGHT_PYRAMID_CELL_POWER);
+		delete[] heights;
+
+		// texels under a block, one more on each side for filtering
+		int blockTexels = CLIPMAP_RESOLUTION + 2;
+		pyramid.buildColumnWindows(HeightPyramid::getWindowCells(blockTexels, HEIGHT_PYRAMID_CELL_POWER));
+
+		std::vector<glm::ivec2> path(steps);
+		glm::vec2 position(size * 0.5f);
+		glm::vec2 direction(1.f, 0.f);
+		for (int step = 0; step < steps; step++) {
+			float angle = step * 0.002f;
+			direction = glm::vec2(cos(angle), sin(angle * 1.7f));
+			position = glm::clamp(position + direction * (float)PATCH_WIDTH, glm::vec2(0.f), glm::vec2(size - blockTexels - 1.f));
+			path[step] = glm::ivec2(position) / PATCH_WIDTH * PATCH_WIDTH;
+		}
+
+		unsigned long long fullChecksum = 0;
+		unsigned long long slidingChecksum = 0;
+		unsigned int mismatches = 0;
+		unsigned short min, max;
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (int step = 0; step < steps; step++) {
+			pyramid.getWindowMinMax(pyramid.getWindowStart(path[step]), min, max);
+			fullChecksum = fullChecksum * 31 + min * 65536 + max;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		double fullDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 1e-3;
+
+		HeightPyramidWindow window;
+		begin = std::chrono::high_resolution_clock::now();
+		for (int step = 0; step < steps; step++) {
+			window.move(&pyramid, pyramid.getWindowStart(path[step]), min, max);
+			slidingChecksum = slidingChecksum * 31 + min * 65536 + max;
+		}
+		end = std::chrono::high_resolution_clock::now();
+		double slidingDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 1e-3;
+
+		window.reset();
+		for (int step = 0; step < steps; step++) {
+			unsigned short fullMin, fullMax;
+			glm::ivec2 cellStart = pyramid.getWindowStart(path[step]);
+			pyramid.getWindowMinMax(cellStart, fullMin, fullMax);
+			window.move(&pyramid, cellStart, min, max);
+			if (min != fullMin || max != fullMax)
+				mismatches++;
+		}
+
+		printf("Block bounds benchmark, %dx%d heightmap, %dx%d cell window, %d steps\n", size, size, pyramid.windowCells, pyramid.windowCells, steps);
+		printf("  full recompute  : %10.3f ms\n", fullDuration);
+		printf("  sliding window  : %10.3f ms, %.2f column lookups per step\n", slidingDuration, (double)window.columnUpdates / steps);
+		printf("  mismatches      : %10u %s\n", mismatches, fullChecksum == slidingChecksum ? "" : "(checksum differs)");
+
+		bool passed = mismatches == 0 && fullChecksum == slidingChecksum;
+		printf("%s\n", passed ? "Passed" : "FAILED");
+		return passed;
+	}
+
+	void HeightPyramidWindow::reset() {
+
+		cellStart = glm::ivec2(-1);
+		columnUpdates = 0;
+	}
+
+	/*
+	* Moves the window to cellStart. A move along the columns looks up the columns the window enters,
+	* any other move looks up all of them. Bounds are reduced from the ring of columns.
+	*/
+	void HeightPyramidWindow::move(HeightPyramid* pyramid, glm::ivec2 cellStart, unsigned short& min, unsigned short& max) {
+
+		int cells = pyramid->windowCells;
+
+		if (cellStart == this->cellStart && (int)columnMin.size() == cells) {
+			min = this->min;
+			max = this->max;
+			return;
+		}
+
+		int first = cellStart.x;
+		int last = cellStart.x + cells - 1;
+		int shift = cellStart.x - this->cellStart.x;
+
+		if ((int)columnMin.size() == cells && cellStart.y == this->cellStart.y && this->cellStart.x >= 0 && abs(shift) < cells) {
+			if (shift > 0)
+				first = this->cellStart.x + cells;
+			else
+				last = this->cellStart.x - 1;
+		}
+		else {
+			columnMin.resize(cells);
+			columnMax.resize(cells);
+		}
+
+		for (int column = first; column <= last; column++) {
+			pyramid->getColumnMinMax(column, cellStart.y, columnMin[column % cells], columnMax[column % cells]);
+			columnUpdates++;
+		}
+
+		this->min = 65535;
+		this->max = 0;
+		for (int i = 0; i < cells; i++) {
+			this->min = std::min(this->min, columnMin[i]);
+			this->max = std::max(this->max, columnMax[i]);
+		}
+
+		this->cellStart = cellStart;
+		min = this->min;
+		max = this->max;
+	}
+}
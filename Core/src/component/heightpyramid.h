@@ -0,0 +1,75 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+// Height Pyramid Class
+// Min/max mip chain of a heightmap. Each cell of a mip keeps the lowest and the highest height
+// of the texels it covers, so a bounding volume of any rectangle is answered with a few lookups
+// and it never cuts the terrain.
+// Bounds of a window of cells that slides with the camera are kept by HeightPyramidWindow. Every column of cells
+// under a window is answered in constant time from two overlapping row spans of a sparse table of the first mip.
+
+#pragma once
+#include "glm/glm.hpp"
+
+namespace Core {
+
+	class __declspec(dllexport) HeightPyramid {
+
+	private:
+
+	public:
+
+		int size;		// texels on one side of the source heightmap
+		int cellPower;	// cells of the first mip are (1 << cellPower) texels wide
+
+		// Mips point into the storage of a built pyramid, or into the mapping of the heightmap cache for a loaded one
+		std::vector<int> mipSizes;
+		std::vector<const unsigned short*> minMips;
+		std::vector<const unsigned short*> maxMips;
+		std::vector<std::vector<unsigned short>> minMipStorage;
+		std::vector<std::vector<unsigned short>> maxMipStorage;
+
+		// Cells on a side of a window, column min/max of the first mip over spans of columnSpanRows rows from each cell down
+		int windowCells = 0;
+		int columnSpanRows = 0;
+		std::vector<unsigned short> columnSpanMin;
+		std::vector<unsigned short> columnSpanMax;
+
+		HeightPyramid();
+		HeightPyramid(const unsigned char* heights, int size, int cellPower);
+		~HeightPyramid();
+		unsigned long long getMipBytes();
+		void getMinMax(glm::ivec2 start, glm::ivec2 end, unsigned short& min, unsigned short& max);
+		void buildColumnWindows(int cells);
+		glm::ivec2 getWindowStart(glm::ivec2 texelStart);
+		void getColumnMinMax(int column, int row, unsigned short& min, unsigned short& max);
+		void getWindowMinMax(glm::ivec2 cellStart, unsigned short& min, unsigned short& max);
+		static int getWindowCells(int texels, int cellPower);
+		static bool benchmark(int size, int steps);
+	};
+
+	/*
+	* Min/max of a square window of windowCells cells of the first pyramid mip that moves a few cells at a time.
+	* Column min/max are kept in a ring indexed by column. When the window moves sideways only the columns
+	* it enters are looked up. Results are the same as HeightPyramid::getWindowMinMax.
+	*/
+	class __declspec(dllexport) HeightPyramidWindow {
+
+	private:
+
+		glm::ivec2 cellStart = glm::ivec2(-1);
+		std::vector<unsigned short> columnMin;
+		std::vector<unsigned short> columnMax;
+		unsigned short min = 65535;
+		unsigned short max = 0;
+
+	public:
+
+		unsigned long long columnUpdates = 0;
+
+		void move(HeightPyramid* pyramid, glm::ivec2 cellStart, unsigned short& min, unsigned short& max);
+		void reset();
+	};
+}
@@ -0,0 +1,253 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "pch.h"
+#include "splatbaker.h"
+#include "terrain.h"
+#include "threadpool.h"
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+namespace Core {
+
+	/*
+	* clamp((bias - value) / sharpness + 0.5, 0, 1) of terrain.frag. A zero sharpness at value == bias is 0 instead of NaN.
+	*/
+	float SplatBaker::getBlend(float bias, float sharpness, float value) {
+
+		float blend = (bias - value) / sharpness + 0.5f;
+		if (!(blend > 0.f))
+			return 0.f;
+		return blend < 1.f ? blend : 1.f;
+	}
+
+	/*
+	* getSlopeBlend of terrain.frag. Inside the transition of the world slope the slope of the normal map is mixed in
+	* by the world blend, past it the normal map slope decides. With a flat normal map textureSlope is slope and this is getBlend.
+	*/
+	float SplatBaker::getSlopeBlend(float bias, float sharpness, float slope, float textureSlope) {
+
+		float worldBlend = SplatBaker::getBlend(bias, sharpness, slope);
+		return SplatBaker::getBlend(bias, sharpness, slope + (textureSlope - slope) * worldBlend);
+	}
+
+	/*
+	* Factors of the chain of terrain.frag for the geometry, slope is the y of the normal.
+	*/
+	void SplatBaker::getBlendFactors(const SplatParameters& params, float height, float slope, float* factors) {
+
+		factors[SPLAT_FACTOR_MUD] = SplatBaker::getBlend(params.slopeBias[0], params.slopeSharpness[0], slope);
+		factors[SPLAT_FACTOR_SNOW] = 1.f - SplatBaker::getBlend(params.heightBias, params.heightSharpness, height);
+		factors[SPLAT_FACTOR_STONE] = SplatBaker::getBlend(params.slopeBias[1], params.slopeSharpness[1], slope);
+		factors[SPLAT_FACTOR_CLIFF] = SplatBaker::getBlend(params.slopeBias[2], params.slopeSharpness[2], slope);
+	}
+
+	/*
+	* refineSplatFactors of terrain.frag, getSlopeBlend from a baked slope factor. A fractional factor gives back the
+	* world slope, a full one only needs the normal map slope and a zero one stays zero.
+	* Mud uses the slope of the mud normal, stone and cliff the one of the cliff normal, as in the shader chain.
+	*/
+	void SplatBaker::refineBlendFactors(const SplatParameters& params, float mudTextureSlope, float cliffTextureSlope, float* factors) {
+
+		auto refine = [&](float& factor, int index, float textureSlope) {
+			if (factor <= 0.f)
+				return;
+			float slope = params.slopeBias[index] - (factor - 0.5f) * params.slopeSharpness[index];
+			factor = SplatBaker::getBlend(params.slopeBias[index], params.slopeSharpness[index], slope + (textureSlope - slope) * factor);
+		};
+
+		refine(factors[SPLAT_FACTOR_MUD], 0, mudTextureSlope);
+		refine(factors[SPLAT_FACTOR_STONE], 1, cliffTextureSlope);
+		refine(factors[SPLAT_FACTOR_CLIFF], 2, cliffTextureSlope);
+	}
+
+	/*
+	* terrain.frag blends grass to mud by slope, the result to snow by height, then to stone and to cliff by slope.
+	* Each blend is a mix, so the weight of a group is its blend factor times one minus the factors of every later blend.
+	*/
+	void SplatBaker::getGroupWeights(const float* factors, float* weights) {
+
+		float rest = 1.f - factors[SPLAT_FACTOR_CLIFF];
+		weights[SPLAT_GROUP_CLIFF] = factors[SPLAT_FACTOR_CLIFF];
+		weights[SPLAT_GROUP_STONE] = factors[SPLAT_FACTOR_STONE] * rest;
+		rest *= 1.f - factors[SPLAT_FACTOR_STONE];
+		weights[SPLAT_GROUP_SNOW] = factors[SPLAT_FACTOR_SNOW] * rest;
+		rest *= 1.f - factors[SPLAT_FACTOR_SNOW];
+		weights[SPLAT_GROUP_MUD] = factors[SPLAT_FACTOR_MUD] * rest;
+		weights[SPLAT_GROUP_GRASS] = (1.f - factors[SPLAT_FACTOR_MUD]) * rest;
+	}
+
+	/*
+	* Factors to bytes. Weights of any factors sum to one, so the factors are rounded on their own.
+	*/
+	void SplatBaker::quantizeFactors(const float* factors, unsigned char* splat) {
+
+		for (int i = 0; i < SPLAT_NUM_CHANNELS; i++)
+			splat[i] = (unsigned char)(factors[i] * 255.f + 0.5f);
+	}
+
+	/*
+	* Heights are (size + 2) x (size + 2) values with a border of one texel around the tile, rows are along z.
+	* Normal is found from the four neighbours like terrain.vert does, texelSize is the world distance between texels.
+	* Output is size x size texels of SPLAT_NUM_CHANNELS bytes.
+	*/
+	void SplatBaker::bakeTile(const unsigned short* heights, int size, float heightScale, float texelSize, const SplatParameters& params, unsigned char* splat) {
+
+		int stride = size + 2;
+		float normalY = 2 * texelSize;
+		float factors[SPLAT_NUM_CHANNELS];
+
+		for (int i = 0; i < size; i++) {
+
+			const unsigned short* row = &heights[(i + 1) * stride + 1];
+
+			for (int j = 0; j < size; j++) {
+
+				float h0 = row[j - stride] * heightScale;
+				float h1 = row[j - 1] * heightScale;
+				float h2 = row[j + 1] * heightScale;
+				float h3 = row[j + stride] * heightScale;
+
+				float normalX = h1 - h2;
+				float normalZ = h0 - h3;
+				float slope = normalY / std::sqrt(normalX * normalX + normalY * normalY + normalZ * normalZ);
+
+				SplatBaker::getBlendFactors(params, row[j] * heightScale, slope, factors);
+				SplatBaker::quantizeFactors(factors, &splat[(i * size + j) * SPLAT_NUM_CHANNELS]);
+			}
+		}
+	}
+
+	/*
+	* Checks the weights against the blend chain of terrain.frag written the same way as the shader, with the groups
+	* as one hot colors, then measures bake throughput of the tiles of every clipmap level on one and on all threads.
+	* Baked factors are checked with flat normal maps, refined factors with random normal map slopes around the world slope.
+	* Fails if an error is over its bound or the threads bake other texels than one thread.
+	*/
+	bool SplatBaker::benchmark(int iterations) {
+
+		SplatParameters params = { { 0.96f, 0.89f, 0.84f }, { 0.074f, 0.08f, 0.08f }, 135.f, 2.f };
+
+		auto mix = [](float* x, const float* y, float a) {
+			for (int i = 0; i < SPLAT_GROUP_COUNT; i++)
+				x[i] = x[i] * (1.f - a) + y[i] * a;
+		};
+
+		float groups[SPLAT_GROUP_COUNT][SPLAT_GROUP_COUNT] = {};
+		for (int i = 0; i < SPLAT_GROUP_COUNT; i++)
+			groups[i][i] = 1.f;
+
+		auto shaderChain = [&](float height, float slope, float mudTextureSlope, float cliffTextureSlope, float* chain) {
+			memcpy(chain, groups[SPLAT_GROUP_GRASS], sizeof(float) * SPLAT_GROUP_COUNT);
+			mix(chain, groups[SPLAT_GROUP_MUD], SplatBaker::getSlopeBlend(params.slopeBias[0], params.slopeSharpness[0], slope, mudTextureSlope));
+			mix(chain, groups[SPLAT_GROUP_SNOW], std::min(std::max((height - params.heightBias) / params.heightSharpness + 0.5f, 0.f), 1.f));
+			mix(chain, groups[SPLAT_GROUP_STONE], SplatBaker::getSlopeBlend(params.slopeBias[1], params.slopeSharpness[1], slope, cliffTextureSlope));
+			mix(chain, groups[SPLAT_GROUP_CLIFF], SplatBaker::getSlopeBlend(params.slopeBias[2], params.slopeSharpness[2], slope, cliffTextureSlope));
+		};
+
+		const int samples = 1000000;
+		float maxError = 0.f;
+		float maxQuantizationError = 0.f;
+		float maxRefineError = 0.f;
+
+		for (int sample = 0; sample < samples; sample++) {
+
+			unsigned int hash = sample * 2654435761u;
+			float height = (hash >> 8 & 65535) * (MAX_HEIGHT / 65535.f);
+			float slope = 0.6f + (hash >> 20) * (0.4f / 4096);
+			unsigned int normalHash = hash * 1664525u + 1013904223u;
+			float mudTextureSlope = std::min(slope + ((int)(normalHash >> 8 & 1023) - 512) * (0.15f / 512), 1.f);
+			float cliffTextureSlope = std::min(slope + ((int)(normalHash >> 20 & 1023) - 512) * (0.15f / 512), 1.f);
+
+			float chain[SPLAT_GROUP_COUNT];
+			shaderChain(height, slope, slope, slope, chain);
+
+			float factors[SPLAT_NUM_CHANNELS];
+			unsigned char splat[SPLAT_NUM_CHANNELS];
+			SplatBaker::getBlendFactors(params, height, slope, factors);
+			SplatBaker::quantizeFactors(factors, splat);
+
+			float quantizedFactors[SPLAT_NUM_CHANNELS];
+			for (int i = 0; i < SPLAT_NUM_CHANNELS; i++)
+				quantizedFactors[i] = splat[i] / 255.f;
+
+			float weights[SPLAT_GROUP_COUNT];
+			float quantized[SPLAT_GROUP_COUNT];
+			SplatBaker::getGroupWeights(factors, weights);
+			SplatBaker::getGroupWeights(quantizedFactors, quantized);
+
+			for (int i = 0; i < SPLAT_GROUP_COUNT; i++) {
+				maxError = std::max(maxError, std::abs(weights[i] - chain[i]));
+				maxQuantizationError = std::max(maxQuantizationError, std::abs(quantized[i] - chain[i]));
+			}
+
+			shaderChain(height, slope, mudTextureSlope, cliffTextureSlope, chain);
+			SplatBaker::refineBlendFactors(params, mudTextureSlope, cliffTextureSlope, factors);
+			SplatBaker::getGroupWeights(factors, weights);
+
+			for (int i = 0; i < SPLAT_GROUP_COUNT; i++)
+				maxRefineError = std::max(maxRefineError, std::abs(weights[i] - chain[i]));
+		}
+
+		// Rough synthetic terrain, slopes cover every transition
+		const int stride = TILE_SIZE + 2;
+		std::vector<unsigned short> heights((size_t)stride * stride);
+		for (int i = 0; i < stride; i++)
+			for (int j = 0; j < stride; j++)
+				heights[i * stride + j] = (unsigned short)(52000 + 12000 * sin(j * 0.05) * cos(i * 0.037) + ((i * 7919 + j * 104729) & 511));
+
+		const int tiles = MEM_TILE_ONE_SIDE * MEM_TILE_ONE_SIDE * CLIPMAP_LEVEL;
+		std::vector<unsigned char> splat((size_t)tiles * TILE_SIZE * TILE_SIZE * SPLAT_NUM_CHANNELS);
+		float heightScale = MAX_HEIGHT / 65535.f;
+		double texels = (double)tiles * TILE_SIZE * TILE_SIZE * iterations;
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++)
+			for (int tile = 0; tile < tiles; tile++)
+				SplatBaker::bakeTile(&heights[0], TILE_SIZE, heightScale, (float)(1 << (tile % CLIPMAP_LEVEL)), params, &splat[(size_t)tile * TILE_SIZE * TILE_SIZE * SPLAT_NUM_CHANNELS]);
+		auto end = std::chrono::high_resolution_clock::now();
+		double singleThread = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 1e-6;
+		std::vector<unsigned char> reference = splat;
+
+		ThreadPool pool;
+		begin = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++) {
+			for (int tile = 0; tile < tiles; tile++)
+				pool.submit([&, tile]() {
+					SplatBaker::bakeTile(&heights[0], TILE_SIZE, heightScale, (float)(1 << (tile % CLIPMAP_LEVEL)), params, &splat[(size_t)tile * TILE_SIZE * TILE_SIZE * SPLAT_NUM_CHANNELS]);
+				});
+			pool.wait();
+		}
+		end = std::chrono::high_resolution_clock::now();
+		double multiThread = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 1e-6;
+
+		unsigned int usedGroups[SPLAT_GROUP_COUNT + 1] = {};
+		for (size_t texel = 0; texel < splat.size(); texel += SPLAT_NUM_CHANNELS) {
+			float factors[SPLAT_NUM_CHANNELS];
+			float weights[SPLAT_GROUP_COUNT];
+			for (int i = 0; i < SPLAT_NUM_CHANNELS; i++)
+				factors[i] = splat[texel + i] / 255.f;
+			SplatBaker::getGroupWeights(factors, weights);
+			int used = 0;
+			for (int i = 0; i < SPLAT_GROUP_COUNT; i++)
+				used += weights[i] > 0.f;
+			usedGroups[used]++;
+		}
+
+		printf("Splat bake benchmark, %d tiles of %dx%d, %d iterations\n", tiles, TILE_SIZE, TILE_SIZE, iterations);
+		printf("  weights vs shader blend chain : %10.2e max error\n", maxError);
+		printf("  after quantization            : %10.2e max error\n", maxQuantizationError);
+		printf("  refined vs chain with normals : %10.2e max error\n", maxRefineError);
+		printf("  1 thread                      : %10.1f Mtexels/s\n", texels / singleThread * 1e-6);
+		printf("  %2u threads                    : %10.1f Mtexels/s %s\n", pool.getThreadCount(), texels / multiThread * 1e-6, reference == splat ? "" : "MISMATCH");
+		for (int i = 1; i <= SPLAT_GROUP_COUNT; i++)
+			printf("  texels with %d group(s)        : %9.1f%%\n", i, usedGroups[i] * 100.0 / (splat.size() / SPLAT_NUM_CHANNELS));
+
+		bool passed = maxError <= SPLAT_MAX_WEIGHT_ERROR && maxQuantizationError <= SPLAT_MAX_QUANTIZATION_ERROR && maxRefineError <= SPLAT_MAX_WEIGHT_ERROR && reference == splat;
+		printf("%s, bounds are %.2e and %.2e\n", passed ? "Passed" : "FAILED", SPLAT_MAX_WEIGHT_ERROR, SPLAT_MAX_QUANTIZATION_ERROR);
+		return passed;
+	}
+}
@@ -0,0 +1,65 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+// Splat Baker Class
+// Bakes the blend factors of the material chain of terrain.frag for every texel of the height clipmap.
+// Factors of the geometry only depend on height and slope, so they are computed once per texel when a tile is streamed
+// instead of once per fragment. The fragment shader mixes in the slope of the mud and cliff normal maps like the
+// slope blends always did, turns the factors to group weights and samples only the groups that are visible.
+// Weights are the closed form of the chain of slope and height blends of terrain.frag.
+
+#pragma once
+
+// Material groups of terrain.frag
+#define SPLAT_GROUP_GRASS 0
+#define SPLAT_GROUP_MUD 1
+#define SPLAT_GROUP_STONE 2
+#define SPLAT_GROUP_CLIFF 3
+#define SPLAT_GROUP_SNOW 4
+#define SPLAT_GROUP_COUNT 5
+
+// Blend factors in RGBA of the splat map, in the order of the chain
+#define SPLAT_FACTOR_MUD 0
+#define SPLAT_FACTOR_SNOW 1
+#define SPLAT_FACTOR_STONE 2
+#define SPLAT_FACTOR_CLIFF 3
+#define SPLAT_NUM_CHANNELS 4
+
+// Error bounds of the benchmark check, the weights against the shader chain and after rounding the factors to bytes.
+// A weight is a product of up to four factors that are each rounded by half a step.
+#define SPLAT_MAX_WEIGHT_ERROR 1e-5f
+#define SPLAT_MAX_QUANTIZATION_ERROR (2.5f / 255.f)
+
+namespace Core {
+
+	class ThreadPool;
+
+	/*
+	* Slope and height transitions of the terrain material, the same as the uniforms of terrain.frag.
+	*/
+	struct SplatParameters {
+
+		float slopeBias[3];
+		float slopeSharpness[3];
+		float heightBias;
+		float heightSharpness;
+	};
+
+	class __declspec(dllexport) SplatBaker {
+
+	private:
+
+	public:
+
+		static float getBlend(float bias, float sharpness, float value);
+		static float getSlopeBlend(float bias, float sharpness, float slope, float textureSlope);
+		static void getBlendFactors(const SplatParameters& params, float height, float slope, float* factors);
+		static void refineBlendFactors(const SplatParameters& params, float mudTextureSlope, float cliffTextureSlope, float* factors);
+		static void getGroupWeights(const float* factors, float* weights);
+		static void quantizeFactors(const float* factors, unsigned char* splat);
+		static void bakeTile(const unsigned short* heights, int size, float heightScale, float texelSize, const SplatParameters& params, unsigned char* splat);
+		static bool benchmark(int iterations);
+	};
+}
@@ -13,9 +13,27 @@
 
 #include "pch.h"
 #include "terrain.h"
+#include "terrainstreamer.h"
+#include "heightmapcache.h"
+#include "terraintilecache.h"
+#include "terrainprefetcher.h"
+#include "ringbuffer.h"
+#include "heightpyramid.h"
+#include "frustumculler.h"
+#include "mipgenerator.h"
+#include "threadpool.h"
+#include "terraintexturecooker.h"
+#include "blockencoder.h"
+#include "texturecontainer.h"
 #include "corecontext.h"
-#include "gl/glew.h"
+#include "gldispatch.h"
+#include "profiler.h"
+#include "gputimer.h"
+#include "counters.h"
 #include "lodepng/lodepng.h"
+#include "rapidXML/rapidxml.hpp"
+#include <cfloat>
+#include <chrono>
 
 namespace Core {
 
@@ -29,85 +47,314 @@ namespace Core {
 
 	Terrain::~Terrain() {
 
-		glDeleteTextures(1, &elevationMapTextureArray);
-		glDeleteVertexArrays(1, &blockVAO);
-		glDeleteVertexArrays(1, &ringFixUpVerticalVAO);
-		glDeleteVertexArrays(1, &ringFixUpHorizontalVAO);
-		glDeleteVertexArrays(1, &smallSquareVAO);
-		glDeleteVertexArrays(1, &outerDegenerateVAO);
-		glDeleteVertexArrays(1, &interiorTrimVAO);
-		glDeleteProgram(terrainProgramID);
+		delete prefetcher;
+		delete streamer;
 
-		for (int i = 0; i < CLIPMAP_LEVEL; i++)
-			delete[] heightmapStack[i];
-		delete[] heightmapStack;
+		if (instanceRing)
+			delete instanceRing;
+		else
+			glDeleteBuffers(1, &instanceBuffer);
 
-		for (int i = 0; i < CLIPMAP_LEVEL; i++)
-			delete[] lowResolustionHeightmapStack[i];
-		delete[] lowResolustionHeightmapStack;
-
-		glDeleteTextures(1, &albedo0);
-		glDeleteTextures(1, &albedo1);
-		glDeleteTextures(1, &albedo2);
-		glDeleteTextures(1, &albedo3);
-		glDeleteTextures(1, &albedo4);
-		glDeleteTextures(1, &albedo5);
-		glDeleteTextures(1, &albedo6);
-		glDeleteTextures(1, &normal0);
-		glDeleteTextures(1, &normal1);
-		glDeleteTextures(1, &normal2);
-		glDeleteTextures(1, &normal3);
-		glDeleteTextures(1, &normal4);
-		glDeleteTextures(1, &normal5);
-		glDeleteTextures(1, &normal6);
-		glDeleteTextures(1, &normal7);
-		glDeleteTextures(1, &normal8);
-		glDeleteTextures(1, &macroTexture);
-		glDeleteTextures(1, &noiseTexture);
+		glDeleteTextures(1, &elevationMapTextureArray);
+		glDeleteTextures(1, &splatMapTextureArray);
+		glDeleteVertexArrays(1, &clipmapVAO);
+		glDeleteBuffers(1, &clipmapVBO);
+		glDeleteBuffers(1, &clipmapEBO);
+		glDeleteBuffers(1, &frameUniformBuffer);
+		glDeleteBuffers(1, &materialUniformBuffer);
+		glDeleteBuffers(1, &pyramidBuffer);
+
+		Terrain::releaseHeightmapStack();
+		delete heightmapCache;
+		delete tileCache;
+
+		glDeleteTextures(1, &albedoArray);
+		glDeleteTextures(1, &normalArray);
+		glDeleteTextures(1, &utilityArray);
+
+		const int categories[] = { MEMORY_CPU_HEIGHTMAP_STACK, MEMORY_CPU_HEIGHT_PYRAMIDS, MEMORY_CPU_TILE_CACHE, MEMORY_GPU_TERRAIN_MAPS, MEMORY_GPU_TERRAIN_MATERIALS, MEMORY_GPU_TERRAIN_BUFFERS };
+		for (int category : categories)
+			Counters::setMemory(category, 0);
 	}
 
 	void Terrain::start() {
 
-		// limit camera position to the remapped terrain region
-		cameraPosition = glm::clamp(CoreContext::instance->scene->cameraInfo.camPos, glm::vec3(MAP_SIZE * 2 + 1, 0, MAP_SIZE * 2 + 1), glm::vec3(MAP_SIZE * 3 - 1, 0, MAP_SIZE * 3 - 1));
+		PROFILE_FUNCTION();
+
+		Terrain::loadHeightmap("resources/textures/terrain/heightmap.png");
 
-		Terrain::initHeightmapStack("resources/textures/terrain/heightmap.png");
-		Terrain::createLowResolutionHeightmapStack();
+		// limit camera position to the remapped terrain region
+		cameraPosition = glm::clamp(CoreContext::instance->scene->cameraInfo.camPos, glm::vec3(mapSize * 2 + 1, 0, mapSize * 2 + 1), glm::vec3(mapSize * 3 - 1, 0, mapSize * 3 - 1));
 		Terrain::generateTerrainClipmapsVertexArrays();
+		Terrain::initInstanceBuffer();
 		Terrain::initShaders("resources/shaders/terrain/terrain.vert", "resources/shaders/terrain/terrain.frag");
 		Terrain::loadTerrainHeightmapOnInit(cameraPosition, CLIPMAP_LEVEL);
 		Terrain::calculateBlockPositions(cameraPosition);
 		Terrain::initBlockAABBs();
-		Terrain::loadTextures();
+		Terrain::loadTextures(TERRAIN_LAYERS_PATH);
+		Terrain::initCullProgram();
+
+		streamer = new TerrainStreamer(this);
+		prefetcher = new TerrainPrefetcher(this);
+		Terrain::updateMemoryCounters();
+	}
+
+	/*
+	* Heightmap stack and height pyramids are read from the cooked cache next to the png if it is up to date.
+	* Otherwise they are built from the png and the cache is cooked for the next start.
+	*/
+	void Terrain::loadHeightmap(const std::string path) {
+
+		std::string cachePath = std::filesystem::path(path).replace_extension(".heightcache").string();
+
+		auto begin = std::chrono::high_resolution_clock::now();
+
+		heightmapCache = new HeightmapCache();
+
+		if (HeightmapCache::benchmarkOnLoad)
+			HeightmapCache::benchmark(this, path, cachePath);
+		else if (!heightmapCache->load(this, path, cachePath)) {
+			Terrain::initHeightmapStack(path);
+			Terrain::createHeightPyramids();
+			HeightmapCache::cook(this, path, cachePath);
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		heightmapLoadDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001f;
+		std::cout << "Heightmap loaded in " << heightmapLoadDuration << " ms" << std::endl;
+	}
+
+	void Terrain::releaseHeightmapStack() {
+
+		if (heightmapStack) {
+			// a mapped stack belongs to the heightmap cache
+			for (int i = 0; i < CLIPMAP_LEVEL && !heightmapStackMapped; i++)
+				delete[] heightmapStack[i];
+			delete[] heightmapStack;
+			heightmapStack = NULL;
+			heightmapStackMapped = false;
+		}
+
+		for (int i = 0; i < CLIPMAP_LEVEL; i++) {
+			delete heightPyramids[i];
+			heightPyramids[i] = NULL;
+		}
 	}
 
 	void Terrain::initShaders(const char* vertexShader, const char* fragShader) {
 
-		terrainProgramID = Shader::loadShaders(vertexShader, fragShader);
-		glUseProgram(terrainProgramID);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "heightmapArray"), 0);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "macroTexture"), 1);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "noiseTexture"), 2);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "albedoT0"), 3);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "albedoT1"), 4);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "albedoT2"), 5);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "albedoT3"), 6);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "albedoT4"), 7);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "albedoT5"), 8);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "albedoT6"), 9);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "normalT0"), 10);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "normalT1"), 11);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "normalT2"), 12);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "normalT3"), 13);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "normalT4"), 14);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "normalT5"), 15);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "normalT6"), 16);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "normalT7"), 17);
-		glUniform1i(glGetUniformLocation(terrainProgramID, "normalT8"), 18);
+		// Samplers and uniform blocks have their bindings in the shaders, so any permutation can be drawn with as it is.
+		// Both programs are compiled while the heightmap and the textures are loaded.
+		vertexShaderPath = vertexShader;
+		fragmentShaderPath = fragShader;
+		ShaderManager* shaderManager = CoreContext::instance->shaderManager;
+		terrainProgramID = shaderManager->load(vertexShaderPath, fragmentShaderPath, Terrain::getShaderDefines());
+		cullProgramID = shaderManager->loadCompute("resources/shaders/terrain/terrain_cull.comp");
+
+		Terrain::initUniformBuffers();
+	}
+
+	/*
+	* Culling falls back to CPU if the cull program does not link. Piece extents do not change, they are set once,
+	* and the height pyramids are uploaded for the bounds the program computes.
+	*/
+	void Terrain::initCullProgram() {
+
+		if (!CoreContext::instance->shaderManager->wait(cullProgramID)) {
+			cullProgramID = 0;
+			return;
+		}
+
+		cullPlanesLocation = glGetUniformLocation(cullProgramID, "planes");
+		cullOriginsLocation = glGetUniformLocation(cullProgramID, "origins");
+		cullPieceExtentsLocation = glGetUniformLocation(cullProgramID, "pieceExtents");
+		cullCommandWordLocation = glGetUniformLocation(cullProgramID, "commandWord");
+
+		glm::vec4 extents[TERRAIN_PIECE_COUNT];
+		for (int i = 0; i < TERRAIN_PIECE_COUNT; i++)
+			extents[i] = glm::vec4(pieces[i].localMin, pieces[i].localMax);
+
+		glUseProgram(cullProgramID);
+		glUniform4fv(cullPieceExtentsLocation, TERRAIN_PIECE_COUNT, &extents[0][0]);
+		glUseProgram(0);
+
+		Terrain::uploadHeightPyramids();
+	}
+
+	/*
+	* Defines of the terrain permutation. Instanced rendering is the only vertex path of terrain.vert.
+	*/
+	std::vector<std::string> Terrain::getShaderDefines() {
+
+		std::vector<std::string> defines;
+		defines.push_back("TERRAIN_INSTANCED_RENDERING");
+		if (fog)
+			defines.push_back("TERRAIN_FOG");
+		if (debugColors)
+			defines.push_back("TERRAIN_DEBUG_COLORS");
+		return defines;
+	}
+
+	/*
+	* Loading a permutation that was loaded before only looks it up. A new one is compiled in the background
+	* with parallel shader compile, and is switched to once it is linked.
+	*/
+	void Terrain::updateProgram() {
+
+		ShaderManager* shaderManager = CoreContext::instance->shaderManager;
+		unsigned int program = shaderManager->load(vertexShaderPath, fragmentShaderPath, Terrain::getShaderDefines());
+
+		if (program != terrainProgramID && shaderManager->isReady(program) && shaderManager->wait(program))
+			terrainProgramID = program;
+	}
+
+	/*
+	* Uniform buffers stay bound to their binding points, programs read them through layout(binding).
+	*/
+	void Terrain::initUniformBuffers() {
+
+		static_assert(sizeof(TerrainFrameUniforms) == 80 + 16 * CLIPMAP_LEVEL, "TerrainFrameUniforms does not match std140 layout of TerrainFrame");
+		static_assert(sizeof(TerrainMaterialUniforms) == 304, "TerrainMaterialUniforms does not match std140 layout of TerrainMaterial");
+
+		glGenBuffers(1, &frameUniformBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(TerrainFrameUniforms), NULL, GL_DYNAMIC_DRAW);
+
+		glGenBuffers(1, &materialUniformBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, materialUniformBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(TerrainMaterialUniforms), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glBindBufferBase(GL_UNIFORM_BUFFER, TERRAIN_FRAME_BINDING, frameUniformBuffer);
+		glBindBufferBase(GL_UNIFORM_BUFFER, TERRAIN_MATERIAL_BINDING, materialUniformBuffer);
+		uniformsUploaded = false;
+	}
+
+	/*
+	* Blocks are filled from the camera and the parameters edited in the editor. A block is sent to the gpu
+	* only if it differs from what was sent last time, so material is uploaded only when a parameter changes.
+	*/
+	void Terrain::updateUniformBuffers(const CameraInfo& camera) {
+
+		TerrainFrameUniforms frame;
+		frame.PV = camera.VP;
+		frame.camPos = camera.camPos;
+		frame.texSize = (float)TILE_SIZE * MEM_TILE_ONE_SIDE;
+
+		// Outer degenerate triangles run along the border of each level
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+			glm::vec2 start = outerDegeneratePositions[level];
+			glm::vec2 end = start + (float)(CLIPMAP_RESOLUTION * 4 - 2) * (1 << level);
+			frame.levelBounds[level] = glm::vec4(start, end);
+		}
+
+		TerrainMaterialUniforms material;
+		memset(&material, 0, sizeof(TerrainMaterialUniforms));
+		material.lightDirection = lightDir;
+		material.lightPow = lightPow;
+		material.color0 = color0;
+		material.ambientAmount = ambientAmount;
+		material.color1 = color1;
+		material.specularAmount = specularAmount;
+		material.fogColor = fogColor;
+		material.specularPower = specularPower;
+
+		material.blendDistance = blendDistance;
+		material.blendAmount = blendAmount;
+
+		material.scale_color0_dist0 = scale_color0_dist0;
+		material.scale_color0_dist1 = scale_color0_dist1;
+		material.scale_color1_dist0 = scale_color1_dist0;
+		material.scale_color1_dist1 = scale_color1_dist1;
+		material.scale_color2_dist0 = scale_color2_dist0;
+		material.scale_color2_dist1 = scale_color2_dist1;
+		material.scale_color3_dist0 = scale_color3_dist0;
+		material.scale_color3_dist1 = scale_color3_dist1;
+		material.scale_color4_dist0 = scale_color4_dist0;
+		material.scale_color4_dist1 = scale_color4_dist1;
+		material.scale_color5_dist0 = scale_color5_dist0;
+		material.scale_color5_dist1 = scale_color5_dist1;
+		material.scale_color6_dist0 = scale_color6_dist0;
+		material.scale_color6_dist1 = scale_color6_dist1;
+		material.scale_color7_dist0 = scale_color7_dist0;
+		material.scale_color7_dist1 = scale_color7_dist1;
+		material.scale_color8_dist0 = scale_color8_dist0;
+		material.scale_color8_dist1 = scale_color8_dist1;
+
+		material.macroScale_0 = macroScale_0;
+		material.macroScale_1 = macroScale_1;
+		material.macroScale_2 = macroScale_2;
+		material.macroPower = macroPower;
+		material.macroOpacity = macroOpacity;
+		material.macroAmountLayer0 = macroAmountLayer0;
+		material.macroAmountLayer1 = macroAmountLayer1;
+		material.macroAmountLayer2 = macroAmountLayer2;
+		material.macroAmountLayer3 = macroAmountLayer3;
+		material.macroAmountLayer4 = macroAmountLayer4;
+
+		material.overlayBlendScale0 = overlayBlendScale0;
+		material.overlayBlendAmount0 = overlayBlendAmount0;
+		material.overlayBlendPower0 = overlayBlendPower0;
+		material.overlayBlendOpacity0 = overlayBlendOpacity0;
+		material.overlayBlendScale1 = overlayBlendScale1;
+		material.overlayBlendAmount1 = overlayBlendAmount1;
+		material.overlayBlendPower1 = overlayBlendPower1;
+		material.overlayBlendOpacity1 = overlayBlendOpacity1;
+		material.overlayBlendScale2 = overlayBlendScale2;
+		material.overlayBlendAmount2 = overlayBlendAmount2;
+		material.overlayBlendPower2 = overlayBlendPower2;
+		material.overlayBlendOpacity2 = overlayBlendOpacity2;
+		material.overlayBlendScale3 = overlayBlendScale3;
+		material.overlayBlendAmount3 = overlayBlendAmount3;
+		material.overlayBlendPower3 = overlayBlendPower3;
+		material.overlayBlendOpacity3 = overlayBlendOpacity3;
+
+		material.slopeSharpness0 = slopeSharpness0;
+		material.slopeSharpness1 = slopeSharpness1;
+		material.slopeSharpness2 = slopeSharpness2;
+		material.slopeBias0 = slopeBias0;
+		material.slopeBias1 = slopeBias1;
+		material.slopeBias2 = slopeBias2;
+
+		material.heightBias0 = heightBias0;
+		material.heightSharpness0 = heightSharpness0;
+
+		material.distanceNear = distanceNear;
+		material.fogBlendDistance = fogBlendDistance;
+		material.maxFog = maxFog;
+
+		if (!uniformsUploaded || memcmp(&frame, &frameUniforms, sizeof(TerrainFrameUniforms)) != 0) {
+			glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(TerrainFrameUniforms), &frame);
+			frameUniforms = frame;
+		}
+
+		if (!uniformsUploaded || memcmp(&material, &materialUniforms, sizeof(TerrainMaterialUniforms)) != 0) {
+			glBindBuffer(GL_UNIFORM_BUFFER, materialUniformBuffer);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(TerrainMaterialUniforms), &material);
+			materialUniforms = material;
+			materialUploads++;
+		}
+
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		uniformsUploaded = true;
 	}
 
 	void Terrain::initBlockAABBs() {
 
+		// Block bounds slide over the first pyramid mip, with a window wide enough for a block at any alignment
+		TerrainInstance instance = { blockPositions[0], 0, 0 };
+		glm::vec2 start, end;
+		glm::ivec2 texelStart, texelEnd;
+		Terrain::getPieceExtent(TERRAIN_PIECE_BLOCK, instance, start, end, texelStart, texelEnd);
+		int windowCells = HeightPyramid::getWindowCells(texelEnd.x - texelStart.x + 1, HEIGHT_PYRAMID_CELL_POWER);
+
+		for (int i = 0; i < CLIPMAP_LEVEL; i++)
+			if (heightPyramids[i]->windowCells != windowCells)
+				heightPyramids[i]->buildColumnWindows(windowCells);
+		for (int i = 0; i < BLOCK_COUNT; i++)
+			blockWindows[i].reset();
+
 		for (int i = 0; i < CLIPMAP_LEVEL; i++)
 			for (int j = 0; j < 12; j++)
 				blockAABBs[12 * i + j] = Terrain::getBlockBoundingBox(i * 12 + j, i);
@@ -120,19 +367,14 @@ namespace Core {
 		std::vector<unsigned char> out;
 		unsigned int w, h;
 		lodepng::decode(out, w, h, path, LodePNGColorType::LCT_GREY, 16);
-		unsigned char* data = new unsigned char[w * w * TERRAIN_STACK_NUM_CHANNELS];
-		for (int i = 0; i < out.size(); i++)
-			data[i] = out[i];
 
-		const unsigned char* const heightmap = Terrain::resizeHeightmap(data, w);
-		unsigned char** heightMapList = Terrain::createMipmaps(heightmap, w * MEM_TILE_ONE_SIDE, CLIPMAP_LEVEL);
-		Terrain::createHeightmapStack(heightMapList, w * MEM_TILE_ONE_SIDE);
+		unsigned char** heightMapList = Terrain::createMipmaps(&out[0], w, CLIPMAP_LEVEL);
+		Terrain::createHeightmapStack(heightMapList, w);
 
-		for (int i = 0; i < CLIPMAP_LEVEL; i++)
+		// level 0 is the decoded image itself
+		for (int i = 1; i < CLIPMAP_LEVEL; i++)
 			delete[] heightMapList[i];
 		delete[] heightMapList;
-		delete[] heightmap;
-		delete[] data;
 	}
 
 	/*
@@ -140,18 +382,15 @@ namespace Core {
 	*/
 	void Terrain::loadTerrainHeightmapOnInit(glm::vec3 camPos, int clipmapLevel) {
 
-		unsigned char** terrainStack = new unsigned char* [clipmapLevel];
-		for (int i = 0; i < clipmapLevel; i++)
-			terrainStack[i] = new unsigned char[MEM_TILE_ONE_SIDE * MEM_TILE_ONE_SIDE * TILE_SIZE * TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS];
+		PROFILE_FUNCTION();
 
-		for (int level = 0; level < clipmapLevel; level++)
-			Terrain::loadHeightmapAtLevel(level, camPos, terrainStack[level]);
+		Terrain::createElevationMapTextureArray();
+		Terrain::createSplatMapTextureArray();
 
-		Terrain::createElevationMapTextureArray(terrainStack);
+		for (int level = 0; level < clipmapLevel; level++)
+			Terrain::loadHeightmapAtLevel(level, camPos);
 
-		for (int i = 0; i < clipmapLevel; i++)
-			delete[] terrainStack[i];
-		delete[] terrainStack;
+		Terrain::bakeSplatMap(camPos);
 	}
 	 
 	/*
@@ -333,108 +572,57 @@ namespace Core {
 			interiorTrimIndices.push_back(i + size * 2 + 3);
 		}
 
-		blockIndiceCount = blockIndices.size();
-		ringFixUpVerticalIndiceCount = ringFixUpVerticalIndices.size();
-		ringFixUpHorizontalIndiceCount = ringFixUpHorizontalIndices.size();
-		smallSquareIndiceCount = smallSquareIndices.size();
-		interiorTrimIndiceCount = interiorTrimIndices.size();
-		outerDegenerateIndiceCount = outerDegenerateIndices.size();
-
-		// Block
-		glGenVertexArrays(1, &blockVAO);
-		glBindVertexArray(blockVAO);
-
-		unsigned int blockVBO;
-		glGenBuffers(1, &blockVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, blockVBO);
-		glBufferData(GL_ARRAY_BUFFER, blockVerts.size() * sizeof(glm::vec2), &blockVerts[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, 0, sizeof(glm::vec2), 0);
-
-		unsigned int EBO;
-		glGenBuffers(1, &EBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, blockIndices.size() * sizeof(unsigned int), &blockIndices[0], GL_STATIC_DRAW);
-
-		// Ring Fix-up Vertical
-		glGenVertexArrays(1, &ringFixUpVerticalVAO);
-		glBindVertexArray(ringFixUpVerticalVAO);
-
-		unsigned int ringFixUpVerticalVBO;
-		glGenBuffers(1, &ringFixUpVerticalVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, ringFixUpVerticalVBO);
-		glBufferData(GL_ARRAY_BUFFER, ringFixUpVerticalVerts.size() * sizeof(glm::vec2), &ringFixUpVerticalVerts[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, 0, sizeof(glm::vec2), 0);
-
-		unsigned int ringFixUpVerticalEBO;
-		glGenBuffers(1, &ringFixUpVerticalEBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ringFixUpVerticalEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, ringFixUpVerticalIndices.size() * sizeof(unsigned int), &ringFixUpVerticalIndices[0], GL_STATIC_DRAW);
-
-		// Ring Fix-up Horizontal
-		glGenVertexArrays(1, &ringFixUpHorizontalVAO);
-		glBindVertexArray(ringFixUpHorizontalVAO);
-
-		unsigned int ringFixUpHorizontalVBO;
-		glGenBuffers(1, &ringFixUpHorizontalVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, ringFixUpHorizontalVBO);
-		glBufferData(GL_ARRAY_BUFFER, ringFixUpHorizontalVerts.size() * sizeof(glm::vec2), &ringFixUpHorizontalVerts[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, 0, sizeof(glm::vec2), 0);
-
-		unsigned int ringFixUpHorizontalEBO;
-		glGenBuffers(1, &ringFixUpHorizontalEBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ringFixUpHorizontalEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, ringFixUpHorizontalIndices.size() * sizeof(unsigned int), &ringFixUpHorizontalIndices[0], GL_STATIC_DRAW);
-
-		// Small Square
-		glGenVertexArrays(1, &smallSquareVAO);
-		glBindVertexArray(smallSquareVAO);
-
-		unsigned int smallSquareVBO;
-		glGenBuffers(1, &smallSquareVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, smallSquareVBO);
-		glBufferData(GL_ARRAY_BUFFER, smallSquareVerts.size() * sizeof(glm::vec2), &smallSquareVerts[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, 0, sizeof(glm::vec2), 0);
-
-		unsigned int smallSquareEBO;
-		glGenBuffers(1, &smallSquareEBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, smallSquareEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, smallSquareIndices.size() * sizeof(unsigned int), &smallSquareIndices[0], GL_STATIC_DRAW);
-
-		// Outer Degenerate
-		glGenVertexArrays(1, &outerDegenerateVAO);
-		glBindVertexArray(outerDegenerateVAO);
-
-		unsigned int outerDegenerateVBO;
-		glGenBuffers(1, &outerDegenerateVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, outerDegenerateVBO);
-		glBufferData(GL_ARRAY_BUFFER, outerDegenerateVerts.size() * sizeof(glm::vec2), &outerDegenerateVerts[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, 0, sizeof(glm::vec2), 0);
+		// All pieces are packed into one vertex and index buffer, a piece is addressed by its first index and base vertex
+		std::vector<glm::vec2>* pieceVerts[TERRAIN_PIECE_COUNT];
+		std::vector<unsigned int>* pieceIndices[TERRAIN_PIECE_COUNT];
+
+		pieceVerts[TERRAIN_PIECE_BLOCK] = &blockVerts;
+		pieceVerts[TERRAIN_PIECE_RING_FIXUP_VERTICAL] = &ringFixUpVerticalVerts;
+		pieceVerts[TERRAIN_PIECE_RING_FIXUP_HORIZONTAL] = &ringFixUpHorizontalVerts;
+		pieceVerts[TERRAIN_PIECE_INTERIOR_TRIM] = &interiorTrimVerts;
+		pieceVerts[TERRAIN_PIECE_OUTER_DEGENERATE] = &outerDegenerateVerts;
+		pieceVerts[TERRAIN_PIECE_SMALL_SQUARE] = &smallSquareVerts;
+
+		pieceIndices[TERRAIN_PIECE_BLOCK] = &blockIndices;
+		pieceIndices[TERRAIN_PIECE_RING_FIXUP_VERTICAL] = &ringFixUpVerticalIndices;
+		pieceIndices[TERRAIN_PIECE_RING_FIXUP_HORIZONTAL] = &ringFixUpHorizontalIndices;
+		pieceIndices[TERRAIN_PIECE_INTERIOR_TRIM] = &interiorTrimIndices;
+		pieceIndices[TERRAIN_PIECE_OUTER_DEGENERATE] = &outerDegenerateIndices;
+		pieceIndices[TERRAIN_PIECE_SMALL_SQUARE] = &smallSquareIndices;
+
+		std::vector<glm::vec2> verts;
+		std::vector<unsigned int> indices;
+
+		for (int i = 0; i < TERRAIN_PIECE_COUNT; i++) {
+
+			pieces[i].indexCount = pieceIndices[i]->size();
+			pieces[i].firstIndex = indices.size();
+			pieces[i].baseVertex = verts.size();
+			pieces[i].localMin = glm::vec2(FLT_MAX);
+			pieces[i].localMax = glm::vec2(-FLT_MAX);
+
+			for (glm::vec2& vert : *pieceVerts[i]) {
+				pieces[i].localMin = glm::min(pieces[i].localMin, vert);
+				pieces[i].localMax = glm::max(pieces[i].localMax, vert);
+			}
 
-		unsigned int outerDegenerateEBO;
-		glGenBuffers(1, &outerDegenerateEBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, outerDegenerateEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, outerDegenerateIndices.size() * sizeof(unsigned int), &outerDegenerateIndices[0], GL_STATIC_DRAW);
+			verts.insert(verts.end(), pieceVerts[i]->begin(), pieceVerts[i]->end());
+			indices.insert(indices.end(), pieceIndices[i]->begin(), pieceIndices[i]->end());
+		}
 
-		// Interior Trim
-		glGenVertexArrays(1, &interiorTrimVAO);
-		glBindVertexArray(interiorTrimVAO);
+		glGenVertexArrays(1, &clipmapVAO);
+		glBindVertexArray(clipmapVAO);
 
-		unsigned int interiorTrimVBO;
-		glGenBuffers(1, &interiorTrimVBO);
-		glBindBuffer(GL_ARRAY_BUFFER, interiorTrimVBO);
-		glBufferData(GL_ARRAY_BUFFER, interiorTrimVerts.size() * sizeof(glm::vec2), &interiorTrimVerts[0], GL_STATIC_DRAW);
+		glGenBuffers(1, &clipmapVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, clipmapVBO);
+		glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(glm::vec2), &verts[0], GL_STATIC_DRAW);
 		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, 0, sizeof(glm::vec2), 0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, 0, sizeof(glm::vec2), 0);
 
-		unsigned int interiorTrimEBO;
-		glGenBuffers(1, &interiorTrimEBO);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, interiorTrimEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, interiorTrimIndices.size() * sizeof(unsigned int), &interiorTrimIndices[0], GL_STATIC_DRAW);
+		glGenBuffers(1, &clipmapEBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, clipmapEBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		clipmapBufferBytes = verts.size() * sizeof(glm::vec2) + indices.size() * sizeof(unsigned int);
 
 		glBindVertexArray(0);
 	}
@@ -443,7 +631,7 @@ namespace Core {
 	* The first time data sent to the gpu when map is loaded this function is called.
 	* Or if you jump to far point of the map, all data is updated instead of toroidally.
 	*/
-	void Terrain::createElevationMapTextureArray(unsigned char** heightmapArray) {
+	void Terrain::createElevationMapTextureArray() {
 
 		int size = TILE_SIZE * MEM_TILE_ONE_SIDE;
 
@@ -455,9 +643,6 @@ namespace Core {
 
 		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RG8, size, size, CLIPMAP_LEVEL);
 
-		for (int i = 0; i < CLIPMAP_LEVEL; i++)
-			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, size, size, 1, GL_RG, GL_UNSIGNED_BYTE, &heightmapArray[i][0]);
-
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -465,218 +650,351 @@ namespace Core {
 	}
 
 	/*
-	* Terrain textures. We procedurally merge them in the fragment shader.
+	* Splat map has the size and the toroidal layout of the elevation map. Blend factors are filtered linearly.
 	*/
-	void Terrain::loadTextures() {
-
-		std::map<std::string, Texture*>& textures = CoreContext::instance->fileSystem->textures;
-
-		Texture* T0 = Texture::mergeTextures(textures.at("grasslawn_a"), textures.at("grasslawn_ao"), 3, 1);
-		Texture* T1 = Texture::mergeTextures(textures.at("grasswild_a"), textures.at("grasswild_ao"), 3, 1);
-		Texture* T2 = Texture::mergeTextures(textures.at("soilmulch_a"), textures.at("soilmulch_ao"), 3, 1);
-		Texture* T3 = Texture::mergeTextures(textures.at("groundforest_a"), textures.at("groundforest_ao"), 3, 1);
-		Texture* T4 = Texture::mergeTextures(textures.at("groundsandy_a"), textures.at("groundsandy_ao"), 3, 1);
-		Texture* T5 = Texture::mergeTextures(textures.at("cliffgranite_a"), textures.at("cliffgranite_ao"), 3, 1);
-		Texture* T6 = Texture::mergeTextures(textures.at("lichenedrock_a"), textures.at("lichenedrock_ao"), 3, 1);
-
-		albedo0 = T0->loadToGPU();
-		albedo1 = T1->loadToGPU();
-		albedo2 = T2->loadToGPU();
-		albedo3 = T3->loadToGPU();
-		albedo4 = T4->loadToGPU();
-		albedo5 = T5->loadToGPU();
-		albedo6 = T6->loadToGPU();
-
-		delete T0;
-		delete T1;
-		delete T2;
-		delete T3;
-		delete T4;
-		delete T5;
-		delete T6;
-
-		Texture* T0_n = textures.at("grasslawn_n");
-		Texture* T1_n = textures.at("grasswild_n");
-		Texture* T2_n = textures.at("soilmulch_n");
-		Texture* T3_n = textures.at("groundforest_n");
-		Texture* T4_n = textures.at("groundsandy_n");
-		Texture* T5_n = textures.at("cliffgranite_n");
-		Texture* T6_n = textures.at("lichenedrock_n");
-		Texture* T7_n = textures.at("snowpure_n");
-		Texture* T8_n = textures.at("snowfresh_n");
-
-		normal0 = T0_n->loadToGPU();
-		normal1 = T1_n->loadToGPU();
-		normal2 = T2_n->loadToGPU();
-		normal3 = T3_n->loadToGPU();
-		normal4 = T4_n->loadToGPU();
-		normal5 = T5_n->loadToGPU();
-		normal6 = T6_n->loadToGPU();
-		normal7 = T7_n->loadToGPU();
-		normal8 = T8_n->loadToGPU();
-
-		Texture* macro = textures.at("macro");
-		Texture* noise = textures.at("noiseTexture");
-
-		macroTexture = macro->loadToGPU();
-		noiseTexture = noise->loadToGPU();
+	void Terrain::createSplatMapTextureArray() {
+
+		int size = TILE_SIZE * MEM_TILE_ONE_SIDE;
+
+		if (splatMapTextureArray)
+			glDeleteTextures(1, &splatMapTextureArray);
+
+		glGenTextures(1, &splatMapTextureArray);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, splatMapTextureArray);
+
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, size, size, CLIPMAP_LEVEL);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+
+	SplatParameters Terrain::getSplatParameters() {
+
+		SplatParameters params;
+		params.slopeBias[0] = slopeBias0;
+		params.slopeBias[1] = slopeBias1;
+		params.slopeBias[2] = slopeBias2;
+		params.slopeSharpness[0] = slopeSharpness0;
+		params.slopeSharpness[1] = slopeSharpness1;
+		params.slopeSharpness[2] = slopeSharpness2;
+		params.heightBias = heightBias0;
+		params.heightSharpness = heightSharpness0;
+		return params;
 	}
 
 	/*
-	* Heightmap is resized according to the structure below in the function (in the comments).
-	* We have to do this in order to work with high level clipmaps.
+	* Bakes the splat map of every level around camPos on a thread pool with the current parameters and sends it to the gpu.
+	* Streaming thread bakes tiles too, so no stream job may be in flight.
 	*/
-	unsigned char* Terrain::resizeHeightmap(const unsigned char* heightmap, int size) {
+	void Terrain::bakeSplatMap(glm::vec3 camPos) {
 
-		// Resize Structure
-		// 0 0 0 0
-		// 0 0 1 0
-		// 0 0 0 0
-		// 0 0 0 0
-		const int totalSize = size * size * 4 * 4 * TERRAIN_STACK_NUM_CHANNELS;
-		unsigned char* const remappedHeightmap = new unsigned char[totalSize];
+		PROFILE_FUNCTION();
 
-		for (int i = 0; i < totalSize; i++)
-			remappedHeightmap[i] = 0;
+		auto begin = std::chrono::high_resolution_clock::now();
 
-		const int start = size * 2;
+		splatParameters = Terrain::getSplatParameters();
 
-		for (int i = 0; i < size; i++) {
-			for (int j = 0; j < size; j++) {
+		const int levelTiles = MEM_TILE_ONE_SIDE * MEM_TILE_ONE_SIDE;
+		std::vector<TerrainStreamTile> tiles[CLIPMAP_LEVEL];
+		std::vector<unsigned char> splat((size_t)CLIPMAP_LEVEL * levelTiles * TERRAIN_SPLAT_TILE_BYTES);
 
-				int indexInRemappedHeightmap = ((i + start) * (size * 4) + (j + start)) * TERRAIN_STACK_NUM_CHANNELS;
-				int indexInHeightmap = (i * size + j) * TERRAIN_STACK_NUM_CHANNELS;
-				remappedHeightmap[indexInRemappedHeightmap] = heightmap[indexInHeightmap];
-				remappedHeightmap[indexInRemappedHeightmap + 1] = heightmap[indexInHeightmap + 1];
+		ThreadPool pool;
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+			Terrain::collectLevelTiles(level, camPos, tiles[level]);
+
+			for (int i = 0; i < levelTiles; i++) {
+				glm::ivec2 tileStart = tiles[level][i].tileStart;
+				unsigned char* splatMap = &splat[(size_t)(level * levelTiles + i) * TERRAIN_SPLAT_TILE_BYTES];
+				pool.submit([this, tileStart, splatMap, level]() { Terrain::writeSplatDataToGPUBuffer(tileStart, splatMap, level); });
 			}
 		}
-		return remappedHeightmap;
+		pool.wait();
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++)
+			for (int i = 0; i < levelTiles; i++)
+				Terrain::updateSplatMapTextureArrayPartial(level, glm::ivec2(TILE_SIZE), tiles[level][i].index * TILE_SIZE, &splat[(size_t)(level * levelTiles + i) * TERRAIN_SPLAT_TILE_BYTES]);
+
+		auto end = std::chrono::high_resolution_clock::now();
+		splatBakeDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001f;
 	}
 
 	/*
-	* Creates mipmaps for each clipmap level. It is good to use with clipmaps since coarser level requires less data.
+	* Reads the layer list and packs the textures of the layers into three texture arrays: albedo with ambient occlusion
+	* in alpha, normal and utility. Layers are read from the cooked block compressed arrays if they are up to date,
+	* see TerrainTextureCooker. Otherwise they are built from the textures of the file system and uploaded uncompressed,
+	* mipmaps are generated by the driver. Missing or mismatching maps are replaced with neutral ones, so layer indices stay valid.
 	*/
-	unsigned char** Terrain::createMipmaps(const unsigned char* const heights, int size, int totalLevel) {
+	void Terrain::loadTextures(const std::string path) {
 
-		unsigned char** mipmaps = new unsigned char* [totalLevel];
-		mipmaps[0] = new unsigned char[size * size * TERRAIN_STACK_NUM_CHANNELS];
+		auto begin = std::chrono::high_resolution_clock::now();
 
-		for (int i = 0; i < size; i++) {
-			for (int j = 0; j < size; j++) {
+		if (!Terrain::readLayerFile(path, layers, utilityLayers)) {
+			std::cout << "Terrain layers could not be read from " << path << std::endl;
+			return;
+		}
 
-				int indexInImportedHeightmap = (i * size + j) * TERRAIN_STACK_NUM_CHANNELS;
-				int indexInTerrainMipmap = (i * size + j) * TERRAIN_STACK_NUM_CHANNELS;
-				mipmaps[0][indexInTerrainMipmap] = heights[indexInImportedHeightmap];
-				mipmaps[0][indexInTerrainMipmap + 1] = heights[indexInImportedHeightmap + 1];
-			}
+		if (!Terrain::loadCookedTextures(path)) {
+
+			std::vector<Texture*> albedoLayers;
+			std::vector<Texture*> normalLayers;
+			std::vector<Texture*> utilityTextures;
+			Terrain::createLayerTextures(layers, utilityLayers, CoreContext::instance->fileSystem->textures, albedoLayers, normalLayers, utilityTextures);
+
+			albedoArray = Texture::loadArrayToGPU(albedoLayers);
+			normalArray = Texture::loadArrayToGPU(normalLayers);
+			utilityArray = Texture::loadArrayToGPU(utilityTextures);
+			textureFormats = "uncompressed";
+
+			// a full mip chain adds a third
+			materialTextureBytes = 0;
+			for (std::vector<Texture*>* arrayLayers : { &albedoLayers, &normalLayers, &utilityTextures })
+				for (Texture* texture : *arrayLayers)
+					materialTextureBytes += (unsigned long long)texture->width * texture->height * texture->channels * 4 / 3;
+
+			for (Texture* texture : albedoLayers)
+				delete texture;
+			for (Texture* texture : normalLayers)
+				delete texture;
+			for (Texture* texture : utilityTextures)
+				delete texture;
 		}
 
-		for (int level = 1; level < totalLevel; level++) {
+		auto end = std::chrono::high_resolution_clock::now();
+		textureLoadDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001f;
+		std::cout << "Terrain textures (" << textureFormats << ") loaded in " << textureLoadDuration << " ms" << std::endl;
+	}
 
-			size /= 2;
-			mipmaps[level] = new unsigned char[size * size * 2];
+	/*
+	* Uploads the arrays cooked from the same layers and sources with their mip chains. False if any of them is missing,
+	* stale, or in a format the driver does not support, nothing is kept then.
+	*/
+	bool Terrain::loadCookedTextures(const std::string path) {
 
-			for (int i = 0; i < size; i++) {
-				for (int j = 0; j < size; j++) {
+		TextureContainer containers[TERRAIN_COOKED_ARRAY_COUNT];
+		if (!TerrainTextureCooker::load(path, layers, utilityLayers, containers)) {
+			std::cout << "Cooked terrain textures are missing or out of date, run with --cook-textures" << std::endl;
+			return false;
+		}
 
-					int indexInFinerLevel = (i * 2 * size * 2 + j * 2) * TERRAIN_STACK_NUM_CHANNELS;
-					int indexInCoarserLevel = (i * size + j) * TERRAIN_STACK_NUM_CHANNELS;
-					mipmaps[level][indexInCoarserLevel] = mipmaps[level - 1][indexInFinerLevel];
-					mipmaps[level][indexInCoarserLevel + 1] = mipmaps[level - 1][indexInFinerLevel + 1];
-				}
+		unsigned int arrays[TERRAIN_COOKED_ARRAY_COUNT];
+		for (int i = 0; i < TERRAIN_COOKED_ARRAY_COUNT; i++)
+			arrays[i] = Texture::loadCompressedArrayToGPU(containers[i]);
+
+		if (!arrays[TERRAIN_COOKED_ALBEDO] || !arrays[TERRAIN_COOKED_NORMAL] || !arrays[TERRAIN_COOKED_UTILITY]) {
+			glDeleteTextures(TERRAIN_COOKED_ARRAY_COUNT, arrays);
+			return false;
+		}
+
+		albedoArray = arrays[TERRAIN_COOKED_ALBEDO];
+		normalArray = arrays[TERRAIN_COOKED_NORMAL];
+		utilityArray = arrays[TERRAIN_COOKED_UTILITY];
+
+		materialTextureBytes = 0;
+		for (int i = 0; i < TERRAIN_COOKED_ARRAY_COUNT; i++)
+			for (std::vector<unsigned char>& level : containers[i].levels)
+				materialTextureBytes += level.size();
+		textureFormats = std::string(BlockEncoder::formatNames[containers[TERRAIN_COOKED_ALBEDO].format]) + ", " +
+			BlockEncoder::formatNames[containers[TERRAIN_COOKED_NORMAL].format] + ", " + BlockEncoder::formatNames[containers[TERRAIN_COOKED_UTILITY].format];
+		return true;
+	}
+
+	bool Terrain::readLayerFile(const std::string path, std::vector<TerrainLayer>& layers, std::vector<std::string>& utilityLayers) {
+
+		layers.clear();
+		utilityLayers.clear();
+
+		std::ifstream file(path);
+		if (file.fail())
+			return false;
+
+		std::vector<char> buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		buffer.push_back('\0');
+		rapidxml::xml_document<> doc;
+		doc.parse<0>(&buffer[0]);
+		rapidxml::xml_node<>* root = doc.first_node("TerrainLayers");
+
+		for (rapidxml::xml_node<>* node = root ? root->first_node("Layer") : NULL; node; node = node->next_sibling("Layer")) {
+
+			TerrainLayer layer;
+			layer.name = node->first_attribute("Name") ? node->first_attribute("Name")->value() : "";
+			layer.albedo = node->first_attribute("Albedo") ? node->first_attribute("Albedo")->value() : "";
+			layer.ao = node->first_attribute("AO") ? node->first_attribute("AO")->value() : "";
+			layer.normal = node->first_attribute("Normal") ? node->first_attribute("Normal")->value() : "";
+			layers.push_back(layer);
+		}
+
+		for (rapidxml::xml_node<>* node = root ? root->first_node("Utility") : NULL; node; node = node->next_sibling("Utility"))
+			utilityLayers.push_back(node->first_attribute("Texture") ? node->first_attribute("Texture")->value() : "");
+
+		return true;
+	}
+
+	/*
+	* Layers of the albedo, normal and utility arrays from the textures, by their names. Albedo keeps ambient occlusion in alpha,
+	* normals are RGB and utility maps are their red channel. Created textures belong to the caller.
+	*/
+	void Terrain::createLayerTextures(const std::vector<TerrainLayer>& layers, const std::vector<std::string>& utilityLayers, std::map<std::string, Texture*>& textures,
+		std::vector<Texture*>& albedoLayers, std::vector<Texture*>& normalLayers, std::vector<Texture*>& utilityTextures) {
+
+		auto findTexture = [&](const std::string& name) -> Texture* {
+			auto it = textures.find(name);
+			if (it == textures.end() || it->second->data == NULL || it->second->width != TERRAIN_TEXTURE_SIZE || it->second->height != TERRAIN_TEXTURE_SIZE) {
+				if (!name.empty())
+					std::cout << "Terrain texture " << name << " is missing or not " << TERRAIN_TEXTURE_SIZE << "x" << TERRAIN_TEXTURE_SIZE << std::endl;
+				return NULL;
 			}
+			return it->second;
+		};
+
+		const unsigned char white[4] = { 255, 255, 255, 255 };
+		const unsigned char flat[3] = { 128, 128, 255 };
+
+		for (const TerrainLayer& layer : layers) {
+
+			Texture* albedo = layer.albedo.empty() ? NULL : findTexture(layer.albedo);
+			Texture* ao = layer.ao.empty() ? NULL : findTexture(layer.ao);
+			Texture* normal = layer.normal.empty() ? NULL : findTexture(layer.normal);
+
+			Texture* whiteTexture = (albedo && ao) ? NULL : Texture::createUniformTexture(TERRAIN_TEXTURE_SIZE, TERRAIN_TEXTURE_SIZE, 4, white);
+			albedoLayers.push_back(Texture::mergeTextures(albedo ? albedo : whiteTexture, ao ? ao : whiteTexture, 3, 1));
+			delete whiteTexture;
+
+			normalLayers.push_back(normal ? Texture::loadTexturePartial(normal, 3) : Texture::createUniformTexture(TERRAIN_TEXTURE_SIZE, TERRAIN_TEXTURE_SIZE, 3, flat));
+		}
+
+		for (const std::string& name : utilityLayers) {
+
+			auto it = textures.find(name);
+			if (it == textures.end() || it->second->data == NULL) {
+				std::cout << "Terrain texture " << name << " is missing" << std::endl;
+				utilityTextures.push_back(Texture::createUniformTexture(TERRAIN_TEXTURE_SIZE, TERRAIN_TEXTURE_SIZE, 1, white));
+				continue;
+			}
+
+			// Smaller maps are magnified once here instead of by the sampler, so every utility map fits one array
+			Texture* red = Texture::loadTexturePartial(it->second, 1);
+			if (red->width != TERRAIN_TEXTURE_SIZE || red->height != TERRAIN_TEXTURE_SIZE) {
+				Texture* resized = Texture::resizeTexture(red, TERRAIN_TEXTURE_SIZE, TERRAIN_TEXTURE_SIZE);
+				delete red;
+				red = resized;
+			}
+			utilityTextures.push_back(red);
+		}
+	}
+
+	/*
+	* Creates mipmaps of the source heightmap for each clipmap level. It is good to use with clipmaps since coarser level requires less data.
+	* Level 0 is the source itself, it is not copied. Heights are filtered with mipFilter on all cores.
+	*/
+	unsigned char** Terrain::createMipmaps(const unsigned char* const heights, int size, int totalLevel) {
+
+		unsigned char** mipmaps = new unsigned char* [totalLevel];
+		mipmaps[0] = (unsigned char*)heights;
+
+		ThreadPool pool;
+
+		for (int level = 1; level < totalLevel; level++) {
+
+			mipmaps[level] = new unsigned char[(size_t)(size / 2) * (size / 2) * TERRAIN_STACK_NUM_CHANNELS];
+			MipGenerator::downsample(mipmaps[level - 1], size, mipmaps[level], mipFilter, &pool);
+			size /= 2;
 		}
 		return mipmaps;
 	}
 
 	/*
 	* Creates heightmap stack that is used by gpu. Rather than streaming from disk, we started to stream from memory.
-	* Takes input from resized image.
+	* 
+	* The map is placed in a virtual heightmap of MEM_TILE_ONE_SIDE x MEM_TILE_ONE_SIDE maps, so high level clipmaps
+	* have room around it. Everything outside the map is zero.
+	* 0 0 0 0
+	* 0 0 1 0
+	* 0 0 0 0
+	* 0 0 0 0
+	* The virtual heightmap is never allocated. Its texels are addressed with an offset into the mips of the source map.
+	* Stack is stored tile by tile and every tile is row major, so streaming a tile is a single copy.
 	*/
 	void Terrain::createHeightmapStack(unsigned char** heightMapList, int width) {
 
 		heightmapStack = new unsigned char* [CLIPMAP_LEVEL];
 
-		for (int i = 0; i < CLIPMAP_LEVEL; i++)
-			clipmapStartIndices[i] = glm::ivec2(0, 0);
+		mapSize = width;
+		Terrain::getClipmapStartIndices(width, clipmapStartIndices);
 
-		int res = width;
+		int levelMapSize = width;
+		int mapStart = width * 2;
 
 		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
 
-			int numTiles = res / TILE_SIZE;
-			int start = (numTiles >> 1) - 2;
-			int end = ((numTiles * 3) >> 2) + 1;
-
-			clipmapStartIndices[level] = glm::ivec2(start, end);
+			int start = clipmapStartIndices[level].x;
+			int end = clipmapStartIndices[level].y;
 			int size = (end - start) * TILE_SIZE;
-			heightmapStack[level] = new unsigned char[size * size * TERRAIN_STACK_NUM_CHANNELS];
+			heightmapStack[level] = new unsigned char[(size_t)size * size * TERRAIN_STACK_NUM_CHANNELS];
+
+			// Columns of the stack that the map covers, the rest of the row is border
+			int mapBegin = mapStart - start * TILE_SIZE;
+			int mapEnd = mapStart + levelMapSize - start * TILE_SIZE;
+			int tilesPerSide = end - start;
 
-			for (int i = start * TILE_SIZE; i < end * TILE_SIZE; i++) {
-				for (int j = start * TILE_SIZE; j < end * TILE_SIZE; j++) {
+			for (int i = 0; i < size; i++) {
+
+				int z = start * TILE_SIZE + i - mapStart;
+				bool rowInMap = z >= 0 && z < levelMapSize;
 
-					int coord_x = j - start * TILE_SIZE;
-					int coord_z = i - start * TILE_SIZE;
+				for (int tileX = 0; tileX < tilesPerSide; tileX++) {
 
-					int baseCoord = (i * res + j) * TERRAIN_STACK_NUM_CHANNELS;
-					int newCoord = (coord_z * size + coord_x) * TERRAIN_STACK_NUM_CHANNELS;
+					unsigned char* row = &heightmapStack[level][(size_t)((i / TILE_SIZE) * tilesPerSide + tileX) * TERRAIN_TILE_BYTES + (i % TILE_SIZE) * TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS];
+					int begin = glm::clamp(mapBegin - tileX * TILE_SIZE, 0, TILE_SIZE);
+					int end = glm::clamp(mapEnd - tileX * TILE_SIZE, 0, TILE_SIZE);
+
+					if (!rowInMap || begin >= end) {
+						memset(row, 0, TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS);
+						continue;
+					}
 
-					heightmapStack[level][newCoord] = heightMapList[level][baseCoord];
-					heightmapStack[level][newCoord + 1] = heightMapList[level][baseCoord + 1];
+					const unsigned char* mapRow = &heightMapList[level][((size_t)z * levelMapSize + tileX * TILE_SIZE + begin - mapBegin) * TERRAIN_STACK_NUM_CHANNELS];
+					memset(row, 0, begin * TERRAIN_STACK_NUM_CHANNELS);
+					memcpy(row + begin * TERRAIN_STACK_NUM_CHANNELS, mapRow, (end - begin) * TERRAIN_STACK_NUM_CHANNELS);
+					memset(row + end * TERRAIN_STACK_NUM_CHANNELS, 0, (TILE_SIZE - end) * TERRAIN_STACK_NUM_CHANNELS);
 				}
 			}
-			res /= 2;
+
+			levelMapSize /= 2;
+			mapStart /= 2;
 		}
 	}
 
 	/*
-	* Creates low resolution heightmap stack that will be used for frustum culling.
-	* We do not need to know precise volume of terrain blocks for that purpose so that heightmap stack can be in low resolution.
-	* In this case memory read will be lesser which will be good for runtime performance.
+	* Tiles of each level that the heightmap stack keeps. They cover the map and the border that clipmaps reach around it.
 	*/
-	void Terrain::createLowResolutionHeightmapStack() {
+	void Terrain::getClipmapStartIndices(int mapSize, glm::ivec2* startIndices) {
 
-		lowResolustionHeightmapStack = new unsigned char* [CLIPMAP_LEVEL];
+		int res = mapSize * MEM_TILE_ONE_SIDE;
 
 		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
 
-			int sizeInHeightmap = ((clipmapStartIndices[level].y - clipmapStartIndices[level].x) * TILE_SIZE);
-			int sizeInLowResolutionHeightmap = sizeInHeightmap >> MIP_STACK_DIVISOR_POWER;
-			lowResolustionHeightmapStack[level] = new unsigned char[sizeInLowResolutionHeightmap * sizeInLowResolutionHeightmap];
-
-			unsigned char* first = new unsigned char[sizeInHeightmap * sizeInHeightmap];
-
-			for (int i = 0; i < sizeInHeightmap; i++)
-				for (int j = 0; j < sizeInHeightmap; j++)
-					first[i * sizeInHeightmap + j] = heightmapStack[level][(i * sizeInHeightmap + j) * 2];
-
-			int sizeIterator = sizeInHeightmap;
-			for (int iter = 0; iter < MIP_STACK_DIVISOR_POWER; iter++) {
-
-				sizeIterator >>= 1;
-				unsigned char* second = new unsigned char[sizeIterator * sizeIterator];
+			int numTiles = res / TILE_SIZE;
+			int start = (numTiles >> 1) - 2;
+			int end = ((numTiles * 3) >> 2) + 1;
 
-				for (int i = 0; i < sizeIterator; i++) {
-					for (int j = 0; j < sizeIterator; j++) {
-						// c0 c1
-						// c2 c3
-						int c0 = first[(i * 2 * sizeIterator * 2 + j * 2)];
-						int c1 = first[(i * 2 * sizeIterator * 2 + j * 2 + 1)];
-						int c2 = first[((i * 2 + 1) * sizeIterator * 2 + j * 2)];
-						int c3 = first[((i * 2 + 1) * sizeIterator * 2 + j * 2 + 1)];
+			startIndices[level] = glm::ivec2(start, end);
+			res /= 2;
+		}
+	}
 
-						second[i * sizeIterator + j] = (c0 + c1 + c2 + c3) * 0.25f;
-					}
-				}
-				delete[] first;
-				first = second;
-			}
+	/*
+	* Creates min/max height pyramid of each level of the heightmap stack. It is used for bounding boxes
+	* of the pieces that frustum culling algorithm tests.
+	*/
+	void Terrain::createHeightPyramids() {
 
-			for (int i = 0; i < sizeIterator; i++)
-				for (int j = 0; j < sizeIterator; j++)
-					lowResolustionHeightmapStack[level][i * sizeIterator + j] = first[i * sizeIterator + j];
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
 
-			delete[] first;
+			int sizeInHeightmap = (clipmapStartIndices[level].y - clipmapStartIndices[level].x) * TILE_SIZE;
+			heightPyramids[level] = new HeightPyramid(heightmapStack[level], sizeInHeightmap, HEIGHT_PYRAMID_CELL_POWER);
 		}
 	}
 
@@ -685,11 +1003,21 @@ namespace Core {
 	*/
 	void Terrain::update(float dt) {
 
-		glm::vec3 camPosition = glm::clamp(CoreContext::instance->scene->cameraInfo.camPos, glm::vec3(MAP_SIZE * 2 + 1, 0, MAP_SIZE * 2 + 1), glm::vec3(MAP_SIZE * 3 - 1, 0, MAP_SIZE * 3 - 1));
+		PROFILE_FUNCTION();
+
+		// Splat map matches cameraPosition when no update is in flight, so edited parameters are baked then
+		SplatParameters params = Terrain::getSplatParameters();
+		if (streamer->jobsInFlight == 0 && memcmp(&params, &splatParameters, sizeof(SplatParameters)) != 0)
+			Terrain::bakeSplatMap(cameraPosition);
+
+		glm::vec3 camPosition = glm::clamp(CoreContext::instance->scene->cameraInfo.camPos, glm::vec3(mapSize * 2 + 1, 0, mapSize * 2 + 1), glm::vec3(mapSize * 3 - 1, 0, mapSize * 3 - 1));
+		prefetcher->update(camPosition, dt);
 		Terrain::calculateBlockPositions(camPosition);
 		Terrain::calculateBoundingBoxes(camPosition);
 		Terrain::streamTerrain(camPosition);
+		streamer->upload();
 		cameraPosition = camPosition;
+		Terrain::updateMemoryCounters();
 	}
 
 	/*
@@ -697,355 +1025,583 @@ namespace Core {
 	*/
 	void Terrain::onDraw() {
 
-		glm::vec3 camPos = CoreContext::instance->scene->cameraInfo.camPos;
+		PROFILE_FUNCTION();
+
 		glm::mat4& PV = CoreContext::instance->scene->cameraInfo.VP;
-		Cubemap* cubemap = CoreContext::instance->scene->cubemap;
+
+		Terrain::updateProgram();
+		Terrain::drawClipmap(CoreContext::instance->scene->cameraInfo);
+
+		// Draw bounding boxes
+		if (showBounds) {
+			for (int i = 0; i < CLIPMAP_LEVEL; i++) {
+
+				for (int j = 0; j < 12; j++) {
+
+					AABB_Box aabb = blockAABBs[i * 12 + j];
+					glm::vec3 pos = (aabb.start + aabb.end) * 0.5f;
+					glm::vec3 scale = aabb.end - aabb.start;
+					glm::mat4 model = glm::translate(glm::mat4(1), pos) * glm::scale(glm::mat4(1), scale);
+					glm::mat4 PVM = PV * model;
+					glm::vec3 color = glm::vec3(1, 1, 1);
+					CoreContext::instance->renderer->drawBoundingBoxVAO(PVM, color);
+				}
+			}
+
+			for (int i = 0; i < 4; i++) {
+
+				AABB_Box aabb = blockAABBs[CLIPMAP_LEVEL * 12 + i];
+				glm::vec3 pos = (aabb.start + aabb.end) * 0.5f;
+				glm::vec3 scale = aabb.end - aabb.start;
+				glm::mat4 model = glm::translate(glm::mat4(1), pos) * glm::scale(glm::mat4(1), scale);
+				glm::mat4 PVM = PV * model;
+				glm::vec3 color = glm::vec3(1, 1, 1);
+				CoreContext::instance->renderer->drawBoundingBoxVAO(PVM, color);
+			}
+		}
+	}
+
+	/*
+	* Culls the pieces of the clipmap for the camera and draws them with the current program. Only GL objects of the
+	* terrain are used, so the terrain benchmark draws its frames with it on the null backend.
+	*/
+	void Terrain::drawClipmap(const CameraInfo& camera) {
 
 		glUseProgram(terrainProgramID);
-		glUniformMatrix4fv(glGetUniformLocation(terrainProgramID, "PV"), 1, 0, &PV[0][0]);
-		glUniform3fv(glGetUniformLocation(terrainProgramID, "camPos"), 1, &camPos[0]);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "texSize"), (float)TILE_SIZE * MEM_TILE_ONE_SIDE);
-
-		// Terrain Material Parameters
-		glUniform3f(glGetUniformLocation(terrainProgramID, "lightDirection"), lightDir.x, lightDir.y, lightDir.z);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "lightPow"), lightPow);
-
-		glUniform1f(glGetUniformLocation(terrainProgramID, "ambientAmount"), ambientAmount);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "specularPower"), specularPower);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "specularAmount"), specularAmount);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "blendDistance"), blendDistance);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "blendAmount"), blendAmount);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color0_dist0"), scale_color0_dist0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color0_dist1"), scale_color0_dist1);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color1_dist0"), scale_color1_dist0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color1_dist1"), scale_color1_dist1);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color2_dist0"), scale_color2_dist0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color2_dist1"), scale_color2_dist1);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color3_dist0"), scale_color3_dist0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color3_dist1"), scale_color3_dist1);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color4_dist0"), scale_color4_dist0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color4_dist1"), scale_color4_dist1);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color5_dist0"), scale_color5_dist0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color5_dist1"), scale_color5_dist1);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color6_dist0"), scale_color6_dist0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color6_dist1"), scale_color6_dist1);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color7_dist0"), scale_color7_dist0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color7_dist1"), scale_color7_dist1);
-
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color8_dist0"), scale_color8_dist0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color8_dist1"), scale_color8_dist1);
-
-		//glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color9_dist0"), scale_color9_dist0);
-		//glUniform1f(glGetUniformLocation(terrainProgramID, "scale_color9_dist1"), scale_color9_dist1);
-
-		glUniform1f(glGetUniformLocation(terrainProgramID, "macroScale_0"), macroScale_0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "macroScale_1"), macroScale_1);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "macroScale_2"), macroScale_2);
-		//glUniform1f(glGetUniformLocation(terrainProgramID, "macroAmount"), macroAmount);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "macroPower"), macroPower);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "macroOpacity"), macroOpacity);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "macroAmountLayer0"), macroAmountLayer0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "macroAmountLayer1"), macroAmountLayer1);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "macroAmountLayer2"), macroAmountLayer2);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "macroAmountLayer3"), macroAmountLayer3);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "macroAmountLayer4"), macroAmountLayer4);
-
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendScale0"), overlayBlendScale0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendAmount0"), overlayBlendAmount0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendPower0"), overlayBlendPower0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendOpacity0"), overlayBlendOpacity0);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendScale1"), overlayBlendScale1);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendAmount1"), overlayBlendAmount1);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendPower1"), overlayBlendPower1);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendOpacity1"), overlayBlendOpacity1);
-
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendScale2"), overlayBlendScale2);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendAmount2"), overlayBlendAmount2);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendPower2"), overlayBlendPower2);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendOpacity2"), overlayBlendOpacity2);
-
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendScale3"), overlayBlendScale3);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendAmount3"), overlayBlendAmount3);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendPower3"), overlayBlendPower3);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "overlayBlendOpacity3"), overlayBlendOpacity3);
-
-		glUniform3fv(glGetUniformLocation(terrainProgramID, "color0"), 1, &color0[0]);
-		glUniform3fv(glGetUniformLocation(terrainProgramID, "color1"), 1, &color1[0]);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "slopeSharpness0"), slopeSharpness0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "slopeSharpness1"), slopeSharpness1);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "slopeSharpness2"), slopeSharpness2);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "slopeBias0"), slopeBias0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "slopeBias1"), slopeBias1);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "slopeBias2"), slopeBias2);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "heightBias0"), heightBias0);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "heightSharpness0"), heightSharpness0);
-		//glUniform1f(glGetUniformLocation(terrainProgramID, "heightBias1"), heightBias1);
-		//glUniform1f(glGetUniformLocation(terrainProgramID, "heightSharpness1"), heightSharpness1);
-					
-		glUniform1f(glGetUniformLocation(terrainProgramID, "distanceNear"), distanceNear);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "fogBlendDistance"), fogBlendDistance);
-		glUniform1f(glGetUniformLocation(terrainProgramID, "maxFog"), maxFog);
-		glUniform3fv(glGetUniformLocation(terrainProgramID, "fogColor"), 1, &fogColor[0]);
+		Terrain::updateUniformBuffers(camera);
 
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D_ARRAY, elevationMapTextureArray);
 		//glActiveTexture(GL_TEXTURE1);
 		//glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap->irradianceMap);
 		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, macroTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, albedoArray);
 		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, noiseTexture);
-		
+		glBindTexture(GL_TEXTURE_2D_ARRAY, normalArray);
 		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, albedo0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, utilityArray);
 		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, albedo1);
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_2D, albedo2);
-		glActiveTexture(GL_TEXTURE6);
-		glBindTexture(GL_TEXTURE_2D, albedo3);
-		glActiveTexture(GL_TEXTURE7);
-		glBindTexture(GL_TEXTURE_2D, albedo4);
-		glActiveTexture(GL_TEXTURE8);
-		glBindTexture(GL_TEXTURE_2D, albedo5);
-		glActiveTexture(GL_TEXTURE9);
-		glBindTexture(GL_TEXTURE_2D, albedo6);
-
-		glActiveTexture(GL_TEXTURE10);
-		glBindTexture(GL_TEXTURE_2D, normal0);
-		glActiveTexture(GL_TEXTURE11);
-		glBindTexture(GL_TEXTURE_2D, normal1);
-		glActiveTexture(GL_TEXTURE12);
-		glBindTexture(GL_TEXTURE_2D, normal2);
-		glActiveTexture(GL_TEXTURE13);
-		glBindTexture(GL_TEXTURE_2D, normal3);
-		glActiveTexture(GL_TEXTURE14);
-		glBindTexture(GL_TEXTURE_2D, normal4);
-		glActiveTexture(GL_TEXTURE15);
-		glBindTexture(GL_TEXTURE_2D, normal5);
-		glActiveTexture(GL_TEXTURE16);
-		glBindTexture(GL_TEXTURE_2D, normal6);
-		glActiveTexture(GL_TEXTURE17);
-		glBindTexture(GL_TEXTURE_2D, normal7);
-		glActiveTexture(GL_TEXTURE18);
-		glBindTexture(GL_TEXTURE_2D, normal8);
-
-		std::vector<TerrainVertexAttribs> instanceArray;
+		glBindTexture(GL_TEXTURE_2D_ARRAY, splatMapTextureArray);
+
+		const glm::vec4* planes = camera.planes;
+		bool cullOnGPU = gpuCulling && cullProgramID;
+
+		// The cull program makes the candidates from the clipmap origins and the pyramid buffer, only their ranges are needed here
+		std::vector<TerrainCullCandidate> candidates;
+		unsigned int instanceFirst[TERRAIN_PIECE_COUNT];
+		unsigned int instanceCount[TERRAIN_PIECE_COUNT];
+		if (cullOnGPU)
+			Terrain::getCandidateRanges(instanceFirst, instanceCount);
+		else
+			Terrain::collectCandidates(candidates, instanceFirst, instanceCount);
+
+		// Layout of the frame in the instance buffer: commands, then instances.
+		// Every piece owns a fixed instance range as big as its candidate count.
+		unsigned int commandBytes = TERRAIN_COMMAND_BYTES;
+		unsigned int instanceBytes = TERRAIN_CANDIDATE_COUNT * sizeof(TerrainInstance);
+		unsigned int frameBytes = commandBytes + instanceBytes;
+
+		unsigned char* data;
+		unsigned int offset = 0;
+		std::vector<unsigned char> clientData;
+
+		if (instanceRing) {
+			data = instanceRing->allocate(frameBytes, offset);
+			if (data == NULL)
+				return;
+		}
+		else {
+			clientData.resize(frameBytes);
+			data = &clientData[0];
+		}
 
-		// BLOCKS
-		for (int i = 0; i < CLIPMAP_LEVEL; i++) {
+		unsigned int baseInstance = (offset + commandBytes) / sizeof(TerrainInstance);
+		unsigned int visibleBlocks[CLIPMAP_LEVEL] = {};
 
-			for (int j = 0; j < 12; j++) {
-
-				glm::vec4 startInWorldSpace;
-				glm::vec4 endInWorldSpace;
-				AABB_Box aabb = blockAABBs[i * 12 + j];
-				startInWorldSpace = aabb.start;
-				endInWorldSpace = aabb.end;
-
-				if (Terrain::intersectsAABB(startInWorldSpace, endInWorldSpace)) {
-					TerrainVertexAttribs attribs;
-					attribs.level = i;
-					attribs.model = glm::mat4(1);
-					attribs.position = blockPositions[i * 12 + j];
-					attribs.color = BLOCK_COLOR;
-					instanceArray.push_back(attribs);
-				}
-			}
+		if (cullOnGPU) {
+			// Counts are filled by the compute pass
+			for (int i = 0; i < TERRAIN_PIECE_COUNT; i++)
+				instanceCount[i] = 0;
 		}
+		else
+			Terrain::cullCandidates(&candidates[0], candidates.size(), planes, instanceFirst, (TerrainInstance*)(data + commandBytes), instanceCount, visibleBlocks);
 
-		for (int i = 0; i < 4; i++) {
+		Terrain::buildDrawCommands(pieces, instanceFirst, instanceCount, baseInstance, (DrawElementsIndirectCommand*)data);
+		Terrain::countDrawnInstances(instanceFirst, instanceCount, visibleBlocks, cullOnGPU);
 
-			glm::vec4 startInWorldSpace;
-			glm::vec4 endInWorldSpace;
-			AABB_Box aabb = blockAABBs[CLIPMAP_LEVEL * 12 + i];
-			startInWorldSpace = aabb.start;
-			endInWorldSpace = aabb.end;
+		if (!instanceRing) {
+			glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, frameBytes, data);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
 
-			//if (Terrain::intersectsAABB(startInWorldSpace, endInWorldSpace)) {
-			TerrainVertexAttribs attribs;
-			attribs.level = 0;
-			attribs.model = glm::mat4(1);
-			attribs.position = blockPositions[CLIPMAP_LEVEL * 12 + i];
-			attribs.color = BLOCK_COLOR;
-			instanceArray.push_back(attribs);
-			//}
+		if (cullOnGPU) {
+			GPUTimer::begin(GPU_PASS_TERRAIN_CULLING);
+			glUseProgram(cullProgramID);
+			glUniform4fv(cullPlanesLocation, 6, &planes[0][0]);
+			glUniform2iv(cullOriginsLocation, CLIPMAP_LEVEL, &clipmapOrigins[0][0]);
+			glUniform1ui(cullCommandWordLocation, offset / sizeof(unsigned int));
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, pyramidBuffer);
+			glDispatchCompute((TERRAIN_CANDIDATE_COUNT + 63) / 64, 1, 1);
+			glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+			glUseProgram(terrainProgramID);
+			GPUTimer::end(GPU_PASS_TERRAIN_CULLING);
 		}
 
-		if (instanceArray.size()) {
-			Terrain::drawElementsInstanced(blockVAO, instanceArray, blockIndiceCount);
-			instanceArray.clear();
+		glBindVertexArray(clipmapVAO);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, instanceBuffer);
+
+		if (GPUTimer::isActive() && GPUTimer::splitTerrain) {
+			// A draw per piece, so each of them is timed on its own
+			const int piecePasses[TERRAIN_PIECE_COUNT] = { GPU_PASS_TERRAIN_BLOCKS, GPU_PASS_TERRAIN_FIXUPS, GPU_PASS_TERRAIN_FIXUPS,
+				GPU_PASS_TERRAIN_TRIMS, GPU_PASS_TERRAIN_DEGENERATES, GPU_PASS_TERRAIN_SMALL_SQUARE };
+
+			for (int i = 0; i < TERRAIN_PIECE_COUNT; i++) {
+				GPUTimer::begin(piecePasses[i]);
+				glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(size_t)(offset + i * sizeof(DrawElementsIndirectCommand)), 1, 0);
+				GPUTimer::end(piecePasses[i]);
+			}
+		}
+		else
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(size_t)offset, TERRAIN_PIECE_COUNT, 0);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		glBindVertexArray(0);
+
+		if (instanceRing)
+			instanceRing->fence(offset);
+	}
+
+	/*
+	* Gathers every instance of every piece with its bounds before culling. Candidates of a piece are contiguous,
+	* first and capacity arrays are indexed by TERRAIN_PIECE_*.
+	*/
+	void Terrain::collectCandidates(std::vector<TerrainCullCandidate>& candidates, unsigned int* first, unsigned int* capacity) {
+
+		candidates.reserve(TERRAIN_CANDIDATE_COUNT);
+		TerrainCullCandidate candidate;
+		candidate.padding = 0;
+
+		// BLOCKS
+		candidate.piece = TERRAIN_PIECE_BLOCK;
+		first[TERRAIN_PIECE_BLOCK] = candidates.size();
+		for (int i = 0; i < BLOCK_COUNT; i++) {
+
+			// last 4 blocks are in the center of level 0
+			unsigned int level = i < CLIPMAP_LEVEL * 12 ? i / 12 : 0;
+			candidate.instance = { blockPositions[i], level, TERRAIN_PIECE_BLOCK << 8 };
+			candidate.boundsMin = glm::vec3(blockAABBs[i].start);
+			candidate.boundsMax = glm::vec3(blockAABBs[i].end);
+			candidates.push_back(candidate);
 		}
+		capacity[TERRAIN_PIECE_BLOCK] = candidates.size() - first[TERRAIN_PIECE_BLOCK];
+
+		std::vector<TerrainInstance> instances[TERRAIN_PIECE_COUNT];
 
 		// RING FIXUP VERTICAL
 		for (int i = 0; i < CLIPMAP_LEVEL; i++) {
 
-			TerrainVertexAttribs attribs;
-			attribs.level = i;
-			attribs.model = glm::mat4(1);
-			attribs.color = FIXUP_VERTICAL_COLOR;
-			attribs.position = ringFixUpVerticalPositions[i * 2 + 0];
-			instanceArray.push_back(attribs);
-			attribs.position = ringFixUpVerticalPositions[i * 2 + 1];
-			instanceArray.push_back(attribs);
+			instances[TERRAIN_PIECE_RING_FIXUP_VERTICAL].push_back({ ringFixUpVerticalPositions[i * 2 + 0], (unsigned int)i, TERRAIN_PIECE_RING_FIXUP_VERTICAL << 8 });
+			instances[TERRAIN_PIECE_RING_FIXUP_VERTICAL].push_back({ ringFixUpVerticalPositions[i * 2 + 1], (unsigned int)i, TERRAIN_PIECE_RING_FIXUP_VERTICAL << 8 });
 		}
+		instances[TERRAIN_PIECE_RING_FIXUP_VERTICAL].push_back({ ringFixUpVerticalPositions[CLIPMAP_LEVEL * 2 + 0], 0, TERRAIN_PIECE_RING_FIXUP_VERTICAL << 8 });
+		instances[TERRAIN_PIECE_RING_FIXUP_VERTICAL].push_back({ ringFixUpVerticalPositions[CLIPMAP_LEVEL * 2 + 1], 0, TERRAIN_PIECE_RING_FIXUP_VERTICAL << 8 });
 
-		{
-			TerrainVertexAttribs attribs;
-			attribs.level = 0;
-			attribs.model = glm::mat4(1);
-			attribs.color = FIXUP_VERTICAL_COLOR;
-			attribs.position = ringFixUpVerticalPositions[CLIPMAP_LEVEL * 2 + 0];
-			instanceArray.push_back(attribs);
-			attribs.position = ringFixUpVerticalPositions[CLIPMAP_LEVEL * 2 + 1];
-			instanceArray.push_back(attribs);
+		// RING FIXUP HORIZONTAL
+		for (int i = 0; i < CLIPMAP_LEVEL; i++) {
+
+			instances[TERRAIN_PIECE_RING_FIXUP_HORIZONTAL].push_back({ ringFixUpHorizontalPositions[i * 2 + 0], (unsigned int)i, TERRAIN_PIECE_RING_FIXUP_HORIZONTAL << 8 });
+			instances[TERRAIN_PIECE_RING_FIXUP_HORIZONTAL].push_back({ ringFixUpHorizontalPositions[i * 2 + 1], (unsigned int)i, TERRAIN_PIECE_RING_FIXUP_HORIZONTAL << 8 });
 		}
+		instances[TERRAIN_PIECE_RING_FIXUP_HORIZONTAL].push_back({ ringFixUpHorizontalPositions[CLIPMAP_LEVEL * 2 + 0], 0, TERRAIN_PIECE_RING_FIXUP_HORIZONTAL << 8 });
+		instances[TERRAIN_PIECE_RING_FIXUP_HORIZONTAL].push_back({ ringFixUpHorizontalPositions[CLIPMAP_LEVEL * 2 + 1], 0, TERRAIN_PIECE_RING_FIXUP_HORIZONTAL << 8 });
 
-		Terrain::drawElementsInstanced(ringFixUpVerticalVAO, instanceArray, ringFixUpVerticalIndiceCount);
-		instanceArray.clear();
+		// INTERIOR TRIM
+		for (int i = 0; i < CLIPMAP_LEVEL - 1; i++)
+			instances[TERRAIN_PIECE_INTERIOR_TRIM].push_back({ interiorTrimPositions[i], (unsigned int)(i + 1), rotationCodes[i] | TERRAIN_PIECE_INTERIOR_TRIM << 8 });
 
-		// RING FIXUP HORIZONTAL
-		for (int i = 0; i < CLIPMAP_LEVEL; i++) {
+		// OUTER DEGENERATE
+		for (int i = 0; i < CLIPMAP_LEVEL - 1; i++)
+			instances[TERRAIN_PIECE_OUTER_DEGENERATE].push_back({ outerDegeneratePositions[i], (unsigned int)i, TERRAIN_PIECE_OUTER_DEGENERATE << 8 });
 
-			TerrainVertexAttribs attribs;
-			attribs.level = i;
-			attribs.model = glm::mat4(1);
-			attribs.color = FIXUP_HORIZONTAL_COLOR;
-			attribs.position = ringFixUpHorizontalPositions[i * 2 + 0];
-			instanceArray.push_back(attribs);
-			attribs.position = ringFixUpHorizontalPositions[i * 2 + 1];
-			instanceArray.push_back(attribs);
+		// SMALL SQUARE
+		instances[TERRAIN_PIECE_SMALL_SQUARE].push_back({ smallSquarePosition, 0, TERRAIN_PIECE_SMALL_SQUARE << 8 });
+
+		for (int piece = TERRAIN_PIECE_BLOCK + 1; piece < TERRAIN_PIECE_COUNT; piece++) {
+
+			candidate.piece = piece;
+			first[piece] = candidates.size();
+
+			for (TerrainInstance& instance : instances[piece]) {
+
+				AABB_Box aabb = Terrain::getPieceBoundingBox(piece, instance);
+				candidate.instance = instance;
+				candidate.boundsMin = glm::vec3(aabb.start);
+				candidate.boundsMax = glm::vec3(aabb.end);
+				candidates.push_back(candidate);
+			}
+
+			capacity[piece] = candidates.size() - first[piece];
 		}
+	}
 
-		{
-			TerrainVertexAttribs attribs;
-			attribs.level = 0;
-			attribs.model = glm::mat4(1);
-			attribs.color = FIXUP_HORIZONTAL_COLOR;
-			attribs.position = ringFixUpHorizontalPositions[CLIPMAP_LEVEL * 2 + 0];
-			instanceArray.push_back(attribs);
-			attribs.position = ringFixUpHorizontalPositions[CLIPMAP_LEVEL * 2 + 1];
-			instanceArray.push_back(attribs);
+	/*
+	* Ranges of the pieces in the candidates of collectCandidates. They do not change with the camera,
+	* so the GPU path knows them without making the candidates.
+	*/
+	void Terrain::getCandidateRanges(unsigned int* first, unsigned int* capacity) {
+
+		capacity[TERRAIN_PIECE_BLOCK] = BLOCK_COUNT;
+		capacity[TERRAIN_PIECE_RING_FIXUP_VERTICAL] = RINGFIXUP_COUNT;
+		capacity[TERRAIN_PIECE_RING_FIXUP_HORIZONTAL] = RINGFIXUP_COUNT;
+		capacity[TERRAIN_PIECE_INTERIOR_TRIM] = CLIPMAP_LEVEL - 1;
+		capacity[TERRAIN_PIECE_OUTER_DEGENERATE] = CLIPMAP_LEVEL - 1;
+		capacity[TERRAIN_PIECE_SMALL_SQUARE] = 1;
+
+		first[0] = 0;
+		for (int i = 1; i < TERRAIN_PIECE_COUNT; i++)
+			first[i] = first[i - 1] + capacity[i - 1];
+	}
+
+	/*
+	* Instance of a candidate, placed from the clipmap origins the way calculateBlockPositions places it.
+	* terrain_cull.comp does the same for its invocation.
+	*/
+	void Terrain::getCandidateInstance(unsigned int index, TerrainInstance& instance, unsigned int& piece) {
+
+		// pI0 to pI3 of calculateBlockPositions, and the columns of each block of a ring and of the center
+		const int offsets[4] = { PATCH_WIDTH - 2 * CLIPMAP_RESOLUTION, PATCH_WIDTH - (CLIPMAP_RESOLUTION + 1), PATCH_WIDTH, PATCH_WIDTH + CLIPMAP_RESOLUTION - 1 };
+		const glm::ivec2 ringBlocks[12] = { { 3, 3 }, { 3, 2 }, { 3, 1 }, { 3, 0 }, { 2, 0 }, { 1, 0 }, { 0, 0 }, { 0, 1 }, { 0, 2 }, { 0, 3 }, { 1, 3 }, { 2, 3 } };
+		const glm::ivec2 centerBlocks[4] = { { 2, 2 }, { 2, 1 }, { 1, 1 }, { 1, 2 } };
+		// rotation code of the interior trim by rotX * 2 + rotZ
+		const unsigned int trimRotations[4] = { 0, 1, 3, 2 };
+
+		unsigned int first[TERRAIN_PIECE_COUNT];
+		unsigned int capacity[TERRAIN_PIECE_COUNT];
+		Terrain::getCandidateRanges(first, capacity);
+
+		piece = TERRAIN_PIECE_BLOCK;
+		while (piece + 1 < TERRAIN_PIECE_COUNT && index >= first[piece + 1])
+			piece++;
+		int i = index - first[piece];
+
+		// position in texels of positionLevel, trims are placed in the texels of the level inside them
+		int level = 0;
+		int positionLevel = 0;
+		glm::ivec2 position = clipmapOrigins[0];
+		unsigned int rotation = 0;
+
+		switch (piece) {
+
+		case TERRAIN_PIECE_BLOCK:
+			if (i < CLIPMAP_LEVEL * 12) {
+				level = positionLevel = i / 12;
+				position = clipmapOrigins[level] + glm::ivec2(offsets[ringBlocks[i % 12].x], offsets[ringBlocks[i % 12].y]);
+			}
+			else
+				position += glm::ivec2(offsets[centerBlocks[i - CLIPMAP_LEVEL * 12].x], offsets[centerBlocks[i - CLIPMAP_LEVEL * 12].y]);
+			break;
+
+		case TERRAIN_PIECE_RING_FIXUP_VERTICAL:
+			if (i < CLIPMAP_LEVEL * 2) {
+				level = positionLevel = i / 2;
+				position = clipmapOrigins[level] + glm::ivec2(0, offsets[i % 2 ? 0 : 3]);
+			}
+			else
+				position += glm::ivec2(0, i % 2 ? 1 - CLIPMAP_RESOLUTION : PATCH_WIDTH);
+			break;
+
+		case TERRAIN_PIECE_RING_FIXUP_HORIZONTAL:
+			if (i < CLIPMAP_LEVEL * 2) {
+				level = positionLevel = i / 2;
+				position = clipmapOrigins[level] + glm::ivec2(offsets[i % 2 ? 0 : 3], 0);
+			}
+			else
+				position += glm::ivec2(i % 2 ? 1 - CLIPMAP_RESOLUTION : PATCH_WIDTH, 0);
+			break;
+
+		case TERRAIN_PIECE_INTERIOR_TRIM: {
+			level = i + 1;
+			positionLevel = i;
+			glm::ivec2 rotations = clipmapOrigins[i] / PATCH_WIDTH % 2;
+			position = clipmapOrigins[i] + PATCH_WIDTH * (1 - rotations);
+			rotation = trimRotations[rotations.x * 2 + rotations.y];
+			break;
 		}
 
-		Terrain::drawElementsInstanced(ringFixUpHorizontalVAO, instanceArray, ringFixUpHorizontalIndiceCount);
-		instanceArray.clear();
+		case TERRAIN_PIECE_OUTER_DEGENERATE:
+			level = positionLevel = i;
+			position = clipmapOrigins[level] + offsets[0];
+			break;
+		}
 
-		// INTERIOR TRIM
-		for (int i = 0; i < CLIPMAP_LEVEL - 1; i++) {
+		instance.position = glm::vec2(position * (1 << positionLevel));
+		instance.level = level;
+		instance.packed = rotation | piece << 8;
+	}
 
-			TerrainVertexAttribs attribs;
-			attribs.level = i + 1;
-			attribs.model = glm::rotate(glm::mat4(1), glm::radians(rotAmounts[i]), glm::vec3(0.0f, 1.0f, 0.0f));
-			attribs.position = interiorTrimPositions[i];
-			attribs.color = INTERIOR_TRIM_COLOR;
-			instanceArray.push_back(attribs);
+	/*
+	* CPU mirror of the candidates of terrain_cull.comp, bounds are read from the pyramid buffer words like it does.
+	* It gives the same candidates as collectCandidates, blocks read their whole window instead of sliding it.
+	*/
+	void Terrain::generateCandidate(const unsigned int* pyramidWords, unsigned int index, TerrainCullCandidate& candidate) {
+
+		Terrain::getCandidateInstance(index, candidate.instance, candidate.piece);
+		candidate.padding = 0;
+
+		glm::vec2 start, end;
+		glm::ivec2 texelStart, texelEnd;
+		Terrain::getPieceExtent(candidate.piece, candidate.instance, start, end, texelStart, texelEnd);
+
+		unsigned short min, max;
+		if (candidate.piece == TERRAIN_PIECE_BLOCK)
+			Terrain::getPackedWindowMinMax(pyramidWords, candidate.instance.level, texelStart, min, max);
+		else
+			Terrain::getPackedMinMax(pyramidWords, candidate.instance.level, texelStart, texelEnd, min, max);
+
+		candidate.boundsMin = glm::vec3(start.x, min * (MAX_HEIGHT / 65535.f) - TERRAIN_BOUNDS_MARGIN, start.y);
+		candidate.boundsMax = glm::vec3(end.x, max * (MAX_HEIGHT / 65535.f) + TERRAIN_BOUNDS_MARGIN, end.y);
+	}
+
+	/*
+	* HeightPyramid::getMinMax on the pyramid buffer words of a level.
+	*/
+	void Terrain::getPackedMinMax(const unsigned int* pyramidWords, int level, glm::ivec2 start, glm::ivec2 end, unsigned short& min, unsigned short& max) {
+
+		const unsigned int* header = pyramidWords + level * TERRAIN_PYRAMID_HEADER_WORDS;
+		int size = header[0];
+		int cellPower = header[1];
+		int mipCount = header[2];
+
+		start = glm::clamp(start, glm::ivec2(0), glm::ivec2(size - 1));
+		end = glm::clamp(end, glm::ivec2(0), glm::ivec2(size - 1));
+
+		glm::ivec2 cellStart = start >> cellPower;
+		glm::ivec2 cellEnd = end >> cellPower;
+		int mip = 0;
+
+		while (mip < mipCount - 1 && (cellEnd.x - cellStart.x > 1 || cellEnd.y - cellStart.y > 1)) {
+			cellStart >>= 1;
+			cellEnd >>= 1;
+			mip++;
 		}
-		Terrain::drawElementsInstanced(interiorTrimVAO, instanceArray, interiorTrimIndiceCount);
-		instanceArray.clear();
 
-		// OUTER DEGENERATE
-		for (int i = 0; i < CLIPMAP_LEVEL - 1; i++) {
+		int mipSize = header[8 + mip];
+		const unsigned int* cells = pyramidWords + header[8 + TERRAIN_PYRAMID_MAX_MIPS + mip];
+		min = 65535;
+		max = 0;
 
-			TerrainVertexAttribs attribs;
-			attribs.level = i;
-			attribs.model = glm::mat4(1);
-			attribs.color = OUTER_DEGENERATE_COLOR;
-			attribs.position = outerDegeneratePositions[i];
-			instanceArray.push_back(attribs);
+		for (int i = cellStart.y; i <= cellEnd.y; i++) {
+			for (int j = cellStart.x; j <= cellEnd.x; j++) {
+				unsigned int cell = cells[i * mipSize + j];
+				min = std::min(min, (unsigned short)(cell & 0xFFFF));
+				max = std::max(max, (unsigned short)(cell >> 16));
+			}
 		}
-		Terrain::drawElementsInstanced(outerDegenerateVAO, instanceArray, outerDegenerateIndiceCount);
-		instanceArray.clear();
+	}
 
-		// SMALL SQUARE
-		TerrainVertexAttribs attribs;
-		attribs.level = 0;
-		attribs.model = glm::mat4(1);
-		attribs.position = smallSquarePosition;
-		attribs.color = SMALL_SQUARE_COLOR;
-		instanceArray.push_back(attribs);
-		Terrain::drawElementsInstanced(smallSquareVAO, instanceArray, smallSquareIndiceCount);
+	/*
+	* HeightPyramid::getWindowMinMax at the window start of the texels, on the pyramid buffer words of a level.
+	*/
+	void Terrain::getPackedWindowMinMax(const unsigned int* pyramidWords, int level, glm::ivec2 texelStart, unsigned short& min, unsigned short& max) {
+
+		const unsigned int* header = pyramidWords + level * TERRAIN_PYRAMID_HEADER_WORDS;
+		int size = header[0];
+		int cellPower = header[1];
+		int windowCells = header[3];
+		int mipSize = header[8];
+		const unsigned int* cells = pyramidWords + header[8 + TERRAIN_PYRAMID_MAX_MIPS];
+
+		glm::ivec2 cellStart = glm::min(glm::clamp(texelStart, glm::ivec2(0), glm::ivec2(size - 1)) >> cellPower, glm::ivec2(mipSize - windowCells));
+		min = 65535;
+		max = 0;
+
+		for (int i = cellStart.y; i < cellStart.y + windowCells; i++) {
+			for (int j = cellStart.x; j < cellStart.x + windowCells; j++) {
+				unsigned int cell = cells[i * mipSize + j];
+				min = std::min(min, (unsigned short)(cell & 0xFFFF));
+				max = std::max(max, (unsigned short)(cell >> 16));
+			}
+		}
+	}
 
-		// Draw bounding boxes
-		if (showBounds) {
-			for (int i = 0; i < CLIPMAP_LEVEL; i++) {
+	/*
+	* Height pyramids in the layout of the pyramid buffer of terrain_cull.comp, see TERRAIN_PYRAMID_HEADER_WORDS.
+	* Window of the blocks is the one of the pyramids, so they are packed after initBlockAABBs.
+	*/
+	void Terrain::packHeightPyramids(std::vector<unsigned int>& words) {
 
-				for (int j = 0; j < 12; j++) {
+		size_t cellCount = 0;
+		for (int level = 0; level < CLIPMAP_LEVEL; level++)
+			for (int mipSize : heightPyramids[level]->mipSizes)
+				cellCount += (size_t)mipSize * mipSize;
 
-					AABB_Box aabb = blockAABBs[i * 12 + j];
-					glm::vec3 pos = (aabb.start + aabb.end) * 0.5f;
-					glm::vec3 scale = aabb.end - aabb.start;
-					glm::mat4 model = glm::translate(glm::mat4(1), pos) * glm::scale(glm::mat4(1), scale);
-					glm::mat4 PVM = PV * model;
-					glm::vec3 color = glm::vec3(1, 1, 1);
-					CoreContext::instance->renderer->drawBoundingBoxVAO(PVM, color);
-				}
+		words.assign(CLIPMAP_LEVEL * TERRAIN_PYRAMID_HEADER_WORDS, 0);
+		words.reserve(words.size() + cellCount);
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+			HeightPyramid* pyramid = heightPyramids[level];
+			size_t header = level * TERRAIN_PYRAMID_HEADER_WORDS;
+			int mipCount = std::min((int)pyramid->mipSizes.size(), TERRAIN_PYRAMID_MAX_MIPS);
+
+			words[header + 0] = pyramid->size;
+			words[header + 1] = pyramid->cellPower;
+			words[header + 2] = mipCount;
+			words[header + 3] = pyramid->windowCells;
+			words[header + 4] = clipmapStartIndices[level].x * TILE_SIZE;
+
+			for (int mip = 0; mip < mipCount; mip++) {
+
+				int mipSize = pyramid->mipSizes[mip];
+				words[header + 8 + mip] = mipSize;
+				words[header + 8 + TERRAIN_PYRAMID_MAX_MIPS + mip] = words.size();
+
+				for (int cell = 0; cell < mipSize * mipSize; cell++)
+					words.push_back(pyramid->minMips[mip][cell] | pyramid->maxMips[mip][cell] << 16);
 			}
+		}
+	}
 
-			for (int i = 0; i < 4; i++) {
+	/*
+	* Pyramids do not change after the heightmap is loaded, they are uploaded once for the cull program.
+	*/
+	void Terrain::uploadHeightPyramids() {
 
-				AABB_Box aabb = blockAABBs[CLIPMAP_LEVEL * 12 + i];
-				glm::vec3 pos = (aabb.start + aabb.end) * 0.5f;
-				glm::vec3 scale = aabb.end - aabb.start;
-				glm::mat4 model = glm::translate(glm::mat4(1), pos) * glm::scale(glm::mat4(1), scale);
-				glm::mat4 PVM = PV * model;
-				glm::vec3 color = glm::vec3(1, 1, 1);
-				CoreContext::instance->renderer->drawBoundingBoxVAO(PVM, color);
+		std::vector<unsigned int> words;
+		Terrain::packHeightPyramids(words);
+
+		if (pyramidBuffer == 0)
+			glGenBuffers(1, &pyramidBuffer);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, pyramidBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, words.size() * sizeof(unsigned int), &words[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		pyramidBufferBytes = words.size() * sizeof(unsigned int);
+	}
+
+	/*
+	* CPU reference of terrain_cull.comp for the candidates of collectCandidates. Visible candidates are appended to the
+	* instance range of their piece. Only the order of instances inside a range can differ from the GPU result.
+	* visibleBlocks, if given, counts the visible blocks of each level. Instances may be write combined memory, they are not read back.
+	*/
+	void Terrain::cullCandidates(const TerrainCullCandidate* candidates, unsigned int candidateCount, const glm::vec4* planes, const unsigned int* first, TerrainInstance* instances, unsigned int* count,
+		unsigned int* visibleBlocks) {
+
+		AABBList boxes;
+		for (unsigned int i = 0; i < candidateCount; i++)
+			boxes.add(candidates[i].boundsMin, candidates[i].boundsMax);
+
+		std::vector<unsigned char> visible(candidateCount);
+		FrustumCuller::cull(boxes, planes, &visible[0]);
+
+		for (int i = 0; i < TERRAIN_PIECE_COUNT; i++)
+			count[i] = 0;
+
+		for (unsigned int i = 0; i < candidateCount; i++) {
+
+			const TerrainCullCandidate& candidate = candidates[i];
+
+			if (visible[i]) {
+				instances[first[candidate.piece] + count[candidate.piece]++] = candidate.instance;
+				if (visibleBlocks && candidate.piece == TERRAIN_PIECE_BLOCK)
+					visibleBlocks[candidate.instance.level]++;
 			}
 		}
 	}
 
 	/*
-	* Draw nested grids instanced.
+	* Blocks per level and triangles of the frame for the counters. When culling is done on GPU the visible instances
+	* are only known there, every candidate is counted as submitted then and blocks are not counted.
 	*/
-	void Terrain::drawElementsInstanced(unsigned int VAO, std::vector<TerrainVertexAttribs>& instanceArray, unsigned int indiceCount) {
+	void Terrain::countDrawnInstances(const unsigned int* first, const unsigned int* count, const unsigned int* visibleBlocks, bool cullOnGPU) {
+
+		// candidates of a piece end where the next piece starts
+		unsigned int last[TERRAIN_PIECE_COUNT];
+		for (int i = 0; i < TERRAIN_PIECE_COUNT; i++)
+			last[i] = i + 1 < TERRAIN_PIECE_COUNT ? first[i + 1] : TERRAIN_CANDIDATE_COUNT;
+
+		unsigned long long triangles = 0;
+		for (int i = 0; i < TERRAIN_PIECE_COUNT; i++)
+			triangles += (unsigned long long)(cullOnGPU ? last[i] - first[i] : count[i]) * pieces[i].indexCount / 3;
+		Counters::add(COUNTER_TRIANGLES, triangles);
+
+		// Visible instances stay on the GPU, triangles above are of every candidate that is submitted
+		if (cullOnGPU) {
+			Counters::add(COUNTER_GPU_CULLING, 1);
+			return;
+		}
 
-		unsigned int instanceBuffer;
-		glGenBuffers(1, &instanceBuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
-		glBufferData(GL_ARRAY_BUFFER, instanceArray.size() * sizeof(TerrainVertexAttribs), &instanceArray[0], GL_STATIC_DRAW);
+		unsigned long long instances = 0;
+		for (int i = 0; i < TERRAIN_PIECE_COUNT; i++)
+			instances += count[i];
+		Counters::add(COUNTER_VISIBLE_INSTANCES, instances);
+
+		// levels of the blocks as collectCandidates gives them, the last 4 are in the center of level 0
+		unsigned int blocks[CLIPMAP_LEVEL] = {};
+		for (int i = 0; i < BLOCK_COUNT; i++)
+			blocks[i < CLIPMAP_LEVEL * 12 ? i / 12 : 0]++;
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+			Counters::addLevel(LEVEL_COUNTER_VISIBLE_BLOCKS, level, visibleBlocks[level]);
+			Counters::addLevel(LEVEL_COUNTER_CULLED_BLOCKS, level, blocks[level] - visibleBlocks[level]);
+		}
+	}
+
+	/*
+	* One indirect command per piece. Does not touch GL, so it can be checked without a context:
+	* command i must draw pieces[i].indexCount indices from pieces[i].firstIndex for count[i] instances.
+	*/
+	void Terrain::buildDrawCommands(const TerrainPieceMesh* pieces, const unsigned int* first, const unsigned int* count, unsigned int baseInstance, DrawElementsIndirectCommand* commands) {
+
+		for (int i = 0; i < TERRAIN_PIECE_COUNT; i++) {
+
+			commands[i].count = pieces[i].indexCount;
+			commands[i].instanceCount = count[i];
+			commands[i].firstIndex = pieces[i].firstIndex;
+			commands[i].baseVertex = pieces[i].baseVertex;
+			commands[i].baseInstance = baseInstance + first[i];
+		}
+	}
+
+	/*
+	* Instance attributes of the clipmap VAO are bound to the instance buffer once.
+	* The same buffer holds the indirect commands of the frame.
+	* Without buffer storage support a regular buffer is updated every frame instead of the ring.
+	*/
+	void Terrain::initInstanceBuffer() {
+
+		instanceRing = new RingBuffer();
+
+		if (instanceRing->init(GL_ARRAY_BUFFER, TERRAIN_INSTANCE_RING_SIZE))
+			instanceBuffer = instanceRing->id;
+		else {
+			delete instanceRing;
+			instanceRing = NULL;
 
-		glBindVertexArray(VAO);
+			glGenBuffers(1, &instanceBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+			glBufferData(GL_ARRAY_BUFFER, TERRAIN_COMMAND_BYTES + TERRAIN_CANDIDATE_COUNT * sizeof(TerrainInstance), NULL, GL_STREAM_DRAW);
+		}
+
+		glBindVertexArray(clipmapVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
 		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TerrainVertexAttribs), (void*)0);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TerrainInstance), (void*)0);
 		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(TerrainVertexAttribs), (void*)(sizeof(glm::vec2)));
+		glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(TerrainInstance), (void*)(sizeof(glm::vec2)));
 		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainVertexAttribs), (void*)(sizeof(glm::vec2) + sizeof(float)));
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainVertexAttribs), (void*)(sizeof(glm::vec2) + sizeof(float) + sizeof(glm::vec4)));
-		glEnableVertexAttribArray(5);
-		glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainVertexAttribs), (void*)(sizeof(glm::vec2) + sizeof(float) + sizeof(glm::vec4) * 2));
-		glEnableVertexAttribArray(6);
-		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainVertexAttribs), (void*)(sizeof(glm::vec2) + sizeof(float) + sizeof(glm::vec4) * 3));
-		glEnableVertexAttribArray(7);
-		glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, sizeof(TerrainVertexAttribs), (void*)(sizeof(glm::vec2) + sizeof(float) + sizeof(glm::vec4) * 4));
+		glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(TerrainInstance), (void*)(sizeof(glm::vec2) + sizeof(unsigned int)));
 
 		glVertexAttribDivisor(1, 1);
 		glVertexAttribDivisor(2, 1);
 		glVertexAttribDivisor(3, 1);
-		glVertexAttribDivisor(4, 1);
-		glVertexAttribDivisor(5, 1);
-		glVertexAttribDivisor(6, 1);
-		glVertexAttribDivisor(7, 1);
-
-		glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(indiceCount), GL_UNSIGNED_INT, 0, instanceArray.size());
 
 		glBindVertexArray(0);
-		glDeleteBuffers(1, &instanceBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
 
 	/*
@@ -1053,6 +1609,8 @@ namespace Core {
 	*/
 	void Terrain::calculateBlockPositions(glm::vec3 camPosition) {
 
+		PROFILE_FUNCTION();
+
 		for (int i = 0; i < CLIPMAP_LEVEL; i++) {
 			/*
 			*      Z+
@@ -1115,16 +1673,18 @@ namespace Core {
 			interiorTrimPositions[i] = glm::vec2((pX + PATCH_WIDTH * (1 - rotX)) * scale, (pZ + PATCH_WIDTH * (1 - rotZ)) * scale);
 
 			if (rotX == 0 && rotZ == 0)
-				rotAmounts[i] = 0.f;
+				rotationCodes[i] = 0;
 			if (rotX == 0 && rotZ == 1)
-				rotAmounts[i] = 90.f;
+				rotationCodes[i] = 1;
 			if (rotX == 1 && rotZ == 0)
-				rotAmounts[i] = 270.f;
+				rotationCodes[i] = 3;
 			if (rotX == 1 && rotZ == 1)
-				rotAmounts[i] = 180.f;
+				rotationCodes[i] = 2;
 
 			// OUTER DEGENERATE
 			outerDegeneratePositions[i] = glm::vec2((pX + pI0) * scale, (pZ + pI0) * scale);
+
+			clipmapOrigins[i] = glm::ivec2(pX, pZ);
 		}
 
 		float pX = (int)(camPosition.x / PATCH_WIDTH) * PATCH_WIDTH;
@@ -1159,6 +1719,8 @@ namespace Core {
 	*/
 	void Terrain::streamTerrain(glm::vec3 newCamPos) {
 
+		PROFILE_FUNCTION();
+
 		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
 
 			glm::ivec2 old_tileIndex = Terrain::getTileIndex(level, cameraPosition);
@@ -1176,10 +1738,14 @@ namespace Core {
 
 			if (tileDelta.x >= MEM_TILE_ONE_SIDE || tileDelta.y >= MEM_TILE_ONE_SIDE || tileDelta.x <= -MEM_TILE_ONE_SIDE || tileDelta.y <= -MEM_TILE_ONE_SIDE) {
 
-				unsigned char* heightData = new unsigned char[MEM_TILE_ONE_SIDE * MEM_TILE_ONE_SIDE * TILE_SIZE * TILE_SIZE * 4];
-				Terrain::loadHeightmapAtLevel(level, newCamPos, heightData);
-				Terrain::updateHeightMapTextureArrayPartial(level, glm::ivec2(TILE_SIZE * MEM_TILE_ONE_SIDE, TILE_SIZE * MEM_TILE_ONE_SIDE), glm::ivec2(0, 0), heightData);
-				delete[] heightData;
+				Counters::add(COUNTER_FULL_RELOADS, 1);
+
+				TerrainStreamJob* job = new TerrainStreamJob;
+				job->level = level;
+				job->size = glm::ivec2(TILE_SIZE * MEM_TILE_ONE_SIDE, TILE_SIZE * MEM_TILE_ONE_SIDE);
+				job->position = glm::ivec2(0, 0);
+				Terrain::collectLevelTiles(level, newCamPos, job->tiles);
+				streamer->submit(job);
 				continue;
 			}
 
@@ -1200,50 +1766,56 @@ namespace Core {
 		if (tileDelta.x > 0) {
 
 			old_tileStart.x += MEM_TILE_ONE_SIDE;
-			unsigned char* heightData = new unsigned char[MEM_TILE_ONE_SIDE * TILE_SIZE * TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS];
 
 			for (int x = 0; x < tileDelta.x; x++) {
 
+				TerrainStreamJob* job = new TerrainStreamJob;
+				job->level = level;
 				int startY = old_tileStart.y;
 
 				for (int z = 0; z < MEM_TILE_ONE_SIDE; z++) {
 
-					Terrain::writeHeightDataToGPUBuffer(glm::ivec2(0, old_border.y), glm::ivec2(old_tileStart.x, startY), TILE_SIZE, heightData, level);
+					job->tiles.push_back({ glm::ivec2(0, old_border.y), glm::ivec2(old_tileStart.x, startY) });
 					old_border.y++;
 					old_border.y %= MEM_TILE_ONE_SIDE;
 					startY++;
 				}
 
-				Terrain::updateHeightMapTextureArrayPartial(level, glm::ivec2(TILE_SIZE, TILE_SIZE * MEM_TILE_ONE_SIDE), glm::ivec2(old_border.x * TILE_SIZE, 0), heightData);
+				job->size = glm::ivec2(TILE_SIZE, TILE_SIZE * MEM_TILE_ONE_SIDE);
+				job->position = glm::ivec2(old_border.x * TILE_SIZE, 0);
+				streamer->submit(job);
 				old_border.x++;
 				old_border.x %= MEM_TILE_ONE_SIDE;
 				old_tileStart.x++;
 			}
-			delete[] heightData;
 		}
 		else if (tileDelta.x < 0) {
 
 			old_tileStart.x -= 1;
-			unsigned char* heightData = new unsigned char[MEM_TILE_ONE_SIDE * TILE_SIZE * TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS];
 
 			for (int x = tileDelta.x; x < 0; x++) {
 
 				old_border.x--;
 				old_border.x += 4;
 				old_border.x %= MEM_TILE_ONE_SIDE;
+
+				TerrainStreamJob* job = new TerrainStreamJob;
+				job->level = level;
 				int startY = old_tileStart.y;
 
 				for (int z = 0; z < MEM_TILE_ONE_SIDE; z++) {
 
-					Terrain::writeHeightDataToGPUBuffer(glm::ivec2(0, old_border.y), glm::ivec2(old_tileStart.x, startY), TILE_SIZE, heightData, level);
+					job->tiles.push_back({ glm::ivec2(0, old_border.y), glm::ivec2(old_tileStart.x, startY) });
 					old_border.y++;
 					old_border.y %= MEM_TILE_ONE_SIDE;
 					startY++;
 				}
-				Terrain::updateHeightMapTextureArrayPartial(level, glm::ivec2(TILE_SIZE, TILE_SIZE * MEM_TILE_ONE_SIDE), glm::ivec2(old_border.x * TILE_SIZE, 0), heightData);
+
+				job->size = glm::ivec2(TILE_SIZE, TILE_SIZE * MEM_TILE_ONE_SIDE);
+				job->position = glm::ivec2(old_border.x * TILE_SIZE, 0);
+				streamer->submit(job);
 				old_tileStart.x--;
 			}
-			delete[] heightData;
 		}
 	}
 
@@ -1255,85 +1827,160 @@ namespace Core {
 		if (tileDelta.y > 0) {
 
 			old_tileStart.y += MEM_TILE_ONE_SIDE;
-			unsigned char* heightData = new unsigned char[MEM_TILE_ONE_SIDE * TILE_SIZE * TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS];
 
 			for (int z = 0; z < tileDelta.y; z++) {
 
+				TerrainStreamJob* job = new TerrainStreamJob;
+				job->level = level;
 				int startX = old_tileStart.x;
 
 				for (int x = 0; x < MEM_TILE_ONE_SIDE; x++) {
 
-					Terrain::writeHeightDataToGPUBuffer(glm::ivec2(old_border.x, 0), glm::ivec2(startX, old_tileStart.y), MEM_TILE_ONE_SIDE * TILE_SIZE, heightData, level);
+					job->tiles.push_back({ glm::ivec2(old_border.x, 0), glm::ivec2(startX, old_tileStart.y) });
 					old_border.x++;
 					old_border.x %= MEM_TILE_ONE_SIDE;
 					startX++;
 				}
-				Terrain::updateHeightMapTextureArrayPartial(level, glm::ivec2(TILE_SIZE * MEM_TILE_ONE_SIDE, TILE_SIZE), glm::ivec2(0, old_border.y * TILE_SIZE), heightData);
+
+				job->size = glm::ivec2(TILE_SIZE * MEM_TILE_ONE_SIDE, TILE_SIZE);
+				job->position = glm::ivec2(0, old_border.y * TILE_SIZE);
+				streamer->submit(job);
 				old_border.y++;
 				old_border.y %= MEM_TILE_ONE_SIDE;
 				old_tileStart.y++;
 			}
-
-			delete[] heightData;
 		}
 		else if (tileDelta.y < 0) {
 
 			old_tileStart.y -= 1;
 
-			unsigned char* heightData = new unsigned char[MEM_TILE_ONE_SIDE * TILE_SIZE * TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS];
-
 			for (int z = tileDelta.y; z < 0; z++) {
 
 				old_border.y--;
 				old_border.y += 4;
 				old_border.y %= MEM_TILE_ONE_SIDE;
+
+				TerrainStreamJob* job = new TerrainStreamJob;
+				job->level = level;
 				int startX = old_tileStart.x;
 
 				for (int x = 0; x < MEM_TILE_ONE_SIDE; x++) {
 
-					Terrain::writeHeightDataToGPUBuffer(glm::ivec2(old_border.x, 0), glm::ivec2(startX, old_tileStart.y), MEM_TILE_ONE_SIDE * TILE_SIZE, heightData, level);
+					job->tiles.push_back({ glm::ivec2(old_border.x, 0), glm::ivec2(startX, old_tileStart.y) });
 					old_border.x++;
 					old_border.x %= MEM_TILE_ONE_SIDE;
 					startX++;
 				}
-				Terrain::updateHeightMapTextureArrayPartial(level, glm::ivec2(TILE_SIZE * MEM_TILE_ONE_SIDE, TILE_SIZE), glm::ivec2(0, old_border.y * TILE_SIZE), heightData);
+
+				job->size = glm::ivec2(TILE_SIZE * MEM_TILE_ONE_SIDE, TILE_SIZE);
+				job->position = glm::ivec2(0, old_border.y * TILE_SIZE);
+				streamer->submit(job);
 				old_tileStart.y--;
 			}
-			delete[] heightData;
 		}
 	}
 
+	/*
+	* Texels of a tile of the heightmap stack. Stack is stored tile by tile, so a tile is one contiguous block
+	* in the layout glTexSubImage3D takes. Only for maps that are resident.
+	*/
+	const unsigned char* Terrain::getStackTile(int level, glm::ivec2 tileStart) {
+
+		int tilesPerSide = clipmapStartIndices[level].y - clipmapStartIndices[level].x;
+		glm::ivec2 tile = tileStart - clipmapStartIndices[level].x;
+		return &heightmapStack[level][(size_t)(tile.y * tilesPerSide + tile.x) * TERRAIN_TILE_BYTES];
+	}
+
 	/*
 	* We toroidally update the height values of the texture in GPU.
 	* In this case we only update small chunks of the memory instead of updating all data.
+	* Called from the streaming thread too. It only reads the heightmap stack, or the tile cache for out of core maps.
+	*/
+	void Terrain::writeHeightDataToGPUBuffer(glm::ivec2 tileStart, unsigned char* heightMap, int level) {
+
+		if (tileCache) {
+			memcpy(heightMap, tileCache->acquire(level, tileStart), TERRAIN_TILE_BYTES);
+			tileCache->release(level, tileStart);
+		}
+		else
+			memcpy(heightMap, Terrain::getStackTile(level, tileStart), TERRAIN_TILE_BYTES);
+	}
+
+	/*
+	* Bakes the material blend factors of a tile with splatParameters. Heights of the tile are gathered with the facing edges
+	* of its four neighbours, a neighbour outside of the heightmap stack repeats the edge of the tile.
+	* Called from the streaming thread and from the bake pool.
 	*/
-	void Terrain::writeHeightDataToGPUBuffer(glm::ivec2 index, glm::ivec2 tileStart, int texWidth, unsigned char* heightMap, int level) {
+	void Terrain::writeSplatDataToGPUBuffer(glm::ivec2 tileStart, unsigned char* splatMap, int level) {
+
+		const int stride = TILE_SIZE + 2;
+		std::vector<unsigned short> heights((size_t)stride * stride);
+
+		auto gather = [&](glm::ivec2 tile, glm::ivec2 source, glm::ivec2 size, glm::ivec2 destination) {
 
-		int startX = index.x * TILE_SIZE;
-		int startZ = index.y * TILE_SIZE;
+			const unsigned char* data = tileCache ? tileCache->acquire(level, tile) : Terrain::getStackTile(level, tile);
 
-		int coord_x = (tileStart.x - clipmapStartIndices[level].x) * TILE_SIZE;
-		int coord_z = (tileStart.y - clipmapStartIndices[level].x) * TILE_SIZE;
+			for (int i = 0; i < size.y; i++) {
+				for (int j = 0; j < size.x; j++) {
+					const unsigned char* texel = &data[((source.y + i) * TILE_SIZE + source.x + j) * TERRAIN_STACK_NUM_CHANNELS];
+					heights[(destination.y + i) * stride + destination.x + j] = texel[0] << 8 | texel[1];
+				}
+			}
+
+			if (tileCache)
+				tileCache->release(level, tile);
+		};
+
+		gather(tileStart, glm::ivec2(0), glm::ivec2(TILE_SIZE), glm::ivec2(1));
+
+		// left, right, lower and upper edge: direction, edge in the neighbour, edge in the tile, edge size, border position
+		const glm::ivec2 edges[4][5] = {
+			{ glm::ivec2(-1, 0), glm::ivec2(TILE_SIZE - 1, 0), glm::ivec2(0, 0), glm::ivec2(1, TILE_SIZE), glm::ivec2(0, 1) },
+			{ glm::ivec2(1, 0), glm::ivec2(0, 0), glm::ivec2(TILE_SIZE - 1, 0), glm::ivec2(1, TILE_SIZE), glm::ivec2(TILE_SIZE + 1, 1) },
+			{ glm::ivec2(0, -1), glm::ivec2(0, TILE_SIZE - 1), glm::ivec2(0, 0), glm::ivec2(TILE_SIZE, 1), glm::ivec2(1, 0) },
+			{ glm::ivec2(0, 1), glm::ivec2(0, 0), glm::ivec2(0, TILE_SIZE - 1), glm::ivec2(TILE_SIZE, 1), glm::ivec2(1, TILE_SIZE + 1) },
+		};
+
+		for (int i = 0; i < 4; i++) {
+
+			glm::ivec2 neighbour = tileStart + edges[i][0];
+			bool inside = neighbour.x >= clipmapStartIndices[level].x && neighbour.y >= clipmapStartIndices[level].x &&
+				neighbour.x < clipmapStartIndices[level].y && neighbour.y < clipmapStartIndices[level].y;
+
+			if (inside)
+				gather(neighbour, edges[i][1], edges[i][3], edges[i][4]);
+			else
+				gather(tileStart, edges[i][2], edges[i][3], edges[i][4]);
+		}
+
+		SplatBaker::bakeTile(&heights[0], TILE_SIZE, MAX_HEIGHT / 65535.f, (float)(1 << level), splatParameters, splatMap);
+	}
+
+	/*
+	* Loads heightmap on a specific level from heightmap stack. Resident tiles are sent to gpu without a copy.
+	*/
+	void Terrain::loadHeightmapAtLevel(int level, glm::vec3 camPos) {
 
-		int stackSize = (clipmapStartIndices[level].y - clipmapStartIndices[level].x) * TILE_SIZE;
+		std::vector<TerrainStreamTile> tiles;
+		Terrain::collectLevelTiles(level, camPos, tiles);
 
-		for (int i = 0; i < TILE_SIZE; i++) {
-			for (int j = 0; j < TILE_SIZE; j++) {
+		for (TerrainStreamTile& tile : tiles) {
 
-				int indexInChunk = ((i + coord_z) * stackSize + coord_x + j) * TERRAIN_STACK_NUM_CHANNELS;
-				int indexInHeightmap = ((i + startZ) * texWidth + j + startX) * TERRAIN_STACK_NUM_CHANNELS;
+			glm::ivec2 position = tile.index * TILE_SIZE;
 
-				// Data that will be sent to GPU
-				heightMap[indexInHeightmap] = heightmapStack[level][indexInChunk];
-				heightMap[indexInHeightmap + 1] = heightmapStack[level][indexInChunk + 1];
+			if (tileCache) {
+				Terrain::updateHeightMapTextureArrayPartial(level, glm::ivec2(TILE_SIZE), position, tileCache->acquire(level, tile.tileStart));
+				tileCache->release(level, tile.tileStart);
 			}
+			else
+				Terrain::updateHeightMapTextureArrayPartial(level, glm::ivec2(TILE_SIZE), position, Terrain::getStackTile(level, tile.tileStart));
 		}
 	}
 
 	/*
-	* Loads heightmap on a specific level from heightmap stack.
+	* All tiles of a level around the camera and where they are placed in the toroidal texture.
 	*/
-	void Terrain::loadHeightmapAtLevel(int level, glm::vec3 camPos, unsigned char* heightData) {
+	void Terrain::collectLevelTiles(int level, glm::vec3 camPos, std::vector<TerrainStreamTile>& tiles) {
 
 		glm::ivec2 tileIndex = Terrain::getTileIndex(level, camPos);
 		glm::ivec2 tileStart = tileIndex - MEM_TILE_ONE_SIDE / 2;
@@ -1345,7 +1992,7 @@ namespace Core {
 
 			for (int j = 0; j < MEM_TILE_ONE_SIDE; j++) {
 
-				Terrain::writeHeightDataToGPUBuffer(border, glm::ivec2(startX, tileStart.y), MEM_TILE_ONE_SIDE * TILE_SIZE, heightData, level);
+				tiles.push_back({ border, glm::ivec2(startX, tileStart.y) });
 				border.x++;
 				border.x %= MEM_TILE_ONE_SIDE;
 				startX++;
@@ -1358,13 +2005,68 @@ namespace Core {
 	}
 
 	/*
-	* Partially update heightmap texture in gpu memory
+	* Partially update heightmap texture in gpu memory. Streamed texels are counted here, the splat map follows the same texels.
 	*/
-	void Terrain::updateHeightMapTextureArrayPartial(int level, glm::ivec2 size, glm::ivec2 position, unsigned char* heights) {
+	void Terrain::updateHeightMapTextureArrayPartial(int level, glm::ivec2 size, glm::ivec2 position, const unsigned char* heights) {
 
 		glBindTexture(GL_TEXTURE_2D_ARRAY, elevationMapTextureArray);
 		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, position.x, position.y, level, size.x, size.y, 1, GL_RG, GL_UNSIGNED_BYTE, &heights[0]);
 		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		Counters::addLevel(LEVEL_COUNTER_STREAMED_TEXELS, level, (unsigned long long)size.x * size.y);
+		Counters::addLevel(LEVEL_COUNTER_STREAMED_BYTES, level, (unsigned long long)size.x * size.y * TERRAIN_STACK_NUM_CHANNELS);
+	}
+
+	/*
+	* Partially update splat map texture in gpu memory
+	*/
+	void Terrain::updateSplatMapTextureArrayPartial(int level, glm::ivec2 size, glm::ivec2 position, const unsigned char* splat) {
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, splatMapTextureArray);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, position.x, position.y, level, size.x, size.y, 1, GL_RGBA, GL_UNSIGNED_BYTE, &splat[0]);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		Counters::addLevel(LEVEL_COUNTER_STREAMED_BYTES, level, (unsigned long long)size.x * size.y * SPLAT_NUM_CHANNELS);
+	}
+
+	/*
+	* Memory the terrain holds, by category. GPU sizes are what the storage was created with, drivers may pad them.
+	* A mapped heightmap stack and mapped pyramids are counted with their full size, the system decides how much of them is resident.
+	*/
+	void Terrain::updateMemoryCounters() {
+
+		unsigned long long stackBytes = 0;
+		for (int level = 0; heightmapStack && level < CLIPMAP_LEVEL; level++) {
+			unsigned long long size = (unsigned long long)(clipmapStartIndices[level].y - clipmapStartIndices[level].x) * TILE_SIZE;
+			stackBytes += size * size * TERRAIN_STACK_NUM_CHANNELS;
+		}
+
+		unsigned long long pyramidBytes = 0;
+		for (HeightPyramid* pyramid : heightPyramids) {
+
+			if (!pyramid)
+				continue;
+
+			pyramidBytes += pyramid->getMipBytes();
+			pyramidBytes += (pyramid->columnSpanMin.size() + pyramid->columnSpanMax.size()) * sizeof(unsigned short);
+		}
+
+		unsigned long long mapSide = TILE_SIZE * MEM_TILE_ONE_SIDE;
+		unsigned long long mapBytes = (elevationMapTextureArray ? mapSide * mapSide * CLIPMAP_LEVEL * TERRAIN_STACK_NUM_CHANNELS : 0) +
+			(splatMapTextureArray ? mapSide * mapSide * CLIPMAP_LEVEL * SPLAT_NUM_CHANNELS : 0);
+
+		unsigned long long bufferBytes = clipmapBufferBytes + sizeof(TerrainFrameUniforms) + sizeof(TerrainMaterialUniforms);
+		bufferBytes += instanceRing ? instanceRing->capacity : TERRAIN_COMMAND_BYTES + TERRAIN_CANDIDATE_COUNT * sizeof(TerrainInstance);
+		bufferBytes += pyramidBufferBytes;
+		if (streamer && streamer->ring)
+			bufferBytes += streamer->ring->capacity;
+
+		Counters::setMemory(MEMORY_CPU_HEIGHTMAP_STACK, stackBytes);
+		Counters::setMemory(MEMORY_CPU_HEIGHT_PYRAMIDS, pyramidBytes);
+		Counters::setMemory(MEMORY_CPU_TILE_CACHE, tileCache ? tileCache->residentBytes : 0);
+		Counters::setMemory(MEMORY_GPU_TERRAIN_MAPS, mapBytes);
+		Counters::setMemory(MEMORY_GPU_TERRAIN_MATERIALS, materialTextureBytes);
+		Counters::setMemory(MEMORY_GPU_TERRAIN_BUFFERS, bufferBytes);
 	}
 
 	/*
@@ -1372,6 +2074,8 @@ namespace Core {
 	*/
 	void Terrain::calculateBoundingBoxes(glm::vec3 camPos) {
 
+		PROFILE_FUNCTION();
+
 		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
 
 			glm::ivec2 old_clipmapPos = Terrain::getClipmapPosition(level, cameraPosition);
@@ -1394,93 +2098,65 @@ namespace Core {
 
 	/*
 	* Each nested block has bounding box that will be used for frustum culling.
+	* Its height range is the min/max of the window of first pyramid mip cells under it. The window of the block
+	* slides as the block moves, so only the columns of cells it enters are read.
 	*/
 	AABB_Box Terrain::getBlockBoundingBox(int index, int level) {
 
-		glm::ivec2 blockPositionInWorldSpace = blockPositions[index];
+		TerrainInstance instance = { blockPositions[index], (unsigned int)level, 0 };
+		glm::vec2 start, end;
+		glm::ivec2 texelStart, texelEnd;
+		Terrain::getPieceExtent(TERRAIN_PIECE_BLOCK, instance, start, end, texelStart, texelEnd);
 
-		int startPos = clipmapStartIndices[level].x;
-		int endPos = clipmapStartIndices[level].y;
-		int startPosWorldSpace = (startPos * TILE_SIZE) << level;
+		unsigned short min, max;
+		blockWindows[index].move(heightPyramids[level], heightPyramids[level]->getWindowStart(texelStart), min, max);
 
-		int sizeInHeightmap = (endPos - startPos) * TILE_SIZE;
-		int lowResolutionHeightmapTextureSize = sizeInHeightmap >> MIP_STACK_DIVISOR_POWER;
-
-		glm::ivec2 startPosInHeightmapWorldSpace = glm::ivec2(startPosWorldSpace, startPosWorldSpace);
-		glm::ivec2 offsetWorldSpace = blockPositionInWorldSpace - startPosInHeightmapWorldSpace;
+		AABB_Box boundingBox;
+		boundingBox.start = glm::vec4(start.x, min * (MAX_HEIGHT / 65535.f) - TERRAIN_BOUNDS_MARGIN, start.y, 1);
+		boundingBox.end = glm::vec4(end.x, max * (MAX_HEIGHT / 65535.f) + TERRAIN_BOUNDS_MARGIN, end.y, 1);
+		return boundingBox;
+	}
 
-		// this is where clipmap position is equivalent in low resolution heightmap
-		glm::ivec2 offsetInLowResolutionHeightmap = (offsetWorldSpace >> level) >> MIP_STACK_DIVISOR_POWER;
-		
-		int blockSizeInLowResolutionHeightmapStack = CLIPMAP_RESOLUTION >> MIP_STACK_DIVISOR_POWER;
-		int blockSizeInWorldSpace = (CLIPMAP_RESOLUTION - 1) << level;
+	/*
+	* Bounds of any piece. Height range is read from the min/max pyramid of its level.
+	*/
+	AABB_Box Terrain::getPieceBoundingBox(int piece, TerrainInstance& instance) {
 
-		// size value of clipmap in low resolution heightmap
-		glm::ivec2 sizeInLowResolutionHeightmapStack = glm::ivec2(blockSizeInLowResolutionHeightmapStack, blockSizeInLowResolutionHeightmapStack);
+		glm::vec2 start, end;
+		glm::ivec2 texelStart, texelEnd;
+		Terrain::getPieceExtent(piece, instance, start, end, texelStart, texelEnd);
 
-		unsigned char min = 255;
-		unsigned char max = 0;
+		unsigned short min, max;
+		heightPyramids[instance.level]->getMinMax(texelStart, texelEnd, min, max);
 
-		int startX = offsetInLowResolutionHeightmap.x;
-		int endX = startX + sizeInLowResolutionHeightmapStack.x;
-		int startZ = offsetInLowResolutionHeightmap.y;
-		int endZ = startZ + sizeInLowResolutionHeightmapStack.y;
+		AABB_Box boundingBox;
+		boundingBox.start = glm::vec4(start.x, min * (MAX_HEIGHT / 65535.f) - TERRAIN_BOUNDS_MARGIN, start.y, 1);
+		boundingBox.end = glm::vec4(end.x, max * (MAX_HEIGHT / 65535.f) + TERRAIN_BOUNDS_MARGIN, end.y, 1);
+		return boundingBox;
+	}
 
-		for (int i = startZ; i < endZ; i++) {
-			for (int j = startX; j < endX; j++) {
-				
-				int index = i * lowResolutionHeightmapTextureSize + j;
-				if (lowResolustionHeightmapStack[level][index] < min)
-					min = lowResolustionHeightmapStack[level][index];
+	/*
+	* World space rectangle of a piece and the texels of the heightmap stack under it (inclusive).
+	* Two more texels on each side for filtering and for the texels of the next level that morphed vertices read.
+	*/
+	void Terrain::getPieceExtent(int piece, TerrainInstance& instance, glm::vec2& start, glm::vec2& end, glm::ivec2& texelStart, glm::ivec2& texelEnd) {
 
-				if (lowResolustionHeightmapStack[level][index] > max)
-					max = lowResolustionHeightmapStack[level][index];
-			}
-		}
+		float scale = 1 << instance.level;
+		glm::vec2 localMin = pieces[piece].localMin;
+		glm::vec2 localMax = pieces[piece].localMax;
 
-		float margin = 1.f;
-		glm::vec4 corner0(blockPositionInWorldSpace.x - margin, min * (MAX_HEIGHT / 255.f) - margin, blockPositionInWorldSpace.y - margin, 1);
-		glm::vec4 corner1(blockPositionInWorldSpace.x + blockSizeInWorldSpace + margin, max * (MAX_HEIGHT / 255.f) + margin, blockPositionInWorldSpace.y + blockSizeInWorldSpace + margin, 1);
+		// same rotation as terrain.vert, quarter turns keep the box axis aligned
+		const glm::vec2 rotations[4] = { glm::vec2(1, 0), glm::vec2(0, 1), glm::vec2(-1, 0), glm::vec2(0, -1) };
+		glm::vec2 rotation = rotations[instance.packed & 3];
+		glm::vec2 corner0(rotation.x * localMin.x + rotation.y * localMin.y, rotation.x * localMin.y - rotation.y * localMin.x);
+		glm::vec2 corner1(rotation.x * localMax.x + rotation.y * localMax.y, rotation.x * localMax.y - rotation.y * localMax.x);
 
-		AABB_Box boundingBox;
-		boundingBox.start = corner0;
-		boundingBox.end = corner1;
-		return boundingBox;
-	}
+		start = instance.position + scale * glm::min(corner0, corner1);
+		end = instance.position + scale * glm::max(corner0, corner1);
 
-	// ref: https://arm-software.github.io/opengl-es-sdk-for-android/terrain.html
-	bool Terrain::intersectsAABB(glm::vec4& start, glm::vec4& end) {
-		// If all corners of an axis-aligned bounding box are on the "wrong side" (negative distance)
-		// of at least one of the frustum planes, we can safely cull the mesh.
-		glm::vec4 corners[8];
-
-		corners[0] = glm::vec4(start.x, start.y, start.z, 1);
-		corners[1] = glm::vec4(start.x, start.y, end.z, 1);
-		corners[2] = glm::vec4(start.x, end.y, start.z, 1);
-		corners[3] = glm::vec4(start.x, end.y, end.z, 1);
-		corners[4] = glm::vec4(end.x, start.y, start.z, 1);
-		corners[5] = glm::vec4(end.x, start.y, end.z, 1);
-		corners[6] = glm::vec4(end.x, end.y, start.z, 1);
-		corners[7] = glm::vec4(end.x, end.y, end.z, 1);
-
-		for (unsigned int p = 0; p < 6; p++)
-		{
-			bool inside_plane = false;
-			for (unsigned int c = 0; c < 8; c++)
-			{
-				// If dot product > 0, we're "inside" the frustum plane,
-				// otherwise, outside.
-				glm::vec4 plane = CoreContext::instance->scene->cameraInfo.planes[p];
-				if (glm::dot(corners[c], plane) > 0.0f)
-				{
-					inside_plane = true;
-					break;
-				}
-			}
-			if (!inside_plane)
-				return false;
-		}
-		return true;
+		int stackStart = clipmapStartIndices[instance.level].x * TILE_SIZE;
+		texelStart = glm::ivec2(glm::floor(start / scale)) - stackStart - 2;
+		texelEnd = glm::ivec2(glm::ceil(end / scale)) - stackStart + 2;
 	}
 
 	glm::ivec2 Terrain::getClipmapPosition(int level, glm::vec3& camPos) {
@@ -17,28 +17,55 @@
 #include "texture.h"
 #include "glm/glm.hpp"
 #include "glm/ext/matrix_transform.hpp"
+#include "mipgenerator.h"
+#include "heightpyramid.h"
+#include "splatbaker.h"
 
 #define TILE_SIZE 256
 #define MEM_TILE_ONE_SIDE 4
 #define TERRAIN_STACK_NUM_CHANNELS 2
-#define MIP_STACK_DIVISOR_POWER 3
+#define TERRAIN_TILE_BYTES (TILE_SIZE * TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS)
+#define TERRAIN_SPLAT_TILE_BYTES (TILE_SIZE * TILE_SIZE * SPLAT_NUM_CHANNELS)
+// Maps whose heightmap stack is bigger than this are paged from disk
+#define TERRAIN_TILE_CACHE_SIZE (512ull * 1024 * 1024)
+#define HEIGHT_PYRAMID_CELL_POWER 3
 #define TERRAIN_TEXTURE_SIZE 1024
+#define TERRAIN_LAYERS_PATH "resources/textures/terrain/layers.xml"
 #define MAX_HEIGHT 150
-#define MAP_SIZE 4096
+// Bounds are conservative, margin only covers rounding of the heights in shader
+#define TERRAIN_BOUNDS_MARGIN 0.01f
 
 #define CLIPMAP_RESOLUTION 120
 #define CLIPMAP_LEVEL 4
 #define PATCH_WIDTH 2
-
-#define BLOCK_COLOR glm::vec3(1,1,1)
-#define FIXUP_VERTICAL_COLOR glm::vec3(1,1,0)
-#define FIXUP_HORIZONTAL_COLOR glm::vec3(1,0,1)
-#define INTERIOR_TRIM_COLOR glm::vec3(0,1,1)
-#define OUTER_DEGENERATE_COLOR glm::vec3(1,0,0)
-#define SMALL_SQUARE_COLOR glm::vec3(0,1,0)
+// Vertices of a level closer than this many of its texels to its outer border blend to the heights of the next level
+#define CLIPMAP_MORPH_WIDTH (CLIPMAP_RESOLUTION / 4)
+
+// Uniform buffer binding points of the terrain program, the same as layout(binding) in the shaders
+#define TERRAIN_FRAME_BINDING 0
+#define TERRAIN_MATERIAL_BINDING 1
+
+// Clipmap pieces in the order they are packed and drawn. Also indices into the debug color palette of terrain.vert
+#define TERRAIN_PIECE_BLOCK 0
+#define TERRAIN_PIECE_RING_FIXUP_VERTICAL 1
+#define TERRAIN_PIECE_RING_FIXUP_HORIZONTAL 2
+#define TERRAIN_PIECE_INTERIOR_TRIM 3
+#define TERRAIN_PIECE_OUTER_DEGENERATE 4
+#define TERRAIN_PIECE_SMALL_SQUARE 5
+#define TERRAIN_PIECE_COUNT 6
 
 #define BLOCK_COUNT 12 * CLIPMAP_LEVEL + 4
 #define RINGFIXUP_COUNT 2 * CLIPMAP_LEVEL + 2
+// Instances before culling in the order of collectCandidates, terrain_cull.comp generates one per invocation
+#define TERRAIN_CANDIDATE_COUNT (BLOCK_COUNT + 2 * (RINGFIXUP_COUNT) + 2 * (CLIPMAP_LEVEL - 1) + 1)
+// Height pyramids of terrain_cull.comp are a header of TERRAIN_PYRAMID_HEADER_WORDS per level, then min | max << 16 of every cell.
+// Header is size, cellPower, mipCount, windowCells, first texel of the stack, 3 unused words, then the size and the first word of each mip.
+#define TERRAIN_PYRAMID_MAX_MIPS 32
+#define TERRAIN_PYRAMID_HEADER_WORDS (8 + 2 * TERRAIN_PYRAMID_MAX_MIPS)
+// Indirect commands of a frame, padded to the instance size
+#define TERRAIN_COMMAND_BYTES ((sizeof(DrawElementsIndirectCommand) * TERRAIN_PIECE_COUNT + sizeof(TerrainInstance) - 1) / sizeof(TerrainInstance) * sizeof(TerrainInstance))
+// Instances of a few frames can be in flight
+#define TERRAIN_INSTANCE_RING_SIZE 65536
 
 namespace Core {
 
@@ -47,13 +74,161 @@ namespace Core {
 	/// </summary>
 
 	class CoreContext;
-
-	struct TerrainVertexAttribs {
+	struct CameraInfo;
+	class RingBuffer;
+	class HeightmapCache;
+	class TerrainTileCache;
+	class TerrainStreamer;
+	class TerrainPrefetcher;
+	struct TerrainStreamTile;
+
+	/*
+	* 16 bytes per instance. Rotation is in quarter turns around Y axis, it is only used by interior trims.
+	*/
+	struct TerrainInstance {
 
 		glm::vec2 position;
-		float level;
-		glm::mat4 model;
-		glm::vec3 color;
+		unsigned int level;
+		unsigned int packed;	// rotation code | color index << 8
+	};
+
+	/*
+	* An instance before frustum culling. 48 bytes, read as words by terrain_cull.comp.
+	*/
+	struct TerrainCullCandidate {
+
+		TerrainInstance instance;
+		glm::vec3 boundsMin;
+		unsigned int piece;
+		glm::vec3 boundsMax;
+		unsigned int padding;
+	};
+
+	/*
+	* Layout is defined by glMultiDrawElementsIndirect.
+	*/
+	struct DrawElementsIndirectCommand {
+
+		unsigned int count;
+		unsigned int instanceCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int baseInstance;
+	};
+
+	/*
+	* std140 layout of the TerrainFrame uniform block of terrain.vert and terrain.frag.
+	*/
+	struct TerrainFrameUniforms {
+
+		glm::mat4 PV;
+		glm::vec3 camPos;
+		float texSize;
+		glm::vec4 levelBounds[CLIPMAP_LEVEL];	// outer border of each level, min x, min z, max x, max z
+	};
+
+	/*
+	* std140 layout of the TerrainMaterial uniform block of terrain.frag. A vec3 is followed by a float
+	* that fills its 16 bytes, floats are packed. It is uploaded only when a parameter changes.
+	*/
+	struct TerrainMaterialUniforms {
+
+		glm::vec3 lightDirection;
+		float lightPow;
+		glm::vec3 color0;
+		float ambientAmount;
+		glm::vec3 color1;
+		float specularAmount;
+		glm::vec3 fogColor;
+		float specularPower;
+
+		float blendDistance;
+		float blendAmount;
+
+		float scale_color0_dist0;
+		float scale_color0_dist1;
+		float scale_color1_dist0;
+		float scale_color1_dist1;
+		float scale_color2_dist0;
+		float scale_color2_dist1;
+		float scale_color3_dist0;
+		float scale_color3_dist1;
+		float scale_color4_dist0;
+		float scale_color4_dist1;
+		float scale_color5_dist0;
+		float scale_color5_dist1;
+		float scale_color6_dist0;
+		float scale_color6_dist1;
+		float scale_color7_dist0;
+		float scale_color7_dist1;
+		float scale_color8_dist0;
+		float scale_color8_dist1;
+
+		float macroScale_0;
+		float macroScale_1;
+		float macroScale_2;
+		float macroPower;
+		float macroOpacity;
+		float macroAmountLayer0;
+		float macroAmountLayer1;
+		float macroAmountLayer2;
+		float macroAmountLayer3;
+		float macroAmountLayer4;
+
+		float overlayBlendScale0;
+		float overlayBlendAmount0;
+		float overlayBlendPower0;
+		float overlayBlendOpacity0;
+		float overlayBlendScale1;
+		float overlayBlendAmount1;
+		float overlayBlendPower1;
+		float overlayBlendOpacity1;
+		float overlayBlendScale2;
+		float overlayBlendAmount2;
+		float overlayBlendPower2;
+		float overlayBlendOpacity2;
+		float overlayBlendScale3;
+		float overlayBlendAmount3;
+		float overlayBlendPower3;
+		float overlayBlendOpacity3;
+
+		float slopeSharpness0;
+		float slopeSharpness1;
+		float slopeSharpness2;
+		float slopeBias0;
+		float slopeBias1;
+		float slopeBias2;
+
+		float heightBias0;
+		float heightSharpness0;
+
+		float distanceNear;
+		float fogBlendDistance;
+		float maxFog;
+		float padding[3];	// block size is a multiple of 16 bytes
+	};
+
+	/*
+	* A material layer of the terrain as listed in the layer file. Texture names are keys of FileSystem::textures.
+	*/
+	struct TerrainLayer {
+
+		std::string name;
+		std::string albedo;
+		std::string ao;
+		std::string normal;
+	};
+
+	/*
+	* Range of a piece in the shared vertex and index buffer.
+	*/
+	struct TerrainPieceMesh {
+
+		unsigned int indexCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		glm::vec2 localMin;		// extent of the vertices before scaling and rotating
+		glm::vec2 localMax;
 	};
 
 	class  __declspec(dllexport) Terrain {
@@ -62,74 +237,137 @@ namespace Core {
 
 		glm::vec3 cameraPosition;
 
+		// replays camera paths without a scene, so it moves cameraPosition itself
+		friend class TerrainBenchmark;
+
 	public:
 
 		AABB_Box blockAABBs[BLOCK_COUNT];
+		HeightPyramidWindow blockWindows[BLOCK_COUNT];
 		glm::vec2 blockPositions[BLOCK_COUNT];
 		glm::vec2 ringFixUpVerticalPositions[RINGFIXUP_COUNT];
 		glm::vec2 ringFixUpHorizontalPositions[RINGFIXUP_COUNT];
 		glm::vec2 interiorTrimPositions[CLIPMAP_LEVEL];
 		glm::vec2 outerDegeneratePositions[CLIPMAP_LEVEL];
 		glm::vec2 smallSquarePosition;
-		float rotAmounts[CLIPMAP_LEVEL];
+		unsigned int rotationCodes[CLIPMAP_LEVEL];
+		glm::ivec2 clipmapOrigins[CLIPMAP_LEVEL];	// snapped camera position of each level in its texels, the positions above are made from it
 
 		unsigned int terrainProgramID;
+		unsigned int cullProgramID = 0;
+
+		/*
+		* Permutation of the terrain program, see getShaderDefines. Programs belong to the shader manager.
+		* When a permutation is changed, the previous program is drawn with until the new one is linked.
+		*/
+		std::string vertexShaderPath;
+		std::string fragmentShaderPath;
+		bool fog = true;
+		bool debugColors = false;
+
+		/*
+		* Uniform blocks of the terrain program, bound to TERRAIN_FRAME_BINDING and TERRAIN_MATERIAL_BINDING.
+		* Last uploaded contents are kept to skip uploads when nothing changed.
+		*/
+		unsigned int frameUniformBuffer = 0;
+		unsigned int materialUniformBuffer = 0;
+		TerrainFrameUniforms frameUniforms;
+		TerrainMaterialUniforms materialUniforms;
+		bool uniformsUploaded = false;
+		unsigned int materialUploads = 0;
+
+		/* Uniform locations of the cull program, resolved once after linking */
+		int cullPlanesLocation = -1;
+		int cullOriginsLocation = -1;
+		int cullPieceExtentsLocation = -1;
+		int cullCommandWordLocation = -1;
+
+		/* Height pyramids of every level for the bounds that the cull program computes, uploaded once they are loaded */
+		unsigned int pyramidBuffer = 0;
+		unsigned long long pyramidBufferBytes = 0;
 		unsigned int elevationMapTextureArray;
 
-		/* Solution textures to get rid of tiling effect of the terrain */
-		unsigned int macroTexture;
-		unsigned int noiseTexture;
-
-		/* Terrain albedo textures */
-		unsigned int albedo0;
-		unsigned int albedo1;
-		unsigned int albedo2;
-		unsigned int albedo3;
-		unsigned int albedo4;
-		unsigned int albedo5;
-		unsigned int albedo6;
-		//unsigned int albedo9;
-		//unsigned int albedo10;
-
-		/* Terrain normal textures */
-		unsigned int normal0;
-		unsigned int normal1;
-		unsigned int normal2;
-		unsigned int normal3;
-		unsigned int normal4;
-		unsigned int normal5;
-		unsigned int normal6;
-		unsigned int normal7;
-		unsigned int normal8;
-		//unsigned int normal9;
-		//unsigned int normal10;
-
-		/* For the geometry */
-		unsigned int blockVAO;
-		unsigned int blockIndiceCount;
-		unsigned int ringFixUpVerticalVAO;
-		unsigned int ringFixUpVerticalIndiceCount;
-		unsigned int ringFixUpHorizontalVAO;
-		unsigned int ringFixUpHorizontalIndiceCount;
-		unsigned int smallSquareVAO;
-		unsigned int smallSquareIndiceCount;
-		unsigned int outerDegenerateVAO;
-		unsigned int outerDegenerateIndiceCount;
-		unsigned int interiorTrimVAO;
-		unsigned int interiorTrimIndiceCount;
+		/*
+		* Material blend factors of every texel of the elevation map, in the same toroidal layout. Tiles are baked
+		* on the streaming thread with splatParameters. They are all baked again when the parameters are edited.
+		*/
+		unsigned int splatMapTextureArray = 0;
+		SplatParameters splatParameters;
+		float splatBakeDuration = 0.f;
+
+		/*
+		* Terrain layers packed into texture arrays, a layer has the same index in albedo and normal arrays.
+		* Albedo array keeps ambient occlusion in alpha. Utility array keeps macro and noise maps.
+		* Layers come from TERRAIN_LAYERS_PATH. Arrays are block compressed if they were cooked, textureFormats tells which.
+		*/
+		unsigned int albedoArray = 0;
+		unsigned int normalArray = 0;
+		unsigned int utilityArray = 0;
+		std::vector<TerrainLayer> layers;
+		std::vector<std::string> utilityLayers;
+		std::string textureFormats;
+		float textureLoadDuration = 0.f;
+		unsigned long long materialTextureBytes = 0;	// of the three arrays with their mipmaps
+
+		/* For the geometry, all pieces share one vertex and index buffer */
+		unsigned int clipmapVAO;
+		unsigned int clipmapVBO;
+		unsigned int clipmapEBO;
+		unsigned long long clipmapBufferBytes = 0;
+		TerrainPieceMesh pieces[TERRAIN_PIECE_COUNT];
+
+		/* Instances and indirect commands are written to a persistent ring every frame, the VAO points to it once */
+		RingBuffer* instanceRing = NULL;
+		unsigned int instanceBuffer = 0;
 
 		/*
 		* Heightmap stack is used by program while running to get 
-		* terrain height values to give shape of the terrain
+		* terrain height values to give shape of the terrain. Stored tile by tile, see getStackTile.
 		*/
-		unsigned char** heightmapStack;
+		unsigned char** heightmapStack = NULL;
+		bool heightmapStackMapped = false;	// levels point into the memory mapped heightmap cache
 		glm::ivec2 clipmapStartIndices[CLIPMAP_LEVEL];
 
 		/*
-		* Low resolution heightmap stack is for calculating bounding box
-		* of each blocks that is used by frustum culling algorithm.
+		* Min/max height pyramid of each level is for calculating bounding box
+		* of each piece that is used by frustum culling algorithm.
+		*/
+		HeightPyramid* heightPyramids[CLIPMAP_LEVEL] = {};
+
+		/*
+		* Cooked heightmap stack and pyramids. Loading it skips png decoding on start.
+		*/
+		HeightmapCache* heightmapCache = NULL;
+
+		/*
+		* Size of the map in texels. It is read from the heightmap, the map is placed at mapSize * 2 in the virtual heightmap.
+		*/
+		int mapSize = 0;
+
+		/*
+		* Pages tiles from disk when the heightmap stack does not fit tileCacheSize. Heightmap stack is NULL then.
+		*/
+		TerrainTileCache* tileCache = NULL;
+		unsigned long long tileCacheSize = TERRAIN_TILE_CACHE_SIZE;
+
+		/*
+		* Filter of the coarser clipmap levels, one of MIP_FILTER_*. Heights are filtered as 16 bit values.
+		* terrain.vert morphs the outer vertices of a level to the heights of the next level, so a filtered level meets
+		* the coarser one at its border without cracks. Box stays in the range of the texels under it, so the pyramid
+		* bounds hold the morphed heights. Lanczos and Kaiser can overshoot them by a little.
+		*/
+		int mipFilter = MIP_FILTER_BOX;
+		float heightmapLoadDuration = 0.f;
+
+		/*
+		* Builds toroidal updates off the render thread and uploads them within a budget per frame.
+		*/
+		TerrainStreamer* streamer = NULL;
+
+		/*
+		* Warms the tiles on the predicted path of the camera, in the tile cache or in the page cache of the mapped stack.
 		*/
-		unsigned char** lowResolustionHeightmapStack;
+		TerrainPrefetcher* prefetcher = NULL;
 
 		// in ui 
 		glm::vec3 lightDir;
@@ -221,35 +459,69 @@ namespace Core {
 		float heightSharpness0 = 2;
 
 		bool showBounds = false;
+		bool gpuCulling = false;
 
 		Terrain();
 		~Terrain();
 		void start();
 		void initShaders(const char* vertexShader, const char* fragShader);
+		void initCullProgram();
+		std::vector<std::string> getShaderDefines();
+		void updateProgram();
+		void initUniformBuffers();
+		void updateUniformBuffers(const CameraInfo& camera);
 		void initBlockAABBs();
+		void loadHeightmap(const std::string path);
+		void releaseHeightmapStack();
 		void initHeightmapStack(const std::string path);
 		void loadTerrainHeightmapOnInit(glm::vec3 camPos, int clipmapLevel);
 		void generateTerrainClipmapsVertexArrays();
-		void createElevationMapTextureArray(unsigned char** heightmapArray);
-		void loadTextures();
-		unsigned char* resizeHeightmap(const unsigned char* heightmap, int size);
+		void createElevationMapTextureArray();
+		void createSplatMapTextureArray();
+		SplatParameters getSplatParameters();
+		void bakeSplatMap(glm::vec3 camPos);
+		void loadTextures(const std::string path);
+		bool loadCookedTextures(const std::string path);
+		static bool readLayerFile(const std::string path, std::vector<TerrainLayer>& layers, std::vector<std::string>& utilityLayers);
+		static void createLayerTextures(const std::vector<TerrainLayer>& layers, const std::vector<std::string>& utilityLayers, std::map<std::string, Texture*>& textures,
+			std::vector<Texture*>& albedoLayers, std::vector<Texture*>& normalLayers, std::vector<Texture*>& utilityTextures);
 		unsigned char** createMipmaps(const unsigned char* const heights, int size, int totalLevel);
 		void createHeightmapStack(unsigned char** heightMapList, int width);
-		void createLowResolutionHeightmapStack();
+		static void getClipmapStartIndices(int mapSize, glm::ivec2* startIndices);
+		void createHeightPyramids();
 		void update(float dt);
 		void onDraw();
-		void drawElementsInstanced(unsigned int VAO, std::vector<TerrainVertexAttribs>& instanceArray, unsigned int indiceCount);
+		void drawClipmap(const CameraInfo& camera);
+		void initInstanceBuffer();
+		void collectCandidates(std::vector<TerrainCullCandidate>& candidates, unsigned int* first, unsigned int* capacity);
+		static void getCandidateRanges(unsigned int* first, unsigned int* capacity);
+		void getCandidateInstance(unsigned int index, TerrainInstance& instance, unsigned int& piece);
+		void generateCandidate(const unsigned int* pyramidWords, unsigned int index, TerrainCullCandidate& candidate);
+		static void getPackedMinMax(const unsigned int* pyramidWords, int level, glm::ivec2 start, glm::ivec2 end, unsigned short& min, unsigned short& max);
+		static void getPackedWindowMinMax(const unsigned int* pyramidWords, int level, glm::ivec2 texelStart, unsigned short& min, unsigned short& max);
+		void packHeightPyramids(std::vector<unsigned int>& words);
+		void uploadHeightPyramids();
+		static void cullCandidates(const TerrainCullCandidate* candidates, unsigned int candidateCount, const glm::vec4* planes, const unsigned int* first, TerrainInstance* instances, unsigned int* count,
+			unsigned int* visibleBlocks = NULL);
+		void countDrawnInstances(const unsigned int* first, const unsigned int* count, const unsigned int* visibleBlocks, bool cullOnGPU);
+		void updateMemoryCounters();
+		static void buildDrawCommands(const TerrainPieceMesh* pieces, const unsigned int* first, const unsigned int* count, unsigned int baseInstance, DrawElementsIndirectCommand* commands);
 		void calculateBlockPositions(glm::vec3 camPosition);
 		void streamTerrain(glm::vec3 newCamPos);
 		void streamTerrainHorizontal(glm::ivec2 old_tileIndex, glm::ivec2 old_tileStart, glm::ivec2 old_border, glm::ivec2 new_tileIndex, glm::ivec2 new_tileStart, glm::ivec2 new_border, glm::ivec2 tileDelta, int level);
 		void streamTerrainVertical(glm::ivec2 old_tileIndex, glm::ivec2 old_tileStart, glm::ivec2 old_border, glm::ivec2 new_tileIndex, glm::ivec2 new_tileStart, glm::ivec2 new_border, glm::ivec2 tileDelta, int level);
-		void writeHeightDataToGPUBuffer(glm::ivec2 index, glm::ivec2 tileStart, int texWidth, unsigned char* heightMap, int level);
-		void loadHeightmapAtLevel(int level, glm::vec3 camPos, unsigned char* heightData);
-		void updateHeightMapTextureArrayPartial(int level, glm::ivec2 size, glm::ivec2 position, unsigned char* heights);
+		const unsigned char* getStackTile(int level, glm::ivec2 tileStart);
+		void writeHeightDataToGPUBuffer(glm::ivec2 tileStart, unsigned char* heightMap, int level);
+		void writeSplatDataToGPUBuffer(glm::ivec2 tileStart, unsigned char* splatMap, int level);
+		void loadHeightmapAtLevel(int level, glm::vec3 camPos);
+		void collectLevelTiles(int level, glm::vec3 camPos, std::vector<TerrainStreamTile>& tiles);
+		void updateHeightMapTextureArrayPartial(int level, glm::ivec2 size, glm::ivec2 position, const unsigned char* heights);
+		void updateSplatMapTextureArrayPartial(int level, glm::ivec2 size, glm::ivec2 position, const unsigned char* splat);
 		void calculateBoundingBoxes(glm::vec3 camPos);
 		AABB_Box getBlockBoundingBox(int index, int level);
-		bool intersectsAABB(glm::vec4& start, glm::vec4& end);
-		glm::ivec2 getClipmapPosition(int level, glm::vec3& camPos);
-		glm::ivec2 getTileIndex(int level, glm::vec3& camPos);
+		AABB_Box getPieceBoundingBox(int piece, TerrainInstance& instance);
+		void getPieceExtent(int piece, TerrainInstance& instance, glm::vec2& start, glm::vec2& end, glm::ivec2& texelStart, glm::ivec2& texelEnd);
+		static glm::ivec2 getClipmapPosition(int level, glm::vec3& camPos);
+		static glm::ivec2 getTileIndex(int level, glm::vec3& camPos);
 	};
 }
\ No newline at end of file
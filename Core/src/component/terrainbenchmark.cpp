@@ -0,0 +1,598 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "pch.h"
+#include "terrainbenchmark.h"
+#include "terrainstreamer.h"
+#include "terrainprefetcher.h"
+#include "terraintilecache.h"
+#include "heightmapcache.h"
+#include "cpufeatures.h"
+#include "gldispatch.h"
+#include "counters.h"
+#include "scene.h"
+#include "lodepng/lodepng.h"
+#include "glm/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <sstream>
+
+namespace Core {
+
+	const char* TerrainBenchmark::stageNames[TERRAIN_BENCHMARK_STAGE_COUNT] = {
+		"prefetch", "calculateBlockPositions", "calculateBoundingBoxes", "streamTerrain", "upload", "draw", "frame"
+	};
+
+	/*
+	* 16 bit grey png with the heights of HeightmapCache::cookSynthetic, so it goes through the same ingest as a real map.
+	*/
+	bool TerrainBenchmark::writeSyntheticHeightmap(const std::string& path, int size) {
+
+		std::vector<unsigned char> image((size_t)size * size * 2);
+
+		for (int z = 0; z < size; z++) {
+			for (int x = 0; x < size; x++) {
+				unsigned short height = (unsigned short)(32768 + 16384 * sin(x * 0.0011) * cos(z * 0.0007) + 8192 * sin((x + z) * 0.0031));
+				image[((size_t)z * size + x) * 2] = height >> 8;
+				image[((size_t)z * size + x) * 2 + 1] = height & 255;
+			}
+		}
+
+		return lodepng::encode(path, image, size, size, LCT_GREY, 16) == 0;
+	}
+
+	/*
+	* Camera looks along the movement to the next frame, a little down to the terrain.
+	*/
+	void TerrainBenchmark::finishPath(TerrainCameraPath& path) {
+
+		glm::vec3 direction = glm::normalize(glm::vec3(1.f, -0.3f, 0.f));
+		path.directions.resize(path.positions.size());
+
+		for (size_t i = 0; i < path.positions.size(); i++) {
+
+			if (i + 1 < path.positions.size()) {
+				glm::vec3 movement = path.positions[i + 1] - path.positions[i];
+				movement.y = 0.f;
+				if (glm::length(movement) > 0.f)
+					direction = glm::normalize(glm::normalize(movement) + glm::vec3(0.f, -0.3f, 0.f));
+			}
+			path.directions[i] = direction;
+		}
+	}
+
+	/*
+	* Crosses most of the map along x at the speed of the tile cache benchmark.
+	*/
+	TerrainCameraPath TerrainBenchmark::createStraightPath(int mapSize, int frames) {
+
+		TerrainCameraPath path;
+		path.name = "straight";
+
+		float speed = mapSize * 0.8f / frames;
+		glm::vec3 position(mapSize * 2 + mapSize * 0.1f, TERRAIN_BENCHMARK_CAMERA_HEIGHT, mapSize * 2 + mapSize * 0.5f);
+
+		for (int i = 0; i < frames; i++) {
+			path.positions.push_back(position);
+			position.x += speed;
+		}
+
+		TerrainBenchmark::finishPath(path);
+		return path;
+	}
+
+	/*
+	* Three turns around the center of the map with a growing radius, every level is streamed in both directions.
+	*/
+	TerrainCameraPath TerrainBenchmark::createSpiralPath(int mapSize, int frames) {
+
+		TerrainCameraPath path;
+		path.name = "spiral";
+
+		glm::vec3 center(mapSize * 2.5f, TERRAIN_BENCHMARK_CAMERA_HEIGHT, mapSize * 2.5f);
+
+		for (int i = 0; i < frames; i++) {
+			float t = (float)i / frames;
+			float angle = t * 3.f * 6.2831853f;
+			float radius = mapSize * (0.05f + 0.35f * t);
+			path.positions.push_back(center + glm::vec3(cos(angle), 0.f, sin(angle)) * radius);
+		}
+
+		TerrainBenchmark::finishPath(path);
+		return path;
+	}
+
+	/*
+	* Moves on a random heading and jumps to a random point of the map every TERRAIN_BENCHMARK_TELEPORT_INTERVAL frames.
+	* Jumps are further than the tile window, so whole levels are reloaded. Seed is fixed so runs are comparable.
+	*/
+	TerrainCameraPath TerrainBenchmark::createTeleportPath(int mapSize, int frames) {
+
+		TerrainCameraPath path;
+		path.name = "teleports";
+
+		std::mt19937 random(1);
+		std::uniform_real_distribution<float> distribution(0.1f, 0.9f);
+
+		float speed = mapSize * 0.8f / frames;
+		glm::vec3 position;
+		glm::vec3 velocity;
+
+		for (int i = 0; i < frames; i++) {
+
+			if (i % TERRAIN_BENCHMARK_TELEPORT_INTERVAL == 0) {
+				position = glm::vec3(mapSize * (2 + distribution(random)), TERRAIN_BENCHMARK_CAMERA_HEIGHT, mapSize * (2 + distribution(random)));
+				float heading = distribution(random) * 7.853982f;
+				velocity = glm::vec3(cos(heading), 0.f, sin(heading)) * speed;
+			}
+
+			path.positions.push_back(position);
+			position += velocity;
+		}
+
+		TerrainBenchmark::finishPath(path);
+		return path;
+	}
+
+	bool TerrainBenchmark::loadPath(const std::string& file, TerrainCameraPath& path) {
+
+		std::ifstream stream(file);
+		if (!stream.is_open())
+			return false;
+
+		path.name = std::filesystem::path(file).stem().string();
+		path.positions.clear();
+
+		std::string line;
+		while (std::getline(stream, line)) {
+
+			if (line.empty() || line[0] == '#')
+				continue;
+
+			std::istringstream values(line);
+			glm::vec3 position;
+			if (values >> position.x >> position.y >> position.z)
+				path.positions.push_back(position);
+		}
+
+		TerrainBenchmark::finishPath(path);
+		return path.positions.size() > 1;
+	}
+
+	/*
+	* Planes from the rows of the view projection matrix, normalized and facing inside like the ones of the scene camera.
+	* Order is near, far, left, right, top, bottom.
+	*/
+	void TerrainBenchmark::getFrustumPlanes(const glm::mat4& VP, glm::vec4* planes) {
+
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+			rows[i] = glm::vec4(VP[0][i], VP[1][i], VP[2][i], VP[3][i]);
+
+		planes[0] = rows[3] + rows[2];
+		planes[1] = rows[3] - rows[2];
+		planes[2] = rows[3] + rows[0];
+		planes[3] = rows[3] - rows[0];
+		planes[4] = rows[3] - rows[1];
+		planes[5] = rows[3] + rows[1];
+
+		for (int i = 0; i < 6; i++)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	/*
+	* Nearest rank percentile of sorted samples.
+	*/
+	float TerrainBenchmark::getPercentile(const std::vector<float>& sorted, float percentile) {
+
+		if (sorted.empty())
+			return 0.f;
+
+		size_t rank = (size_t)ceil(percentile * 0.01f * sorted.size());
+		return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+	}
+
+	void TerrainBenchmark::releaseHeightmap(Terrain* terrain) {
+
+		terrain->releaseHeightmapStack();
+		delete terrain->heightmapCache;
+		terrain->heightmapCache = NULL;
+		delete terrain->tileCache;
+		terrain->tileCache = NULL;
+	}
+
+	/*
+	* Builds the heightmap stack and the height pyramids from the png, or maps them from the cooked cache.
+	* Returns the duration in ms, negative if the cache could not be loaded.
+	*/
+	float TerrainBenchmark::ingest(Terrain* terrain, const std::string& heightmapPath, bool fromCache) {
+
+		TerrainBenchmark::releaseHeightmap(terrain);
+
+		auto begin = std::chrono::high_resolution_clock::now();
+
+		if (fromCache) {
+			std::string cachePath = std::filesystem::path(heightmapPath).replace_extension(".heightcache").string();
+			terrain->heightmapCache = new HeightmapCache();
+			if (!terrain->heightmapCache->load(terrain, heightmapPath, cachePath))
+				return -1.f;
+		}
+		else {
+			terrain->initHeightmapStack(heightmapPath);
+			terrain->createHeightPyramids();
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001f;
+	}
+
+	/*
+	* Same order as Terrain::update followed by the culling of Terrain::onDraw. The clipmap is loaded at the start of the path
+	* like on start, the streamer is drained at the end so the next path starts without jobs in flight.
+	*/
+	void TerrainBenchmark::replay(Terrain* terrain, const TerrainCameraPath& path, TerrainBenchmarkResult& result) {
+
+		int mapSize = terrain->mapSize;
+		glm::vec3 minPosition(mapSize * 2 + 1, 0, mapSize * 2 + 1);
+		glm::vec3 maxPosition(mapSize * 3 - 1, 0, mapSize * 3 - 1);
+
+		result.name = path.name;
+
+		glm::vec3 start = glm::clamp(path.positions[0], minPosition, maxPosition);
+		terrain->cameraPosition = start;
+		terrain->loadTerrainHeightmapOnInit(start, CLIPMAP_LEVEL);
+		terrain->calculateBlockPositions(start);
+		terrain->initBlockAABBs();
+		terrain->uploadHeightPyramids();
+
+		// terrain_cull.comp reads the pyramids from this buffer, generateCandidate reads the same words
+		std::vector<unsigned char> pyramidBytes;
+		GLDispatch::getBufferData(terrain->pyramidBuffer, pyramidBytes);
+		std::vector<unsigned int> pyramidWords(pyramidBytes.size() / sizeof(unsigned int));
+		if (!pyramidWords.empty())
+			memcpy(&pyramidWords[0], &pyramidBytes[0], pyramidWords.size() * sizeof(unsigned int));
+
+		delete terrain->prefetcher;
+		terrain->prefetcher = new TerrainPrefetcher(terrain);
+
+		glm::mat4 projection = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 10000.f);
+		CameraInfo camera;
+
+		std::vector<TerrainCullCandidate> candidates;
+		unsigned int first[TERRAIN_PIECE_COUNT];
+		unsigned int capacity[TERRAIN_PIECE_COUNT];
+
+		for (int stage = 0; stage < TERRAIN_BENCHMARK_STAGE_COUNT; stage++)
+			result.samples[stage].reserve(path.positions.size());
+		result.glCalls.reserve(path.positions.size());
+
+		// calls and uploads of the clipmap load are not a frame
+		GLDispatch::endFrame();
+		Counters::frame = {};
+
+		for (size_t frame = 0; frame < path.positions.size(); frame++) {
+
+			glm::vec3 eye = path.positions[frame];
+			glm::vec3 camPosition = glm::clamp(eye, minPosition, maxPosition);
+			camera.camPos = eye;
+			camera.VP = projection * glm::lookAt(eye, eye + path.directions[frame], glm::vec3(0, 1, 0));
+			TerrainBenchmark::getFrustumPlanes(camera.VP, camera.planes);
+
+			std::chrono::high_resolution_clock::time_point times[TERRAIN_BENCHMARK_STAGE_FRAME + 1];
+			times[0] = std::chrono::high_resolution_clock::now();
+
+			terrain->prefetcher->update(camPosition, TERRAIN_BENCHMARK_DT);
+			times[TERRAIN_BENCHMARK_STAGE_PREFETCH + 1] = std::chrono::high_resolution_clock::now();
+
+			terrain->calculateBlockPositions(camPosition);
+			times[TERRAIN_BENCHMARK_STAGE_BLOCK_POSITIONS + 1] = std::chrono::high_resolution_clock::now();
+
+			terrain->calculateBoundingBoxes(camPosition);
+			times[TERRAIN_BENCHMARK_STAGE_BOUNDING_BOXES + 1] = std::chrono::high_resolution_clock::now();
+
+			terrain->streamTerrain(camPosition);
+			times[TERRAIN_BENCHMARK_STAGE_STREAM + 1] = std::chrono::high_resolution_clock::now();
+
+			terrain->streamer->upload();
+			terrain->cameraPosition = camPosition;
+			times[TERRAIN_BENCHMARK_STAGE_UPLOAD + 1] = std::chrono::high_resolution_clock::now();
+
+			terrain->drawClipmap(camera);
+			times[TERRAIN_BENCHMARK_STAGE_DRAW + 1] = std::chrono::high_resolution_clock::now();
+
+			for (int stage = 0; stage < TERRAIN_BENCHMARK_STAGE_FRAME; stage++)
+				result.samples[stage].push_back(std::chrono::duration<float, std::micro>(times[stage + 1] - times[stage]).count());
+			result.samples[TERRAIN_BENCHMARK_STAGE_FRAME].push_back(std::chrono::duration<float, std::micro>(times[TERRAIN_BENCHMARK_STAGE_FRAME] - times[0]).count());
+
+			// candidates of the GPU path must be the CPU ones of the frame, outside of the timed stages
+			candidates.clear();
+			terrain->collectCandidates(candidates, first, capacity);
+			bool candidatesDiffer = pyramidWords.empty();
+			for (unsigned int i = 0; i < candidates.size() && !candidatesDiffer; i++) {
+				TerrainCullCandidate generated;
+				terrain->generateCandidate(&pyramidWords[0], i, generated);
+				candidatesDiffer = memcmp(&generated, &candidates[i], sizeof(TerrainCullCandidate)) != 0;
+			}
+			if (candidatesDiffer)
+				result.candidateMismatches++;
+
+			result.visibleInstances += Counters::frame.values[COUNTER_VISIBLE_INSTANCES];
+			result.candidates += candidates.size();
+			result.uploadedBytes += terrain->streamer->uploadedBytes;
+			result.glCalls.push_back((float)GLDispatch::frame.calls);
+			result.glUploadedBytes += GLDispatch::frame.uploadedBytes;
+			GLDispatch::endFrame();
+			Counters::endFrame(result.samples[TERRAIN_BENCHMARK_STAGE_FRAME].back() * 0.001f);
+			result.fullReloads += Counters::get(COUNTER_FULL_RELOADS);
+
+			if (frame + 1 == TERRAIN_BENCHMARK_CHECK_FRAME) {
+				unsigned int elevationMismatches = 0;
+				unsigned int splatMismatches = 0;
+				TerrainBenchmark::drain(terrain, result);
+				TerrainBenchmark::checkTextureArrays(terrain, TERRAIN_BENCHMARK_CHECK_LEVEL, elevationMismatches, splatMismatches);
+				result.levelChecked = true;
+				result.levelMismatches = elevationMismatches + splatMismatches;
+			}
+		}
+
+		result.drainDuration = TerrainBenchmark::drain(terrain, result);
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++)
+			TerrainBenchmark::checkTextureArrays(terrain, level, result.elevationMismatches, result.splatMismatches);
+	}
+
+	/*
+	* Uploads the jobs in flight, outside of any frame. Returns the time it took in ms.
+	*/
+	float TerrainBenchmark::drain(Terrain* terrain, TerrainBenchmarkResult& result) {
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		while (terrain->streamer->jobsInFlight > 0) {
+			std::this_thread::yield();
+			terrain->streamer->upload();
+			result.uploadedBytes += terrain->streamer->uploadedBytes;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		result.glUploadedBytes += GLDispatch::frame.uploadedBytes;
+		GLDispatch::endFrame();
+
+		return std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001f;
+	}
+
+	/*
+	* Every tile of the level around the last camera position has to be in the texture arrays of the null backend where
+	* the toroidal layout puts it, with the heights of the heightmap and the factors the splat baker gives for them.
+	*/
+	void TerrainBenchmark::checkTextureArrays(Terrain* terrain, int level, unsigned int& elevationMismatches, unsigned int& splatMismatches) {
+
+		const int size = TILE_SIZE * MEM_TILE_ONE_SIDE;
+		std::vector<unsigned char> elevation;
+		std::vector<unsigned char> splat;
+		std::vector<unsigned char> heights(TERRAIN_TILE_BYTES);
+		std::vector<unsigned char> weights(TERRAIN_SPLAT_TILE_BYTES);
+
+		auto matches = [size](const std::vector<unsigned char>& layer, glm::ivec2 position, const unsigned char* tile, int texelBytes) {
+			for (int row = 0; row < TILE_SIZE; row++) {
+				const unsigned char* texels = &layer[((size_t)(position.y + row) * size + position.x) * texelBytes];
+				if (memcmp(texels, tile + (size_t)row * TILE_SIZE * texelBytes, (size_t)TILE_SIZE * texelBytes) != 0)
+					return false;
+			}
+			return true;
+		};
+
+		bool elevationRead = GLDispatch::getTextureImage(terrain->elevationMapTextureArray, 0, level, elevation);
+		bool splatRead = GLDispatch::getTextureImage(terrain->splatMapTextureArray, 0, level, splat);
+
+		std::vector<TerrainStreamTile> tiles;
+		terrain->collectLevelTiles(level, terrain->cameraPosition, tiles);
+
+		for (TerrainStreamTile& tile : tiles) {
+
+			glm::ivec2 position = tile.index * TILE_SIZE;
+
+			terrain->writeHeightDataToGPUBuffer(tile.tileStart, &heights[0], level);
+			if (!elevationRead || !matches(elevation, position, &heights[0], TERRAIN_STACK_NUM_CHANNELS))
+				elevationMismatches++;
+
+			terrain->writeSplatDataToGPUBuffer(tile.tileStart, &weights[0], level);
+			if (!splatRead || !matches(splat, position, &weights[0], SPLAT_NUM_CHANNELS))
+				splatMismatches++;
+		}
+	}
+
+	/*
+	* Stage samples are in microseconds, ingest samples in milliseconds.
+	*/
+	bool TerrainBenchmark::writeJSON(const std::string& outputPath, const std::string& heightmapPath, int mapSize, const std::vector<float>* ingestSamples, const std::vector<TerrainBenchmarkResult>& results) {
+
+		std::ofstream file(outputPath, std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		auto writeString = [&file](const std::string& value) {
+			file << '"';
+			for (char c : value) {
+				if (c == '"' || c == '\\')
+					file << '\\';
+				file << c;
+			}
+			file << '"';
+		};
+
+		auto writeStatistics = [&file](std::vector<float> samples) {
+			std::sort(samples.begin(), samples.end());
+			double sum = 0.0;
+			for (float sample : samples)
+				sum += sample;
+			file << "{ \"count\": " << samples.size()
+				<< ", \"mean\": " << (samples.empty() ? 0.0 : sum / samples.size())
+				<< ", \"p50\": " << TerrainBenchmark::getPercentile(samples, 50.f)
+				<< ", \"p90\": " << TerrainBenchmark::getPercentile(samples, 90.f)
+				<< ", \"p99\": " << TerrainBenchmark::getPercentile(samples, 99.f)
+				<< ", \"max\": " << (samples.empty() ? 0.f : samples.back()) << " }";
+		};
+
+		file << "{\n";
+		file << "  \"heightmap\": ";
+		writeString(heightmapPath);
+		file << ",\n";
+		file << "  \"mapSize\": " << mapSize << ",\n";
+		file << "  \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n";
+		file << "  \"cullingInstructionSet\": \"" << CPUFeatures::instructionSetNames[CPUFeatures::instructionSet] << "\",\n";
+		file << "  \"ingestMs\": {\n";
+		file << "    \"png\": ";
+		writeStatistics(ingestSamples[0]);
+		file << ",\n    \"cache\": ";
+		writeStatistics(ingestSamples[1]);
+		file << "\n  },\n";
+		file << "  \"paths\": [\n";
+
+		for (size_t i = 0; i < results.size(); i++) {
+
+			const TerrainBenchmarkResult& result = results[i];
+			size_t frames = result.samples[TERRAIN_BENCHMARK_STAGE_FRAME].size();
+
+			file << "    {\n";
+			file << "      \"name\": ";
+			writeString(result.name);
+			file << ",\n";
+			file << "      \"frames\": " << frames << ",\n";
+			file << "      \"candidatesPerFrame\": " << (frames ? (double)result.candidates / frames : 0.0) << ",\n";
+			file << "      \"visibleInstancesPerFrame\": " << (frames ? (double)result.visibleInstances / frames : 0.0) << ",\n";
+			file << "      \"uploadedBytes\": " << result.uploadedBytes << ",\n";
+			file << "      \"fullReloads\": " << result.fullReloads << ",\n";
+			file << "      \"drainMs\": " << result.drainDuration << ",\n";
+			file << "      \"glUploadedBytes\": " << result.glUploadedBytes << ",\n";
+			file << "      \"elevationMismatches\": " << result.elevationMismatches << ",\n";
+			file << "      \"splatMismatches\": " << result.splatMismatches << ",\n";
+			file << "      \"gpuCandidateMismatches\": " << result.candidateMismatches << ",\n";
+			if (result.levelChecked)
+				file << "      \"level" << TERRAIN_BENCHMARK_CHECK_LEVEL << "MismatchesAtFrame" << TERRAIN_BENCHMARK_CHECK_FRAME << "\": " << result.levelMismatches << ",\n";
+			file << "      \"glCallsPerFrame\": ";
+			writeStatistics(result.glCalls);
+			file << ",\n";
+			file << "      \"stagesUs\": {\n";
+
+			for (int stage = 0; stage < TERRAIN_BENCHMARK_STAGE_COUNT; stage++) {
+				file << "        \"" << stageNames[stage] << "\": ";
+				writeStatistics(result.samples[stage]);
+				file << (stage + 1 < TERRAIN_BENCHMARK_STAGE_COUNT ? ",\n" : "\n");
+			}
+
+			file << "      }\n";
+			file << "    }" << (i + 1 < results.size() ? ",\n" : "\n");
+		}
+
+		file << "  ]\n";
+		file << "}\n";
+
+		return file.good();
+	}
+
+	/*
+	* Ingests the heightmap of the scene, or a synthetic one if it is missing, from png and from the cooked cache.
+	* Then the synthetic paths and the recorded one, if given, are replayed. Results are written to outputPath and printed.
+	*/
+	bool TerrainBenchmark::run(const std::string& outputPath, const std::string& cameraPathFile) {
+
+		GLDispatch::install(GL_DISPATCH_NULL, true);
+
+		std::string heightmapPath = TERRAIN_BENCHMARK_HEIGHTMAP_PATH;
+		if (!std::filesystem::exists(heightmapPath)) {
+
+			heightmapPath = (std::filesystem::temp_directory_path() / ("terrain_benchmark_" + std::to_string(TERRAIN_BENCHMARK_SYNTHETIC_SIZE) + ".png")).string();
+			if (!std::filesystem::exists(heightmapPath)) {
+				printf("Writing synthetic %dx%d heightmap to %s\n", TERRAIN_BENCHMARK_SYNTHETIC_SIZE, TERRAIN_BENCHMARK_SYNTHETIC_SIZE, heightmapPath.c_str());
+				if (!TerrainBenchmark::writeSyntheticHeightmap(heightmapPath, TERRAIN_BENCHMARK_SYNTHETIC_SIZE)) {
+					printf("Synthetic heightmap could not be written\n");
+					return false;
+				}
+			}
+		}
+
+		Terrain* terrain = new Terrain();
+		terrain->elevationMapTextureArray = 0;
+
+		std::vector<float> ingestSamples[2];
+		for (int i = 0; i < TERRAIN_BENCHMARK_INGEST_RUNS; i++)
+			ingestSamples[0].push_back(TerrainBenchmark::ingest(terrain, heightmapPath, false));
+
+		std::string cachePath = std::filesystem::path(heightmapPath).replace_extension(".heightcache").string();
+		if (HeightmapCache::cook(terrain, heightmapPath, cachePath)) {
+			for (int i = 0; i < TERRAIN_BENCHMARK_INGEST_RUNS; i++) {
+				float duration = TerrainBenchmark::ingest(terrain, heightmapPath, true);
+				if (duration < 0.f) {
+					printf("Heightmap cache could not be loaded, paths are replayed on the png stack\n");
+					TerrainBenchmark::ingest(terrain, heightmapPath, false);
+					break;
+				}
+				ingestSamples[1].push_back(duration);
+			}
+		}
+
+		int mapSize = terrain->mapSize;
+
+		std::vector<TerrainCameraPath> paths;
+		paths.push_back(TerrainBenchmark::createStraightPath(mapSize, TERRAIN_BENCHMARK_FRAMES));
+		paths.push_back(TerrainBenchmark::createSpiralPath(mapSize, TERRAIN_BENCHMARK_FRAMES));
+		paths.push_back(TerrainBenchmark::createTeleportPath(mapSize, TERRAIN_BENCHMARK_FRAMES));
+
+		if (!cameraPathFile.empty()) {
+			TerrainCameraPath recorded;
+			if (TerrainBenchmark::loadPath(cameraPathFile, recorded))
+				paths.push_back(recorded);
+			else
+				printf("Camera path could not be read: %s\n", cameraPathFile.c_str());
+		}
+
+		terrain->generateTerrainClipmapsVertexArrays();
+		terrain->initInstanceBuffer();
+		terrain->initUniformBuffers();
+		terrain->streamer = new TerrainStreamer(terrain);
+
+		std::vector<TerrainBenchmarkResult> results(paths.size());
+		for (size_t i = 0; i < paths.size(); i++)
+			TerrainBenchmark::replay(terrain, paths[i], results[i]);
+
+		printf("Terrain benchmark, %dx%d map, %s\n", mapSize, mapSize, heightmapPath.c_str());
+		std::vector<float> sorted[2] = { ingestSamples[0], ingestSamples[1] };
+		std::sort(sorted[0].begin(), sorted[0].end());
+		std::sort(sorted[1].begin(), sorted[1].end());
+		printf("  ingest png   : %10.2f ms p50\n", TerrainBenchmark::getPercentile(sorted[0], 50.f));
+		printf("  ingest cache : %10.2f ms p50\n", TerrainBenchmark::getPercentile(sorted[1], 50.f));
+
+		bool consistent = true;
+		for (TerrainBenchmarkResult& result : results) {
+
+			std::vector<float> glCalls = result.glCalls;
+			std::sort(glCalls.begin(), glCalls.end());
+			float maxCalls = TerrainBenchmark::getPercentile(glCalls, 100.f);
+			printf("  %s, %zu frames, %u full reloads, %.1f MB uploaded, GL calls p50 %.0f max %.0f, %u elevation and %u splat tiles differ\n", result.name.c_str(),
+				result.samples[TERRAIN_BENCHMARK_STAGE_FRAME].size(), result.fullReloads, result.uploadedBytes / (1024.0 * 1024.0),
+				TerrainBenchmark::getPercentile(glCalls, 50.f), maxCalls, result.elevationMismatches, result.splatMismatches);
+			if (result.levelChecked)
+				printf("    %-24s: %s, %u tiles differ\n", ("level " + std::to_string(TERRAIN_BENCHMARK_CHECK_LEVEL) + " after " + std::to_string(TERRAIN_BENCHMARK_CHECK_FRAME) + " frames").c_str(),
+					result.levelMismatches == 0 ? "passed" : "FAILED", result.levelMismatches);
+			printf("    %-24s: %s, %u frames differ\n", "GPU candidates", result.candidateMismatches == 0 ? "passed" : "FAILED", result.candidateMismatches);
+			printf("    %-24s: %s, max %.0f of %d\n", "GL calls per frame", maxCalls <= TERRAIN_BENCHMARK_MAX_GL_CALLS ? "passed" : "FAILED", maxCalls, TERRAIN_BENCHMARK_MAX_GL_CALLS);
+			consistent = consistent && result.elevationMismatches == 0 && result.splatMismatches == 0 && result.levelMismatches == 0 && result.candidateMismatches == 0 && maxCalls <= TERRAIN_BENCHMARK_MAX_GL_CALLS;
+
+			for (int stage = 0; stage < TERRAIN_BENCHMARK_STAGE_COUNT; stage++) {
+				std::vector<float> samples = result.samples[stage];
+				std::sort(samples.begin(), samples.end());
+				printf("    %-24s: p50 %9.1f us  p99 %9.1f us  max %9.1f us\n", stageNames[stage],
+					TerrainBenchmark::getPercentile(samples, 50.f), TerrainBenchmark::getPercentile(samples, 99.f), TerrainBenchmark::getPercentile(samples, 100.f));
+			}
+		}
+
+		bool written = TerrainBenchmark::writeJSON(outputPath, heightmapPath, mapSize, ingestSamples, results);
+		printf(written ? "Results written to %s\n" : "Results could not be written to %s\n", outputPath.c_str());
+
+		delete terrain;
+		return written && consistent;
+	}
+}
@@ -0,0 +1,104 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+// Terrain Benchmark Class
+// Runs the CPU pipeline of the terrain without a window: heightmap ingest, then camera paths are replayed frame by frame
+// through the prefetcher, calculateBlockPositions, calculateBoundingBoxes, streamTerrain, the streamer upload and drawClipmap.
+// GL calls go to the null backend and are recorded. Every stage is timed per frame and written as JSON with percentiles,
+// so runs on machines without a GPU can be compared. The run fails if a frame makes more than TERRAIN_BENCHMARK_MAX_GL_CALLS
+// calls, if level TERRAIN_BENCHMARK_CHECK_LEVEL of the arrays the null backend holds differs from the heightmap after
+// TERRAIN_BENCHMARK_CHECK_FRAME frames, or if any level differs after the path, so a streaming bug fails the run.
+//
+// Paths are a straight run, a spiral and a run with teleports that reload whole levels. A recorded path can be added,
+// it is a text file of world space camera positions, one frame per line as "x y z", lines starting with # are skipped.
+//
+// Runs from Application and from the headless TerrainBenchmarks executable of CMakeLists.txt.
+
+#pragma once
+#include "terrain.h"
+
+#define TERRAIN_BENCHMARK_FRAMES 1200
+#define TERRAIN_BENCHMARK_DT (1.f / 60.f)
+#define TERRAIN_BENCHMARK_INGEST_RUNS 3
+// Used when the heightmap of the scene is not there, the synthetic png is written to the temp directory
+#define TERRAIN_BENCHMARK_HEIGHTMAP_PATH "resources/textures/terrain/heightmap.png"
+#define TERRAIN_BENCHMARK_SYNTHETIC_SIZE 4096
+// Camera height above zero for the frustum, the terrain streams around the projected position
+#define TERRAIN_BENCHMARK_CAMERA_HEIGHT 200.f
+#define TERRAIN_BENCHMARK_TELEPORT_INTERVAL 120
+// Streamed jobs are drained before the check, so the level has to match exactly
+#define TERRAIN_BENCHMARK_CHECK_FRAME 500
+#define TERRAIN_BENCHMARK_CHECK_LEVEL 2
+// A frame draws with about 20 calls and uploads its tiles with a few calls each, the synthetic paths reach 86
+#define TERRAIN_BENCHMARK_MAX_GL_CALLS 128
+
+#define TERRAIN_BENCHMARK_STAGE_PREFETCH 0
+#define TERRAIN_BENCHMARK_STAGE_BLOCK_POSITIONS 1
+#define TERRAIN_BENCHMARK_STAGE_BOUNDING_BOXES 2
+#define TERRAIN_BENCHMARK_STAGE_STREAM 3
+#define TERRAIN_BENCHMARK_STAGE_UPLOAD 4
+#define TERRAIN_BENCHMARK_STAGE_DRAW 5
+#define TERRAIN_BENCHMARK_STAGE_FRAME 6
+#define TERRAIN_BENCHMARK_STAGE_COUNT 7
+
+namespace Core {
+
+	/*
+	* Camera of every frame, world space. Directions are along the movement.
+	*/
+	struct TerrainCameraPath {
+
+		std::string name;
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec3> directions;
+	};
+
+	/*
+	* Per frame samples of a replayed path in microseconds, indexed by TERRAIN_BENCHMARK_STAGE_*.
+	*/
+	struct TerrainBenchmarkResult {
+
+		std::string name;
+		std::vector<float> samples[TERRAIN_BENCHMARK_STAGE_COUNT];
+		unsigned long long visibleInstances = 0;
+		unsigned long long candidates = 0;
+		unsigned long long uploadedBytes = 0;
+		unsigned int fullReloads = 0;
+		float drainDuration = 0.f;	// ms to upload the jobs that were in flight when the path ended
+		std::vector<float> glCalls;	// per frame
+		unsigned long long glUploadedBytes = 0;
+		unsigned int elevationMismatches = 0;	// tiles of the arrays that differ from the heightmap after the path
+		unsigned int splatMismatches = 0;
+		bool levelChecked = false;	// paths shorter than TERRAIN_BENCHMARK_CHECK_FRAME are not
+		unsigned int levelMismatches = 0;	// elevation and splat tiles of TERRAIN_BENCHMARK_CHECK_LEVEL
+		unsigned int candidateMismatches = 0;	// frames where Terrain::generateCandidate differs from collectCandidates
+	};
+
+	class __declspec(dllexport) TerrainBenchmark {
+
+	private:
+
+		static const char* stageNames[TERRAIN_BENCHMARK_STAGE_COUNT];
+
+		static bool writeSyntheticHeightmap(const std::string& path, int size);
+		static void finishPath(TerrainCameraPath& path);
+		static TerrainCameraPath createStraightPath(int mapSize, int frames);
+		static TerrainCameraPath createSpiralPath(int mapSize, int frames);
+		static TerrainCameraPath createTeleportPath(int mapSize, int frames);
+		static bool loadPath(const std::string& file, TerrainCameraPath& path);
+		static void getFrustumPlanes(const glm::mat4& VP, glm::vec4* planes);
+		static float getPercentile(const std::vector<float>& sorted, float percentile);
+		static void releaseHeightmap(Terrain* terrain);
+		static float ingest(Terrain* terrain, const std::string& heightmapPath, bool fromCache);
+		static void replay(Terrain* terrain, const TerrainCameraPath& path, TerrainBenchmarkResult& result);
+		static float drain(Terrain* terrain, TerrainBenchmarkResult& result);
+		static void checkTextureArrays(Terrain* terrain, int level, unsigned int& elevationMismatches, unsigned int& splatMismatches);
+		static bool writeJSON(const std::string& outputPath, const std::string& heightmapPath, int mapSize, const std::vector<float>* ingestSamples, const std::vector<TerrainBenchmarkResult>& results);
+
+	public:
+
+		static bool run(const std::string& outputPath, const std::string& cameraPathFile);
+	};
+}
@@ -0,0 +1,186 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "pch.h"
+#include "terrainprefetcher.h"
+#include "terraintilecache.h"
+#include "heightmapcache.h"
+#include "profiler.h"
+
+namespace Core {
+
+	TerrainPrefetcher::TerrainPrefetcher(Terrain* terrain) {
+
+		this->terrain = terrain;
+	}
+
+	unsigned long long TerrainPrefetcher::getKey(int level, glm::ivec2 tile) {
+
+		return ((unsigned long long)level << 56) | ((unsigned long long)(unsigned int)tile.x << 28) | (unsigned long long)(unsigned int)tile.y;
+	}
+
+	bool TerrainPrefetcher::isInWindow(glm::ivec2 windowStart, glm::ivec2 tile) {
+
+		glm::ivec2 offset = tile - windowStart;
+		return offset.x >= 0 && offset.y >= 0 && offset.x < MEM_TILE_ONE_SIDE && offset.y < MEM_TILE_ONE_SIDE;
+	}
+
+	/*
+	* Called every frame before the terrain is streamed.
+	* 1. Tiles that entered the clipmap windows since the last frame are counted as hits or misses.
+	* 2. Velocity and acceleration are updated from the camera movement.
+	* 3. Tiles of the windows at points of the predicted path that are not in the current windows are warmed.
+	*/
+	void TerrainPrefetcher::update(glm::vec3 camPos, float dt) {
+
+		PROFILE_FUNCTION();
+
+		time += dt;
+
+		glm::ivec2 newWindowStarts[CLIPMAP_LEVEL];
+		for (int level = 0; level < CLIPMAP_LEVEL; level++)
+			newWindowStarts[level] = Terrain::getTileIndex(level, camPos) - MEM_TILE_ONE_SIDE / 2;
+
+		if (!initialized) {
+			for (int level = 0; level < CLIPMAP_LEVEL; level++)
+				windowStarts[level] = newWindowStarts[level];
+			lastPosition = camPos;
+			initialized = true;
+			return;
+		}
+
+		bool teleported = false;
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+			if (newWindowStarts[level] == windowStarts[level])
+				continue;
+
+			glm::ivec2 delta = glm::abs(newWindowStarts[level] - windowStarts[level]);
+			if (delta.x >= MEM_TILE_ONE_SIDE || delta.y >= MEM_TILE_ONE_SIDE)
+				teleported = true;
+
+			for (int z = 0; z < MEM_TILE_ONE_SIDE; z++) {
+				for (int x = 0; x < MEM_TILE_ONE_SIDE; x++) {
+
+					glm::ivec2 tile = newWindowStarts[level] + glm::ivec2(x, z);
+					if (TerrainPrefetcher::isInWindow(windowStarts[level], tile))
+						continue;
+
+					auto it = pendingTiles.find(TerrainPrefetcher::getKey(level, tile));
+					if (it != pendingTiles.end()) {
+						hits++;
+						pendingTiles.erase(it);
+					}
+					else
+						misses++;
+				}
+			}
+
+			windowStarts[level] = newWindowStarts[level];
+		}
+
+		// Prefetches that the camera did not reach in time
+		for (auto it = pendingTiles.begin(); it != pendingTiles.end();) {
+			if (time - it->second > horizon * 2.f) {
+				wastedBytes += TERRAIN_TILE_BYTES;
+				it = pendingTiles.erase(it);
+			}
+			else
+				it++;
+		}
+
+		if (dt > 0.f) {
+
+			glm::vec3 measuredVelocity = (camPos - lastPosition) / dt;
+			glm::vec3 measuredAcceleration = (measuredVelocity - velocity) / dt;
+
+			// A jump of the camera is not a movement
+			if (teleported) {
+				measuredVelocity = glm::vec3(0.f);
+				measuredAcceleration = glm::vec3(0.f);
+				velocity = glm::vec3(0.f);
+			}
+
+			velocity = glm::mix(velocity, measuredVelocity, TERRAIN_PREFETCH_SMOOTHING);
+			acceleration = glm::mix(acceleration, measuredAcceleration, TERRAIN_PREFETCH_SMOOTHING);
+		}
+		lastPosition = camPos;
+
+		if (!enabled)
+			return;
+
+		for (int sample = 1; sample <= TERRAIN_PREFETCH_SAMPLES; sample++) {
+
+			glm::vec3 predicted = TerrainPrefetcher::predict(horizon * sample / TERRAIN_PREFETCH_SAMPLES);
+
+			for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+				glm::ivec2 windowStart = Terrain::getTileIndex(level, predicted) - MEM_TILE_ONE_SIDE / 2;
+				if (windowStart == windowStarts[level])
+					continue;
+
+				for (int z = 0; z < MEM_TILE_ONE_SIDE; z++) {
+					for (int x = 0; x < MEM_TILE_ONE_SIDE; x++) {
+
+						glm::ivec2 tile = windowStart + glm::ivec2(x, z);
+						if (TerrainPrefetcher::isInWindow(windowStarts[level], tile))
+							continue;
+
+						unsigned long long key = TerrainPrefetcher::getKey(level, tile);
+						if (pendingTiles.find(key) != pendingTiles.end())
+							continue;
+
+						pendingTiles[key] = time;
+						prefetchedTiles++;
+						TerrainPrefetcher::warm(level, tile);
+					}
+				}
+			}
+		}
+	}
+
+	/*
+	* Camera position after the given time if velocity and acceleration stay the same. Kept in the map region.
+	*/
+	glm::vec3 TerrainPrefetcher::predict(float seconds) {
+
+		int mapSize = terrain->mapSize;
+		glm::vec3 predicted = lastPosition + velocity * seconds + acceleration * (0.5f * seconds * seconds);
+		predicted.y = lastPosition.y;
+		return glm::clamp(predicted, glm::vec3(mapSize * 2 + 1, 0, mapSize * 2 + 1), glm::vec3(mapSize * 3 - 1, 0, mapSize * 3 - 1));
+	}
+
+	/*
+	* Out of core tiles are read into the tile cache. Tiles of a stack mapped from the heightmap cache are paged in,
+	* so the streamer does not fault on them. A stack in client memory is already warm.
+	*/
+	void TerrainPrefetcher::warm(int level, glm::ivec2 tile) {
+
+		if (terrain->tileCache)
+			terrain->tileCache->prefetch(level, tile);
+		else if (terrain->heightmapStackMapped && terrain->heightmapCache) {
+
+			glm::ivec2 local = tile - terrain->clipmapStartIndices[level].x;
+			int tilesPerSide = terrain->clipmapStartIndices[level].y - terrain->clipmapStartIndices[level].x;
+			if (local.x >= 0 && local.y >= 0 && local.x < tilesPerSide && local.y < tilesPerSide)
+				terrain->heightmapCache->prefetch(terrain->getStackTile(level, tile), TERRAIN_TILE_BYTES);
+		}
+	}
+
+	float TerrainPrefetcher::getHitRate() {
+
+		unsigned long long total = hits + misses;
+		return total ? (float)hits / total : 0.f;
+	}
+
+	void TerrainPrefetcher::resetCounters() {
+
+		prefetchedTiles = 0;
+		hits = 0;
+		misses = 0;
+		wastedBytes = 0;
+	}
+}
@@ -0,0 +1,61 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+// Terrain Prefetcher Class
+// Predicts where the camera will be from its velocity and acceleration and warms the tiles that the clipmap
+// windows will need before the camera crosses a tile border. Out of core tiles are read into the tile cache,
+// tiles of a memory mapped heightmap stack are paged in. Counts how many predicted tiles are used.
+
+#pragma once
+#include "terrain.h"
+#include <unordered_map>
+
+// Seconds ahead of the camera that tiles are warmed for
+#define TERRAIN_PREFETCH_HORIZON 1.0f
+// Points on the predicted path that are checked
+#define TERRAIN_PREFETCH_SAMPLES 4
+// Weight of the newest measurement of velocity and acceleration
+#define TERRAIN_PREFETCH_SMOOTHING 0.2f
+
+namespace Core {
+
+	class __declspec(dllexport) TerrainPrefetcher {
+
+	private:
+
+		Terrain* terrain;
+
+		bool initialized = false;
+		glm::vec3 lastPosition;
+		glm::ivec2 windowStarts[CLIPMAP_LEVEL];
+
+		// prefetched tile -> time it was prefetched, until its window reaches it or it expires
+		std::unordered_map<unsigned long long, float> pendingTiles;
+		float time = 0.f;
+
+		static unsigned long long getKey(int level, glm::ivec2 tile);
+		static bool isInWindow(glm::ivec2 windowStart, glm::ivec2 tile);
+		void warm(int level, glm::ivec2 tile);
+
+	public:
+
+		bool enabled = true;
+		float horizon = TERRAIN_PREFETCH_HORIZON;
+
+		glm::vec3 velocity = glm::vec3(0.f);
+		glm::vec3 acceleration = glm::vec3(0.f);
+
+		unsigned long long prefetchedTiles = 0;
+		unsigned long long hits = 0;		// tiles that entered a window after they were prefetched
+		unsigned long long misses = 0;		// tiles that entered a window without a prefetch
+		unsigned long long wastedBytes = 0;	// prefetched tiles that were not used in time
+
+		TerrainPrefetcher(Terrain* terrain);
+		void update(glm::vec3 camPos, float dt);
+		glm::vec3 predict(float seconds);
+		float getHitRate();
+		void resetCounters();
+	};
+}
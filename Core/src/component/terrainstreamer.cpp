@@ -0,0 +1,300 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "pch.h"
+#include "terrainstreamer.h"
+#include "GL/glew.h"
+#include "profiler.h"
+#include "gldispatch.h"
+#include <chrono>
+#include <cstring>
+
+namespace Core {
+
+	TerrainStreamer::TerrainStreamer(Terrain* terrain) {
+
+		this->terrain = terrain;
+
+		ring = new RingBuffer();
+		if (!ring->init(GL_PIXEL_UNPACK_BUFFER, TERRAIN_STREAM_RING_SIZE)) {
+			std::cout << "Persistent mapped buffers are not supported, terrain is streamed from client memory" << std::endl;
+			delete ring;
+			ring = NULL;
+		}
+
+		worker = std::thread(&TerrainStreamer::run, this);
+	}
+
+	TerrainStreamer::~TerrainStreamer() {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		condition.notify_one();
+		worker.join();
+
+		while (!pendingJobs.empty()) {
+			TerrainStreamer::deleteJob(pendingJobs.front());
+			pendingJobs.pop();
+		}
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+			while (!readyJobs[level].empty()) {
+				TerrainStreamer::deleteJob(readyJobs[level].front());
+				readyJobs[level].pop();
+			}
+		}
+
+		delete ring;
+	}
+
+	/*
+	* Jobs are built in the order they are submitted. So updates of the same level never overtake each other.
+	* Staging memory is taken from the ring here on the render thread, the worker only writes into it.
+	* If the ring is full, tiles of a resident map are uploaded from the heightmap stack without a copy,
+	* tiles of an out of core map are gathered into client memory. Splat weights are always baked into client memory.
+	*/
+	void TerrainStreamer::submit(TerrainStreamJob* job) {
+
+		unsigned int jobBytes = job->tiles.size() * TERRAIN_TILE_BYTES;
+
+		if (ring)
+			job->heightData = ring->allocate(jobBytes, job->offset);
+
+		job->staged = job->heightData != NULL;
+		if (!job->staged && terrain->tileCache)
+			job->heightData = new unsigned char[jobBytes];
+		job->splatData = new unsigned char[job->tiles.size() * TERRAIN_SPLAT_TILE_BYTES];
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pendingJobs.push(job);
+		}
+		jobsInFlight++;
+		condition.notify_one();
+	}
+
+	/*
+	* Worker thread. Gathers texels of the tiles into the staging buffer of the job and bakes their splat weights.
+	*/
+	void TerrainStreamer::run() {
+
+		PROFILE_THREAD("Terrain streamer");
+
+		while (true) {
+
+			TerrainStreamJob* job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this] { return !running || !pendingJobs.empty(); });
+
+				if (!running)
+					return;
+
+				job = pendingJobs.front();
+				pendingJobs.pop();
+			}
+
+			TerrainStreamer::buildJob(job);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			readyJobs[job->level].push(job);
+		}
+	}
+
+	void TerrainStreamer::buildJob(TerrainStreamJob* job) {
+
+		PROFILE_FUNCTION();
+
+		for (unsigned int i = 0; i < job->tiles.size(); i++) {
+
+			if (job->heightData)
+				terrain->writeHeightDataToGPUBuffer(job->tiles[i].tileStart, job->heightData + i * TERRAIN_TILE_BYTES, job->level);
+			terrain->writeSplatDataToGPUBuffer(job->tiles[i].tileStart, job->splatData + i * TERRAIN_SPLAT_TILE_BYTES, job->level);
+		}
+	}
+
+	/*
+	* Called on render thread. Sends built jobs to the gpu starting from the finest level until the frame budget is spent.
+	* At least one job is uploaded each frame, so a job bigger than the budget does not wait forever.
+	*/
+	void TerrainStreamer::upload() {
+
+		PROFILE_FUNCTION();
+
+		uploadedBytes = 0;
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+			while (true) {
+
+				TerrainStreamJob* job;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (readyJobs[level].empty())
+						break;
+					job = readyJobs[level].front();
+				}
+
+				unsigned int jobBytes = job->tiles.size() * (TERRAIN_TILE_BYTES + TERRAIN_SPLAT_TILE_BYTES);
+				if (uploadedBytes > 0 && uploadedBytes + jobBytes > bytesPerFrame)
+					return;
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					readyJobs[level].pop();
+				}
+
+				// Texture is sourced from the bound unpack buffer when staged, so the pointer is an offset into it
+				if (job->staged)
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->id);
+
+				for (unsigned int i = 0; i < job->tiles.size(); i++) {
+
+					const unsigned char* tileData;
+					if (job->staged)
+						tileData = (const unsigned char*)(size_t)(job->offset + i * TERRAIN_TILE_BYTES);
+					else if (job->heightData)
+						tileData = job->heightData + i * TERRAIN_TILE_BYTES;
+					else
+						tileData = terrain->getStackTile(job->level, job->tiles[i].tileStart);
+
+					glm::ivec2 position = job->position + job->tiles[i].index * TILE_SIZE;
+					terrain->updateHeightMapTextureArrayPartial(job->level, glm::ivec2(TILE_SIZE), position, tileData);
+				}
+
+				if (job->staged) {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					ring->fence(job->offset);
+				}
+
+				for (unsigned int i = 0; i < job->tiles.size(); i++) {
+					glm::ivec2 position = job->position + job->tiles[i].index * TILE_SIZE;
+					terrain->updateSplatMapTextureArrayPartial(job->level, glm::ivec2(TILE_SIZE), position, job->splatData + i * TERRAIN_SPLAT_TILE_BYTES);
+				}
+
+				uploadedBytes += jobBytes;
+				jobsInFlight--;
+
+				TerrainStreamer::deleteJob(job);
+			}
+		}
+	}
+
+	void TerrainStreamer::deleteJob(TerrainStreamJob* job) {
+
+		if (!job->staged)
+			delete[] job->heightData;
+		delete[] job->splatData;
+		delete job;
+	}
+
+	/*
+	* Measures how fast tiles are gathered into a staging buffer with the heightmap stack layout before tiles were contiguous
+	* (row major stack, copied texel by texel into the job rectangle) and with the current one (a copy per tile).
+	* Stack is the size of level 0 of a 4096 map. Every tile of it is gathered as part of a row job. Fails if the layouts
+	* gather different texels or checkRing fails.
+	*/
+	bool TerrainStreamer::benchmark(int iterations) {
+
+		const int tilesPerSide = 19;
+		const int stackSize = tilesPerSide * TILE_SIZE;
+		const size_t stackBytes = (size_t)stackSize * stackSize * TERRAIN_STACK_NUM_CHANNELS;
+
+		unsigned char* rowMajor = new unsigned char[stackBytes];
+		unsigned char* tileMajor = new unsigned char[stackBytes];
+		for (size_t i = 0; i < stackBytes; i++)
+			rowMajor[i] = (unsigned char)(i * 2654435761u >> 13);
+
+		for (int z = 0; z < stackSize; z++)
+			for (int tileX = 0; tileX < tilesPerSide; tileX++)
+				memcpy(&tileMajor[(size_t)((z / TILE_SIZE) * tilesPerSide + tileX) * TERRAIN_TILE_BYTES + (z % TILE_SIZE) * TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS],
+					&rowMajor[((size_t)z * stackSize + tileX * TILE_SIZE) * TERRAIN_STACK_NUM_CHANNELS], TILE_SIZE * TERRAIN_STACK_NUM_CHANNELS);
+
+		const int texWidth = TILE_SIZE * MEM_TILE_ONE_SIDE;
+		unsigned char* staging = new unsigned char[MEM_TILE_ONE_SIDE * TERRAIN_TILE_BYTES];
+		unsigned long long checksum[2] = { 0, 0 };
+
+		auto begin = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++) {
+			for (int tileZ = 0; tileZ < tilesPerSide; tileZ++) {
+				for (int tileX = 0; tileX < tilesPerSide; tileX++) {
+
+					int startX = (tileX % MEM_TILE_ONE_SIDE) * TILE_SIZE;
+
+					for (int i = 0; i < TILE_SIZE; i++) {
+						for (int j = 0; j < TILE_SIZE; j++) {
+
+							int indexInChunk = ((i + tileZ * TILE_SIZE) * stackSize + tileX * TILE_SIZE + j) * TERRAIN_STACK_NUM_CHANNELS;
+							int indexInHeightmap = (i * texWidth + j + startX) * TERRAIN_STACK_NUM_CHANNELS;
+							staging[indexInHeightmap] = rowMajor[indexInChunk];
+							staging[indexInHeightmap + 1] = rowMajor[indexInChunk + 1];
+						}
+					}
+					checksum[0] += staging[startX * TERRAIN_STACK_NUM_CHANNELS];
+				}
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		double rowMajorDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 1e-6;
+
+		begin = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++) {
+			for (int tileZ = 0; tileZ < tilesPerSide; tileZ++) {
+				for (int tileX = 0; tileX < tilesPerSide; tileX++) {
+
+					unsigned char* tile = &staging[(tileX % MEM_TILE_ONE_SIDE) * TERRAIN_TILE_BYTES];
+					memcpy(tile, &tileMajor[(size_t)(tileZ * tilesPerSide + tileX) * TERRAIN_TILE_BYTES], TERRAIN_TILE_BYTES);
+					checksum[1] += tile[0];
+				}
+			}
+		}
+		end = std::chrono::high_resolution_clock::now();
+		double tileMajorDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 1e-6;
+
+		double texels = (double)stackSize * stackSize * iterations;
+		printf("Terrain streaming benchmark, %d tiles, %d iterations\n", tilesPerSide * tilesPerSide, iterations);
+		printf("  row major stack, per texel : %10.1f Mtexels/s\n", texels / rowMajorDuration * 1e-6);
+		printf("  tile major stack, per tile : %10.1f Mtexels/s\n", texels / tileMajorDuration * 1e-6);
+		printf("  speedup                    : %10.2fx %s\n", rowMajorDuration / tileMajorDuration, checksum[0] == checksum[1] ? "" : "(data mismatch)");
+
+		delete[] staging;
+		delete[] tileMajor;
+		delete[] rowMajor;
+
+		bool ringValid = TerrainStreamer::checkRing();
+		printf("  ring reuse check           : %s\n", ringValid ? "passed" : "FAILED, a range that is not uploaded yet was reused");
+		return ringValid && checksum[0] == checksum[1];
+	}
+
+	/*
+	* Ranges are taken on submit and fenced on upload, which is limited by a budget. This order puts a range that is not
+	* fenced yet two laps behind the head: A and D are uploaded, R and B are not. E does not fit after D, it starts the next lap
+	* at 0 and covers R, so it has to fail until R is fenced. Runs on the null backend, its fences are signaled at once.
+	*/
+	bool TerrainStreamer::checkRing() {
+
+		GLDispatch::install(GL_DISPATCH_NULL, false);
+
+		RingBuffer ring;
+		if (!ring.init(GL_PIXEL_UNPACK_BUFFER, 4096))
+			return false;
+
+		unsigned int a, r, b, d, e;
+		bool valid = ring.allocate(2048, a) != NULL;
+		ring.fence(a);
+		valid = valid && ring.allocate(1024, r) != NULL && r == 2048;
+		valid = valid && ring.allocate(1024, b) != NULL && b == 3072;
+		valid = valid && ring.allocate(2048, d) != NULL && d == 0;
+		ring.fence(d);
+		valid = valid && ring.allocate(3072, e) == NULL;
+
+		ring.fence(r);
+		ring.fence(b);
+		valid = valid && ring.allocate(3072, e) != NULL && e == 0;
+		return valid;
+	}
+}
@@ -0,0 +1,83 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+// Terrain Streamer Class
+// Builds toroidal clipmap updates on a background thread and uploads them on the render thread
+// within a fixed byte budget per frame. Finer clipmap levels are uploaded first.
+
+#pragma once
+#include "terrain.h"
+#include "ringbuffer.h"
+#include <mutex>
+#include <condition_variable>
+
+// One column of tiles per frame for every level by default, heights and splat weights
+#define TERRAIN_STREAM_BYTES_PER_FRAME ((TERRAIN_TILE_BYTES + TERRAIN_SPLAT_TILE_BYTES) * MEM_TILE_ONE_SIDE * CLIPMAP_LEVEL)
+// Enough for two full reloads of every level
+#define TERRAIN_STREAM_RING_SIZE (TILE_SIZE * TILE_SIZE * MEM_TILE_ONE_SIDE * MEM_TILE_ONE_SIDE * TERRAIN_STACK_NUM_CHANNELS * CLIPMAP_LEVEL * 2)
+
+namespace Core {
+
+	/*
+	* A tile that is copied from the heightmap stack into the staging buffer of a job.
+	*/
+	struct TerrainStreamTile {
+
+		glm::ivec2 index;		// tile position in the job region, in tiles
+		glm::ivec2 tileStart;	// tile position in heightmap stack
+	};
+
+	/*
+	* A column, a row or a whole level update of the elevation map and the splat map texture arrays.
+	* Tiles are placed one after another in heightData and splatData and each of them is uploaded on its own.
+	* heightData is NULL when tiles are uploaded straight from the heightmap stack. Splat weights are always baked into splatData.
+	*/
+	struct TerrainStreamJob {
+
+		int level;
+		glm::ivec2 size;
+		glm::ivec2 position;
+		std::vector<TerrainStreamTile> tiles;
+		unsigned char* heightData = NULL;
+		unsigned char* splatData = NULL;
+		bool staged = false;		// heightData points into the pixel unpack ring
+		unsigned int offset = 0;	// offset of heightData in the ring
+	};
+
+	class __declspec(dllexport) TerrainStreamer {
+
+	private:
+
+		Terrain* terrain;
+
+		std::thread worker;
+		std::mutex mutex;
+		std::condition_variable condition;
+		bool running = true;
+
+		std::queue<TerrainStreamJob*> pendingJobs;
+		std::queue<TerrainStreamJob*> readyJobs[CLIPMAP_LEVEL];
+
+		void run();
+		void buildJob(TerrainStreamJob* job);
+		void deleteJob(TerrainStreamJob* job);
+
+	public:
+
+		unsigned int bytesPerFrame = TERRAIN_STREAM_BYTES_PER_FRAME;
+		unsigned int uploadedBytes = 0;
+		unsigned int jobsInFlight = 0;
+
+		// NULL if persistent mapping is not supported, jobs are uploaded from client memory then
+		RingBuffer* ring = NULL;
+
+		TerrainStreamer(Terrain* terrain);
+		~TerrainStreamer();
+		void submit(TerrainStreamJob* job);
+		void upload();
+		static bool benchmark(int iterations);
+		static bool checkRing();
+	};
+}
@@ -0,0 +1,300 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "pch.h"
+#include "terraintexturecooker.h"
+#include "terrain.h"
+#include "texture.h"
+#include "texturecontainer.h"
+#include "threadpool.h"
+#include "shadermanager.h"
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+namespace Core {
+
+	const char* TerrainTextureCooker::arrayNames[TERRAIN_COOKED_ARRAY_COUNT] = { "albedo", "normal", "utility" };
+
+	std::string TerrainTextureCooker::getCookedPath(int array) {
+
+		return std::string(TERRAIN_COOKED_TEXTURE_DIRECTORY) + arrayNames[array] + ".ktx2";
+	}
+
+	/*
+	* Layer maps are in texturemaps, utility maps are next to the layer file. Empty if there is no such png.
+	*/
+	std::string TerrainTextureCooker::getSourcePath(const std::string& name) {
+
+		std::string paths[2] = { std::string(TERRAIN_SOURCE_TEXTURE_DIRECTORY) + "texturemaps/" + name + ".png", std::string(TERRAIN_SOURCE_TEXTURE_DIRECTORY) + name + ".png" };
+
+		std::error_code error;
+		for (std::string& path : paths)
+			if (std::filesystem::exists(path, error))
+				return path;
+		return "";
+	}
+
+	/*
+	* Hash of the layer file and of the size and write time of every source png, cooked files of other sources are stale.
+	*/
+	std::string TerrainTextureCooker::getSourceStamp(const std::string& layersPath, const std::vector<TerrainLayer>& layers, const std::vector<std::string>& utilityLayers) {
+
+		std::string layerFile;
+		ShaderManager::readFile(layersPath, layerFile);
+
+		int textureSize = TERRAIN_TEXTURE_SIZE;
+		unsigned long long hash = ShaderManager::hash(&textureSize, sizeof(textureSize), 0);
+		hash = ShaderManager::hash(layerFile.data(), layerFile.size(), hash);
+
+		std::vector<std::string> names = utilityLayers;
+		for (const TerrainLayer& layer : layers) {
+			names.push_back(layer.albedo);
+			names.push_back(layer.ao);
+			names.push_back(layer.normal);
+		}
+
+		for (const std::string& name : names) {
+
+			std::string path = name.empty() ? "" : TerrainTextureCooker::getSourcePath(name);
+			uint64_t size = 0;
+			int64_t writeTime = 0;
+			if (!path.empty()) {
+				std::error_code error;
+				size = std::filesystem::file_size(path, error);
+				writeTime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+			}
+
+			hash = ShaderManager::hash(path.data(), path.size(), hash);
+			hash = ShaderManager::hash(&size, sizeof(size), hash);
+			hash = ShaderManager::hash(&writeTime, sizeof(writeTime), hash);
+		}
+
+		char stamp[32];
+		snprintf(stamp, sizeof(stamp), "%016llx", hash);
+		return stamp;
+	}
+
+	/*
+	* Box filter to half the size. Normals are averaged as vectors and normalized again, so coarse levels stay unit length.
+	*/
+	void TerrainTextureCooker::downsample(const unsigned char* source, int width, int height, int channels, bool normalMap, unsigned char* destination) {
+
+		int newWidth = std::max(width / 2, 1);
+		int newHeight = std::max(height / 2, 1);
+
+		for (int y = 0; y < newHeight; y++) {
+
+			const unsigned char* row0 = &source[(size_t)std::min(y * 2, height - 1) * width * channels];
+			const unsigned char* row1 = &source[(size_t)std::min(y * 2 + 1, height - 1) * width * channels];
+
+			for (int x = 0; x < newWidth; x++) {
+
+				int x0 = std::min(x * 2, width - 1) * channels;
+				int x1 = std::min(x * 2 + 1, width - 1) * channels;
+				unsigned char* texel = &destination[((size_t)y * newWidth + x) * channels];
+
+				for (int c = 0; c < channels; c++)
+					texel[c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2;
+
+				if (!normalMap || channels < 3)
+					continue;
+
+				float normal[3];
+				float length = 0.f;
+				for (int c = 0; c < 3; c++) {
+					normal[c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) / 510.f - 1.f;
+					length += normal[c] * normal[c];
+				}
+
+				length = std::sqrt(length);
+				if (length > 0.f)
+					for (int c = 0; c < 3; c++)
+						texel[c] = (unsigned char)std::min(std::max((normal[c] / length * 0.5f + 0.5f) * 255.f + 0.5f, 0.f), 255.f);
+			}
+		}
+	}
+
+	/*
+	* Mip chain of every layer and its blocks. References are the levels before compression, references[layer][level].
+	*/
+	void TerrainTextureCooker::cookArray(const std::vector<Texture*>& layers, int format, bool normalMap, TextureContainer& container,
+		std::vector<std::vector<std::vector<unsigned char>>>& references, ThreadPool* pool) {
+
+		int channels = layers[0]->channels;
+		container.format = format;
+		container.width = layers[0]->width;
+		container.height = layers[0]->height;
+		container.layerCount = (int)layers.size();
+
+		int levelCount = TextureContainer::getLevelCount(container.width, container.height);
+		container.levels.resize(levelCount);
+		for (int level = 0; level < levelCount; level++)
+			container.levels[level].resize(container.getLevelBytes(level));
+
+		references.resize(layers.size());
+		for (unsigned int layer = 0; layer < layers.size(); layer++) {
+
+			references[layer].resize(levelCount);
+			references[layer][0].assign(layers[layer]->data, layers[layer]->data + (size_t)container.width * container.height * channels);
+
+			for (int level = 0; level < levelCount; level++) {
+
+				int width = std::max(container.width >> level, 1);
+				int height = std::max(container.height >> level, 1);
+
+				if (level > 0) {
+					references[layer][level].resize((size_t)width * height * channels);
+					TerrainTextureCooker::downsample(&references[layer][level - 1][0], std::max(container.width >> (level - 1), 1), std::max(container.height >> (level - 1), 1),
+						channels, normalMap, &references[layer][level][0]);
+				}
+
+				size_t layerBytes = BlockEncoder::getImageBytes(format, width, height);
+				BlockEncoder::encode(&references[layer][level][0], width, height, channels, format, &container.levels[level][layer * layerBytes], pool);
+			}
+		}
+	}
+
+	/*
+	* The file that was read back has to have the blocks that were written, and its decoded levels are compared with the references.
+	*/
+	bool TerrainTextureCooker::verifyArray(int array, const TextureContainer& written, const TextureContainer& cooked,
+		const std::vector<std::vector<std::vector<unsigned char>>>& references, int channels, int comparedChannels) {
+
+		if (cooked.format != written.format || cooked.width != written.width || cooked.height != written.height ||
+			cooked.layerCount != written.layerCount || cooked.levels != written.levels) {
+			std::cout << "Cooked " << arrayNames[array] << " array does not match the blocks that were written" << std::endl;
+			return false;
+		}
+
+		double minPSNR = 99.0;
+		double basePSNR = 0.0;
+		size_t bytes = 0;
+		std::vector<unsigned char> decoded((size_t)cooked.width * cooked.height * 4);
+
+		for (unsigned int level = 0; level < cooked.levels.size(); level++) {
+
+			int width = std::max(cooked.width >> level, 1);
+			int height = std::max(cooked.height >> level, 1);
+			size_t layerBytes = BlockEncoder::getImageBytes(cooked.format, width, height);
+			bytes += cooked.levels[level].size();
+
+			for (int layer = 0; layer < cooked.layerCount; layer++) {
+
+				BlockEncoder::decode(&cooked.levels[level][layer * layerBytes], width, height, cooked.format, &decoded[0]);
+				double psnr = BlockEncoder::getPSNR(&references[layer][level][0], channels, &decoded[0], width, height, comparedChannels);
+				minPSNR = std::min(minPSNR, psnr);
+				if (level == 0)
+					basePSNR += psnr / cooked.layerCount;
+			}
+		}
+
+		bool valid = minPSNR >= TERRAIN_COOKED_MIN_PSNR;
+		printf("  %-8s %s  %2d layers  %2d levels  %6.2f MB  PSNR %6.2f dB (level 0)  %6.2f dB (worst) %s\n", arrayNames[array], BlockEncoder::formatNames[cooked.format],
+			cooked.layerCount, (int)cooked.levels.size(), bytes / (1024.0 * 1024.0), basePSNR, minPSNR, valid ? "" : "FAILED");
+		return valid;
+	}
+
+	/*
+	* Builds the arrays from the pngs like Terrain::loadTextures does, cooks and writes them, then reads every file back
+	* and checks it against the uncompressed levels. Normals are BC5 and utility maps BC4, albedo is BC1, BC3 or BC7.
+	*/
+	bool TerrainTextureCooker::cook(const std::string& layersPath, int albedoFormat) {
+
+		auto begin = std::chrono::high_resolution_clock::now();
+
+		std::vector<TerrainLayer> layers;
+		std::vector<std::string> utilityLayers;
+		if (!Terrain::readLayerFile(layersPath, layers, utilityLayers)) {
+			std::cout << "Terrain layers could not be read from " << layersPath << std::endl;
+			return false;
+		}
+
+		// Sources are keyed by name like the file system does, and decoded on the pool
+		ThreadPool pool;
+		std::map<std::string, Texture*> textures;
+		auto addSource = [&](const std::string& name) {
+			std::string path = name.empty() ? "" : TerrainTextureCooker::getSourcePath(name);
+			if (path.empty() || textures.find(name) != textures.end())
+				return;
+			Texture* texture = new Texture();
+			textures[name] = texture;
+			pool.submit([texture, path]() { texture->loadPNGFile(path.c_str()); });
+		};
+
+		for (const TerrainLayer& layer : layers) {
+			addSource(layer.albedo);
+			addSource(layer.ao);
+			addSource(layer.normal);
+		}
+		for (const std::string& name : utilityLayers)
+			addSource(name);
+		pool.wait();
+
+		std::vector<Texture*> arrays[TERRAIN_COOKED_ARRAY_COUNT];
+		Terrain::createLayerTextures(layers, utilityLayers, textures, arrays[TERRAIN_COOKED_ALBEDO], arrays[TERRAIN_COOKED_NORMAL], arrays[TERRAIN_COOKED_UTILITY]);
+		for (auto& it : textures)
+			delete it.second;
+
+		const int formats[TERRAIN_COOKED_ARRAY_COUNT] = { albedoFormat, BLOCK_FORMAT_BC5, BLOCK_FORMAT_BC4 };
+		const int comparedChannels[TERRAIN_COOKED_ARRAY_COUNT] = { albedoFormat == BLOCK_FORMAT_BC1 ? 3 : 4, 2, 1 };
+		std::string stamp = TerrainTextureCooker::getSourceStamp(layersPath, layers, utilityLayers);
+
+		bool verified = true;
+		printf("Cooking terrain textures to %s on %u threads\n", TERRAIN_COOKED_TEXTURE_DIRECTORY, pool.getThreadCount());
+
+		for (int array = 0; array < TERRAIN_COOKED_ARRAY_COUNT; array++) {
+
+			if (arrays[array].empty()) {
+				std::cout << "Terrain has no " << arrayNames[array] << " layers" << std::endl;
+				verified = false;
+				continue;
+			}
+
+			TextureContainer container;
+			std::vector<std::vector<std::vector<unsigned char>>> references;
+			TerrainTextureCooker::cookArray(arrays[array], formats[array], array == TERRAIN_COOKED_NORMAL, container, references, &pool);
+			container.keyValues["KTXwriter"] = "TerrainTextureCooker";
+			container.keyValues[TERRAIN_COOKED_STAMP_KEY] = stamp;
+
+			TextureContainer cooked;
+			std::string path = TerrainTextureCooker::getCookedPath(array);
+			if (!container.save(path) || !cooked.load(path)) {
+				std::cout << "Cooked terrain texture could not be written to " << path << std::endl;
+				verified = false;
+				continue;
+			}
+
+			verified &= TerrainTextureCooker::verifyArray(array, container, cooked, references, arrays[array][0]->channels, comparedChannels[array]);
+		}
+
+		for (int array = 0; array < TERRAIN_COOKED_ARRAY_COUNT; array++)
+			for (Texture* texture : arrays[array])
+				delete texture;
+
+		auto end = std::chrono::high_resolution_clock::now();
+		printf("Terrain textures cooked in %.1f ms%s\n", std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001, verified ? "" : ", verification FAILED");
+		return verified;
+	}
+
+	/*
+	* Reads the cooked arrays for the runtime. False if a file is missing, was cooked from other sources or does not fit the layers.
+	*/
+	bool TerrainTextureCooker::load(const std::string& layersPath, const std::vector<TerrainLayer>& layers, const std::vector<std::string>& utilityLayers, TextureContainer* containers) {
+
+		std::string stamp = TerrainTextureCooker::getSourceStamp(layersPath, layers, utilityLayers);
+
+		for (int array = 0; array < TERRAIN_COOKED_ARRAY_COUNT; array++) {
+
+			TextureContainer& container = containers[array];
+			size_t layerCount = array == TERRAIN_COOKED_UTILITY ? utilityLayers.size() : layers.size();
+
+			if (!container.load(TerrainTextureCooker::getCookedPath(array)) || container.keyValues[TERRAIN_COOKED_STAMP_KEY] != stamp ||
+				container.width != TERRAIN_TEXTURE_SIZE || container.height != TERRAIN_TEXTURE_SIZE || container.layerCount != (int)layerCount)
+				return false;
+		}
+		return true;
+	}
+}
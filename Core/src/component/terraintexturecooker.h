@@ -0,0 +1,56 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+// Terrain Texture Cooker Class
+// Cooks the albedo, normal and utility arrays of the terrain layers offline to block compressed KTX2 files
+// with their whole mip chains, so the runtime uploads them as they are instead of uncompressed textures
+// whose mipmaps are generated by the driver. It runs headless, it only needs the layer file and the pngs.
+// It builds with the solution and in the headless TerrainBenchmarks target of CMakeLists.txt, --cook-textures runs it from either.
+
+#pragma once
+
+#include "blockencoder.h"
+
+// Cooked arrays are kept here, one KTX2 file per array
+#define TERRAIN_COOKED_TEXTURE_DIRECTORY "resources/textures/terrain/cooked/"
+#define TERRAIN_SOURCE_TEXTURE_DIRECTORY "resources/textures/terrain/"
+
+// Key of the source stamp in the key/value data of the cooked files
+#define TERRAIN_COOKED_STAMP_KEY "TerrainSourceStamp"
+
+// A decoded level below this is reported as broken by the verification after cooking
+#define TERRAIN_COOKED_MIN_PSNR 25.0
+
+#define TERRAIN_COOKED_ALBEDO 0
+#define TERRAIN_COOKED_NORMAL 1
+#define TERRAIN_COOKED_UTILITY 2
+#define TERRAIN_COOKED_ARRAY_COUNT 3
+
+namespace Core {
+
+	struct TerrainLayer;
+	class Texture;
+	class TextureContainer;
+	class ThreadPool;
+
+	class __declspec(dllexport) TerrainTextureCooker {
+
+	private:
+
+		static const char* arrayNames[TERRAIN_COOKED_ARRAY_COUNT];
+
+		static std::string getCookedPath(int array);
+		static std::string getSourcePath(const std::string& name);
+		static std::string getSourceStamp(const std::string& layersPath, const std::vector<TerrainLayer>& layers, const std::vector<std::string>& utilityLayers);
+		static void downsample(const unsigned char* source, int width, int height, int channels, bool normalMap, unsigned char* destination);
+		static void cookArray(const std::vector<Texture*>& layers, int format, bool normalMap, TextureContainer& container, std::vector<std::vector<std::vector<unsigned char>>>& references, ThreadPool* pool);
+		static bool verifyArray(int array, const TextureContainer& written, const TextureContainer& cooked, const std::vector<std::vector<std::vector<unsigned char>>>& references, int channels, int comparedChannels);
+
+	public:
+
+		static bool cook(const std::string& layersPath, int albedoFormat);
+		static bool load(const std::string& layersPath, const std::vector<TerrainLayer>& layers, const std::vector<std::string>& utilityLayers, TextureContainer* containers);
+	};
+}
@@ -0,0 +1,354 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "pch.h"
+#include "terraintilecache.h"
+#include <chrono>
+#include <cstring>
+#include <climits>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Core {
+
+	TerrainTileCache::TerrainTileCache(unsigned long long capacity, unsigned int threadCount) {
+
+		this->capacity = capacity;
+		pool = new ThreadPool(threadCount);
+
+		zeroTile = new unsigned char[TERRAIN_TILE_BYTES];
+		memset(zeroTile, 0, TERRAIN_TILE_BYTES);
+	}
+
+	TerrainTileCache::~TerrainTileCache() {
+
+		// In flight reads finish before the tiles are freed
+		delete pool;
+
+		for (auto& entry : tiles) {
+			delete[] entry.second->data;
+			delete entry.second;
+		}
+		delete[] zeroTile;
+
+#ifdef _WIN32
+		if (fileHandle)
+			CloseHandle(fileHandle);
+#else
+		if (fileHandle >= 0)
+			close(fileHandle);
+#endif
+	}
+
+	/*
+	* Opens a cooked heightmap cache and reads its tile directories. Tiles are read when they are requested.
+	*/
+	bool TerrainTileCache::open(const std::string& path) {
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		fileHandle = file;
+#else
+		fileHandle = ::open(path.c_str(), O_RDONLY);
+		if (fileHandle < 0)
+			return false;
+#endif
+
+		HeightmapCacheHeader header;
+		if (!TerrainTileCache::readFile(0, sizeof(header), &header) || !HeightmapCache::isCompatible(header))
+			return false;
+
+		if (!TerrainTileCache::readFile(sizeof(header), sizeof(levels), levels))
+			return false;
+
+		mapSize = header.mapSize;
+
+		for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+			clipmapStartIndices[level] = glm::ivec2(levels[level].startTile, levels[level].endTile);
+
+			unsigned long long tilesPerSide = levels[level].endTile - levels[level].startTile;
+			tileDirectories[level].resize(tilesPerSide * tilesPerSide);
+			if (!TerrainTileCache::readFile(levels[level].tileDirectoryOffset, tileDirectories[level].size() * sizeof(unsigned long long), &tileDirectories[level][0]))
+				return false;
+		}
+
+		return true;
+	}
+
+	/*
+	* Positional read, it does not move a shared file pointer. So any thread can read at the same time.
+	*/
+	bool TerrainTileCache::readFile(unsigned long long offset, unsigned int size, void* data) {
+
+#ifdef _WIN32
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+		DWORD readBytes = 0;
+		return ReadFile(fileHandle, data, size, &readBytes, &overlapped) && readBytes == size;
+#else
+		unsigned int readBytes = 0;
+		while (readBytes < size) {
+			ssize_t result = pread(fileHandle, (char*)data + readBytes, size - readBytes, offset + readBytes);
+			if (result <= 0)
+				return false;
+			readBytes += result;
+		}
+		return true;
+#endif
+	}
+
+	unsigned long long TerrainTileCache::getKey(int level, glm::ivec2 tile) {
+
+		return ((unsigned long long)level << 56) | ((unsigned long long)tile.x << 28) | (unsigned long long)tile.y;
+	}
+
+	bool TerrainTileCache::contains(int level, glm::ivec2 tile) {
+
+		return tile.x >= clipmapStartIndices[level].x && tile.y >= clipmapStartIndices[level].x &&
+			tile.x < clipmapStartIndices[level].y && tile.y < clipmapStartIndices[level].y;
+	}
+
+	void TerrainTileCache::read(int level, glm::ivec2 tile, unsigned char* data) {
+
+		int tilesPerSide = clipmapStartIndices[level].y - clipmapStartIndices[level].x;
+		glm::ivec2 local = tile - clipmapStartIndices[level].x;
+		unsigned long long offset = tileDirectories[level][local.y * tilesPerSide + local.x];
+
+		if (!TerrainTileCache::readFile(offset, TERRAIN_TILE_BYTES, data))
+			memset(data, 0, TERRAIN_TILE_BYTES);
+	}
+
+	/*
+	* Adds an empty tile. Called with the mutex locked. Least recently used tiles that are not pinned
+	* are evicted to stay in the memory cap and their memory is reused. If every tile is pinned, the cap is exceeded.
+	*/
+	TerrainTile* TerrainTileCache::insert(unsigned long long key) {
+
+		TerrainTile* tile = NULL;
+
+		auto it = lru.end();
+		while (residentBytes + TERRAIN_TILE_BYTES > capacity && it != lru.begin()) {
+
+			it--;
+			TerrainTile* candidate = *it;
+			if (candidate->references > 0 || !candidate->ready)
+				continue;
+
+			it = lru.erase(it);
+			tiles.erase(candidate->key);
+			residentBytes -= TERRAIN_TILE_BYTES;
+			evictions++;
+
+			if (tile) {
+				delete[] candidate->data;
+				delete candidate;
+			}
+			else
+				tile = candidate;
+		}
+
+		if (tile == NULL) {
+			tile = new TerrainTile;
+			tile->data = new unsigned char[TERRAIN_TILE_BYTES];
+		}
+
+		tile->key = key;
+		tile->ready = false;
+		tile->references = 0;
+		lru.push_front(tile);
+		tile->lruPosition = lru.begin();
+		tiles[key] = tile;
+		residentBytes += TERRAIN_TILE_BYTES;
+
+		return tile;
+	}
+
+	/*
+	* Returns the texels of a tile of the heightmap stack, tile is the tile index in the level. The tile stays resident until it is released.
+	* Blocks if the tile is not resident or its prefetch is still in flight. Tiles out of the stack are zero.
+	*/
+	const unsigned char* TerrainTileCache::acquire(int level, glm::ivec2 tile) {
+
+		if (!TerrainTileCache::contains(level, tile))
+			return zeroTile;
+
+		unsigned long long key = TerrainTileCache::getKey(level, tile - clipmapStartIndices[level].x);
+
+		std::unique_lock<std::mutex> lock(mutex);
+
+		auto it = tiles.find(key);
+		if (it != tiles.end()) {
+
+			TerrainTile* entry = it->second;
+			entry->references++;
+			lru.splice(lru.begin(), lru, entry->lruPosition);
+			hits++;
+
+			tileLoaded.wait(lock, [entry] { return entry->ready; });
+			return entry->data;
+		}
+
+		misses++;
+		TerrainTile* entry = TerrainTileCache::insert(key);
+		entry->references++;
+		lock.unlock();
+
+		TerrainTileCache::read(level, tile, entry->data);
+
+		lock.lock();
+		entry->ready = true;
+		bytesRead += TERRAIN_TILE_BYTES;
+		lock.unlock();
+		tileLoaded.notify_all();
+
+		return entry->data;
+	}
+
+	void TerrainTileCache::release(int level, glm::ivec2 tile) {
+
+		if (!TerrainTileCache::contains(level, tile))
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto it = tiles.find(TerrainTileCache::getKey(level, tile - clipmapStartIndices[level].x));
+		if (it != tiles.end() && it->second->references > 0)
+			it->second->references--;
+	}
+
+	/*
+	* Starts reading a tile on the thread pool if it is not resident. Does not block.
+	*/
+	void TerrainTileCache::prefetch(int level, glm::ivec2 tile) {
+
+		if (!TerrainTileCache::contains(level, tile))
+			return;
+
+		unsigned long long key = TerrainTileCache::getKey(level, tile - clipmapStartIndices[level].x);
+
+		TerrainTile* entry;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (tiles.find(key) != tiles.end())
+				return;
+
+			entry = TerrainTileCache::insert(key);
+			prefetches++;
+		}
+
+		pool->submit([this, level, tile, entry] {
+
+			TerrainTileCache::read(level, tile, entry->data);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				entry->ready = true;
+				bytesRead += TERRAIN_TILE_BYTES;
+			}
+			tileLoaded.notify_all();
+		});
+	}
+
+	void TerrainTileCache::resetCounters() {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		hits = 0;
+		misses = 0;
+		evictions = 0;
+		prefetches = 0;
+		bytesRead = 0;
+	}
+
+	/*
+	* Streams a synthetic map along a camera path without a window or a gpu. The map is cooked into
+	* the temp directory once. Every tile of the clipmap windows is acquired as the camera moves like the streamer does.
+	* Nothing is prefetched, so every tile that enters a window and is not resident is a miss read on this thread.
+	*/
+	void TerrainTileCache::benchmark(int mapSize, unsigned long long capacity) {
+
+		std::string path = (std::filesystem::temp_directory_path() / ("terrain_synthetic_" + std::to_string(mapSize) + ".heightcache")).string();
+
+		TerrainTileCache* cache = new TerrainTileCache(capacity);
+		if (!cache->open(path) || cache->mapSize != mapSize) {
+
+			delete cache;
+			printf("Cooking synthetic %dx%d map to %s\n", mapSize, mapSize, path.c_str());
+			if (!HeightmapCache::cookSynthetic(path, mapSize)) {
+				printf("Synthetic map could not be written\n");
+				return;
+			}
+			cache = new TerrainTileCache(capacity);
+			cache->open(path);
+		}
+
+		// Camera drives across the map with a slow turn, in the region the terrain clamps it to
+		const int stepCount = 4000;
+		const float speed = mapSize * 0.8f / stepCount;
+		glm::vec3 camPos(mapSize * 2 + mapSize * 0.1f, 0, mapSize * 2 + mapSize * 0.5f);
+		float heading = 0.f;
+
+		glm::ivec2 windowStart[CLIPMAP_LEVEL];
+		for (int level = 0; level < CLIPMAP_LEVEL; level++)
+			windowStart[level] = glm::ivec2(INT_MIN);
+
+		unsigned long long maxResidentBytes = 0;
+		auto begin = std::chrono::high_resolution_clock::now();
+
+		for (int step = 0; step < stepCount; step++) {
+
+			heading = 0.6f * sin(step * 0.002f);
+			camPos += glm::vec3(cos(heading), 0, sin(heading)) * speed;
+			camPos = glm::clamp(camPos, glm::vec3(mapSize * 2 + 1, 0, mapSize * 2 + 1), glm::vec3(mapSize * 3 - 1, 0, mapSize * 3 - 1));
+
+			for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+
+				glm::ivec2 tileStart = Terrain::getTileIndex(level, camPos) - MEM_TILE_ONE_SIDE / 2;
+				if (tileStart == windowStart[level])
+					continue;
+
+				// Tiles that entered the window are read, like jobs of the streamer
+				for (int z = 0; z < MEM_TILE_ONE_SIDE; z++) {
+					for (int x = 0; x < MEM_TILE_ONE_SIDE; x++) {
+
+						glm::ivec2 tile = tileStart + glm::ivec2(x, z);
+						glm::ivec2 old = tile - windowStart[level];
+						if (old.x >= 0 && old.y >= 0 && old.x < MEM_TILE_ONE_SIDE && old.y < MEM_TILE_ONE_SIDE)
+							continue;
+
+						cache->acquire(level, tile);
+						cache->release(level, tile);
+					}
+				}
+
+				windowStart[level] = tileStart;
+			}
+
+			maxResidentBytes = std::max(maxResidentBytes, cache->residentBytes);
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		double duration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001;
+
+		unsigned long long requests = cache->hits + cache->misses;
+		printf("Tile cache benchmark, %dx%d map, %llu MB cap, %d steps\n", mapSize, mapSize, capacity >> 20, stepCount);
+		printf("  requests   : %llu\n", requests);
+		printf("  hits       : %llu (%.1f%%)\n", cache->hits, requests ? cache->hits * 100.0 / requests : 0.0);
+		printf("  misses     : %llu\n", cache->misses);
+		printf("  evictions  : %llu\n", cache->evictions);
+		printf("  read       : %.1f MB\n", cache->bytesRead / (1024.0 * 1024.0));
+		printf("  resident   : %.1f MB max\n", maxResidentBytes / (1024.0 * 1024.0));
+		printf("  time       : %.3f ms\n", duration);
+
+		delete cache;
+	}
+}
@@ -0,0 +1,82 @@
+// Copyright (c) Abdullah Gulcur 2022-2023
+//
+// This project is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+// Terrain Tile Cache Class
+// Pages tiles of the heightmap stack from a cooked heightmap cache file for maps that do not fit in memory.
+// Tiles are kept in a least recently used cache with a memory cap. Missing tiles are read on the calling thread,
+// prefetched tiles are read by a thread pool with positional reads, so reads of different tiles do not wait each other.
+
+#pragma once
+#include "terrain.h"
+#include "heightmapcache.h"
+#include "threadpool.h"
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+
+#define TERRAIN_TILE_CACHE_THREADS 4
+
+namespace Core {
+
+	struct TerrainTile {
+
+		unsigned long long key;
+		unsigned char* data;
+		bool ready = false;				// false while a read is in flight
+		unsigned int references = 0;	// pinned tiles are not evicted
+		std::list<TerrainTile*>::iterator lruPosition;
+	};
+
+	class __declspec(dllexport) TerrainTileCache {
+
+	private:
+
+#ifdef _WIN32
+		void* fileHandle = NULL;
+#else
+		int fileHandle = -1;
+#endif
+		HeightmapCacheLevel levels[CLIPMAP_LEVEL];
+		std::vector<unsigned long long> tileDirectories[CLIPMAP_LEVEL];
+
+		std::unordered_map<unsigned long long, TerrainTile*> tiles;
+		std::list<TerrainTile*> lru;	// most recently used first
+		std::mutex mutex;
+		std::condition_variable tileLoaded;
+		ThreadPool* pool;
+
+		unsigned char* zeroTile;
+
+		bool contains(int level, glm::ivec2 tile);
+		TerrainTile* insert(unsigned long long key);
+		void read(int level, glm::ivec2 tile, unsigned char* data);
+		bool readFile(unsigned long long offset, unsigned int size, void* data);
+		static unsigned long long getKey(int level, glm::ivec2 tile);
+
+	public:
+
+		unsigned long long capacity;
+		unsigned long long residentBytes = 0;
+
+		unsigned long long hits = 0;
+		unsigned long long misses = 0;
+		unsigned long long evictions = 0;
+		unsigned long long prefetches = 0;
+		unsigned long long bytesRead = 0;
+
+		int mapSize = 0;
+		glm::ivec2 clipmapStartIndices[CLIPMAP_LEVEL];
+
+		TerrainTileCache(unsigned long long capacity, unsigned int threadCount = TERRAIN_TILE_CACHE_THREADS);
+		~TerrainTileCache();
+		bool open(const std::string& path);
+		const unsigned char* acquire(int level, glm::ivec2 tile);
+		void release(int level, glm::ivec2 tile);
+		void prefetch(int level, glm::ivec2 tile);
+		void resetCounters();
+		static void benchmark(int mapSize, unsigned long long capacity);
+	};
+}
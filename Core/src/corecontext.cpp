@@ -1,5 +1,7 @@
 #include "pch.h"
 #include "corecontext.h"
+#include "profiler.h"
+#include "gputimer.h"
 
 namespace Core {
 
@@ -8,9 +10,11 @@ namespace Core {
 	CoreContext::CoreContext() {
 
 		std::cout << "Core module started." << std::endl;
+		PROFILE_THREAD("Main");
 
 		glfwContext = new GlfwContext();
 		glewContext = new GlewContext();
+		shaderManager = new ShaderManager();
 		fileSystem = new FileSystem();
 		renderer = new Renderer();
 		scene = new Scene();
@@ -18,9 +22,11 @@ namespace Core {
 
 	CoreContext::~CoreContext() {
 
+		GPUTimer::release();
 		delete scene;
 		delete renderer;
 		delete fileSystem;
+		delete shaderManager;
 		delete glewContext;
 		delete glfwContext;
 
@@ -29,14 +35,21 @@ namespace Core {
 
 	void CoreContext::init() {
 
+		PROFILE_FUNCTION();
+
 		renderer->init();
 		fileSystem->init();
 
 		scene->start();
+
+		// Programs nobody waited for are checked and stored in the shader cache
+		shaderManager->finish();
 	}
 
 	void CoreContext::update(float dt) {
 
+		PROFILE_FUNCTION();
+
 		scene->update(dt);
 		renderer->update(dt);
 	}
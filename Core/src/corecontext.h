@@ -2,6 +2,7 @@
 
 #include "glfwcontext.h"
 #include "glewcontext.h"
+#include "shadermanager.h"
 #include "filesystem.h"
 #include "scene.h"
 #include "renderer.h"
@@ -18,6 +19,7 @@ namespace Core {
 		
 		GlfwContext* glfwContext = NULL;
 		GlewContext* glewContext = NULL;
+		ShaderManager* shaderManager = NULL;
 		FileSystem* fileSystem = NULL;
 		Renderer* renderer = NULL;
 
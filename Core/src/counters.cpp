@@ -0,0 +1,99 @@
+#include "pch.h"
+#include "counters.h"
+#include <cfloat>
+
+namespace Core {
+
+	CounterFrame Counters::history[COUNTERS_HISTORY] = {};
+
+	CounterFrame Counters::frame = {};
+	unsigned long long Counters::frameCount = 0;
+	unsigned long long Counters::memory[MEMORY_CATEGORY_COUNT] = {};
+	unsigned long long Counters::histogram[COUNTERS_HISTOGRAM_BUCKETS] = {};
+
+	const char* Counters::counterNames[COUNTER_COUNT] = { "Triangles", "Full level reloads", "GPU culling", "Visible instances" };
+	const char* Counters::levelCounterNames[LEVEL_COUNTER_COUNT] = { "Visible blocks", "Culled blocks", "Streamed texels", "Streamed bytes" };
+	const char* Counters::memoryNames[MEMORY_CATEGORY_COUNT] = {
+		"Heightmap stack", "Height pyramids", "Tile cache", "Terrain maps", "Terrain materials", "Terrain buffers", "Environment", "Framebuffers"
+	};
+	// 120, 90, 60, 50, 40, 30, 20, 15 and 10 fps
+	const float Counters::histogramEdges[COUNTERS_HISTOGRAM_BUCKETS] = { 8.33f, 11.1f, 16.7f, 20.f, 25.f, 33.3f, 50.f, 66.7f, 100.f, FLT_MAX };
+
+	void Counters::add(int counter, unsigned long long value) {
+
+		frame.values[counter] += value;
+	}
+
+	void Counters::addLevel(int counter, int level, unsigned long long value) {
+
+		if (level < COUNTERS_MAX_LEVELS)
+			frame.levelValues[counter][level] += value;
+	}
+
+	void Counters::setMemory(int category, unsigned long long bytes) {
+
+		memory[category] = bytes;
+	}
+
+	/*
+	* Called once the frame is submitted, with the time it took.
+	*/
+	void Counters::endFrame(float frameTime) {
+
+		frame.frameTime = frameTime;
+		history[frameCount % COUNTERS_HISTORY] = frame;
+		frameCount++;
+
+		int bucket = 0;
+		while (bucket < COUNTERS_HISTOGRAM_BUCKETS - 1 && frameTime > histogramEdges[bucket])
+			bucket++;
+		histogram[bucket]++;
+
+		frame = {};
+	}
+
+	/*
+	* A finished frame, age 0 is the last one. Frames older than the history or before the start are zero.
+	*/
+	const CounterFrame& Counters::getFrame(unsigned int age) {
+
+		static const CounterFrame empty = {};
+		if (age >= COUNTERS_HISTORY || age >= frameCount)
+			return empty;
+
+		return history[(frameCount - 1 - age) % COUNTERS_HISTORY];
+	}
+
+	unsigned long long Counters::get(int counter, unsigned int age) {
+
+		return Counters::getFrame(age).values[counter];
+	}
+
+	unsigned long long Counters::getLevel(int counter, int level, unsigned int age) {
+
+		return level < COUNTERS_MAX_LEVELS ? Counters::getFrame(age).levelValues[counter][level] : 0;
+	}
+
+	unsigned long long Counters::getLevelTotal(int counter, unsigned int age) {
+
+		const CounterFrame& counters = Counters::getFrame(age);
+		unsigned long long total = 0;
+		for (int level = 0; level < COUNTERS_MAX_LEVELS; level++)
+			total += counters.levelValues[counter][level];
+		return total;
+	}
+
+	unsigned long long Counters::getMemoryTotal(bool gpu) {
+
+		unsigned long long total = 0;
+		for (int i = gpu ? MEMORY_GPU_FIRST : 0; i < (gpu ? MEMORY_CATEGORY_COUNT : MEMORY_GPU_FIRST); i++)
+			total += memory[i];
+		return total;
+	}
+
+	void Counters::resetHistogram() {
+
+		for (int i = 0; i < COUNTERS_HISTOGRAM_BUCKETS; i++)
+			histogram[i] = 0;
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+// Frames the rolling graphs keep
+#define COUNTERS_HISTORY 256
+// Levels a level counter has room for, not less than CLIPMAP_LEVEL
+#define COUNTERS_MAX_LEVELS 8
+#define COUNTERS_HISTOGRAM_BUCKETS 10
+
+// Ids below are part of the API that the game HUD and tests read, new ones are only appended
+
+// Frame counters
+#define COUNTER_TRIANGLES 0
+#define COUNTER_FULL_RELOADS 1		// levels streamTerrain loaded whole since the camera moved too far
+#define COUNTER_GPU_CULLING 2		// 1 if the terrain was culled on the GPU, block counts are unknown and triangles are the submitted ones
+#define COUNTER_VISIBLE_INSTANCES 3	// clipmap instances left after culling on the CPU
+#define COUNTER_COUNT 4
+
+// Frame counters of every clipmap level
+#define LEVEL_COUNTER_VISIBLE_BLOCKS 0
+#define LEVEL_COUNTER_CULLED_BLOCKS 1
+#define LEVEL_COUNTER_STREAMED_TEXELS 2
+#define LEVEL_COUNTER_STREAMED_BYTES 3
+#define LEVEL_COUNTER_COUNT 4
+
+// Memory categories, CPU ones first
+#define MEMORY_CPU_HEIGHTMAP_STACK 0
+#define MEMORY_CPU_HEIGHT_PYRAMIDS 1
+#define MEMORY_CPU_TILE_CACHE 2
+#define MEMORY_GPU_TERRAIN_MAPS 3
+#define MEMORY_GPU_TERRAIN_MATERIALS 4
+#define MEMORY_GPU_TERRAIN_BUFFERS 5
+#define MEMORY_GPU_ENVIRONMENT 6
+#define MEMORY_GPU_FRAMEBUFFERS 7
+#define MEMORY_CATEGORY_COUNT 8
+#define MEMORY_GPU_FIRST MEMORY_GPU_TERRAIN_MAPS
+
+namespace Core {
+
+	/*
+	* Counters of a frame. Frame time is in milliseconds.
+	*/
+	struct CounterFrame {
+
+		float frameTime;
+		unsigned long long values[COUNTER_COUNT];
+		unsigned long long levelValues[LEVEL_COUNTER_COUNT][COUNTERS_MAX_LEVELS];
+	};
+
+	/*
+	* Runtime statistics of the terrain and the renderer. Frame counters are added up in frame and moved to the history
+	* by endFrame, readers take the finished frames from getFrame. Memory is what each category holds now, its owner sets it.
+	* Frame times are counted into a histogram since the last reset, a bucket holds frames up to its edge.
+	* Not thread safe, counters are written and read on the render thread like the GL calls they count.
+	*/
+	class __declspec(dllexport) Counters {
+
+	private:
+
+		static CounterFrame history[COUNTERS_HISTORY];
+
+	public:
+
+		static CounterFrame frame;		// counters of the frame so far
+		static unsigned long long frameCount;
+		static unsigned long long memory[MEMORY_CATEGORY_COUNT];
+		static unsigned long long histogram[COUNTERS_HISTOGRAM_BUCKETS];
+
+		static const char* counterNames[COUNTER_COUNT];
+		static const char* levelCounterNames[LEVEL_COUNTER_COUNT];
+		static const char* memoryNames[MEMORY_CATEGORY_COUNT];
+		static const float histogramEdges[COUNTERS_HISTOGRAM_BUCKETS];
+
+		static void add(int counter, unsigned long long value);
+		static void addLevel(int counter, int level, unsigned long long value);
+		static void setMemory(int category, unsigned long long bytes);
+		static void endFrame(float frameTime);
+		static const CounterFrame& getFrame(unsigned int age = 0);
+		static unsigned long long get(int counter, unsigned int age = 0);
+		static unsigned long long getLevel(int counter, int level, unsigned int age = 0);
+		static unsigned long long getLevelTotal(int counter, unsigned int age = 0);
+		static unsigned long long getMemoryTotal(bool gpu);
+		static void resetHistogram();
+	};
+}
@@ -0,0 +1,47 @@
+#include "pch.h"
+#include "cpufeatures.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace Core {
+
+	const int CPUFeatures::instructionSet = CPUFeatures::detectInstructionSet();
+	const char* CPUFeatures::instructionSetNames[INSTRUCTION_SET_COUNT] = { "scalar", "sse", "avx2" };
+
+	/*
+	* AVX2 needs support of both cpu and os (saved ymm registers).
+	*/
+	int CPUFeatures::detectInstructionSet() {
+
+#ifdef _MSC_VER
+		int info[4] = { 0, 0, 0, 0 };
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+		__cpuid(info, 1);
+
+		bool sse2 = (info[3] & (1 << 26)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+
+		if (!sse2)
+			return INSTRUCTION_SET_SCALAR;
+
+		if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5))
+				return INSTRUCTION_SET_AVX2;
+		}
+
+		return INSTRUCTION_SET_SSE;
+#else
+		if (__builtin_cpu_supports("avx2"))
+			return INSTRUCTION_SET_AVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return INSTRUCTION_SET_SSE;
+		return INSTRUCTION_SET_SCALAR;
+#endif
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// SIMD paths, each one is only chosen if the ones before it are supported too
+#define INSTRUCTION_SET_SCALAR 0
+#define INSTRUCTION_SET_SSE 1
+#define INSTRUCTION_SET_AVX2 2
+#define INSTRUCTION_SET_COUNT 3
+
+#ifdef _MSC_VER
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+namespace Core {
+
+	/*
+	* Instruction sets the CPU and the OS support, detected once when the library is loaded.
+	* It is the default path of the frustum culler, the mip generator and the block encoder,
+	* they also take a path as a parameter so benchmarks run each one without changing the default.
+	*/
+	class __declspec(dllexport) CPUFeatures {
+
+	private:
+
+	public:
+
+		static const int instructionSet;
+		static const char* instructionSetNames[INSTRUCTION_SET_COUNT];
+
+		static int detectInstructionSet();
+	};
+}
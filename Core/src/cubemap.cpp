@@ -3,8 +3,11 @@
 #include "cubemap.h"
 #include "glewcontext.h"
 #include "renderer.h"
-#include "shader.h"
-#include "GL/glew.h"
+#include "shadermanager.h"
+#include "gldispatch.h"
+#include "profiler.h"
+#include "gputimer.h"
+#include "counters.h"
 #include "glm/gtc/matrix_transform.hpp"
 #include "FreeImage.h"
 
@@ -21,18 +24,23 @@ namespace Core {
 		glDeleteTextures(1, &irradianceMap);
 		glDeleteTextures(1, &prefilterMap);
 		glDeleteTextures(1, &brdfLUTTexture);
+		Counters::setMemory(MEMORY_GPU_ENVIRONMENT, 0);
 	}
 
 	// ref: https://learnopengl.com/PBR/IBL/Specular-IBL
 	void Cubemap::createCubemapTextures(std::string path) {
 
+		PROFILE_FUNCTION();
+
 		GlewContext* glew = CoreContext::instance->glewContext;
 		Renderer* renderer = CoreContext::instance->renderer;
 
-		int equirectangularToCubemapShaderProgramId = Shader::loadShaders("resources/shaders/cubemap/cubemap.vert", "resources/shaders/cubemap/equirectangular_to_cubemap.frag");
-		int irradianceShaderProgramId = Shader::loadShaders("resources/shaders/cubemap/cubemap.vert", "resources/shaders/cubemap/irradiance_convolution.frag");
-		int prefilterShaderProgramId = Shader::loadShaders("resources/shaders/cubemap/cubemap.vert", "resources/shaders/cubemap/prefilter.frag");
-		int brdfShaderProgramId = Shader::loadShaders("resources/shaders/cubemap/brdf.vert", "resources/shaders/cubemap/brdf.frag");
+		// All four are submitted before the first is used, so they are compiled in parallel. Cubemaps share them.
+		ShaderManager* shaderManager = CoreContext::instance->shaderManager;
+		int equirectangularToCubemapShaderProgramId = shaderManager->load("resources/shaders/cubemap/cubemap.vert", "resources/shaders/cubemap/equirectangular_to_cubemap.frag");
+		int irradianceShaderProgramId = shaderManager->load("resources/shaders/cubemap/cubemap.vert", "resources/shaders/cubemap/irradiance_convolution.frag");
+		int prefilterShaderProgramId = shaderManager->load("resources/shaders/cubemap/cubemap.vert", "resources/shaders/cubemap/prefilter.frag");
+		int brdfShaderProgramId = shaderManager->load("resources/shaders/cubemap/brdf.vert", "resources/shaders/cubemap/brdf.frag");
 
 		unsigned int backgroundShaderProgramId = CoreContext::instance->renderer->backgroundShaderProgramId;
 
@@ -40,6 +48,7 @@ namespace Core {
 		unsigned int quadVAO;
 		Cubemap::createQuadVAO(quadVAO);
 
+		GPUTimer::begin(GPU_PASS_IBL_PRECOMPUTE);
 		glDisable(GL_CULL_FACE);
 
 		glUseProgram(backgroundShaderProgramId);
@@ -255,11 +264,11 @@ namespace Core {
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 		glEnable(GL_CULL_FACE);
+		GPUTimer::end(GPU_PASS_IBL_PRECOMPUTE);
+
+		// RGB16F environment and prefiltered maps with their mipmaps, irradiance map and RG16F BRDF lookup table
+		Counters::setMemory(MEMORY_GPU_ENVIRONMENT, (512ull * 512 * 6 * 6 + 128ull * 128 * 6 * 6) * 4 / 3 + 32ull * 32 * 6 * 6 + 512ull * 512 * 4);
 
-		glDeleteProgram(equirectangularToCubemapShaderProgramId);
-		glDeleteProgram(irradianceShaderProgramId);
-		glDeleteProgram(prefilterShaderProgramId);
-		glDeleteProgram(brdfShaderProgramId);
 		glDeleteVertexArrays(1, &quadVAO);
 	}
 
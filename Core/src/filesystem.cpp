@@ -1,14 +1,22 @@
 #include "pch.h"
 #include "filesystem.h"
+#include "threadpool.h"
+#include "profiler.h"
+#include <chrono>
 
 namespace Core {
 
 	FileSystem::FileSystem() {
 
+		loadPool = new ThreadPool();
+		loadThreads = loadPool->getThreadCount();
 	}
 
 	FileSystem::~FileSystem() {
 
+		// textures that are still decoding are written by the pool
+		delete loadPool;
+
 		for (auto it : textures)
 			delete it.second;
 		for (auto it : cubemaps)
@@ -19,9 +27,14 @@ namespace Core {
 			delete it.second;
 	}
 
+	/*
+	* Textures are submitted first, so the cubemap is decoded and drawn on this thread while they are decoded on the pool.
+	*/
 	void FileSystem::init() {
 
-		FileSystem::loadCubemap("resources/cubemaps/hilly_terrain_01_puresky_4k.hdr");
+		PROFILE_FUNCTION();
+
+		auto begin = std::chrono::high_resolution_clock::now();
 
 		FileSystem::loadTexture("resources/textures/terrain/texturemaps/cliffgranite_a.png");
 		FileSystem::loadTexture("resources/textures/terrain/texturemaps/groundforest_a.png");
@@ -51,12 +64,46 @@ namespace Core {
 
 		FileSystem::loadTexture("resources/textures/terrain/macro.png");
 		FileSystem::loadTexture("resources/textures/terrain/noiseTexture.png");
+
+		FileSystem::loadCubemap("resources/cubemaps/hilly_terrain_01_puresky_4k.hdr");
+
+		FileSystem::wait();
+
+		auto end = std::chrono::high_resolution_clock::now();
+		loadDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001f;
+		FileSystem::printLoadTimes();
 	}
 
+	/*
+	* Blocks until every texture that was submitted is decoded.
+	*/
+	void FileSystem::wait() {
+
+		loadPool->wait();
+	}
+
+	void FileSystem::printLoadTimes() {
+
+		float decodeTotal = 0.f;
+		for (auto& it : textures) {
+			Texture* texture = it.second;
+			printf("  %-24s %5ux%-5u %u channels %8.1f ms\n", it.first.c_str(), texture->width, texture->height, texture->channels, texture->decodeDuration);
+			decodeTotal += texture->decodeDuration;
+		}
+		printf("Assets loaded in %.1f ms, %.1f ms of decoding on %u threads\n", loadDuration, decodeTotal, loadThreads);
+	}
+
+	/*
+	* The texture is returned before it is decoded, its texels must not be used before wait().
+	*/
 	Texture* FileSystem::loadTexture(std::filesystem::path entry) {
 
-		Texture* texture = new Texture(entry.string());
+		Texture* texture = new Texture();
 		textures.insert({ entry.stem().string(), texture });
+
+		std::string path = entry.string();
+		if (entry.extension() == ".png")
+			loadPool->submit([texture, path]() { texture->loadPNGFile(path.c_str()); });
 		return texture;
 	}
 
@@ -7,11 +7,17 @@
 
 namespace Core {
 
+	class ThreadPool;
 
+	/*
+	* Textures are decoded on a pool of loader threads. loadTexture returns the texture at once as the handle of the load,
+	* its texels are there after wait(). Anything that needs the context, like cubemaps, is loaded on the calling thread.
+	*/
 	class __declspec(dllexport) FileSystem {
 
 	private:
 
+		ThreadPool* loadPool = NULL;
 
 	public:
 
@@ -20,9 +26,14 @@ namespace Core {
 		std::map<std::string, Shader*> shaders;
 		std::map<std::string, Mesh*> meshes;
 
+		float loadDuration = 0.f;
+		unsigned int loadThreads = 0;
+
 		FileSystem();
 		~FileSystem();
 		void init();
+		void wait();
+		void printLoadTimes();
 		Texture* loadTexture(std::filesystem::path entry);
 		Mesh* loadMesh(std::filesystem::path entry);
 		Shader* loadShader(std::filesystem::path entry);
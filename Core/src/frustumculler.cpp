@@ -0,0 +1,253 @@
+#include "pch.h"
+#include "frustumculler.h"
+#include <immintrin.h>
+#include <chrono>
+#include <random>
+
+namespace Core {
+
+	void AABBList::add(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+
+		minX.push_back(boundsMin.x);
+		minY.push_back(boundsMin.y);
+		minZ.push_back(boundsMin.z);
+		maxX.push_back(boundsMax.x);
+		maxY.push_back(boundsMax.y);
+		maxZ.push_back(boundsMax.z);
+	}
+
+	void AABBList::clear() {
+
+		minX.clear();
+		minY.clear();
+		minZ.clear();
+		maxX.clear();
+		maxY.clear();
+		maxZ.clear();
+	}
+
+	unsigned int AABBList::size() const {
+
+		return minX.size();
+	}
+
+	void FrustumCuller::cull(const AABBList& boxes, const glm::vec4* planes, unsigned char* visible, int instructionSet) {
+
+		unsigned int done = 0;
+
+		if (instructionSet == INSTRUCTION_SET_AVX2)
+			done = FrustumCuller::cullAVX2(boxes, planes, visible);
+		else if (instructionSet == INSTRUCTION_SET_SSE)
+			done = FrustumCuller::cullSSE(boxes, planes, visible);
+
+		// remainder that does not fill a register
+		FrustumCuller::cullScalar(boxes, planes, visible, done);
+	}
+
+	void FrustumCuller::cullScalar(const AABBList& boxes, const glm::vec4* planes, unsigned char* visible, unsigned int start) {
+
+		unsigned int count = boxes.size();
+
+		for (unsigned int i = start; i < count; i++) {
+
+			visible[i] = 1;
+
+			for (int p = 0; p < 6; p++) {
+
+				const glm::vec4& plane = planes[p];
+				float x = plane.x >= 0 ? boxes.maxX[i] : boxes.minX[i];
+				float y = plane.y >= 0 ? boxes.maxY[i] : boxes.minY[i];
+				float z = plane.z >= 0 ? boxes.maxZ[i] : boxes.minZ[i];
+
+				if (plane.x * x + plane.y * y + plane.z * z + plane.w <= 0.0f) {
+					visible[i] = 0;
+					break;
+				}
+			}
+		}
+	}
+
+	/*
+	* Returns the number of boxes that are tested. The plane is the same for all lanes,
+	* so the p-vertex is chosen by picking the min or max array once per plane. An empty list has no arrays to point to.
+	*/
+	unsigned int FrustumCuller::cullSSE(const AABBList& boxes, const glm::vec4* planes, unsigned char* visible) {
+
+		unsigned int count = boxes.size() & ~3u;
+		if (count == 0)
+			return 0;
+
+		const float* pX[6], * pY[6], * pZ[6];
+
+		for (int p = 0; p < 6; p++) {
+			pX[p] = planes[p].x >= 0 ? &boxes.maxX[0] : &boxes.minX[0];
+			pY[p] = planes[p].y >= 0 ? &boxes.maxY[0] : &boxes.minY[0];
+			pZ[p] = planes[p].z >= 0 ? &boxes.maxZ[0] : &boxes.minZ[0];
+		}
+
+		__m128 zero = _mm_setzero_ps();
+
+		for (unsigned int i = 0; i < count; i += 4) {
+
+			__m128 outside = _mm_setzero_ps();
+
+			for (int p = 0; p < 6; p++) {
+
+				__m128 d = _mm_mul_ps(_mm_set1_ps(planes[p].x), _mm_loadu_ps(pX[p] + i));
+				d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes[p].y), _mm_loadu_ps(pY[p] + i)));
+				d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(planes[p].z), _mm_loadu_ps(pZ[p] + i)));
+				d = _mm_add_ps(d, _mm_set1_ps(planes[p].w));
+				outside = _mm_or_ps(outside, _mm_cmple_ps(d, zero));
+			}
+
+			int mask = _mm_movemask_ps(outside);
+			visible[i + 0] = !(mask & 1);
+			visible[i + 1] = !(mask & 2);
+			visible[i + 2] = !(mask & 4);
+			visible[i + 3] = !(mask & 8);
+		}
+
+		return count;
+	}
+
+	AVX2_TARGET unsigned int FrustumCuller::cullAVX2(const AABBList& boxes, const glm::vec4* planes, unsigned char* visible) {
+
+		unsigned int count = boxes.size() & ~7u;
+		if (count == 0)
+			return 0;
+
+		const float* pX[6], * pY[6], * pZ[6];
+
+		for (int p = 0; p < 6; p++) {
+			pX[p] = planes[p].x >= 0 ? &boxes.maxX[0] : &boxes.minX[0];
+			pY[p] = planes[p].y >= 0 ? &boxes.maxY[0] : &boxes.minY[0];
+			pZ[p] = planes[p].z >= 0 ? &boxes.maxZ[0] : &boxes.minZ[0];
+		}
+
+		__m256 zero = _mm256_setzero_ps();
+
+		for (unsigned int i = 0; i < count; i += 8) {
+
+			__m256 outside = _mm256_setzero_ps();
+
+			for (int p = 0; p < 6; p++) {
+
+				// no fma, results must match the scalar path
+				__m256 d = _mm256_mul_ps(_mm256_set1_ps(planes[p].x), _mm256_loadu_ps(pX[p] + i));
+				d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(planes[p].y), _mm256_loadu_ps(pY[p] + i)));
+				d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(planes[p].z), _mm256_loadu_ps(pZ[p] + i)));
+				d = _mm256_add_ps(d, _mm256_set1_ps(planes[p].w));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, zero, _CMP_LE_OQ));
+			}
+
+			int mask = _mm256_movemask_ps(outside);
+			for (int lane = 0; lane < 8; lane++)
+				visible[i + lane] = !(mask & (1 << lane));
+		}
+
+		return count;
+	}
+
+	// ref: https://arm-software.github.io/opengl-es-sdk-for-android/terrain.html
+	/*
+	* Previous routine of the terrain. Eight corners are tested against each plane. Kept to compare with.
+	*/
+	void FrustumCuller::cullCorners(const AABBList& boxes, const glm::vec4* planes, unsigned char* visible) {
+
+		unsigned int count = boxes.size();
+
+		for (unsigned int i = 0; i < count; i++) {
+
+			glm::vec4 corners[8];
+			corners[0] = glm::vec4(boxes.minX[i], boxes.minY[i], boxes.minZ[i], 1);
+			corners[1] = glm::vec4(boxes.minX[i], boxes.minY[i], boxes.maxZ[i], 1);
+			corners[2] = glm::vec4(boxes.minX[i], boxes.maxY[i], boxes.minZ[i], 1);
+			corners[3] = glm::vec4(boxes.minX[i], boxes.maxY[i], boxes.maxZ[i], 1);
+			corners[4] = glm::vec4(boxes.maxX[i], boxes.minY[i], boxes.minZ[i], 1);
+			corners[5] = glm::vec4(boxes.maxX[i], boxes.minY[i], boxes.maxZ[i], 1);
+			corners[6] = glm::vec4(boxes.maxX[i], boxes.maxY[i], boxes.minZ[i], 1);
+			corners[7] = glm::vec4(boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i], 1);
+
+			visible[i] = 1;
+
+			for (unsigned int p = 0; p < 6 && visible[i]; p++) {
+
+				bool insidePlane = false;
+				for (unsigned int c = 0; c < 8; c++) {
+					if (glm::dot(corners[c], planes[p]) > 0.0f) {
+						insidePlane = true;
+						break;
+					}
+				}
+				if (!insidePlane)
+					visible[i] = 0;
+			}
+		}
+	}
+
+	/*
+	* Culls random boxes with a fixed frustum using every available path and prints the time per box.
+	* Fails if a path does not give the result of the corner test.
+	*/
+	bool FrustumCuller::benchmark(unsigned int boxCount, unsigned int iterations) {
+
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-1000.f, 1000.f);
+		std::uniform_real_distribution<float> extent(1.f, 100.f);
+
+		AABBList boxes;
+		for (unsigned int i = 0; i < boxCount; i++) {
+			glm::vec3 start(position(random), position(random) * 0.1f, position(random));
+			boxes.add(start, start + glm::vec3(extent(random), extent(random), extent(random)));
+		}
+
+		// 90 degree frustum looking down -z from the origin
+		glm::vec4 planes[6] = {
+			glm::vec4(0.7071f, 0, -0.7071f, 0), glm::vec4(-0.7071f, 0, -0.7071f, 0),
+			glm::vec4(0, 0.7071f, -0.7071f, 0), glm::vec4(0, -0.7071f, -0.7071f, 0),
+			glm::vec4(0, 0, -1, -0.1f), glm::vec4(0, 0, 1, 800.f)
+		};
+
+		std::vector<unsigned char> reference(boxCount);
+		std::vector<unsigned char> visible(boxCount);
+		FrustumCuller::cullCorners(boxes, planes, &reference[0]);
+
+		const char* names[4] = { "corners", "scalar", "sse", "avx2" };
+		unsigned int totalMismatches = 0;
+
+		for (int path = 0; path < 4; path++) {
+
+			if (path == 3 && CPUFeatures::instructionSet != INSTRUCTION_SET_AVX2)
+				continue;
+			if (path == 2 && CPUFeatures::instructionSet == INSTRUCTION_SET_SCALAR)
+				continue;
+
+			auto begin = std::chrono::high_resolution_clock::now();
+
+			for (unsigned int iteration = 0; iteration < iterations; iteration++) {
+
+				if (path == 0)
+					FrustumCuller::cullCorners(boxes, planes, &visible[0]);
+				else if (path == 1)
+					FrustumCuller::cullScalar(boxes, planes, &visible[0], 0);
+				else if (path == 2)
+					FrustumCuller::cullScalar(boxes, planes, &visible[0], FrustumCuller::cullSSE(boxes, planes, &visible[0]));
+				else
+					FrustumCuller::cullScalar(boxes, planes, &visible[0], FrustumCuller::cullAVX2(boxes, planes, &visible[0]));
+			}
+
+			auto end = std::chrono::high_resolution_clock::now();
+			double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+
+			unsigned int mismatches = 0;
+			for (unsigned int i = 0; i < boxCount; i++)
+				mismatches += visible[i] != reference[i];
+
+			printf("Frustum culling %-8s %8.3f ns/box, mismatches: %u\n", names[path], nanoseconds / ((double)boxCount * iterations), mismatches);
+			totalMismatches += mismatches;
+		}
+
+		printf("%s\n", totalMismatches == 0 ? "Passed" : "FAILED");
+		return totalMismatches == 0;
+	}
+}
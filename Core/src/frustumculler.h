@@ -0,0 +1,42 @@
+#pragma once
+#include "glm/glm.hpp"
+#include "cpufeatures.h"
+
+namespace Core {
+
+	/*
+	* Bounding boxes in structure of arrays layout, so 4 or 8 boxes are loaded with one instruction.
+	*/
+	struct __declspec(dllexport) AABBList {
+
+		std::vector<float> minX;
+		std::vector<float> minY;
+		std::vector<float> minZ;
+		std::vector<float> maxX;
+		std::vector<float> maxY;
+		std::vector<float> maxZ;
+
+		void add(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+		void clear();
+		unsigned int size() const;
+	};
+
+	/*
+	* Tests many boxes against the six frustum planes. A box is culled when its p-vertex,
+	* the corner furthest along the plane normal, is not in front of a plane.
+	* Every path gives the same result as the scalar one.
+	*/
+	class __declspec(dllexport) FrustumCuller {
+
+	private:
+
+	public:
+
+		static void cull(const AABBList& boxes, const glm::vec4* planes, unsigned char* visible, int instructionSet = CPUFeatures::instructionSet);
+		static void cullScalar(const AABBList& boxes, const glm::vec4* planes, unsigned char* visible, unsigned int start);
+		static unsigned int cullSSE(const AABBList& boxes, const glm::vec4* planes, unsigned char* visible);
+		static unsigned int cullAVX2(const AABBList& boxes, const glm::vec4* planes, unsigned char* visible);
+		static void cullCorners(const AABBList& boxes, const glm::vec4* planes, unsigned char* visible);
+		static bool benchmark(unsigned int boxCount, unsigned int iterations);
+	};
+}
@@ -0,0 +1,837 @@
+#include "pch.h"
+#define GL_DISPATCH_NO_REDIRECT
+#include "gldispatch.h"
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifdef GL_DISPATCH_NO_GLEW
+// Builds without the GLEW library, the headless target of CMakeLists.txt. They only run on the null backend,
+// install replaces the entry points and sets the extensions it has.
+GLboolean __GLEW_ARB_buffer_storage = GL_FALSE;
+GLboolean __GLEW_ARB_get_program_binary = GL_FALSE;
+GLboolean __GLEW_ARB_parallel_shader_compile = GL_FALSE;
+GLboolean __GLEW_ARB_texture_compression_bptc = GL_FALSE;
+GLboolean __GLEW_ARB_timer_query = GL_FALSE;
+GLboolean __GLEW_EXT_texture_compression_s3tc = GL_FALSE;
+GLboolean __GLEW_KHR_parallel_shader_compile = GL_FALSE;
+GLboolean __GLEW_VERSION_3_3 = GL_FALSE;
+#define GL_DISPATCH_DEFINE_GLEW(category, returnType, name, parameters, arguments, bytes) decltype(__glew##name) __glew##name = NULL;
+GL_DISPATCH_GLEW_FUNCTIONS(GL_DISPATCH_DEFINE_GLEW)
+#undef GL_DISPATCH_DEFINE_GLEW
+#endif
+
+namespace Core {
+
+	enum {
+#define GL_DISPATCH_INDEX(category, returnType, name, parameters, arguments, bytes) GL_FUNCTION_##name,
+		GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_INDEX)
+		GL_DISPATCH_GLEW_FUNCTIONS(GL_DISPATCH_INDEX)
+#undef GL_DISPATCH_INDEX
+		GL_FUNCTION_COUNT
+	};
+
+	// Entry points of GL 1.1 start at the system library, so Core works before install is called
+#define GL_DISPATCH_DEFINE(category, returnType, name, parameters, arguments, bytes) returnType (GLAPIENTRY* GLDispatch::gl##name) parameters = ::gl##name;
+	GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_DEFINE)
+#undef GL_DISPATCH_DEFINE
+
+	int GLDispatch::backend = GL_DISPATCH_DRIVER;
+	bool GLDispatch::recording = false;
+	std::vector<const char*> GLDispatch::functionNames;
+	GLFrameStatistics GLDispatch::frame;
+	GLFrameStatistics GLDispatch::lastFrame;
+	unsigned long long GLDispatch::frameCount = 0;
+
+	// driver: as the driver was loaded, backend: where calls go after the recorder
+#define GL_DISPATCH_POINTERS(category, returnType, name, parameters, arguments, bytes) \
+	static returnType (GLAPIENTRY* driver##name) parameters = NULL; \
+	static returnType (GLAPIENTRY* backend##name) parameters = NULL;
+	GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_POINTERS)
+	GL_DISPATCH_GLEW_FUNCTIONS(GL_DISPATCH_POINTERS)
+#undef GL_DISPATCH_POINTERS
+
+#define GL_DISPATCH_RECORD(category, returnType, name, parameters, arguments, bytes) \
+	static returnType GLAPIENTRY record##name parameters { \
+		GLDispatch::record(GL_FUNCTION_##name, category, bytes); \
+		return backend##name arguments; \
+	}
+	GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_RECORD)
+	GL_DISPATCH_GLEW_FUNCTIONS(GL_DISPATCH_RECORD)
+#undef GL_DISPATCH_RECORD
+
+	// ------------------------------------------------------------------------------------------------------------------
+	// Null backend
+
+	template<typename T>
+	static T getNullValue() {
+		return T();
+	}
+
+	template<>
+	void getNullValue<void>() { }
+
+	// Functions that have nothing to track return zero, the ones that do are overridden in installNullBackend
+#define GL_DISPATCH_NULL_FUNCTION(category, returnType, name, parameters, arguments, bytes) \
+	static returnType GLAPIENTRY nullDefault##name parameters { \
+		return getNullValue<returnType>(); \
+	}
+	GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_NULL_FUNCTION)
+	GL_DISPATCH_GLEW_FUNCTIONS(GL_DISPATCH_NULL_FUNCTION)
+#undef GL_DISPATCH_NULL_FUNCTION
+
+	/*
+	* Storage of a texture, levels are tightly packed, layers after each other. Cubemap faces are layers.
+	* texelBytes is 0 for block compressed formats, their levels are only written as a whole.
+	*/
+	struct NullTexture {
+
+		GLenum target = 0;
+		int width = 0;
+		int height = 0;
+		int layers = 0;
+		int texelBytes = 0;
+		int blockBytes = 0;
+		bool byteComponents = false;	// unsigned normalized bytes, GenerateMipmap filters them
+		bool immutable = false;
+		std::vector<std::vector<unsigned char>> levels;
+	};
+
+	static std::set<size_t> nullObjects[GL_OBJECT_TYPE_COUNT];
+	static std::unordered_map<GLuint, std::vector<unsigned char>> nullBuffers;
+	static std::unordered_map<GLenum, GLuint> nullBoundBuffers;
+	static std::unordered_map<GLuint, NullTexture> nullTextures;
+	static std::map<std::pair<GLenum, GLenum>, GLuint> nullBoundTextures;	// (unit, target)
+	static GLenum nullActiveUnit = GL_TEXTURE0;
+	static GLint nullUnpackAlignment = 4;
+	static size_t nullNextName = 1;
+	static std::unordered_map<GLuint, GLuint64> nullQueries;
+
+	static GLuint createNullObject(int type) {
+
+		GLuint name = (GLuint)nullNextName++;
+		nullObjects[type].insert(name);
+		return name;
+	}
+
+	static void genNullObjects(int type, GLsizei n, GLuint* names) {
+
+		for (GLsizei i = 0; i < n; i++)
+			names[i] = createNullObject(type);
+	}
+
+	static void deleteNullObjects(int type, GLsizei n, const GLuint* names) {
+
+		for (GLsizei i = 0; i < n; i++)
+			nullObjects[type].erase(names[i]);
+	}
+
+	static int getComponentCount(GLenum format) {
+
+		switch (format) {
+		case GL_RED: case GL_R: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: return 1;
+		case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL: return 2;
+		case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: return 3;
+		case GL_RGBA: case GL_BGRA: case GL_RGBA_INTEGER: return 4;
+		}
+		return 4;
+	}
+
+	static int getTypeBytes(GLenum type) {
+
+		switch (type) {
+		case GL_UNSIGNED_BYTE: case GL_BYTE: return 1;
+		case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: return 2;
+		}
+		return 4;
+	}
+
+	// Bytes of a texel of an uncompressed internal format, 0 when it is block compressed
+	static int getTexelBytes(GLenum internalFormat, int& blockBytes, bool& byteComponents) {
+
+		blockBytes = 0;
+		byteComponents = false;
+
+		switch (internalFormat) {
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: case GL_COMPRESSED_RED_RGTC1:
+			blockBytes = 8;
+			return 0;
+		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: case GL_COMPRESSED_RG_RGTC2:
+		case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB: case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB:
+			blockBytes = 16;
+			return 0;
+		case GL_R16F: case GL_DEPTH_COMPONENT16: return 2;
+		case GL_RG16F: case GL_R32F: case GL_DEPTH24_STENCIL8: case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F: return 4;
+		case GL_RGB16F: return 6;
+		case GL_RGBA16F: case GL_RG32F: return 8;
+		case GL_RGB32F: return 12;
+		case GL_RGBA32F: return 16;
+		}
+
+		byteComponents = true;
+		switch (internalFormat) {
+		case GL_R8: case GL_RED: case GL_R: return 1;
+		case GL_RG8: case GL_RG: return 2;
+		case GL_RGB8: case GL_SRGB8: case GL_RGB: return 3;
+		}
+		return 4;
+	}
+
+	static size_t getLevelBytes(const NullTexture& texture, int level) {
+
+		int width = std::max(texture.width >> level, 1);
+		int height = std::max(texture.height >> level, 1);
+
+		if (texture.texelBytes == 0)
+			return (size_t)((width + 3) / 4) * ((height + 3) / 4) * texture.blockBytes * texture.layers;
+
+		return (size_t)width * height * texture.texelBytes * texture.layers;
+	}
+
+	// Cubemap faces are bound as the cubemap and stored as its layers
+	static NullTexture* getBoundTexture(GLenum target, int& layer) {
+
+		layer = 0;
+		if (target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z) {
+			layer = target - GL_TEXTURE_CUBE_MAP_POSITIVE_X;
+			target = GL_TEXTURE_CUBE_MAP;
+		}
+
+		auto bound = nullBoundTextures.find({ nullActiveUnit, target });
+		if (bound == nullBoundTextures.end())
+			return NULL;
+
+		auto texture = nullTextures.find(bound->second);
+		return texture == nullTextures.end() ? NULL : &texture->second;
+	}
+
+	// Pixels are read from the bound unpack buffer when there is one, the pointer is an offset into it then
+	static const unsigned char* getUnpackSource(const void* pixels) {
+
+		GLuint unpackBuffer = nullBoundBuffers[GL_PIXEL_UNPACK_BUFFER];
+		if (unpackBuffer == 0)
+			return (const unsigned char*)pixels;
+
+		std::vector<unsigned char>& storage = nullBuffers[unpackBuffer];
+		return storage.empty() ? NULL : &storage[0] + (size_t)pixels;
+	}
+
+	static void GLAPIENTRY nullGenBuffers(GLsizei n, GLuint* buffers) {
+
+		genNullObjects(GL_OBJECT_BUFFER, n, buffers);
+		for (GLsizei i = 0; i < n; i++)
+			nullBuffers[buffers[i]];
+	}
+
+	static void GLAPIENTRY nullDeleteBuffers(GLsizei n, const GLuint* buffers) {
+
+		deleteNullObjects(GL_OBJECT_BUFFER, n, buffers);
+		for (GLsizei i = 0; i < n; i++)
+			nullBuffers.erase(buffers[i]);
+	}
+
+	static void GLAPIENTRY nullBindBuffer(GLenum target, GLuint buffer) {
+
+		nullBoundBuffers[target] = buffer;
+	}
+
+	static void GLAPIENTRY nullBindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+
+		nullBoundBuffers[target] = buffer;
+	}
+
+	static void GLAPIENTRY nullBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) {
+
+		std::vector<unsigned char>& storage = nullBuffers[nullBoundBuffers[target]];
+		storage.assign(size, 0);
+		if (data && size > 0)
+			memcpy(&storage[0], data, size);
+	}
+
+	static void GLAPIENTRY nullBufferStorage(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags) {
+
+		nullBufferData(target, size, data, 0);
+	}
+
+	static void GLAPIENTRY nullBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) {
+
+		std::vector<unsigned char>& storage = nullBuffers[nullBoundBuffers[target]];
+		if (offset + size <= (GLsizeiptr)storage.size() && size > 0)
+			memcpy(&storage[offset], data, size);
+	}
+
+	static void* GLAPIENTRY nullMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) {
+
+		std::vector<unsigned char>& storage = nullBuffers[nullBoundBuffers[target]];
+		return offset + length > (GLsizeiptr)storage.size() || storage.empty() ? NULL : &storage[offset];
+	}
+
+	static GLboolean GLAPIENTRY nullUnmapBuffer(GLenum target) {
+
+		return GL_TRUE;
+	}
+
+	static GLsync GLAPIENTRY nullFenceSync(GLenum condition, GLbitfield flags) {
+
+		return (GLsync)(size_t)createNullObject(GL_OBJECT_SYNC);
+	}
+
+	static GLenum GLAPIENTRY nullClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
+
+		return GL_ALREADY_SIGNALED;
+	}
+
+	static void GLAPIENTRY nullDeleteSync(GLsync sync) {
+
+		nullObjects[GL_OBJECT_SYNC].erase((size_t)sync);
+	}
+
+	static void GLAPIENTRY nullGenTextures(GLsizei n, GLuint* textures) {
+
+		genNullObjects(GL_OBJECT_TEXTURE, n, textures);
+		for (GLsizei i = 0; i < n; i++)
+			nullTextures[textures[i]];
+	}
+
+	static void GLAPIENTRY nullDeleteTextures(GLsizei n, const GLuint* textures) {
+
+		deleteNullObjects(GL_OBJECT_TEXTURE, n, textures);
+		for (GLsizei i = 0; i < n; i++)
+			nullTextures.erase(textures[i]);
+	}
+
+	static void GLAPIENTRY nullActiveTexture(GLenum texture) {
+
+		nullActiveUnit = texture;
+	}
+
+	static void GLAPIENTRY nullBindTexture(GLenum target, GLuint texture) {
+
+		nullBoundTextures[{ nullActiveUnit, target }] = texture;
+
+		auto bound = nullTextures.find(texture);
+		if (bound != nullTextures.end() && bound->second.target == 0)
+			bound->second.target = target;
+	}
+
+	static void GLAPIENTRY nullPixelStorei(GLenum pname, GLint param) {
+
+		if (pname == GL_UNPACK_ALIGNMENT)
+			nullUnpackAlignment = param;
+	}
+
+	static void GLAPIENTRY nullTexStorage3D(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height, GLsizei depth) {
+
+		int layer;
+		NullTexture* texture = getBoundTexture(target, layer);
+		if (!texture || texture->immutable)
+			return;
+
+		texture->width = width;
+		texture->height = height;
+		texture->layers = depth;
+		texture->texelBytes = getTexelBytes(internalformat, texture->blockBytes, texture->byteComponents);
+		texture->immutable = true;
+		texture->levels.resize(levels);
+		for (int i = 0; i < levels; i++)
+			texture->levels[i].assign(getLevelBytes(*texture, i), 0);
+	}
+
+	static void GLAPIENTRY nullTexSubImage3D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth,
+		GLenum format, GLenum type, const void* pixels) {
+
+		int layer;
+		NullTexture* texture = getBoundTexture(target, layer);
+		const unsigned char* source = getUnpackSource(pixels);
+		if (!texture || !source || level >= (int)texture->levels.size() || texture->texelBytes == 0)
+			return;
+
+		int texelBytes = getComponentCount(format) * getTypeBytes(type);
+		if (texelBytes != texture->texelBytes)
+			return;
+
+		int levelWidth = std::max(texture->width >> level, 1);
+		int levelHeight = std::max(texture->height >> level, 1);
+		if (xoffset < 0 || yoffset < 0 || zoffset < 0 || xoffset + width > levelWidth || yoffset + height > levelHeight || zoffset + depth > texture->layers)
+			return;
+
+		size_t rowBytes = (size_t)width * texelBytes;
+		size_t sourcePitch = (rowBytes + nullUnpackAlignment - 1) / nullUnpackAlignment * nullUnpackAlignment;
+		unsigned char* storage = &texture->levels[level][0];
+
+		for (int z = 0; z < depth; z++) {
+			for (int y = 0; y < height; y++) {
+				size_t destination = (((size_t)(zoffset + z) * levelHeight + yoffset + y) * levelWidth + xoffset) * texelBytes;
+				memcpy(storage + destination, source + ((size_t)z * height + y) * sourcePitch, rowBytes);
+			}
+		}
+	}
+
+	static void GLAPIENTRY nullTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels) {
+
+		int layer;
+		NullTexture* texture = getBoundTexture(target, layer);
+		if (!texture || texture->immutable)
+			return;
+
+		if (level == 0) {
+			int blockBytes;
+			bool byteComponents;
+			getTexelBytes(internalformat, blockBytes, byteComponents);
+
+			texture->width = width;
+			texture->height = height;
+			texture->layers = target == GL_TEXTURE_2D ? 1 : 6;
+			// Data is kept as it is given, so the readback matches the upload
+			texture->texelBytes = getComponentCount(format) * getTypeBytes(type);
+			texture->blockBytes = 0;
+			texture->byteComponents = byteComponents && getTypeBytes(type) == 1;
+		}
+
+		if (level >= (int)texture->levels.size())
+			texture->levels.resize(level + 1);
+
+		std::vector<unsigned char>& storage = texture->levels[level];
+		size_t levelBytes = getLevelBytes(*texture, level);
+		if (storage.size() != levelBytes)
+			storage.assign(levelBytes, 0);
+
+		const unsigned char* source = getUnpackSource(pixels);
+		if (!source)
+			return;
+
+		size_t rowBytes = (size_t)width * texture->texelBytes;
+		size_t sourcePitch = (rowBytes + nullUnpackAlignment - 1) / nullUnpackAlignment * nullUnpackAlignment;
+		size_t layerBytes = levelBytes / texture->layers;
+
+		for (int y = 0; y < height && layerBytes >= rowBytes * height; y++)
+			memcpy(&storage[layer * layerBytes + y * rowBytes], source + y * sourcePitch, rowBytes);
+	}
+
+	static void GLAPIENTRY nullCompressedTexSubImage3D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth,
+		GLenum format, GLsizei imageSize, const void* data) {
+
+		int layer;
+		NullTexture* texture = getBoundTexture(target, layer);
+		const unsigned char* source = getUnpackSource(data);
+		if (!texture || !source || level >= (int)texture->levels.size() || texture->texelBytes != 0)
+			return;
+
+		// Blocks are stored as they come, so only whole layers are tracked
+		std::vector<unsigned char>& storage = texture->levels[level];
+		size_t layerBytes = storage.size() / texture->layers;
+		size_t offset = zoffset * layerBytes;
+		if (xoffset == 0 && yoffset == 0 && offset + imageSize <= storage.size() && (size_t)imageSize == layerBytes * depth)
+			memcpy(&storage[offset], source, imageSize);
+	}
+
+	static void GLAPIENTRY nullCompressedTexImage2D(GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void* data) {
+
+		int layer;
+		NullTexture* texture = getBoundTexture(target, layer);
+		if (!texture || texture->immutable)
+			return;
+
+		if (level == 0) {
+			texture->width = width;
+			texture->height = height;
+			texture->layers = target == GL_TEXTURE_2D ? 1 : 6;
+			texture->texelBytes = getTexelBytes(internalformat, texture->blockBytes, texture->byteComponents);
+		}
+
+		if (level >= (int)texture->levels.size())
+			texture->levels.resize(level + 1);
+
+		std::vector<unsigned char>& storage = texture->levels[level];
+		size_t levelBytes = getLevelBytes(*texture, level);
+		if (storage.size() != levelBytes)
+			storage.assign(levelBytes, 0);
+
+		const unsigned char* source = getUnpackSource(data);
+		size_t layerBytes = levelBytes / texture->layers;
+		if (source && (size_t)imageSize == layerBytes)
+			memcpy(&storage[layer * layerBytes], source, imageSize);
+	}
+
+	/*
+	* Box filters byte textures down the chain, which is what drivers do for power of two sizes.
+	* Other formats get their levels allocated and left as they are.
+	*/
+	static void GLAPIENTRY nullGenerateMipmap(GLenum target) {
+
+		int layer;
+		NullTexture* texture = getBoundTexture(target, layer);
+		if (!texture || texture->levels.empty() || texture->width == 0)
+			return;
+
+		if (!texture->immutable) {
+			int levels = 1;
+			while ((std::max(texture->width, texture->height) >> levels) > 0)
+				levels++;
+			texture->levels.resize(levels);
+		}
+
+		for (int level = 1; level < (int)texture->levels.size(); level++) {
+
+			std::vector<unsigned char>& storage = texture->levels[level];
+			size_t levelBytes = getLevelBytes(*texture, level);
+			if (storage.size() != levelBytes)
+				storage.assign(levelBytes, 0);
+
+			if (!texture->byteComponents || texture->texelBytes == 0)
+				continue;
+
+			const std::vector<unsigned char>& parent = texture->levels[level - 1];
+			int parentWidth = std::max(texture->width >> (level - 1), 1);
+			int parentHeight = std::max(texture->height >> (level - 1), 1);
+			int width = std::max(texture->width >> level, 1);
+			int height = std::max(texture->height >> level, 1);
+			int texelBytes = texture->texelBytes;
+
+			for (int z = 0; z < texture->layers; z++) {
+				for (int y = 0; y < height; y++) {
+					int y0 = std::min(y * 2, parentHeight - 1);
+					int y1 = std::min(y * 2 + 1, parentHeight - 1);
+
+					for (int x = 0; x < width; x++) {
+						int x0 = std::min(x * 2, parentWidth - 1);
+						int x1 = std::min(x * 2 + 1, parentWidth - 1);
+
+						for (int c = 0; c < texelBytes; c++) {
+							size_t base = (size_t)z * parentHeight;
+							int sum = parent[((base + y0) * parentWidth + x0) * texelBytes + c] + parent[((base + y0) * parentWidth + x1) * texelBytes + c] +
+								parent[((base + y1) * parentWidth + x0) * texelBytes + c] + parent[((base + y1) * parentWidth + x1) * texelBytes + c];
+							storage[(((size_t)z * height + y) * width + x) * texelBytes + c] = (unsigned char)((sum + 2) / 4);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	static void GLAPIENTRY nullGenVertexArrays(GLsizei n, GLuint* arrays) {
+
+		genNullObjects(GL_OBJECT_VERTEX_ARRAY, n, arrays);
+	}
+
+	static void GLAPIENTRY nullDeleteVertexArrays(GLsizei n, const GLuint* arrays) {
+
+		deleteNullObjects(GL_OBJECT_VERTEX_ARRAY, n, arrays);
+	}
+
+	static void GLAPIENTRY nullGenFramebuffers(GLsizei n, GLuint* framebuffers) {
+
+		genNullObjects(GL_OBJECT_FRAMEBUFFER, n, framebuffers);
+	}
+
+	static void GLAPIENTRY nullDeleteFramebuffers(GLsizei n, const GLuint* framebuffers) {
+
+		deleteNullObjects(GL_OBJECT_FRAMEBUFFER, n, framebuffers);
+	}
+
+	static void GLAPIENTRY nullGenRenderbuffers(GLsizei n, GLuint* renderbuffers) {
+
+		genNullObjects(GL_OBJECT_RENDERBUFFER, n, renderbuffers);
+	}
+
+	static void GLAPIENTRY nullDeleteRenderbuffers(GLsizei n, const GLuint* renderbuffers) {
+
+		deleteNullObjects(GL_OBJECT_RENDERBUFFER, n, renderbuffers);
+	}
+
+	static GLenum GLAPIENTRY nullCheckFramebufferStatus(GLenum target) {
+
+		return GL_FRAMEBUFFER_COMPLETE;
+	}
+
+	static GLuint GLAPIENTRY nullCreateShader(GLenum type) {
+
+		return createNullObject(GL_OBJECT_SHADER);
+	}
+
+	static void GLAPIENTRY nullDeleteShader(GLuint shader) {
+
+		nullObjects[GL_OBJECT_SHADER].erase(shader);
+	}
+
+	static GLuint GLAPIENTRY nullCreateProgram(void) {
+
+		return createNullObject(GL_OBJECT_PROGRAM);
+	}
+
+	static void GLAPIENTRY nullDeleteProgram(GLuint program) {
+
+		nullObjects[GL_OBJECT_PROGRAM].erase(program);
+	}
+
+	static void GLAPIENTRY nullGenQueries(GLsizei n, GLuint* ids) {
+
+		genNullObjects(GL_OBJECT_QUERY, n, ids);
+	}
+
+	static void GLAPIENTRY nullDeleteQueries(GLsizei n, const GLuint* ids) {
+
+		deleteNullObjects(GL_OBJECT_QUERY, n, ids);
+		for (GLsizei i = 0; i < n; i++)
+			nullQueries.erase(ids[i]);
+	}
+
+	// Commands are done when they are issued, so a timestamp is the time of the call
+	static void GLAPIENTRY nullQueryCounter(GLuint id, GLenum target) {
+
+		nullQueries[id] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+	}
+
+	static void GLAPIENTRY nullGetQueryObjectiv(GLuint id, GLenum pname, GLint* params) {
+
+		*params = pname == GL_QUERY_RESULT_AVAILABLE ? GL_TRUE : (GLint)nullQueries[id];
+	}
+
+	static void GLAPIENTRY nullGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64* params) {
+
+		*params = pname == GL_QUERY_RESULT_AVAILABLE ? GL_TRUE : nullQueries[id];
+	}
+
+	// Shaders always compile and link, without a log
+	static void GLAPIENTRY nullGetShaderiv(GLuint shader, GLenum pname, GLint* param) {
+
+		*param = pname == GL_COMPILE_STATUS ? GL_TRUE : 0;
+	}
+
+	static void GLAPIENTRY nullGetProgramiv(GLuint program, GLenum pname, GLint* param) {
+
+		*param = pname == GL_LINK_STATUS || pname == GL_COMPLETION_STATUS_KHR ? GL_TRUE : 0;
+	}
+
+	static void GLAPIENTRY nullGetInfoLog(GLuint object, GLsizei bufSize, GLsizei* length, GLchar* infoLog) {
+
+		if (length)
+			*length = 0;
+		if (infoLog && bufSize > 0)
+			infoLog[0] = '\0';
+	}
+
+	static GLint GLAPIENTRY nullGetUniformLocation(GLuint program, const GLchar* name) {
+
+		return 0;
+	}
+
+	static void GLAPIENTRY nullGetIntegerv(GLenum pname, GLint* params) {
+
+		*params = 0;
+	}
+
+	static void GLAPIENTRY nullGetFloatv(GLenum pname, GLfloat* params) {
+
+		*params = pname == GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT ? 1.f : 0.f;
+	}
+
+	static const GLubyte* GLAPIENTRY nullGetString(GLenum name) {
+
+		return (const GLubyte*)"Null";
+	}
+
+	static void resetNullBackend() {
+
+		for (int i = 0; i < GL_OBJECT_TYPE_COUNT; i++)
+			nullObjects[i].clear();
+		nullBuffers.clear();
+		nullBoundBuffers.clear();
+		nullTextures.clear();
+		nullBoundTextures.clear();
+		nullQueries.clear();
+		nullActiveUnit = GL_TEXTURE0;
+		nullUnpackAlignment = 4;
+	}
+
+	static void installNullBackend() {
+
+#define GL_DISPATCH_NULL_DEFAULT(category, returnType, name, parameters, arguments, bytes) backend##name = nullDefault##name;
+		GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_NULL_DEFAULT)
+		GL_DISPATCH_GLEW_FUNCTIONS(GL_DISPATCH_NULL_DEFAULT)
+#undef GL_DISPATCH_NULL_DEFAULT
+
+		backendGenBuffers = nullGenBuffers;
+		backendDeleteBuffers = nullDeleteBuffers;
+		backendBindBuffer = nullBindBuffer;
+		backendBindBufferBase = nullBindBufferBase;
+		backendBufferData = nullBufferData;
+		backendBufferStorage = nullBufferStorage;
+		backendBufferSubData = nullBufferSubData;
+		backendMapBufferRange = nullMapBufferRange;
+		backendUnmapBuffer = nullUnmapBuffer;
+		backendFenceSync = nullFenceSync;
+		backendClientWaitSync = nullClientWaitSync;
+		backendDeleteSync = nullDeleteSync;
+		backendGenTextures = nullGenTextures;
+		backendDeleteTextures = nullDeleteTextures;
+		backendActiveTexture = nullActiveTexture;
+		backendBindTexture = nullBindTexture;
+		backendPixelStorei = nullPixelStorei;
+		backendTexStorage3D = nullTexStorage3D;
+		backendTexSubImage3D = nullTexSubImage3D;
+		backendTexImage2D = nullTexImage2D;
+		backendCompressedTexSubImage3D = nullCompressedTexSubImage3D;
+		backendCompressedTexImage2D = nullCompressedTexImage2D;
+		backendGenerateMipmap = nullGenerateMipmap;
+		backendGenVertexArrays = nullGenVertexArrays;
+		backendDeleteVertexArrays = nullDeleteVertexArrays;
+		backendGenFramebuffers = nullGenFramebuffers;
+		backendDeleteFramebuffers = nullDeleteFramebuffers;
+		backendGenRenderbuffers = nullGenRenderbuffers;
+		backendDeleteRenderbuffers = nullDeleteRenderbuffers;
+		backendCheckFramebufferStatus = nullCheckFramebufferStatus;
+		backendCreateShader = nullCreateShader;
+		backendDeleteShader = nullDeleteShader;
+		backendCreateProgram = nullCreateProgram;
+		backendDeleteProgram = nullDeleteProgram;
+		backendGetShaderiv = nullGetShaderiv;
+		backendGetProgramiv = nullGetProgramiv;
+		backendGetShaderInfoLog = nullGetInfoLog;
+		backendGetProgramInfoLog = nullGetInfoLog;
+		backendGetUniformLocation = nullGetUniformLocation;
+		backendGetIntegerv = nullGetIntegerv;
+		backendGetFloatv = nullGetFloatv;
+		backendGetString = nullGetString;
+		backendGenQueries = nullGenQueries;
+		backendDeleteQueries = nullDeleteQueries;
+		backendQueryCounter = nullQueryCounter;
+		backendGetQueryObjectiv = nullGetQueryObjectiv;
+		backendGetQueryObjectui64v = nullGetQueryObjectui64v;
+
+		// Ring buffers are persistently mapped and cooked arrays are uploaded compressed, as they are with a driver.
+		// Program binaries and parallel compile stay off, the null backend has no binaries to give.
+		__GLEW_ARB_buffer_storage = GL_TRUE;
+		__GLEW_ARB_timer_query = GL_TRUE;
+		__GLEW_EXT_texture_compression_s3tc = GL_TRUE;
+		__GLEW_ARB_texture_compression_bptc = GL_TRUE;
+		__GLEW_ARB_get_program_binary = GL_FALSE;
+		__GLEW_ARB_parallel_shader_compile = GL_FALSE;
+		__GLEW_KHR_parallel_shader_compile = GL_FALSE;
+	}
+
+	// ------------------------------------------------------------------------------------------------------------------
+
+	/*
+	* Can be called again to switch. The driver backend has to be installed after glewInit and before the null backend,
+	* the glew pointers are saved then.
+	* Objects of the null backend are dropped when it is installed.
+	*/
+	void GLDispatch::install(int backend, bool recording) {
+
+		if (functionNames.empty()) {
+#define GL_DISPATCH_NAME(category, returnType, name, parameters, arguments, bytes) functionNames.push_back("gl" #name);
+			GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_NAME)
+			GL_DISPATCH_GLEW_FUNCTIONS(GL_DISPATCH_NAME)
+#undef GL_DISPATCH_NAME
+
+#define GL_DISPATCH_SAVE_CORE(category, returnType, name, parameters, arguments, bytes) driver##name = ::gl##name;
+			GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_SAVE_CORE)
+#undef GL_DISPATCH_SAVE_CORE
+		}
+
+		// glew pointers are the driver's until the first install that replaces them
+		static bool driverSaved = false;
+		if (backend == GL_DISPATCH_DRIVER && !driverSaved) {
+#define GL_DISPATCH_SAVE_GLEW(category, returnType, name, parameters, arguments, bytes) driver##name = __glew##name;
+			GL_DISPATCH_GLEW_FUNCTIONS(GL_DISPATCH_SAVE_GLEW)
+#undef GL_DISPATCH_SAVE_GLEW
+			driverSaved = true;
+		}
+
+		GLDispatch::backend = backend;
+		GLDispatch::recording = recording;
+
+		if (backend == GL_DISPATCH_NULL) {
+			resetNullBackend();
+			installNullBackend();
+		}
+		else {
+#define GL_DISPATCH_DRIVER_BACKEND(category, returnType, name, parameters, arguments, bytes) backend##name = driver##name;
+			GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_DRIVER_BACKEND)
+			GL_DISPATCH_GLEW_FUNCTIONS(GL_DISPATCH_DRIVER_BACKEND)
+#undef GL_DISPATCH_DRIVER_BACKEND
+		}
+
+		// Functions the driver does not have stay NULL, callers check the extension before calling them
+#define GL_DISPATCH_ACTIVATE_CORE(category, returnType, name, parameters, arguments, bytes) gl##name = recording && backend##name ? record##name : backend##name;
+#define GL_DISPATCH_ACTIVATE_GLEW(category, returnType, name, parameters, arguments, bytes) __glew##name = recording && backend##name ? record##name : backend##name;
+		GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_ACTIVATE_CORE)
+		GL_DISPATCH_GLEW_FUNCTIONS(GL_DISPATCH_ACTIVATE_GLEW)
+#undef GL_DISPATCH_ACTIVATE_CORE
+#undef GL_DISPATCH_ACTIVATE_GLEW
+
+		frame = GLFrameStatistics();
+		frame.functionCalls.assign(GL_FUNCTION_COUNT, 0);
+		lastFrame = frame;
+		frameCount = 0;
+	}
+
+	void GLDispatch::record(int function, int category, unsigned long long bytes) {
+
+		frame.calls++;
+		frame.categoryCalls[category]++;
+		frame.uploadedBytes += bytes;
+		frame.functionCalls[function]++;
+	}
+
+	void GLDispatch::endFrame() {
+
+		if (!recording)
+			return;
+
+		lastFrame = frame;
+		frame.calls = 0;
+		frame.uploadedBytes = 0;
+		std::fill(frame.categoryCalls, frame.categoryCalls + GL_CALL_CATEGORY_COUNT, 0);
+		std::fill(frame.functionCalls.begin(), frame.functionCalls.end(), 0);
+		frameCount++;
+	}
+
+	unsigned long long GLDispatch::getImageBytes(GLenum format, GLenum type, GLsizei width, GLsizei height, GLsizei depth) {
+
+		return (unsigned long long)getComponentCount(format) * getTypeBytes(type) * width * height * depth;
+	}
+
+	unsigned int GLDispatch::getLiveObjects(int type) {
+
+		return (unsigned int)nullObjects[type].size();
+	}
+
+	/*
+	* Copies a layer of a level of a texture of the null backend, tightly packed. Block compressed levels are copied as blocks.
+	* Returns false with the driver backend or when the texture or level is not there.
+	*/
+	bool GLDispatch::getTextureImage(unsigned int texture, int level, int layer, std::vector<unsigned char>& data) {
+
+		auto found = nullTextures.find(texture);
+		if (backend != GL_DISPATCH_NULL || found == nullTextures.end())
+			return false;
+
+		const NullTexture& nullTexture = found->second;
+		if (level < 0 || level >= (int)nullTexture.levels.size() || layer < 0 || layer >= nullTexture.layers)
+			return false;
+
+		const std::vector<unsigned char>& storage = nullTexture.levels[level];
+		size_t layerBytes = storage.size() / nullTexture.layers;
+		data.assign(storage.begin() + layer * layerBytes, storage.begin() + (layer + 1) * layerBytes);
+		return true;
+	}
+
+	/*
+	* Copies the contents of a buffer of the null backend.
+	* Returns false with the driver backend or when the buffer is not there.
+	*/
+	bool GLDispatch::getBufferData(unsigned int buffer, std::vector<unsigned char>& data) {
+
+		auto found = nullBuffers.find(buffer);
+		if (backend != GL_DISPATCH_NULL || found == nullBuffers.end())
+			return false;
+
+		data = found->second;
+		return true;
+	}
+}
@@ -0,0 +1,200 @@
+#pragma once
+#include "GL/glew.h"
+
+// Backends of GLDispatch::install
+#define GL_DISPATCH_DRIVER 0
+#define GL_DISPATCH_NULL 1
+
+// Categories that the recorder counts calls in
+#define GL_CALL_DRAW 0
+#define GL_CALL_STATE 1
+#define GL_CALL_UNIFORM 2
+#define GL_CALL_UPLOAD 3
+#define GL_CALL_OBJECT 4
+#define GL_CALL_QUERY 5
+#define GL_CALL_CATEGORY_COUNT 6
+
+// Objects that the null backend keeps track of
+#define GL_OBJECT_BUFFER 0
+#define GL_OBJECT_TEXTURE 1
+#define GL_OBJECT_VERTEX_ARRAY 2
+#define GL_OBJECT_FRAMEBUFFER 3
+#define GL_OBJECT_RENDERBUFFER 4
+#define GL_OBJECT_SHADER 5
+#define GL_OBJECT_PROGRAM 6
+#define GL_OBJECT_SYNC 7
+#define GL_OBJECT_QUERY 8
+#define GL_OBJECT_TYPE_COUNT 9
+
+/*
+* Every GL function that Core calls, as X(category, return type, name without gl, parameters, arguments, bytes uploaded by the call).
+* GL 1.1 functions are exported by the system library, so calls to them are redirected to the pointers of GLDispatch.
+* The others are glew function pointers, they are replaced where they are.
+*/
+#define GL_DISPATCH_CORE_FUNCTIONS(X) \
+	X(GL_CALL_STATE, void, BindTexture, (GLenum target, GLuint texture), (target, texture), 0) \
+	X(GL_CALL_DRAW, void, Clear, (GLbitfield mask), (mask), 0) \
+	X(GL_CALL_STATE, void, ClearColor, (GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha), (red, green, blue, alpha), 0) \
+	X(GL_CALL_STATE, void, CullFace, (GLenum mode), (mode), 0) \
+	X(GL_CALL_OBJECT, void, DeleteTextures, (GLsizei n, const GLuint* textures), (n, textures), 0) \
+	X(GL_CALL_STATE, void, DepthFunc, (GLenum func), (func), 0) \
+	X(GL_CALL_STATE, void, Disable, (GLenum cap), (cap), 0) \
+	X(GL_CALL_DRAW, void, DrawArrays, (GLenum mode, GLint first, GLsizei count), (mode, first, count), 0) \
+	X(GL_CALL_STATE, void, Enable, (GLenum cap), (cap), 0) \
+	X(GL_CALL_OBJECT, void, GenTextures, (GLsizei n, GLuint* textures), (n, textures), 0) \
+	X(GL_CALL_QUERY, void, GetFloatv, (GLenum pname, GLfloat* params), (pname, params), 0) \
+	X(GL_CALL_QUERY, void, GetIntegerv, (GLenum pname, GLint* params), (pname, params), 0) \
+	X(GL_CALL_QUERY, const GLubyte*, GetString, (GLenum name), (name), 0) \
+	X(GL_CALL_STATE, void, PixelStorei, (GLenum pname, GLint param), (pname, param), 0) \
+	X(GL_CALL_STATE, void, PolygonMode, (GLenum face, GLenum mode), (face, mode), 0) \
+	X(GL_CALL_UPLOAD, void, TexImage2D, (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels), \
+		(target, level, internalformat, width, height, border, format, type, pixels), pixels ? GLDispatch::getImageBytes(format, type, width, height, 1) : 0) \
+	X(GL_CALL_STATE, void, TexParameterf, (GLenum target, GLenum pname, GLfloat param), (target, pname, param), 0) \
+	X(GL_CALL_STATE, void, TexParameteri, (GLenum target, GLenum pname, GLint param), (target, pname, param), 0) \
+	X(GL_CALL_STATE, void, Viewport, (GLint x, GLint y, GLsizei width, GLsizei height), (x, y, width, height), 0)
+
+#define GL_DISPATCH_GLEW_FUNCTIONS(X) \
+	X(GL_CALL_STATE, void, ActiveTexture, (GLenum texture), (texture), 0) \
+	X(GL_CALL_OBJECT, void, AttachShader, (GLuint program, GLuint shader), (program, shader), 0) \
+	X(GL_CALL_STATE, void, BindBuffer, (GLenum target, GLuint buffer), (target, buffer), 0) \
+	X(GL_CALL_STATE, void, BindBufferBase, (GLenum target, GLuint index, GLuint buffer), (target, index, buffer), 0) \
+	X(GL_CALL_STATE, void, BindFramebuffer, (GLenum target, GLuint framebuffer), (target, framebuffer), 0) \
+	X(GL_CALL_STATE, void, BindRenderbuffer, (GLenum target, GLuint renderbuffer), (target, renderbuffer), 0) \
+	X(GL_CALL_STATE, void, BindVertexArray, (GLuint array), (array), 0) \
+	X(GL_CALL_UPLOAD, void, BufferData, (GLenum target, GLsizeiptr size, const void* data, GLenum usage), (target, size, data, usage), data ? size : 0) \
+	X(GL_CALL_UPLOAD, void, BufferStorage, (GLenum target, GLsizeiptr size, const void* data, GLbitfield flags), (target, size, data, flags), data ? size : 0) \
+	X(GL_CALL_UPLOAD, void, BufferSubData, (GLenum target, GLintptr offset, GLsizeiptr size, const void* data), (target, offset, size, data), size) \
+	X(GL_CALL_QUERY, GLenum, CheckFramebufferStatus, (GLenum target), (target), 0) \
+	X(GL_CALL_QUERY, GLenum, ClientWaitSync, (GLsync sync, GLbitfield flags, GLuint64 timeout), (sync, flags, timeout), 0) \
+	X(GL_CALL_OBJECT, void, CompileShader, (GLuint shader), (shader), 0) \
+	X(GL_CALL_UPLOAD, void, CompressedTexImage2D, (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void* data), \
+		(target, level, internalformat, width, height, border, imageSize, data), imageSize) \
+	X(GL_CALL_UPLOAD, void, CompressedTexSubImage3D, (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLsizei imageSize, const void* data), \
+		(target, level, xoffset, yoffset, zoffset, width, height, depth, format, imageSize, data), imageSize) \
+	X(GL_CALL_OBJECT, GLuint, CreateProgram, (void), (), 0) \
+	X(GL_CALL_OBJECT, GLuint, CreateShader, (GLenum type), (type), 0) \
+	X(GL_CALL_OBJECT, void, DeleteBuffers, (GLsizei n, const GLuint* buffers), (n, buffers), 0) \
+	X(GL_CALL_OBJECT, void, DeleteFramebuffers, (GLsizei n, const GLuint* framebuffers), (n, framebuffers), 0) \
+	X(GL_CALL_OBJECT, void, DeleteProgram, (GLuint program), (program), 0) \
+	X(GL_CALL_OBJECT, void, DeleteQueries, (GLsizei n, const GLuint* ids), (n, ids), 0) \
+	X(GL_CALL_OBJECT, void, DeleteRenderbuffers, (GLsizei n, const GLuint* renderbuffers), (n, renderbuffers), 0) \
+	X(GL_CALL_OBJECT, void, DeleteShader, (GLuint shader), (shader), 0) \
+	X(GL_CALL_OBJECT, void, DeleteSync, (GLsync sync), (sync), 0) \
+	X(GL_CALL_OBJECT, void, DeleteVertexArrays, (GLsizei n, const GLuint* arrays), (n, arrays), 0) \
+	X(GL_CALL_OBJECT, void, DetachShader, (GLuint program, GLuint shader), (program, shader), 0) \
+	X(GL_CALL_DRAW, void, DispatchCompute, (GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z), (num_groups_x, num_groups_y, num_groups_z), 0) \
+	X(GL_CALL_STATE, void, EnableVertexAttribArray, (GLuint index), (index), 0) \
+	X(GL_CALL_OBJECT, GLsync, FenceSync, (GLenum condition, GLbitfield flags), (condition, flags), 0) \
+	X(GL_CALL_STATE, void, FramebufferRenderbuffer, (GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer), (target, attachment, renderbuffertarget, renderbuffer), 0) \
+	X(GL_CALL_STATE, void, FramebufferTexture2D, (GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level), (target, attachment, textarget, texture, level), 0) \
+	X(GL_CALL_OBJECT, void, GenBuffers, (GLsizei n, GLuint* buffers), (n, buffers), 0) \
+	X(GL_CALL_OBJECT, void, GenFramebuffers, (GLsizei n, GLuint* framebuffers), (n, framebuffers), 0) \
+	X(GL_CALL_OBJECT, void, GenQueries, (GLsizei n, GLuint* ids), (n, ids), 0) \
+	X(GL_CALL_OBJECT, void, GenRenderbuffers, (GLsizei n, GLuint* renderbuffers), (n, renderbuffers), 0) \
+	X(GL_CALL_OBJECT, void, GenVertexArrays, (GLsizei n, GLuint* arrays), (n, arrays), 0) \
+	X(GL_CALL_DRAW, void, GenerateMipmap, (GLenum target), (target), 0) \
+	X(GL_CALL_QUERY, void, GetProgramBinary, (GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary), (program, bufSize, length, binaryFormat, binary), 0) \
+	X(GL_CALL_QUERY, void, GetProgramInfoLog, (GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog), (program, bufSize, length, infoLog), 0) \
+	X(GL_CALL_QUERY, void, GetProgramiv, (GLuint program, GLenum pname, GLint* param), (program, pname, param), 0) \
+	X(GL_CALL_QUERY, void, GetQueryObjectiv, (GLuint id, GLenum pname, GLint* params), (id, pname, params), 0) \
+	X(GL_CALL_QUERY, void, GetQueryObjectui64v, (GLuint id, GLenum pname, GLuint64* params), (id, pname, params), 0) \
+	X(GL_CALL_QUERY, void, GetShaderInfoLog, (GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog), (shader, bufSize, length, infoLog), 0) \
+	X(GL_CALL_QUERY, void, GetShaderiv, (GLuint shader, GLenum pname, GLint* param), (shader, pname, param), 0) \
+	X(GL_CALL_QUERY, GLint, GetUniformLocation, (GLuint program, const GLchar* name), (program, name), 0) \
+	X(GL_CALL_OBJECT, void, LinkProgram, (GLuint program), (program), 0) \
+	X(GL_CALL_QUERY, void*, MapBufferRange, (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access), (target, offset, length, access), 0) \
+	X(GL_CALL_STATE, void, MaxShaderCompilerThreadsARB, (GLuint count), (count), 0) \
+	X(GL_CALL_STATE, void, MaxShaderCompilerThreadsKHR, (GLuint count), (count), 0) \
+	X(GL_CALL_STATE, void, MemoryBarrier, (GLbitfield barriers), (barriers), 0) \
+	X(GL_CALL_DRAW, void, MultiDrawElementsIndirect, (GLenum mode, GLenum type, const void* indirect, GLsizei primcount, GLsizei stride), (mode, type, indirect, primcount, stride), 0) \
+	X(GL_CALL_OBJECT, void, ProgramBinary, (GLuint program, GLenum binaryFormat, const void* binary, GLsizei length), (program, binaryFormat, binary, length), 0) \
+	X(GL_CALL_STATE, void, ProgramParameteri, (GLuint program, GLenum pname, GLint value), (program, pname, value), 0) \
+	X(GL_CALL_QUERY, void, QueryCounter, (GLuint id, GLenum target), (id, target), 0) \
+	X(GL_CALL_OBJECT, void, RenderbufferStorage, (GLenum target, GLenum internalformat, GLsizei width, GLsizei height), (target, internalformat, width, height), 0) \
+	X(GL_CALL_OBJECT, void, ShaderSource, (GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length), (shader, count, string, length), 0) \
+	X(GL_CALL_OBJECT, void, TexStorage3D, (GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height, GLsizei depth), (target, levels, internalformat, width, height, depth), 0) \
+	X(GL_CALL_UPLOAD, void, TexSubImage3D, (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels), \
+		(target, level, xoffset, yoffset, zoffset, width, height, depth, format, type, pixels), GLDispatch::getImageBytes(format, type, width, height, depth)) \
+	X(GL_CALL_UNIFORM, void, Uniform1f, (GLint location, GLfloat v0), (location, v0), 0) \
+	X(GL_CALL_UNIFORM, void, Uniform1i, (GLint location, GLint v0), (location, v0), 0) \
+	X(GL_CALL_UNIFORM, void, Uniform1ui, (GLint location, GLuint v0), (location, v0), 0) \
+	X(GL_CALL_UNIFORM, void, Uniform2f, (GLint location, GLfloat v0, GLfloat v1), (location, v0, v1), 0) \
+	X(GL_CALL_UNIFORM, void, Uniform2iv, (GLint location, GLsizei count, const GLint* value), (location, count, value), 0) \
+	X(GL_CALL_UNIFORM, void, Uniform3fv, (GLint location, GLsizei count, const GLfloat* value), (location, count, value), 0) \
+	X(GL_CALL_UNIFORM, void, Uniform4fv, (GLint location, GLsizei count, const GLfloat* value), (location, count, value), 0) \
+	X(GL_CALL_UNIFORM, void, UniformMatrix4fv, (GLint location, GLsizei count, GLboolean transpose, const GLfloat* value), (location, count, transpose, value), 0) \
+	X(GL_CALL_QUERY, GLboolean, UnmapBuffer, (GLenum target), (target), 0) \
+	X(GL_CALL_STATE, void, UseProgram, (GLuint program), (program), 0) \
+	X(GL_CALL_STATE, void, VertexAttribDivisor, (GLuint index, GLuint divisor), (index, divisor), 0) \
+	X(GL_CALL_STATE, void, VertexAttribIPointer, (GLuint index, GLint size, GLenum type, GLsizei stride, const void* pointer), (index, size, type, stride, pointer), 0) \
+	X(GL_CALL_STATE, void, VertexAttribPointer, (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer), (index, size, type, normalized, stride, pointer), 0)
+
+namespace Core {
+
+	/*
+	* Calls the recorder counted in a frame. functionCalls is indexed like GLDispatch::functionNames.
+	*/
+	struct GLFrameStatistics {
+
+		unsigned int calls = 0;
+		unsigned int categoryCalls[GL_CALL_CATEGORY_COUNT] = {};
+		unsigned long long uploadedBytes = 0;
+		std::vector<unsigned int> functionCalls;
+	};
+
+	/*
+	* Dispatch layer between Core and GL with two backends and an optional recorder on top of either:
+	* - driver: calls go to the driver as glew loaded them
+	* - null: no driver is needed. Objects are tracked, buffers keep their memory so they can be mapped, textures keep
+	*   their contents so uploads can be checked with getTextureImage and getBufferData, fences are always signaled, timer queries
+	*   are always available and hold the CPU time they were issued at
+	* - recorder: counts calls per category and function and the bytes uploaded, frame by frame
+	* Only the render thread may call GL, so the recorder and the null backend are not synchronized.
+	*/
+	class __declspec(dllexport) GLDispatch {
+
+	public:
+
+#define GL_DISPATCH_DECLARE(category, returnType, name, parameters, arguments, bytes) static returnType (GLAPIENTRY* gl##name) parameters;
+		GL_DISPATCH_CORE_FUNCTIONS(GL_DISPATCH_DECLARE)
+#undef GL_DISPATCH_DECLARE
+
+		static int backend;
+		static bool recording;
+		static std::vector<const char*> functionNames;
+		static GLFrameStatistics frame;		// calls of the frame so far
+		static GLFrameStatistics lastFrame;
+		static unsigned long long frameCount;
+
+		static void install(int backend, bool recording);
+		static void record(int function, int category, unsigned long long bytes);
+		static void endFrame();
+		static unsigned long long getImageBytes(GLenum format, GLenum type, GLsizei width, GLsizei height, GLsizei depth);
+		static unsigned int getLiveObjects(int type);
+		static bool getTextureImage(unsigned int texture, int level, int layer, std::vector<unsigned char>& data);
+		static bool getBufferData(unsigned int buffer, std::vector<unsigned char>& data);
+	};
+}
+
+// GL 1.1 calls of Core go through the dispatch layer, other modules call the system library
+#if defined(CORE_EXPORTS) && !defined(GL_DISPATCH_NO_REDIRECT)
+#define glBindTexture ::Core::GLDispatch::glBindTexture
+#define glClear ::Core::GLDispatch::glClear
+#define glClearColor ::Core::GLDispatch::glClearColor
+#define glCullFace ::Core::GLDispatch::glCullFace
+#define glDeleteTextures ::Core::GLDispatch::glDeleteTextures
+#define glDepthFunc ::Core::GLDispatch::glDepthFunc
+#define glDisable ::Core::GLDispatch::glDisable
+#define glDrawArrays ::Core::GLDispatch::glDrawArrays
+#define glEnable ::Core::GLDispatch::glEnable
+#define glGenTextures ::Core::GLDispatch::glGenTextures
+#define glGetFloatv ::Core::GLDispatch::glGetFloatv
+#define glGetIntegerv ::Core::GLDispatch::glGetIntegerv
+#define glGetString ::Core::GLDispatch::glGetString
+#define glPixelStorei ::Core::GLDispatch::glPixelStorei
+#define glPolygonMode ::Core::GLDispatch::glPolygonMode
+#define glTexImage2D ::Core::GLDispatch::glTexImage2D
+#define glTexParameterf ::Core::GLDispatch::glTexParameterf
+#define glTexParameteri ::Core::GLDispatch::glTexParameteri
+#define glViewport ::Core::GLDispatch::glViewport
+#endif
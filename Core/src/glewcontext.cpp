@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "glewcontext.h"
+#include "gldispatch.h"
 
 namespace Core {
 
@@ -10,6 +11,8 @@ namespace Core {
 		if (glewInit() != GLEW_OK)
 			fprintf(stderr, "Failed to initialize GLEW\n");
 
+		GLDispatch::install(GL_DISPATCH_DRIVER, GLDispatch::recording);
+
 		glCullFace(GL_BACK);
 		//glCullFace(GL_FRONT_AND_BACK);
 
@@ -0,0 +1,138 @@
+#include "pch.h"
+#include "gputimer.h"
+#include "gldispatch.h"
+
+namespace Core {
+
+	std::vector<unsigned int> GPUTimer::queries[GPU_TIMER_FRAMES];
+	std::vector<GPUTimerRange> GPUTimer::ranges[GPU_TIMER_FRAMES];
+	unsigned int GPUTimer::usedQueries[GPU_TIMER_FRAMES] = {};
+	int GPUTimer::openRanges[GPU_PASS_COUNT];
+	unsigned int GPUTimer::frame = 0;
+	bool GPUTimer::supported = false;
+
+	bool GPUTimer::enabled = false;
+	bool GPUTimer::splitTerrain = false;
+	const char* GPUTimer::passNames[GPU_PASS_COUNT] = {
+		"Frame", "Terrain", "Terrain culling", "Terrain blocks", "Terrain fix-ups", "Terrain trims", "Terrain degenerates", "Terrain small square",
+		"Skybox", "Filter (FXAA)", "IBL precompute"
+	};
+	float GPUTimer::passTimes[GPU_PASS_COUNT] = {};
+	float GPUTimer::smoothedTimes[GPU_PASS_COUNT] = {};
+	unsigned int GPUTimer::resolvedFrames = 0;
+	unsigned int GPUTimer::droppedFrames = 0;
+
+	/*
+	* Needs the GL context, queries are created as they are needed.
+	*/
+	void GPUTimer::init() {
+
+		supported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+		for (int i = 0; i < GPU_PASS_COUNT; i++)
+			openRanges[i] = -1;
+
+		if (!supported)
+			printf("Timer queries are not supported, GPU pass times are not measured\n");
+	}
+
+	void GPUTimer::release() {
+
+		for (int i = 0; i < GPU_TIMER_FRAMES; i++) {
+			if (!queries[i].empty())
+				glDeleteQueries(queries[i].size(), &queries[i][0]);
+			queries[i].clear();
+			ranges[i].clear();
+			usedQueries[i] = 0;
+		}
+	}
+
+	bool GPUTimer::isActive() {
+
+		return enabled && supported;
+	}
+
+	unsigned int GPUTimer::issueTimestamp() {
+
+		int set = frame % GPU_TIMER_FRAMES;
+		if (usedQueries[set] == queries[set].size()) {
+			queries[set].push_back(0);
+			glGenQueries(1, &queries[set].back());
+		}
+
+		unsigned int index = usedQueries[set]++;
+		glQueryCounter(queries[set][index], GL_TIMESTAMP);
+		return index;
+	}
+
+	void GPUTimer::begin(int pass) {
+
+		if (!GPUTimer::isActive() || openRanges[pass] >= 0)
+			return;
+
+		openRanges[pass] = GPUTimer::issueTimestamp();
+	}
+
+	void GPUTimer::end(int pass) {
+
+		if (!GPUTimer::isActive() || openRanges[pass] < 0)
+			return;
+
+		ranges[frame % GPU_TIMER_FRAMES].push_back({ pass, (unsigned int)openRanges[pass], GPUTimer::issueTimestamp() });
+		openRanges[pass] = -1;
+	}
+
+	/*
+	* Called once the frame is submitted. The oldest set is read back and recorded into again.
+	*/
+	void GPUTimer::endFrame() {
+
+		if (!supported)
+			return;
+
+		// a pass that is still open is not counted
+		for (int i = 0; i < GPU_PASS_COUNT; i++)
+			openRanges[i] = -1;
+
+		frame++;
+		int set = frame % GPU_TIMER_FRAMES;
+		GPUTimer::resolve(set);
+		ranges[set].clear();
+		usedQueries[set] = 0;
+	}
+
+	/*
+	* Timestamps complete in order, so the set is ready when its last query is.
+	*/
+	void GPUTimer::resolve(int set) {
+
+		if (ranges[set].empty())
+			return;
+
+		GLint available = 0;
+		glGetQueryObjectiv(queries[set][usedQueries[set] - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			droppedFrames++;
+			return;
+		}
+
+		std::vector<GLuint64> timestamps(usedQueries[set]);
+		for (unsigned int i = 0; i < usedQueries[set]; i++)
+			glGetQueryObjectui64v(queries[set][i], GL_QUERY_RESULT, &timestamps[i]);
+
+		float times[GPU_PASS_COUNT] = {};
+		bool timed[GPU_PASS_COUNT] = {};
+		for (GPUTimerRange& range : ranges[set]) {
+			times[range.pass] += (timestamps[range.end] - timestamps[range.begin]) * 1e-6f;
+			timed[range.pass] = true;
+		}
+
+		for (int i = 0; i < GPU_PASS_COUNT; i++) {
+			if (!timed[i])
+				continue;
+			passTimes[i] = times[i];
+			smoothedTimes[i] = smoothedTimes[i] == 0.f ? times[i] : smoothedTimes[i] + (times[i] - smoothedTimes[i]) * GPU_TIMER_SMOOTHING;
+		}
+
+		resolvedFrames++;
+	}
+}
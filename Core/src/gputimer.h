@@ -0,0 +1,73 @@
+#pragma once
+
+// Query sets in use: the frame being recorded and two frames the GPU may still be working on
+#define GPU_TIMER_FRAMES 3
+// Weight of a new sample in the smoothed pass times
+#define GPU_TIMER_SMOOTHING 0.1f
+
+#define GPU_PASS_FRAME 0
+#define GPU_PASS_TERRAIN 1
+#define GPU_PASS_TERRAIN_CULLING 2
+#define GPU_PASS_TERRAIN_BLOCKS 3
+#define GPU_PASS_TERRAIN_FIXUPS 4
+#define GPU_PASS_TERRAIN_TRIMS 5
+#define GPU_PASS_TERRAIN_DEGENERATES 6
+#define GPU_PASS_TERRAIN_SMALL_SQUARE 7
+#define GPU_PASS_SKYBOX 8
+#define GPU_PASS_FILTER 9
+#define GPU_PASS_IBL_PRECOMPUTE 10
+#define GPU_PASS_COUNT 11
+
+namespace Core {
+
+	/*
+	* Timestamps of a pass in a frame, a pass can be timed more than once in a frame and its ranges are added up.
+	*/
+	struct GPUTimerRange {
+
+		int pass;
+		unsigned int begin;		// query indices in the set of the frame
+		unsigned int end;
+	};
+
+	/*
+	* GPU time of render passes with GL_TIMESTAMP queries. Timestamps are used instead of GL_TIME_ELAPSED,
+	* since elapsed queries can not be nested and the terrain pieces are timed inside the terrain.
+	* Every frame records into its own query set. A set is read back when it comes around again, GPU_TIMER_FRAMES - 1
+	* frames later, only if its results are available, so the CPU never waits. A frame that is not done yet is dropped.
+	* Passes that did not run in a frame keep their last time, the IBL precompute runs once on start.
+	* Timers are off by default. The terrain is timed as one range, splitTerrain times each piece with a draw of its own
+	* and costs the single multi-draw, so it is only turned on when the pieces are looked at.
+	*/
+	class __declspec(dllexport) GPUTimer {
+
+	private:
+
+		static std::vector<unsigned int> queries[GPU_TIMER_FRAMES];
+		static std::vector<GPUTimerRange> ranges[GPU_TIMER_FRAMES];
+		static unsigned int usedQueries[GPU_TIMER_FRAMES];
+		static int openRanges[GPU_PASS_COUNT];
+		static unsigned int frame;
+		static bool supported;
+
+		static unsigned int issueTimestamp();
+		static void resolve(int set);
+
+	public:
+
+		static bool enabled;
+		static bool splitTerrain;		// per-piece terrain ranges, a draw per piece
+		static const char* passNames[GPU_PASS_COUNT];
+		static float passTimes[GPU_PASS_COUNT];		// ms of the last frame read back
+		static float smoothedTimes[GPU_PASS_COUNT];
+		static unsigned int resolvedFrames;
+		static unsigned int droppedFrames;
+
+		static void init();
+		static void release();
+		static void begin(int pass);
+		static void end(int pass);
+		static void endFrame();
+		static bool isActive();
+	};
+}
@@ -0,0 +1,484 @@
+#include "pch.h"
+#include "mipgenerator.h"
+#include "cpufeatures.h"
+#include "threadpool.h"
+#include "glm/glm.hpp"
+#include <immintrin.h>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#define MIP_PI 3.14159265358979323846
+
+namespace Core {
+
+	const char* MipGenerator::filterNames[MIP_FILTER_COUNT] = { "point", "box", "min", "max", "lanczos", "kaiser" };
+
+	static inline unsigned short loadHeight(const unsigned char* texel) {
+
+		return texel[0] << 8 | texel[1];
+	}
+
+	static inline void storeHeight(unsigned char* texel, unsigned short height) {
+
+		texel[0] = height >> 8;
+		texel[1] = height & 255;
+	}
+
+	static inline unsigned short quantize(float value) {
+
+		value += 0.5f;
+		value = value < 0.f ? 0.f : (value > 65535.f ? 65535.f : value);
+		return (unsigned short)(int)value;
+	}
+
+	/*
+	* Heights are big endian, swapping bytes of the 16 bit lanes gives the values.
+	*/
+	static inline __m128i swapBytes(__m128i v) {
+
+		return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	}
+
+	/*
+	* 4 coarser heights as 32 bit lanes from 8 heights of two finer rows.
+	*/
+	static inline __m128i reduce4(__m128i row0, __m128i row1, int filter) {
+
+		__m128i low = _mm_set1_epi32(0xFFFF);
+
+		if (filter == MIP_FILTER_POINT)
+			return _mm_and_si128(row0, low);
+
+		if (filter == MIP_FILTER_BOX) {
+			__m128i sum0 = _mm_add_epi32(_mm_and_si128(row0, low), _mm_srli_epi32(row0, 16));
+			__m128i sum1 = _mm_add_epi32(_mm_and_si128(row1, low), _mm_srli_epi32(row1, 16));
+			return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(sum0, sum1), _mm_set1_epi32(2)), 2);
+		}
+
+		// SSE2 only compares signed 16 bit values, heights are biased to keep the order
+		__m128i bias = _mm_set1_epi16((short)0x8000);
+		__m128i a = _mm_xor_si128(row0, bias);
+		__m128i b = _mm_xor_si128(row1, bias);
+		__m128i m = filter == MIP_FILTER_MIN ? _mm_min_epi16(a, b) : _mm_max_epi16(a, b);
+		m = filter == MIP_FILTER_MIN ? _mm_min_epi16(m, _mm_srli_epi32(m, 16)) : _mm_max_epi16(m, _mm_srli_epi32(m, 16));
+		return _mm_add_epi32(_mm_srai_epi32(_mm_slli_epi32(m, 16), 16), _mm_set1_epi32(32768));
+	}
+
+	/*
+	* 8 big endian heights from two vectors of 32 bit lanes in [0, 65535].
+	*/
+	static inline __m128i pack8(__m128i a, __m128i b) {
+
+		__m128i offset = _mm_set1_epi32(32768);
+		__m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, offset), _mm_sub_epi32(b, offset));
+		return swapBytes(_mm_xor_si128(packed, _mm_set1_epi16((short)0x8000)));
+	}
+
+	AVX2_TARGET static inline __m256i swapBytes256(__m256i v) {
+
+		return _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+	}
+
+	AVX2_TARGET static inline __m256i reduce8(__m256i row0, __m256i row1, int filter) {
+
+		__m256i low = _mm256_set1_epi32(0xFFFF);
+
+		if (filter == MIP_FILTER_POINT)
+			return _mm256_and_si256(row0, low);
+
+		if (filter == MIP_FILTER_BOX) {
+			__m256i sum0 = _mm256_add_epi32(_mm256_and_si256(row0, low), _mm256_srli_epi32(row0, 16));
+			__m256i sum1 = _mm256_add_epi32(_mm256_and_si256(row1, low), _mm256_srli_epi32(row1, 16));
+			return _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(sum0, sum1), _mm256_set1_epi32(2)), 2);
+		}
+
+		__m256i m = filter == MIP_FILTER_MIN ? _mm256_min_epu16(row0, row1) : _mm256_max_epu16(row0, row1);
+		m = filter == MIP_FILTER_MIN ? _mm256_min_epu16(m, _mm256_srli_epi32(m, 16)) : _mm256_max_epu16(m, _mm256_srli_epi32(m, 16));
+		return _mm256_and_si256(m, low);
+	}
+
+	/*
+	* 16 big endian heights in order. Packing works in 128 bit halves, so the 64 bit blocks are put back in order.
+	*/
+	AVX2_TARGET static inline __m256i pack16(__m256i a, __m256i b) {
+
+		__m256i packed = _mm256_packus_epi32(a, b);
+		return swapBytes256(_mm256_permute4x64_epi64(packed, 0xD8));
+	}
+
+	/*
+	* Halves the heightmap. Rows of the coarser level are split into bands that run on the pool if there is one.
+	*/
+	void MipGenerator::downsample(const unsigned char* finer, int finerSize, unsigned char* coarser, int filter, ThreadPool* pool, int instructionSet) {
+
+		int coarserSize = finerSize / 2;
+
+		if (pool == NULL) {
+			MipGenerator::downsampleRows(finer, finerSize, coarser, filter, 0, coarserSize, instructionSet);
+			return;
+		}
+
+		// A few bands per thread so threads that finish early take more
+		int bandCount = pool->getThreadCount() * 4;
+		if (bandCount > coarserSize)
+			bandCount = coarserSize;
+
+		for (int band = 0; band < bandCount; band++) {
+
+			int rowBegin = (int)((long long)coarserSize * band / bandCount);
+			int rowEnd = (int)((long long)coarserSize * (band + 1) / bandCount);
+			pool->submit([=] { MipGenerator::downsampleRows(finer, finerSize, coarser, filter, rowBegin, rowEnd, instructionSet); });
+		}
+
+		pool->wait();
+	}
+
+	void MipGenerator::downsampleRows(const unsigned char* finer, int finerSize, unsigned char* coarser, int filter, int rowBegin, int rowEnd, int instructionSet) {
+
+		if (filter == MIP_FILTER_LANCZOS || filter == MIP_FILTER_KAISER) {
+			MipGenerator::resampleRows(finer, finerSize, coarser, filter, rowBegin, rowEnd, instructionSet);
+			return;
+		}
+
+		int coarserSize = finerSize / 2;
+
+		for (int i = rowBegin; i < rowEnd; i++) {
+
+			const unsigned char* row0 = &finer[(size_t)(i * 2) * finerSize * 2];
+			const unsigned char* row1 = row0 + (size_t)finerSize * 2;
+			unsigned char* out = &coarser[(size_t)i * coarserSize * 2];
+
+			int done = 0;
+			if (instructionSet == INSTRUCTION_SET_AVX2)
+				done = MipGenerator::reduceAVX2(row0, row1, out, coarserSize, filter);
+			else if (instructionSet == INSTRUCTION_SET_SSE)
+				done = MipGenerator::reduceSSE(row0, row1, out, coarserSize, filter);
+
+			// remainder that does not fill a register
+			MipGenerator::reduceScalar(row0, row1, out, coarserSize, filter, done);
+		}
+	}
+
+	void MipGenerator::reduceScalar(const unsigned char* row0, const unsigned char* row1, unsigned char* coarser, int coarserSize, int filter, int start) {
+
+		for (int j = start; j < coarserSize; j++) {
+
+			unsigned int a = loadHeight(&row0[j * 4]);
+			unsigned int b = loadHeight(&row0[j * 4 + 2]);
+			unsigned int c = loadHeight(&row1[j * 4]);
+			unsigned int d = loadHeight(&row1[j * 4 + 2]);
+
+			unsigned int height;
+			if (filter == MIP_FILTER_POINT)
+				height = a;
+			else if (filter == MIP_FILTER_BOX)
+				height = (a + b + c + d + 2) >> 2;
+			else if (filter == MIP_FILTER_MIN)
+				height = std::min(std::min(a, b), std::min(c, d));
+			else
+				height = std::max(std::max(a, b), std::max(c, d));
+
+			storeHeight(&coarser[j * 2], height);
+		}
+	}
+
+	/*
+	* Returns the number of coarser texels written, 8 per iteration.
+	*/
+	int MipGenerator::reduceSSE(const unsigned char* row0, const unsigned char* row1, unsigned char* coarser, int coarserSize, int filter) {
+
+		int count = coarserSize & ~7;
+
+		for (int j = 0; j < count; j += 8) {
+
+			__m128i a0 = swapBytes(_mm_loadu_si128((const __m128i*)&row0[j * 4]));
+			__m128i a1 = swapBytes(_mm_loadu_si128((const __m128i*)&row0[j * 4 + 16]));
+			__m128i b0 = swapBytes(_mm_loadu_si128((const __m128i*)&row1[j * 4]));
+			__m128i b1 = swapBytes(_mm_loadu_si128((const __m128i*)&row1[j * 4 + 16]));
+
+			__m128i packed = pack8(reduce4(a0, b0, filter), reduce4(a1, b1, filter));
+			_mm_storeu_si128((__m128i*)&coarser[j * 2], packed);
+		}
+
+		return count;
+	}
+
+	/*
+	* Returns the number of coarser texels written, 16 per iteration.
+	*/
+	AVX2_TARGET int MipGenerator::reduceAVX2(const unsigned char* row0, const unsigned char* row1, unsigned char* coarser, int coarserSize, int filter) {
+
+		int count = coarserSize & ~15;
+
+		for (int j = 0; j < count; j += 16) {
+
+			__m256i a0 = swapBytes256(_mm256_loadu_si256((const __m256i*)&row0[j * 4]));
+			__m256i a1 = swapBytes256(_mm256_loadu_si256((const __m256i*)&row0[j * 4 + 32]));
+			__m256i b0 = swapBytes256(_mm256_loadu_si256((const __m256i*)&row1[j * 4]));
+			__m256i b1 = swapBytes256(_mm256_loadu_si256((const __m256i*)&row1[j * 4 + 32]));
+
+			__m256i packed = pack16(reduce8(a0, b0, filter), reduce8(a1, b1, filter));
+			_mm256_storeu_si256((__m256i*)&coarser[j * 2], packed);
+		}
+
+		return count;
+	}
+
+	/*
+	* Coarser texel j is centered between finer texels 2j and 2j + 1. Tap t samples finer texel 2j + t - 5,
+	* so taps are at half texel offsets and the weights are the same for every texel.
+	*/
+	void MipGenerator::getWeights(int filter, float* weights) {
+
+		auto sinc = [](double x) { return x == 0.0 ? 1.0 : sin(MIP_PI * x) / (MIP_PI * x); };
+		auto besselI0 = [](double x) {
+			double sum = 1.0, term = 1.0;
+			for (int k = 1; k < 32; k++) {
+				term *= (x / (2.0 * k)) * (x / (2.0 * k));
+				sum += term;
+			}
+			return sum;
+		};
+
+		const double radius = MIP_FILTER_TAPS / 4.0;
+		double total = 0.0;
+		double values[MIP_FILTER_TAPS];
+
+		for (int t = 0; t < MIP_FILTER_TAPS; t++) {
+
+			// distance from the center in coarser texels
+			double x = (t - (MIP_FILTER_TAPS / 2 - 1) - 0.5) * 0.5;
+
+			if (filter == MIP_FILTER_LANCZOS)
+				values[t] = sinc(x) * sinc(x / radius);
+			else {
+				double r = x / radius;
+				values[t] = sinc(x) * besselI0(MIP_FILTER_KAISER_BETA * sqrt(std::max(0.0, 1.0 - r * r))) / besselI0(MIP_FILTER_KAISER_BETA);
+			}
+			total += values[t];
+		}
+
+		for (int t = 0; t < MIP_FILTER_TAPS; t++)
+			weights[t] = (float)(values[t] / total);
+	}
+
+	static void filterRowScalar(const float* padded, float* out, int coarserSize, const float* weights, int start) {
+
+		for (int j = start; j < coarserSize; j++) {
+			float sum = 0.f;
+			for (int t = 0; t < MIP_FILTER_TAPS; t++)
+				sum += weights[t] * padded[j * 2 + t];
+			out[j] = sum;
+		}
+	}
+
+	static int filterRowSSE(const float* padded, float* out, int coarserSize, const float* weights) {
+
+		int count = coarserSize & ~3;
+
+		for (int j = 0; j < count; j += 4) {
+
+			__m128 sum = _mm_setzero_ps();
+			for (int t = 0; t < MIP_FILTER_TAPS; t++) {
+				const float* p = &padded[j * 2 + t];
+				__m128 even = _mm_shuffle_ps(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _MM_SHUFFLE(2, 0, 2, 0));
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), even));
+			}
+			_mm_storeu_ps(&out[j], sum);
+		}
+
+		return count;
+	}
+
+	AVX2_TARGET static int filterRowAVX2(const float* padded, float* out, int coarserSize, const float* weights) {
+
+		int count = coarserSize & ~7;
+
+		for (int j = 0; j < count; j += 8) {
+
+			__m256 sum = _mm256_setzero_ps();
+			for (int t = 0; t < MIP_FILTER_TAPS; t++) {
+				const float* p = &padded[j * 2 + t];
+				__m256 even = _mm256_shuffle_ps(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 8), _MM_SHUFFLE(2, 0, 2, 0));
+				even = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(even), 0xD8));
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[t]), even));
+			}
+			_mm256_storeu_ps(&out[j], sum);
+		}
+
+		return count;
+	}
+
+	static void filterColumnScalar(const float* const* rows, unsigned char* out, int coarserSize, const float* weights, int start) {
+
+		for (int j = start; j < coarserSize; j++) {
+			float sum = 0.f;
+			for (int t = 0; t < MIP_FILTER_TAPS; t++)
+				sum += weights[t] * rows[t][j];
+			storeHeight(&out[j * 2], quantize(sum));
+		}
+	}
+
+	static int filterColumnSSE(const float* const* rows, unsigned char* out, int coarserSize, const float* weights) {
+
+		int count = coarserSize & ~7;
+
+		for (int j = 0; j < count; j += 8) {
+
+			__m128i heights[2];
+			for (int half = 0; half < 2; half++) {
+
+				__m128 sum = _mm_setzero_ps();
+				for (int t = 0; t < MIP_FILTER_TAPS; t++)
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(&rows[t][j + half * 4])));
+
+				sum = _mm_add_ps(sum, _mm_set1_ps(0.5f));
+				sum = _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(65535.f));
+				heights[half] = _mm_cvttps_epi32(sum);
+			}
+
+			_mm_storeu_si128((__m128i*)&out[j * 2], pack8(heights[0], heights[1]));
+		}
+
+		return count;
+	}
+
+	AVX2_TARGET static int filterColumnAVX2(const float* const* rows, unsigned char* out, int coarserSize, const float* weights) {
+
+		int count = coarserSize & ~15;
+
+		for (int j = 0; j < count; j += 16) {
+
+			__m256i heights[2];
+			for (int half = 0; half < 2; half++) {
+
+				__m256 sum = _mm256_setzero_ps();
+				for (int t = 0; t < MIP_FILTER_TAPS; t++)
+					sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[t]), _mm256_loadu_ps(&rows[t][j + half * 8])));
+
+				sum = _mm256_add_ps(sum, _mm256_set1_ps(0.5f));
+				sum = _mm256_min_ps(_mm256_max_ps(sum, _mm256_setzero_ps()), _mm256_set1_ps(65535.f));
+				heights[half] = _mm256_cvttps_epi32(sum);
+			}
+
+			_mm256_storeu_si256((__m256i*)&out[j * 2], pack16(heights[0], heights[1]));
+		}
+
+		return count;
+	}
+
+	/*
+	* Separable windowed sinc. Finer rows the band needs are filtered horizontally first, then columns of them vertically.
+	* Texels out of the heightmap repeat the edge.
+	*/
+	void MipGenerator::resampleRows(const unsigned char* finer, int finerSize, unsigned char* coarser, int filter, int rowBegin, int rowEnd, int instructionSet) {
+
+		const int before = MIP_FILTER_TAPS / 2 - 1;
+		int coarserSize = finerSize / 2;
+
+		float weights[MIP_FILTER_TAPS];
+		MipGenerator::getWeights(filter, weights);
+
+		int firstRow = rowBegin * 2 - before;
+		int rowCount = (rowEnd - rowBegin) * 2 + MIP_FILTER_TAPS - 2;
+
+		std::vector<float> padded(finerSize + MIP_FILTER_TAPS + 1);
+		std::vector<float> horizontal((size_t)rowCount * coarserSize);
+
+		for (int r = 0; r < rowCount; r++) {
+
+			int row = glm::clamp(firstRow + r, 0, finerSize - 1);
+			const unsigned char* source = &finer[(size_t)row * finerSize * 2];
+
+			for (int p = 0; p < (int)padded.size(); p++)
+				padded[p] = loadHeight(&source[glm::clamp(p - before, 0, finerSize - 1) * 2]);
+
+			float* out = &horizontal[(size_t)r * coarserSize];
+			int done = 0;
+			if (instructionSet == INSTRUCTION_SET_AVX2)
+				done = filterRowAVX2(&padded[0], out, coarserSize, weights);
+			else if (instructionSet == INSTRUCTION_SET_SSE)
+				done = filterRowSSE(&padded[0], out, coarserSize, weights);
+			filterRowScalar(&padded[0], out, coarserSize, weights, done);
+		}
+
+		const float* rows[MIP_FILTER_TAPS];
+
+		for (int i = rowBegin; i < rowEnd; i++) {
+
+			for (int t = 0; t < MIP_FILTER_TAPS; t++)
+				rows[t] = &horizontal[(size_t)((i - rowBegin) * 2 + t) * coarserSize];
+
+			unsigned char* out = &coarser[(size_t)i * coarserSize * 2];
+			int done = 0;
+			if (instructionSet == INSTRUCTION_SET_AVX2)
+				done = filterColumnAVX2(rows, out, coarserSize, weights);
+			else if (instructionSet == INSTRUCTION_SET_SSE)
+				done = filterColumnSSE(rows, out, coarserSize, weights);
+			filterColumnScalar(rows, out, coarserSize, weights, done);
+		}
+	}
+
+	/*
+	* Times every filter with every instruction set on one thread, then the fastest one on a growing number of threads.
+	* Results of all paths are compared with the scalar one, it fails if one of them differs.
+	*/
+	bool MipGenerator::benchmark(int size, int iterations) {
+
+		std::vector<unsigned char> finer((size_t)size * size * 2);
+		for (int i = 0; i < size; i++)
+			for (int j = 0; j < size; j++)
+				storeHeight(&finer[((size_t)i * size + j) * 2], (unsigned short)(32768 + 20000 * sin(i * 0.013) * cos(j * 0.007) + ((i * 7919 + j * 104729) & 1023)));
+
+		size_t coarserBytes = (size_t)size * size / 2;
+		std::vector<unsigned char> reference(coarserBytes);
+		std::vector<unsigned char> coarser(coarserBytes);
+
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		double texels = (double)size * size * iterations;
+
+		unsigned int mismatches = 0;
+
+		printf("Mip generation benchmark, %dx%d to %dx%d, %d iterations, %u hardware threads\n", size, size, size / 2, size / 2, iterations, hardwareThreads);
+
+		for (int filter = 0; filter < MIP_FILTER_COUNT; filter++) {
+
+			MipGenerator::downsampleRows(&finer[0], size, &reference[0], filter, 0, size / 2, INSTRUCTION_SET_SCALAR);
+
+			for (int path = 0; path <= CPUFeatures::instructionSet; path++) {
+
+				auto begin = std::chrono::high_resolution_clock::now();
+				for (int iteration = 0; iteration < iterations; iteration++)
+					MipGenerator::downsampleRows(&finer[0], size, &coarser[0], filter, 0, size / 2, path);
+				auto end = std::chrono::high_resolution_clock::now();
+
+				double duration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 1e-6;
+				bool same = memcmp(&reference[0], &coarser[0], coarserBytes) == 0;
+				mismatches += !same;
+				printf("  %-8s %-6s 1 thread   : %9.1f Mtexels/s %s\n", filterNames[filter], CPUFeatures::instructionSetNames[path], texels / duration * 1e-6, same ? "" : "MISMATCH");
+			}
+
+			double singleThread = 0.0;
+			for (unsigned int threads = 1; threads <= hardwareThreads; threads *= 2) {
+
+				ThreadPool pool(threads);
+				auto begin = std::chrono::high_resolution_clock::now();
+				for (int iteration = 0; iteration < iterations; iteration++)
+					MipGenerator::downsample(&finer[0], size, &coarser[0], filter, &pool);
+				auto end = std::chrono::high_resolution_clock::now();
+
+				double duration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 1e-6;
+				if (threads == 1)
+					singleThread = duration;
+
+				bool same = memcmp(&reference[0], &coarser[0], coarserBytes) == 0;
+				mismatches += !same;
+				printf("  %-8s %-6s %2u threads : %9.1f Mtexels/s %5.2fx %s\n", filterNames[filter], CPUFeatures::instructionSetNames[CPUFeatures::instructionSet], threads, texels / duration * 1e-6, singleThread / duration, same ? "" : "MISMATCH");
+			}
+		}
+
+		printf("%s, %u mismatches\n", mismatches == 0 ? "Passed" : "FAILED", mismatches);
+		return mismatches == 0;
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "cpufeatures.h"
+
+#define MIP_FILTER_POINT 0
+#define MIP_FILTER_BOX 1
+#define MIP_FILTER_MIN 2
+#define MIP_FILTER_MAX 3
+#define MIP_FILTER_LANCZOS 4
+#define MIP_FILTER_KAISER 5
+#define MIP_FILTER_COUNT 6
+
+// Taps of the windowed filters on each axis, they reach 3 coarser texels on both sides
+#define MIP_FILTER_TAPS 12
+#define MIP_FILTER_KAISER_BETA 4.f
+
+namespace Core {
+
+	class ThreadPool;
+
+	/*
+	* Halves a square heightmap of 16 bit big endian heights, the layout of the heightmap stack.
+	* Heights are filtered as 16 bit values. Point, box, min and max look at the 2x2 texels under a coarser texel.
+	* Lanczos and Kaiser are separable windowed sinc filters of MIP_FILTER_TAPS taps.
+	* Rows are split into bands that run on a thread pool. Every path gives the same result as the scalar one.
+	*/
+	class __declspec(dllexport) MipGenerator {
+
+	private:
+
+	public:
+
+		static const char* filterNames[MIP_FILTER_COUNT];
+
+		static void downsample(const unsigned char* finer, int finerSize, unsigned char* coarser, int filter, ThreadPool* pool = 0, int instructionSet = CPUFeatures::instructionSet);
+		static void downsampleRows(const unsigned char* finer, int finerSize, unsigned char* coarser, int filter, int rowBegin, int rowEnd, int instructionSet);
+		static void reduceScalar(const unsigned char* row0, const unsigned char* row1, unsigned char* coarser, int coarserSize, int filter, int start);
+		static int reduceSSE(const unsigned char* row0, const unsigned char* row1, unsigned char* coarser, int coarserSize, int filter);
+		static int reduceAVX2(const unsigned char* row0, const unsigned char* row1, unsigned char* coarser, int coarserSize, int filter);
+		static void resampleRows(const unsigned char* finer, int finerSize, unsigned char* coarser, int filter, int rowBegin, int rowEnd, int instructionSet);
+		static void getWeights(int filter, float* weights);
+		static bool benchmark(int size, int iterations);
+	};
+}
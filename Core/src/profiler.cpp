@@ -0,0 +1,158 @@
+#include "pch.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace Core {
+
+	ProfilerThread Profiler::threads[PROFILER_MAX_THREADS];
+	bool Profiler::enabled = true;
+	unsigned long long Profiler::origin = Profiler::now();
+
+	/*
+	* Gives the slot back when its thread exits.
+	*/
+	struct ProfilerThreadSlot {
+
+		ProfilerThread* thread = NULL;
+		unsigned int depth = 0;
+
+		~ProfilerThreadSlot() {
+			if (thread)
+				thread->owned.store(false, std::memory_order_release);
+		}
+	};
+
+	static thread_local ProfilerThreadSlot threadSlot;
+
+	/*
+	* Slot of the calling thread, taken on its first scope. NULL when every slot is owned, the thread is not recorded then.
+	*/
+	ProfilerThread* Profiler::getThread() {
+
+		if (threadSlot.thread)
+			return threadSlot.thread;
+
+		for (int i = 0; i < PROFILER_MAX_THREADS; i++) {
+
+			bool owned = false;
+			if (threads[i].owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+				snprintf(threads[i].name, PROFILER_THREAD_NAME_LENGTH, "Thread %d", i);
+				threadSlot.thread = &threads[i];
+				break;
+			}
+		}
+
+		return threadSlot.thread;
+	}
+
+	void Profiler::setThreadName(const char* name) {
+
+		if (ProfilerThread* thread = Profiler::getThread())
+			snprintf(thread->name, PROFILER_THREAD_NAME_LENGTH, "%s", name);
+	}
+
+	void Profiler::enter() {
+
+		threadSlot.depth++;
+	}
+
+	void Profiler::leave(const char* name, unsigned long long start, unsigned long long end) {
+
+		threadSlot.depth--;
+
+		ProfilerThread* thread = Profiler::getThread();
+		if (!thread)
+			return;
+
+		unsigned long long head = thread->head.load(std::memory_order_relaxed);
+		ProfilerEvent& event = thread->events[head & (PROFILER_RING_SIZE - 1)];
+		event.name = name;
+		event.start = start;
+		event.end = end;
+		event.depth = threadSlot.depth;
+		thread->head.store(head + 1, std::memory_order_release);
+	}
+
+	/*
+	* Copies the events that ended after since, from every thread that recorded any. Can be called from any thread
+	* while the others keep recording.
+	*/
+	void Profiler::collect(std::vector<ProfilerThreadEvents>& threadEvents, unsigned long long since) {
+
+		threadEvents.clear();
+
+		for (unsigned int i = 0; i < PROFILER_MAX_THREADS; i++) {
+
+			ProfilerThread& thread = threads[i];
+			unsigned long long head = thread.head.load(std::memory_order_acquire);
+			if (head == 0)
+				continue;
+
+			unsigned long long first = head > PROFILER_RING_SIZE ? head - PROFILER_RING_SIZE : 0;
+			std::vector<ProfilerEvent> events;
+			events.reserve(head - first);
+			for (unsigned long long j = first; j < head; j++)
+				events.push_back(thread.events[j & (PROFILER_RING_SIZE - 1)]);
+
+			// events the owner wrote over while they were copied
+			std::atomic_thread_fence(std::memory_order_acquire);
+			unsigned long long last = thread.head.load(std::memory_order_relaxed);
+			unsigned long long valid = last + 1 > PROFILER_RING_SIZE ? last + 1 - PROFILER_RING_SIZE : 0;
+			size_t overwritten = valid > first ? (size_t)std::min(valid - first, head - first) : 0;
+			events.erase(events.begin(), events.begin() + overwritten);
+
+			events.erase(std::remove_if(events.begin(), events.end(), [since](const ProfilerEvent& event) { return event.end < since; }), events.end());
+			if (events.empty())
+				continue;
+
+			threadEvents.push_back({ i, std::string(thread.name, strnlen(thread.name, PROFILER_THREAD_NAME_LENGTH)), std::move(events) });
+		}
+	}
+
+	/*
+	* Complete events in microseconds from the start of the program, one track per thread.
+	*/
+	bool Profiler::exportChromeTrace(const std::string& path) {
+
+		std::vector<ProfilerThreadEvents> threadEvents;
+		Profiler::collect(threadEvents);
+
+		std::ofstream file(path, std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		auto writeString = [&file](const char* value) {
+			file << '"';
+			for (const char* c = value; *c; c++) {
+				if (*c == '"' || *c == '\\')
+					file << '\\';
+				file << *c;
+			}
+			file << '"';
+		};
+
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		file << std::fixed;
+		file.precision(3);
+
+		bool first = true;
+		for (ProfilerThreadEvents& thread : threadEvents) {
+
+			file << (first ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.thread << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+			writeString(thread.name.c_str());
+			file << "}}";
+			first = false;
+
+			for (ProfilerEvent& event : thread.events) {
+				file << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << thread.thread << ",\"ts\":" << (event.start - origin) * 0.001 << ",\"dur\":" << (event.end - event.start) * 0.001 << ",\"name\":";
+				writeString(event.name);
+				file << "}";
+			}
+		}
+
+		file << "\n]}\n";
+		return file.good();
+	}
+}
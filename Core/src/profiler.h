@@ -0,0 +1,114 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+
+// Comment out to compile the profiling scopes out, the Profiler class is still there but nothing is recorded
+#define CORE_PROFILER
+
+// Events each thread keeps, power of two. Older events are overwritten.
+#define PROFILER_RING_SIZE 8192
+#define PROFILER_MAX_THREADS 64
+#define PROFILER_THREAD_NAME_LENGTH 32
+
+#ifdef CORE_PROFILER
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+// Name has to outlive the profiler, a string literal
+#define PROFILE_SCOPE(name) ::Core::ProfilerScope PROFILER_CONCAT(profilerScope, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#define PROFILE_THREAD(name) ::Core::Profiler::setThreadName(name)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FUNCTION()
+#define PROFILE_THREAD(name)
+#endif
+
+namespace Core {
+
+	/*
+	* A finished scope. Times are nanoseconds of Profiler::now, depth is the number of scopes it is nested in.
+	*/
+	struct ProfilerEvent {
+
+		const char* name;
+		unsigned long long start;
+		unsigned long long end;
+		unsigned int depth;
+	};
+
+	/*
+	* Events of a thread that are still in its ring, ordered by end time.
+	*/
+	struct ProfilerThreadEvents {
+
+		unsigned int thread;
+		std::string name;
+		std::vector<ProfilerEvent> events;
+	};
+
+	/*
+	* Ring of a thread. Only the owner thread writes events and head, readers copy the ring and drop the events
+	* that were overwritten meanwhile by checking head again, so neither side takes a lock.
+	* A slot is given back when its thread exits and can be taken by a new thread, its events stay readable.
+	*/
+	struct ProfilerThread {
+
+		ProfilerEvent events[PROFILER_RING_SIZE];
+		std::atomic<unsigned long long> head{ 0 };
+		std::atomic<bool> owned{ false };
+		char name[PROFILER_THREAD_NAME_LENGTH] = {};
+	};
+
+	/*
+	* Scoped CPU profiler. PROFILE_SCOPE and PROFILE_FUNCTION time the enclosing scope on any thread and write it
+	* to the ring of that thread. collect gives the events to the editor timeline, exportChromeTrace writes them in
+	* the trace event format that chrome://tracing and Perfetto open.
+	*/
+	class __declspec(dllexport) Profiler {
+
+	private:
+
+		static ProfilerThread threads[PROFILER_MAX_THREADS];
+
+		static ProfilerThread* getThread();
+
+	public:
+
+		static bool enabled;
+		static unsigned long long origin;	// now() when the program started, traces start there
+
+		static unsigned long long now() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+		}
+
+		static void setThreadName(const char* name);
+		static void enter();
+		static void leave(const char* name, unsigned long long start, unsigned long long end);
+		static void collect(std::vector<ProfilerThreadEvents>& threadEvents, unsigned long long since = 0);
+		static bool exportChromeTrace(const std::string& path);
+	};
+
+	class ProfilerScope {
+
+	private:
+
+		const char* name;
+		unsigned long long start;
+
+	public:
+
+		ProfilerScope(const char* name) : name(Profiler::enabled ? name : NULL), start(0) {
+
+			if (this->name) {
+				Profiler::enter();
+				start = Profiler::now();
+			}
+		}
+
+		~ProfilerScope() {
+
+			if (name)
+				Profiler::leave(name, start, Profiler::now());
+		}
+	};
+}
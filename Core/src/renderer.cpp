@@ -1,10 +1,13 @@
 #include "pch.h"
 #include "renderer.h"
-#include "GL/glew.h"
+#include "gldispatch.h"
 #include "corecontext.h"
-#include "shader.h"
+#include "shadermanager.h"
 #include "glewcontext.h"
 #include "component/terrain.h"
+#include "profiler.h"
+#include "gputimer.h"
+#include "counters.h"
 
 using namespace std::chrono;
 
@@ -12,11 +15,14 @@ namespace Core {
 
 	void Renderer::init() {
 
-		backgroundShaderProgramId = Shader::loadShaders("resources/shaders/cubemap/background.vert", "resources/shaders/cubemap/background.frag");
-		defaultPbrShaderProgramId = Shader::loadShaders("resources/shaders/pbr/pbr.vert", "resources/shaders/pbr/pbr.frag");
-		lineShaderProgramId = Shader::loadShaders("resources/shaders/gizmo/line.vert", "resources/shaders/gizmo/line.frag");
+		// Compiled in parallel, they are not used before the first frame
+		ShaderManager* shaderManager = CoreContext::instance->shaderManager;
+		backgroundShaderProgramId = shaderManager->load("resources/shaders/cubemap/background.vert", "resources/shaders/cubemap/background.frag");
+		defaultPbrShaderProgramId = shaderManager->load("resources/shaders/pbr/pbr.vert", "resources/shaders/pbr/pbr.frag");
+		lineShaderProgramId = shaderManager->load("resources/shaders/gizmo/line.vert", "resources/shaders/gizmo/line.frag");
 
 		Renderer::createEnvironmentCubeVAO();
+		GPUTimer::init();
 
 		// EDITOR
 		Renderer::createBoundingBoxVAO();
@@ -24,8 +30,12 @@ namespace Core {
 
 	void Renderer::update(float dt) {
 
+		PROFILE_FUNCTION();
+
         Scene* scene = CoreContext::instance->scene;
 
+        GPUTimer::begin(GPU_PASS_FRAME);
+
         glBindFramebuffer(GL_FRAMEBUFFER, scene->FBO);
         glEnable(GL_DEPTH_TEST);
         glDepthFunc(GL_LEQUAL);
@@ -38,14 +48,19 @@ namespace Core {
 		if (Terrain* terrain = scene->terrain) {
 			//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
+			unsigned int glCalls = GLDispatch::frame.calls;
 			auto start = high_resolution_clock::now();
+			GPUTimer::begin(GPU_PASS_TERRAIN);
 			terrain->onDraw();
+			GPUTimer::end(GPU_PASS_TERRAIN);
 			auto stop = high_resolution_clock::now();
 			unsigned int duration = duration_cast<microseconds>(stop - start).count();
 			terrainRenderTotalTime += duration;
+			terrainGLCalls = GLDispatch::frame.calls - glCalls;
 		}
 
         // render skybox (render as last to prevent overdraw)
+        GPUTimer::begin(GPU_PASS_SKYBOX);
         glUseProgram(backgroundShaderProgramId);
         glUniformMatrix4fv(glGetUniformLocation(backgroundShaderProgramId, "projection"), 1, GL_FALSE, &scene->cameraInfo.projection[0][0]);
         glUniformMatrix4fv(glGetUniformLocation(backgroundShaderProgramId, "view"), 1, GL_FALSE, &scene->cameraInfo.view[0][0]);
@@ -57,6 +72,8 @@ namespace Core {
         glDrawArrays(GL_TRIANGLES, 0, 36);
         glBindVertexArray(0);
         glEnable(GL_CULL_FACE);
+        Counters::add(COUNTER_TRIANGLES, 12);
+        GPUTimer::end(GPU_PASS_SKYBOX);
 
 
 		// ------------------ FRAMEBUFFER PASS (FILTERS) ------------------
@@ -66,6 +83,7 @@ namespace Core {
 #else
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 #endif
+		GPUTimer::begin(GPU_PASS_FILTER);
 		glDisable(GL_DEPTH_TEST);
 		glClear(GL_COLOR_BUFFER_BIT);
 		glUseProgram(scene->filterFramebufferProgramID);
@@ -74,6 +92,9 @@ namespace Core {
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, scene->textureBuffer);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
+		Counters::add(COUNTER_TRIANGLES, 2);
+		GPUTimer::end(GPU_PASS_FILTER);
+		GPUTimer::end(GPU_PASS_FRAME);
 
 #ifdef EDITOR_MODE
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -81,6 +102,9 @@ namespace Core {
 
 		frameCounter++;
 		terrainRenderDuration = terrainRenderTotalTime / frameCounter;
+		GLDispatch::endFrame();
+		GPUTimer::endFrame();
+		Counters::endFrame(dt * 1000.f);
 	}
 
 	void Renderer::createEnvironmentCubeVAO() {
@@ -25,6 +25,7 @@ namespace Core {
 		unsigned int terrainRenderTotalTime = 0;
 		unsigned int terrainRenderDuration = 0;
 		unsigned int frameCounter = 0;
+		unsigned int terrainGLCalls = 0;	// calls of onDraw, counted when GL calls are recorded
 
 		void init();
 		void update(float dt);
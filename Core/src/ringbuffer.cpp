@@ -0,0 +1,133 @@
+#include "pch.h"
+#include "ringbuffer.h"
+#include <chrono>
+
+#define RING_BUFFER_ALIGNMENT 256
+
+namespace Core {
+
+	RingBuffer::RingBuffer() { }
+
+	RingBuffer::~RingBuffer() {
+
+		for (RingBufferRange& range : ranges)
+			if (range.fence)
+				glDeleteSync(range.fence);
+
+		if (id) {
+			glBindBuffer(target, id);
+			glUnmapBuffer(target);
+			glBindBuffer(target, 0);
+			glDeleteBuffers(1, &id);
+		}
+	}
+
+	bool RingBuffer::init(GLenum target, unsigned int capacity) {
+
+		if (!GLEW_ARB_buffer_storage)
+			return false;
+
+		this->target = target;
+		this->capacity = capacity;
+
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glGenBuffers(1, &id);
+		glBindBuffer(target, id);
+		glBufferStorage(target, capacity, NULL, flags);
+		mappedData = (unsigned char*)glMapBufferRange(target, 0, capacity, flags);
+		glBindBuffer(target, 0);
+
+		if (mappedData == NULL) {
+			std::cout << "ERROR::RINGBUFFER:: Buffer could not be mapped persistently" << std::endl;
+			glDeleteBuffers(1, &id);
+			id = 0;
+			return false;
+		}
+
+		return true;
+	}
+
+	/*
+	* Returns a pointer to write and the offset of it in the buffer.
+	* A range never crosses the end of the buffer, so the new range is checked against the memory of every live range,
+	* whatever lap it was taken in. If it overlaps a range that GPU may still read, we wait for its fence and count it
+	* as a stall. If it overlaps a range that is not fenced yet, its command is not issued, the ring is full and NULL is returned.
+	*/
+	unsigned char* RingBuffer::allocate(unsigned int size, unsigned int& offset) {
+
+		if (size > capacity) {
+			fullCount++;
+			return NULL;
+		}
+
+		unsigned long long start = (head + RING_BUFFER_ALIGNMENT - 1) / RING_BUFFER_ALIGNMENT * RING_BUFFER_ALIGNMENT;
+		if (start % capacity + size > capacity)
+			start += capacity - start % capacity;
+
+		unsigned long long end = start + size;
+		unsigned long long physicalStart = start % capacity;
+		unsigned long long physicalEnd = physicalStart + size;
+
+		auto overlaps = [&](const RingBufferRange& range) {
+			unsigned long long rangeStart = range.start % capacity;
+			unsigned long long rangeEnd = rangeStart + (range.end - range.start);
+			return rangeStart < physicalEnd && physicalStart < rangeEnd;
+		};
+
+		for (RingBufferRange& range : ranges) {
+			if (range.fence == NULL && overlaps(range)) {
+				fullCount++;
+				return NULL;
+			}
+		}
+
+		for (auto it = ranges.begin(); it != ranges.end();) {
+
+			if (!overlaps(*it)) {
+				it++;
+				continue;
+			}
+
+			GLsync sync = it->fence;
+			GLenum result = glClientWaitSync(sync, 0, 0);
+
+			if (result == GL_TIMEOUT_EXPIRED) {
+
+				auto begin = std::chrono::high_resolution_clock::now();
+				while (result == GL_TIMEOUT_EXPIRED)
+					result = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+				auto finish = std::chrono::high_resolution_clock::now();
+
+				stallCount++;
+				stallDuration += std::chrono::duration_cast<std::chrono::microseconds>(finish - begin).count();
+			}
+
+			glDeleteSync(sync);
+			it = ranges.erase(it);
+		}
+
+		while (!ranges.empty() && ranges.front().fence && glClientWaitSync(ranges.front().fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+			glDeleteSync(ranges.front().fence);
+			ranges.pop_front();
+		}
+
+		ranges.push_back({ start, end, NULL });
+		head = end;
+		offset = (unsigned int)physicalStart;
+		return &mappedData[offset];
+	}
+
+	/*
+	* Call after the command that reads the range at offset is issued.
+	*/
+	void RingBuffer::fence(unsigned int offset) {
+
+		for (RingBufferRange& range : ranges) {
+			if (range.fence == NULL && range.start % capacity == offset) {
+				range.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				return;
+			}
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "GL/glew.h"
+#include <deque>
+
+namespace Core {
+
+	/*
+	* Region of the ring that is written by the CPU and then read by a GPU command.
+	* Positions are linear, they keep increasing as the ring wraps.
+	*/
+	struct RingBufferRange {
+
+		unsigned long long start;
+		unsigned long long end;
+		GLsync fence = NULL;
+	};
+
+	/*
+	* Persistently mapped buffer that is filled by CPU and consumed by GPU in a circular way.
+	* A range can only be reused after the fence of the command that read it is signaled.
+	* Requires GL_ARB_buffer_storage, the caller should use client memory if init fails.
+	*/
+	class __declspec(dllexport) RingBuffer {
+
+	private:
+
+		std::deque<RingBufferRange> ranges;
+		unsigned long long head = 0;
+
+	public:
+
+		unsigned int id = 0;
+		GLenum target;
+		unsigned int capacity = 0;
+		unsigned char* mappedData = NULL;
+
+		unsigned int stallCount = 0;
+		unsigned long long stallDuration = 0;	// microseconds
+		unsigned int fullCount = 0;
+
+		RingBuffer();
+		~RingBuffer();
+		bool init(GLenum target, unsigned int capacity);
+		unsigned char* allocate(unsigned int size, unsigned int& offset);
+		void fence(unsigned int offset);
+	};
+}
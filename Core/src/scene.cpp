@@ -1,8 +1,11 @@
 #include "pch.h"
 #include "scene.h"
-#include "shader.h"
+#include "shadermanager.h"
 #include "corecontext.h"
 #include "component/terrain.h"
+#include "gldispatch.h"
+#include "profiler.h"
+#include "counters.h"
 
 namespace Core {
 
@@ -21,11 +24,12 @@ namespace Core {
 		glDeleteFramebuffers(1, &FBO);
 		glDeleteFramebuffers(1, &filterFBO);
 		//glDeleteProgram(framebufferProgramID);
-		glDeleteProgram(filterFramebufferProgramID);
 	}
 
 	void Scene::start() {
 
+		PROFILE_FUNCTION();
+
 		Scene::initFramebuffers();
 		cubemap = CoreContext::instance->fileSystem->cubemaps.at("hilly_terrain_01_puresky_4k");
 		Scene::loadScene(Scene::getActiveScenePath());
@@ -36,13 +40,15 @@ namespace Core {
 
 	void Scene::update(float dt) {
 
+		PROFILE_FUNCTION();
+
 		if (terrain != NULL)
 			terrain->update(dt);
 	}
 
 	void Scene::initFramebuffers() {
 
-		filterFramebufferProgramID = Shader::loadShaders("resources/shaders/framebuffer/framebuffer.vert",
+		filterFramebufferProgramID = CoreContext::instance->shaderManager->load("resources/shaders/framebuffer/framebuffer.vert",
 			"resources/shaders/framebuffer/framebuffer_filter.frag");
 		//framebufferProgramID = Shader::loadShaders("resources/shaders/framebuffer/framebuffer.vert",
 		//	"resources/shaders/framebuffer/framebuffer.frag");
@@ -172,6 +178,8 @@ namespace Core {
 
 		CoreContext::instance->glewContext->createFrameBuffer(FBO, RBO, textureBuffer, width, height);
 		CoreContext::instance->glewContext->createFrameBuffer(filterFBO, filterRBO, filterTextureBuffer, width, height);
+		// RGB8 color and depth stencil of both
+		Counters::setMemory(MEMORY_GPU_FRAMEBUFFERS, 2ull * width * height * (3 + 4));
 	}
 
 	void Scene::setSize(int width, int height) {
@@ -180,6 +188,7 @@ namespace Core {
 		this->height = height;
 		CoreContext::instance->glewContext->createFrameBuffer(FBO, RBO, textureBuffer, width, height);
 		CoreContext::instance->glewContext->createFrameBuffer(filterFBO, filterRBO, filterTextureBuffer, width, height);
+		Counters::setMemory(MEMORY_GPU_FRAMEBUFFERS, 2ull * width * height * (3 + 4));
 	}
 
 	void Scene::loadScene(std::string filePath) {
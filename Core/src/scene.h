@@ -2,7 +2,7 @@
 
 #include "rapidXML/rapidxml_print.hpp"
 #include "rapidXML/rapidxml.hpp"
-#include "GLM/glm.hpp"
+#include "glm/glm.hpp"
 #include "cubemap.h"
 #include "component/terrain.h"
 
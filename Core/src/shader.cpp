@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "shader.h"
-#include "GL/glew.h"
+#include "corecontext.h"
+
 namespace Core {
 
 	Shader::Shader(std::string path) {
@@ -11,93 +12,20 @@ namespace Core {
 
 	}
 
+	/*
+	* Compiles a program through the shader manager and waits for it. 0 if it could not be linked.
+	*/
 	unsigned int Shader::loadShaders(std::string vertexPath, std::string fragmentPath) {
 
-		//Create the shaders
-		unsigned int VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-		unsigned int FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-		// Read the Vertex Shader code from the file
-		std::string VertexShaderCode;
-		std::ifstream VertexShaderStream(vertexPath.c_str(), std::ios::in);
-		if (VertexShaderStream.is_open()) {
-			std::stringstream sstr;
-			sstr << VertexShaderStream.rdbuf();
-			VertexShaderCode = sstr.str();
-			VertexShaderStream.close();
-		}
-		else {
-			printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", fragmentPath.c_str());
-			getchar();
-			return 0;
-		}
-
-		// Read the Fragment Shader code from the file
-		std::string FragmentShaderCode;
-		std::ifstream FragmentShaderStream(fragmentPath.c_str(), std::ios::in);
-		if (FragmentShaderStream.is_open()) {
-			std::stringstream sstr;
-			sstr << FragmentShaderStream.rdbuf();
-			FragmentShaderCode = sstr.str();
-			FragmentShaderStream.close();
-		}
-
-		int Result = GL_FALSE;
-		int InfoLogLength;
-
-		// Compile Vertex Shader
-		printf("Compiling shader : %s\n", vertexPath.c_str());
-		char const* VertexSourcePointer = VertexShaderCode.c_str();
-		glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-		glCompileShader(VertexShaderID);
-
-		// Check Vertex Shader
-		glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-		glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0) {
-			std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-			glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-			printf("%s\n", &VertexShaderErrorMessage[0]);
-		}
-
-		// Compile Fragment Shader
-		printf("Compiling shader : %s\n", fragmentPath.c_str());
-		char const* FragmentSourcePointer = FragmentShaderCode.c_str();
-		glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-		glCompileShader(FragmentShaderID);
-
-		// Check Fragment Shader
-		glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-		glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0) {
-			std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-			glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-			printf("%s\n", &FragmentShaderErrorMessage[0]);
-		}
-
-		// Link the program
-		printf("Linking program\n");
-		unsigned int ProgramID = glCreateProgram();
-		glAttachShader(ProgramID, VertexShaderID);
-		glAttachShader(ProgramID, FragmentShaderID);
-		glLinkProgram(ProgramID);
-
-		// Check the program
-		glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-		glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-		if (InfoLogLength > 0) {
-			std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
-			glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-			printf("%s\n", &ProgramErrorMessage[0]);
-		}
-
-		glDetachShader(ProgramID, VertexShaderID);
-		glDetachShader(ProgramID, FragmentShaderID);
+		ShaderManager* shaderManager = CoreContext::instance->shaderManager;
+		unsigned int programID = shaderManager->load(vertexPath, fragmentPath);
+		return shaderManager->wait(programID) ? programID : 0;
+	}
 
-		glDeleteShader(VertexShaderID);
-		glDeleteShader(FragmentShaderID);
+	unsigned int Shader::loadComputeShader(std::string computePath) {
 
-		return ProgramID;
+		ShaderManager* shaderManager = CoreContext::instance->shaderManager;
+		unsigned int programID = shaderManager->loadCompute(computePath);
+		return shaderManager->wait(programID) ? programID : 0;
 	}
-
 }
@@ -11,6 +11,7 @@ namespace Core {
 		Shader(std::string path);
 		~Shader();
 		static unsigned int loadShaders(std::string vertexPath, std::string fragmentPath);
+		static unsigned int loadComputeShader(std::string computePath);
 
 	};
 }
\ No newline at end of file
@@ -0,0 +1,328 @@
+#include "pch.h"
+#include "shadermanager.h"
+#include "gldispatch.h"
+#include "profiler.h"
+
+namespace Core {
+
+	/*
+	* Needs a current context. Driver string is part of the key of the cached binaries, so a driver update compiles them again.
+	*/
+	ShaderManager::ShaderManager() {
+
+		if (GLEW_KHR_parallel_shader_compile) {
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+			parallelCompile = true;
+		}
+		else if (GLEW_ARB_parallel_shader_compile) {
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+			parallelCompile = true;
+		}
+
+		int binaryFormats = 0;
+		if (GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+		binaryCache = binaryFormats > 0;
+
+		const char* strings[3] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+		for (int i = 0; i < 3; i++)
+			driver += std::string(strings[i] ? strings[i] : "") + "\n";
+	}
+
+	ShaderManager::~ShaderManager() {
+
+		for (auto& it : programs) {
+			ShaderProgram* program = it.second;
+			for (unsigned int shader : program->shaders)
+				glDeleteShader(shader);
+			glDeleteProgram(program->id);
+			delete program;
+		}
+	}
+
+	unsigned int ShaderManager::load(const std::string& vertexPath, const std::string& fragmentPath, const std::vector<std::string>& defines) {
+
+		ShaderProgram* program = ShaderManager::submit({ { GL_VERTEX_SHADER, vertexPath }, { GL_FRAGMENT_SHADER, fragmentPath } }, defines);
+		return program ? program->id : 0;
+	}
+
+	unsigned int ShaderManager::loadCompute(const std::string& computePath, const std::vector<std::string>& defines) {
+
+		ShaderProgram* program = ShaderManager::submit({ { GL_COMPUTE_SHADER, computePath } }, defines);
+		return program ? program->id : 0;
+	}
+
+	/*
+	* Returns the program of a permutation that was loaded before without reading the sources again.
+	* Otherwise the program is read from the shader cache, or its stages are compiled and linked without waiting for them.
+	*/
+	ShaderProgram* ShaderManager::submit(const std::vector<ShaderStage>& stages, const std::vector<std::string>& defines) {
+
+		std::string key;
+		for (const ShaderStage& stage : stages)
+			key += stage.path + "|";
+		for (const std::string& define : defines)
+			key += define + ";";
+
+		auto it = programs.find(key);
+		if (it != programs.end())
+			return it->second;
+
+		std::vector<std::string> sources(stages.size());
+		unsigned long long hash = ShaderManager::hash(&driver[0], driver.size(), SHADER_CACHE_VERSION);
+
+		for (unsigned int i = 0; i < stages.size(); i++) {
+
+			std::string source;
+			if (!ShaderManager::readFile(stages[i].path, source)) {
+				printf("Impossible to open %s.\n", stages[i].path.c_str());
+				return NULL;
+			}
+
+			sources[i] = ShaderManager::addDefines(source, defines);
+			hash = ShaderManager::hash(&stages[i].type, sizeof(unsigned int), hash);
+			hash = ShaderManager::hash(&sources[i][0], sources[i].size(), hash);
+		}
+
+		ShaderProgram* program = new ShaderProgram;
+		program->id = glCreateProgram();
+		program->hash = hash;
+		for (const ShaderStage& stage : stages)
+			program->name += (program->name.empty() ? "" : ", ") + stage.path;
+		programs[key] = program;
+		programIds[program->id] = program;
+
+		if (binaryCache && ShaderManager::loadBinary(program)) {
+			cacheHits++;
+			return program;
+		}
+		cacheMisses++;
+
+		printf("Compiling program : %s\n", program->name.c_str());
+
+		for (unsigned int i = 0; i < stages.size(); i++) {
+
+			unsigned int shader = glCreateShader(stages[i].type);
+			const char* sourcePointer = sources[i].c_str();
+			glShaderSource(shader, 1, &sourcePointer, NULL);
+			glCompileShader(shader);
+			glAttachShader(program->id, shader);
+			program->shaders.push_back(shader);
+		}
+
+		if (binaryCache)
+			glProgramParameteri(program->id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program->id);
+		program->pending = true;
+
+		return program;
+	}
+
+	/*
+	* True if the program can be used without blocking. Without parallel compile the link is checked right away.
+	*/
+	bool ShaderManager::isReady(unsigned int program) {
+
+		auto it = programIds.find(program);
+		if (it == programIds.end())
+			return true;
+
+		ShaderProgram* shaderProgram = it->second;
+		if (!shaderProgram->pending)
+			return true;
+
+		if (parallelCompile) {
+			int complete = GL_FALSE;
+			glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+			if (complete == GL_FALSE)
+				return false;
+		}
+
+		ShaderManager::check(shaderProgram);
+		return true;
+	}
+
+	/*
+	* Blocks until the program is linked. Returns false if it failed to compile or to link.
+	*/
+	bool ShaderManager::wait(unsigned int program) {
+
+		auto it = programIds.find(program);
+		if (it == programIds.end())
+			return false;
+
+		ShaderProgram* shaderProgram = it->second;
+		if (shaderProgram->pending)
+			ShaderManager::check(shaderProgram);
+
+		return shaderProgram->linked;
+	}
+
+	void ShaderManager::finish() {
+
+		PROFILE_FUNCTION();
+
+		for (auto& it : programs)
+			if (it.second->pending)
+				ShaderManager::check(it.second);
+	}
+
+	/*
+	* Prints the logs of the stages and the program and stores the binary of a linked program.
+	*/
+	void ShaderManager::check(ShaderProgram* program) {
+
+		int result = GL_FALSE;
+		int infoLogLength;
+
+		for (unsigned int shader : program->shaders) {
+
+			glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLength);
+			if (infoLogLength > 0) {
+				std::vector<char> shaderErrorMessage(infoLogLength + 1);
+				glGetShaderInfoLog(shader, infoLogLength, NULL, &shaderErrorMessage[0]);
+				printf("%s\n", &shaderErrorMessage[0]);
+			}
+		}
+
+		glGetProgramiv(program->id, GL_LINK_STATUS, &result);
+		glGetProgramiv(program->id, GL_INFO_LOG_LENGTH, &infoLogLength);
+		if (infoLogLength > 0) {
+			std::vector<char> programErrorMessage(infoLogLength + 1);
+			glGetProgramInfoLog(program->id, infoLogLength, NULL, &programErrorMessage[0]);
+			printf("%s\n", &programErrorMessage[0]);
+		}
+
+		for (unsigned int shader : program->shaders) {
+			glDetachShader(program->id, shader);
+			glDeleteShader(shader);
+		}
+		program->shaders.clear();
+
+		program->pending = false;
+		program->linked = result == GL_TRUE;
+
+		if (!program->linked) {
+			printf("Linking failed : %s\n", program->name.c_str());
+			failedPrograms++;
+		}
+		else if (binaryCache)
+			ShaderManager::saveBinary(program);
+	}
+
+	/*
+	* A binary can be rejected by the driver even if its key matches, the program is compiled from source then.
+	*/
+	bool ShaderManager::loadBinary(ShaderProgram* program) {
+
+		std::ifstream file(ShaderManager::getCachePath(program->hash), std::ios::binary);
+		if (!file.is_open())
+			return false;
+
+		ShaderCacheHeader header;
+		if (!file.read((char*)&header, sizeof(ShaderCacheHeader)) || header.magic != SHADER_CACHE_MAGIC ||
+			header.version != SHADER_CACHE_VERSION || header.hash != program->hash || header.length == 0)
+			return false;
+
+		std::vector<char> binary(header.length);
+		if (!file.read(&binary[0], header.length))
+			return false;
+
+		glProgramBinary(program->id, header.format, &binary[0], header.length);
+
+		int result = GL_FALSE;
+		glGetProgramiv(program->id, GL_LINK_STATUS, &result);
+		if (result == GL_FALSE)
+			return false;
+
+		program->linked = true;
+		program->fromCache = true;
+		return true;
+	}
+
+	void ShaderManager::saveBinary(ShaderProgram* program) {
+
+		int length = 0;
+		glGetProgramiv(program->id, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+
+		std::vector<char> binary(length);
+		ShaderCacheHeader header = { SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, program->hash, 0, 0 };
+		glGetProgramBinary(program->id, length, &length, &header.format, &binary[0]);
+		header.length = length;
+
+		std::error_code error;
+		std::filesystem::create_directories(cacheDirectory, error);
+
+		std::ofstream file(ShaderManager::getCachePath(program->hash), std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return;
+
+		file.write((const char*)&header, sizeof(ShaderCacheHeader));
+		file.write(&binary[0], length);
+	}
+
+	std::string ShaderManager::getCachePath(unsigned long long hash) {
+
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", hash);
+		return cacheDirectory + name;
+	}
+
+	bool ShaderManager::readFile(const std::string& path, std::string& source) {
+
+		std::ifstream stream(path.c_str(), std::ios::in);
+		if (!stream.is_open())
+			return false;
+
+		std::stringstream sstr;
+		sstr << stream.rdbuf();
+		source = sstr.str();
+		return true;
+	}
+
+	/*
+	* Defines are placed after the #version line, a #line directive keeps line numbers of the log the same as the file.
+	*/
+	std::string ShaderManager::addDefines(const std::string& source, const std::vector<std::string>& defines) {
+
+		if (defines.empty())
+			return source;
+
+		size_t insert = 0;
+		size_t version = source.find("#version");
+		if (version != std::string::npos) {
+			size_t end = source.find('\n', version);
+			insert = end == std::string::npos ? source.size() : end + 1;
+		}
+
+		std::string block = source.substr(0, insert);
+		if (!block.empty() && block.back() != '\n')
+			block += "\n";
+
+		int line = 1;
+		for (size_t i = 0; i < insert; i++)
+			line += source[i] == '\n';
+
+		for (const std::string& define : defines)
+			block += "#define " + define + "\n";
+		block += "#line " + std::to_string(line) + "\n";
+
+		return block + source.substr(insert);
+	}
+
+	/*
+	* 64 bit FNV-1a, seed is the hash of the previous data.
+	*/
+	unsigned long long ShaderManager::hash(const void* data, size_t size, unsigned long long seed) {
+
+		unsigned long long hash = seed ^ 14695981039346656037ull;
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+// Linked programs are kept here, keyed by the hash of their sources and the driver
+#define SHADER_CACHE_DIRECTORY "database/shadercache/"
+#define SHADER_CACHE_MAGIC 0x48534354
+#define SHADER_CACHE_VERSION 1
+
+namespace Core {
+
+	struct ShaderStage {
+
+		unsigned int type;	// GL_VERTEX_SHADER, GL_FRAGMENT_SHADER or GL_COMPUTE_SHADER
+		std::string path;
+	};
+
+	/*
+	* A permutation of a program, the sources of its stages with a set of defines.
+	*/
+	struct ShaderProgram {
+
+		unsigned int id = 0;
+		unsigned long long hash = 0;
+		std::string name;					// paths of the stages, for the log
+		std::vector<unsigned int> shaders;	// kept until the link is checked, for their logs
+		bool pending = false;				// compiled and linked, but not checked yet
+		bool linked = false;
+		bool fromCache = false;
+	};
+
+	/*
+	* Header of a program binary in the shader cache. Binary follows the header.
+	*/
+	struct ShaderCacheHeader {
+
+		unsigned int magic;
+		unsigned int version;
+		unsigned long long hash;
+		unsigned int format;
+		unsigned int length;
+	};
+
+	/*
+	* Compiles programs from their sources with a set of defines, each set is a permutation of the program.
+	* Loading only submits the compile and the link, so programs that are loaded one after another are compiled
+	* in parallel by drivers with KHR_parallel_shader_compile. Status is checked when a program is waited for.
+	* Linked programs are stored with glGetProgramBinary, next launches load them without compiling.
+	* Programs belong to the manager, a permutation that is loaded again returns the same program.
+	*/
+	class __declspec(dllexport) ShaderManager {
+
+	private:
+
+		std::map<std::string, ShaderProgram*> programs;	// by stages and defines
+		std::map<unsigned int, ShaderProgram*> programIds;
+		std::string driver;
+
+		ShaderProgram* submit(const std::vector<ShaderStage>& stages, const std::vector<std::string>& defines);
+		bool loadBinary(ShaderProgram* program);
+		void saveBinary(ShaderProgram* program);
+		void check(ShaderProgram* program);
+		std::string getCachePath(unsigned long long hash);
+
+	public:
+
+		std::string cacheDirectory = SHADER_CACHE_DIRECTORY;
+		bool parallelCompile = false;
+		bool binaryCache = false;
+
+		unsigned int cacheHits = 0;
+		unsigned int cacheMisses = 0;
+		unsigned int failedPrograms = 0;
+
+		ShaderManager();
+		~ShaderManager();
+		unsigned int load(const std::string& vertexPath, const std::string& fragmentPath, const std::vector<std::string>& defines = std::vector<std::string>());
+		unsigned int loadCompute(const std::string& computePath, const std::vector<std::string>& defines = std::vector<std::string>());
+		bool isReady(unsigned int program);
+		bool wait(unsigned int program);
+		void finish();
+		static bool readFile(const std::string& path, std::string& source);
+		static std::string addDefines(const std::string& source, const std::vector<std::string>& defines);
+		static unsigned long long hash(const void* data, size_t size, unsigned long long seed);
+	};
+}
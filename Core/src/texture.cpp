@@ -1,7 +1,12 @@
 #include "pch.h"
 #include "texture.h"
-#include "GL/glew.h"
+#include "texturecontainer.h"
+#include "blockencoder.h"
+#include "gldispatch.h"
 #include "lodepng/lodepng.h"
+#include <algorithm>
+#include <cmath>
+#include <chrono>
 
 #define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
 #define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
@@ -27,7 +32,6 @@ namespace Core {
 
 	Texture::~Texture() {
 
-		delete[] data;
 		//glDeleteTextures(1, &textureId);
 	}
 
@@ -119,45 +123,60 @@ namespace Core {
 	//	glBindTexture(GL_TEXTURE_2D, 0);
 	//}
 
+	/*
+	* The png is decoded straight to its own channel count, 8 bits per channel, so the decoded buffer is kept as it is.
+	* Palette images are decoded to RGBA.
+	*/
 	void Texture::loadPNGFile(const char* path) {
 
-		if (path == "") {
-			std::cout << "Please provide a filename to preview" << std::endl;
-			return;
-		}
+		auto begin = std::chrono::high_resolution_clock::now();
 
 		std::vector<unsigned char> buffer;
-		std::vector<unsigned char> image;
 		unsigned w, h;
 
-		lodepng::load_file(buffer, path);
+		if (lodepng::load_file(buffer, path) || buffer.empty()) {
+			std::cout << "Texture " << path << " could not be read" << std::endl;
+			return;
+		}
 
 		lodepng::State state;
-		unsigned error = lodepng::decode(image, w, h, state, buffer);
+		unsigned error = lodepng_inspect(&w, &h, &state, &buffer[0], buffer.size());
+
+		if (!error) {
+			bitDepth = state.info_png.color.bitdepth;
+			channels = lodepng_get_channels(&state.info_png.color);
+
+			LodePNGColorType colorTypes[5] = { LCT_RGBA, LCT_GREY, LCT_GREY_ALPHA, LCT_RGB, LCT_RGBA };
+			if (state.info_png.color.colortype == LCT_PALETTE)
+				channels = 4;
+			state.info_raw.colortype = colorTypes[channels];
+			state.info_raw.bitdepth = 8;
+
+			error = lodepng::decode(pixels, w, h, state, buffer);
+		}
 
 		if (error) {
 			std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+			pixels.clear();
+			channels = 0;
 			return;
 		}
 
 		width = w;
 		height = h;
-		bitDepth = state.info_png.color.bitdepth;
-		channels = lodepng_get_channels(&state.info_png.color);
+		data = &pixels[0];
 
-		int size = width * height;
-		int step = image.size() / (width * height);
-		data = new unsigned char[size * channels];
-		for (int i = 0; i < size; i++)
-			for (int j = 0; j < channels; j++)
-				data[i * channels + j] = image[i * step + j];
+		auto end = std::chrono::high_resolution_clock::now();
+		decodeDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() * 0.001f;
 	}
 
 	Texture* Texture::mergeTextures(Texture* tex0, Texture* tex1, int ch0, int ch1) {
 
 		int totalTexels = tex0->width * tex0->height;
 		int newNumChannels = ch0 + ch1;
-		unsigned char* data = new unsigned char[totalTexels * newNumChannels];
+		Texture* newTexture = new Texture;
+		newTexture->pixels.resize((size_t)totalTexels * newNumChannels);
+		unsigned char* data = &newTexture->pixels[0];
 
 		for (int i = 0; i < totalTexels; i++) {
 
@@ -168,7 +187,6 @@ namespace Core {
 				data[i * newNumChannels + ch0 + j] = tex1->data[i * tex1->channels + j];
 		}
 
-		Texture* newTexture = new Texture;
 		newTexture->data = data;
 		newTexture->channels = ch0 + ch1;
 		newTexture->bitDepth = tex0->bitDepth;
@@ -181,14 +199,15 @@ namespace Core {
 
 		int totalTexels = tex->width * tex->height;
 		int newNumChannels = ch0;
-		unsigned char* data = new unsigned char[totalTexels * newNumChannels];
+		Texture* newTexture = new Texture;
+		newTexture->pixels.resize((size_t)totalTexels * newNumChannels);
+		unsigned char* data = &newTexture->pixels[0];
 
 		for (int i = 0; i < totalTexels; i++) {
 			for (int j = 0; j < ch0; j++)
 				data[i * newNumChannels + j] = tex->data[i * tex->channels + j];
 		}
 
-		Texture* newTexture = new Texture;
 		newTexture->data = data;
 		newTexture->channels = ch0;
 		newTexture->bitDepth = tex->bitDepth;
@@ -197,6 +216,189 @@ namespace Core {
 		return newTexture;
 	}
 
+	/*
+	* Texture whose every texel is the given one. Used where a layer has no map of its own.
+	*/
+	Texture* Texture::createUniformTexture(int width, int height, int channels, const unsigned char* texel) {
+
+		int totalTexels = width * height;
+		Texture* newTexture = new Texture;
+		newTexture->pixels.resize((size_t)totalTexels * channels);
+		unsigned char* data = &newTexture->pixels[0];
+
+		for (int i = 0; i < totalTexels; i++)
+			for (int j = 0; j < channels; j++)
+				data[i * channels + j] = texel[j];
+
+		newTexture->data = data;
+		newTexture->channels = channels;
+		newTexture->bitDepth = 8;
+		newTexture->width = width;
+		newTexture->height = height;
+		return newTexture;
+	}
+
+	/*
+	* Bilinear resize with wrapping, textures of the terrain are tiled.
+	*/
+	Texture* Texture::resizeTexture(Texture* tex, int width, int height) {
+
+		int channels = tex->channels;
+		Texture* newTexture = new Texture;
+		newTexture->pixels.resize((size_t)width * height * channels);
+		unsigned char* data = &newTexture->pixels[0];
+
+		for (int i = 0; i < height; i++) {
+
+			float v = (i + 0.5f) * tex->height / height - 0.5f;
+			int y0 = (int)floor(v);
+			float fy = v - y0;
+			int row0 = ((y0 % (int)tex->height) + tex->height) % tex->height;
+			int row1 = (row0 + 1) % tex->height;
+
+			for (int j = 0; j < width; j++) {
+
+				float u = (j + 0.5f) * tex->width / width - 0.5f;
+				int x0 = (int)floor(u);
+				float fx = u - x0;
+				int column0 = ((x0 % (int)tex->width) + tex->width) % tex->width;
+				int column1 = (column0 + 1) % tex->width;
+
+				for (int c = 0; c < channels; c++) {
+					float top = tex->data[(row0 * tex->width + column0) * channels + c] * (1 - fx) + tex->data[(row0 * tex->width + column1) * channels + c] * fx;
+					float bottom = tex->data[(row1 * tex->width + column0) * channels + c] * (1 - fx) + tex->data[(row1 * tex->width + column1) * channels + c] * fx;
+					data[(i * width + j) * channels + c] = (unsigned char)(top * (1 - fy) + bottom * fy + 0.5f);
+				}
+			}
+		}
+
+		newTexture->data = data;
+		newTexture->channels = channels;
+		newTexture->bitDepth = tex->bitDepth;
+		newTexture->width = width;
+		newTexture->height = height;
+		return newTexture;
+	}
+
+	/*
+	* Every texture is a layer of one GL_TEXTURE_2D_ARRAY. They must have the same size and channel count.
+	*/
+	unsigned int Texture::loadArrayToGPU(const std::vector<Texture*>& layers) {
+
+		if (layers.empty())
+			return 0;
+
+		int width = layers[0]->width;
+		int height = layers[0]->height;
+		int channels = layers[0]->channels;
+
+		for (Texture* layer : layers) {
+			if (layer->width != width || layer->height != height || layer->channels != channels) {
+				std::cout << "Texture array layers must have the same size and channels" << std::endl;
+				return 0;
+			}
+		}
+
+		int internalFormat, format;
+		switch (channels) {
+		case 1:
+			internalFormat = GL_R8;
+			format = GL_RED;
+			break;
+		case 2:
+			internalFormat = GL_RG8;
+			format = GL_RG;
+			break;
+		case 3:
+			internalFormat = GL_RGB8;
+			format = GL_RGB;
+			break;
+		default:
+			internalFormat = GL_RGBA8;
+			format = GL_RGBA;
+			break;
+		}
+
+		int mipCount = 1;
+		while ((std::max(width, height) >> mipCount) > 0)
+			mipCount++;
+
+		float maxAniso = 0.0f;
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAniso);
+
+		unsigned int textureId;
+		glGenTextures(1, &textureId);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, mipCount, internalFormat, width, height, layers.size());
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (unsigned int i = 0; i < layers.size(); i++)
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, format, GL_UNSIGNED_BYTE, layers[i]->data);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAniso);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return textureId;
+	}
+
+	/*
+	* Uploads a cooked array with its mip chain as it is, nothing is generated by the driver.
+	* Returns 0 if the driver does not support the block format.
+	*/
+	unsigned int Texture::loadCompressedArrayToGPU(const TextureContainer& container) {
+
+		int internalFormat = 0;
+		switch (container.format) {
+		case BLOCK_FORMAT_BC1:
+			internalFormat = GLEW_EXT_texture_compression_s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : 0;
+			break;
+		case BLOCK_FORMAT_BC3:
+			internalFormat = GLEW_EXT_texture_compression_s3tc ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+			break;
+		case BLOCK_FORMAT_BC4:
+			internalFormat = GL_COMPRESSED_RED_RGTC1;
+			break;
+		case BLOCK_FORMAT_BC5:
+			internalFormat = GL_COMPRESSED_RG_RGTC2;
+			break;
+		case BLOCK_FORMAT_BC7:
+			internalFormat = GLEW_ARB_texture_compression_bptc ? GL_COMPRESSED_RGBA_BPTC_UNORM_ARB : 0;
+			break;
+		}
+
+		if (internalFormat == 0 || container.levels.empty())
+			return 0;
+
+		float maxAniso = 0.0f;
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAniso);
+
+		unsigned int textureId;
+		glGenTextures(1, &textureId);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, container.levels.size(), internalFormat, container.width, container.height, container.layerCount);
+
+		// A level keeps the blocks of every layer one after another, so all layers of a level are one upload
+		for (unsigned int level = 0; level < container.levels.size(); level++) {
+			int width = std::max(container.width >> level, 1);
+			int height = std::max(container.height >> level, 1);
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, width, height, container.layerCount, internalFormat,
+				container.levels[level].size(), &container.levels[level][0]);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAniso);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return textureId;
+	}
+
 	unsigned int Texture::loadToGPU() {
 
 		int channelType;
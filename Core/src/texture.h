@@ -2,6 +2,8 @@
 
 namespace Core {
 
+	class TextureContainer;
+
 	class __declspec(dllexport) Texture {
 
 	private:
@@ -12,11 +14,16 @@ namespace Core {
 
 	public:
 
-		unsigned char* data;
-		unsigned int channels;
-		unsigned int bitDepth;
-		unsigned int width;
-		unsigned int height;
+		/*
+		* Texels belong to pixels, data points to them. A decoded png is kept in the buffer lodepng decoded it to.
+		*/
+		std::vector<unsigned char> pixels;
+		unsigned char* data = NULL;
+		unsigned int channels = 0;
+		unsigned int bitDepth = 0;
+		unsigned int width = 0;
+		unsigned int height = 0;
+		float decodeDuration = 0.f;
 
 		Texture();
 		Texture(std::filesystem::path entry);
@@ -26,6 +33,10 @@ namespace Core {
 		void loadPNGFile(const char* path);
 		static Texture* mergeTextures(Texture* tex0, Texture* tex1, int ch0, int ch1);
 		static Texture* loadTexturePartial(Texture* tex, int ch0);
+		static Texture* createUniformTexture(int width, int height, int channels, const unsigned char* texel);
+		static Texture* resizeTexture(Texture* tex, int width, int height);
+		static unsigned int loadArrayToGPU(const std::vector<Texture*>& layers);
+		static unsigned int loadCompressedArrayToGPU(const TextureContainer& container);
 		unsigned int loadToGPU();
 
 	};
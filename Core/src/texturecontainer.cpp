@@ -0,0 +1,263 @@
+#include "pch.h"
+#include "texturecontainer.h"
+#include "blockencoder.h"
+#include <cstring>
+#include <algorithm>
+
+namespace Core {
+
+	static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	static_assert(sizeof(TextureContainerHeader) == 68, "TextureContainerHeader does not match the KTX2 header");
+	static_assert(sizeof(TextureContainerLevel) == 24, "TextureContainerLevel does not match the KTX2 level index");
+
+	static inline void appendWord(std::vector<unsigned char>& data, unsigned int word) {
+
+		for (int i = 0; i < 4; i++)
+			data.push_back(word >> (8 * i) & 255);
+	}
+
+	static inline size_t alignUp(size_t value, size_t alignment) {
+
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	unsigned int TextureContainer::getVkFormat(int format) {
+
+		switch (format) {
+		case BLOCK_FORMAT_BC1:
+			return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		case BLOCK_FORMAT_BC3:
+			return VK_FORMAT_BC3_UNORM_BLOCK;
+		case BLOCK_FORMAT_BC4:
+			return VK_FORMAT_BC4_UNORM_BLOCK;
+		case BLOCK_FORMAT_BC5:
+			return VK_FORMAT_BC5_UNORM_BLOCK;
+		case BLOCK_FORMAT_BC7:
+			return VK_FORMAT_BC7_UNORM_BLOCK;
+		}
+		return 0;
+	}
+
+	int TextureContainer::getLevelCount(int width, int height) {
+
+		int levelCount = 1;
+		while ((std::max(width, height) >> levelCount) > 0)
+			levelCount++;
+		return levelCount;
+	}
+
+	/*
+	* Bytes of a level with all of its layers.
+	*/
+	size_t TextureContainer::getLevelBytes(int level) {
+
+		return BlockEncoder::getImageBytes(format, std::max(width >> level, 1), std::max(height >> level, 1)) * layerCount;
+	}
+
+	/*
+	* Basic data format descriptor of a block format: one sample per BC4 block in the block, linear BT.709 values.
+	*/
+	void TextureContainer::writeDataFormatDescriptor(int format, std::vector<unsigned char>& descriptor) {
+
+		// color model and the channel of each 64 bit half of the block
+		unsigned int colorModel = 0;
+		std::vector<unsigned int> channels;
+		switch (format) {
+		case BLOCK_FORMAT_BC1:
+			colorModel = 128;
+			channels = { 0 };
+			break;
+		case BLOCK_FORMAT_BC3:
+			colorModel = 130;
+			channels = { 15, 0 };
+			break;
+		case BLOCK_FORMAT_BC4:
+			colorModel = 131;
+			channels = { 0 };
+			break;
+		case BLOCK_FORMAT_BC5:
+			colorModel = 132;
+			channels = { 0, 1 };
+			break;
+		case BLOCK_FORMAT_BC7:
+			colorModel = 134;
+			channels = { 0 };
+			break;
+		}
+
+		unsigned int blockBytes = BlockEncoder::getBlockBytes(format);
+		unsigned int sampleBits = blockBytes * 8 / (unsigned int)channels.size();
+		unsigned int blockSize = 24 + 16 * (unsigned int)channels.size();
+
+		descriptor.clear();
+		appendWord(descriptor, 4 + blockSize);
+		appendWord(descriptor, 0);						// Khronos vendor, basic descriptor type
+		appendWord(descriptor, 2 | blockSize << 16);	// version 1.3
+		appendWord(descriptor, colorModel | 1 << 8 | 1 << 16);
+		appendWord(descriptor, 3 | 3 << 8);				// 4x4 texel blocks
+		appendWord(descriptor, blockBytes);
+		appendWord(descriptor, 0);
+
+		for (unsigned int i = 0; i < channels.size(); i++) {
+			appendWord(descriptor, i * sampleBits | (sampleBits - 1) << 16 | channels[i] << 24);
+			appendWord(descriptor, 0);
+			appendWord(descriptor, 0);
+			appendWord(descriptor, 0xFFFFFFFF);
+		}
+	}
+
+	/*
+	* Levels are written from the smallest, each one aligned to its block size, as KTX2 orders them.
+	*/
+	bool TextureContainer::save(const std::string& path) {
+
+		unsigned int levelCount = (unsigned int)levels.size();
+		size_t alignment = BlockEncoder::getBlockBytes(format);
+
+		std::vector<unsigned char> descriptor;
+		TextureContainer::writeDataFormatDescriptor(format, descriptor);
+
+		std::vector<unsigned char> keyValueData;
+		for (auto& it : keyValues) {
+			appendWord(keyValueData, (unsigned int)(it.first.size() + it.second.size() + 2));
+			keyValueData.insert(keyValueData.end(), it.first.begin(), it.first.end());
+			keyValueData.push_back(0);
+			keyValueData.insert(keyValueData.end(), it.second.begin(), it.second.end());
+			keyValueData.push_back(0);
+			keyValueData.resize(alignUp(keyValueData.size(), 4), 0);
+		}
+
+		TextureContainerHeader header = {};
+		header.vkFormat = TextureContainer::getVkFormat(format);
+		header.typeSize = 1;
+		header.pixelWidth = width;
+		header.pixelHeight = height;
+		header.layerCount = layerCount;
+		header.faceCount = 1;
+		header.levelCount = levelCount;
+		header.dfdByteOffset = (unsigned int)(sizeof(identifier) + sizeof(TextureContainerHeader) + levelCount * sizeof(TextureContainerLevel));
+		header.dfdByteLength = (unsigned int)descriptor.size();
+		header.kvdByteOffset = keyValueData.empty() ? 0 : header.dfdByteOffset + header.dfdByteLength;
+		header.kvdByteLength = (unsigned int)keyValueData.size();
+
+		std::vector<TextureContainerLevel> levelIndex(levelCount);
+		size_t offset = header.dfdByteOffset + descriptor.size() + keyValueData.size();
+		for (int level = levelCount - 1; level >= 0; level--) {
+			offset = alignUp(offset, alignment);
+			levelIndex[level].byteOffset = offset;
+			levelIndex[level].byteLength = levels[level].size();
+			levelIndex[level].uncompressedByteLength = levels[level].size();
+			offset += levels[level].size();
+		}
+
+		std::error_code error;
+		std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		file.write((const char*)identifier, sizeof(identifier));
+		file.write((const char*)&header, sizeof(TextureContainerHeader));
+		file.write((const char*)&levelIndex[0], levelCount * sizeof(TextureContainerLevel));
+		file.write((const char*)&descriptor[0], descriptor.size());
+		if (!keyValueData.empty())
+			file.write((const char*)&keyValueData[0], keyValueData.size());
+
+		size_t position = header.dfdByteOffset + descriptor.size() + keyValueData.size();
+		const char padding[16] = {};
+		for (int level = levelCount - 1; level >= 0; level--) {
+			file.write(padding, levelIndex[level].byteOffset - position);
+			file.write((const char*)&levels[level][0], levels[level].size());
+			position = levelIndex[level].byteOffset + levels[level].size();
+		}
+
+		return file.good();
+	}
+
+	/*
+	* Fails on anything the cooker does not write, so the caller can fall back to the source textures.
+	*/
+	bool TextureContainer::load(const std::string& path) {
+
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return false;
+
+		size_t fileSize = (size_t)file.tellg();
+		file.seekg(0);
+
+		unsigned char fileIdentifier[12];
+		TextureContainerHeader header;
+		if (fileSize < sizeof(identifier) + sizeof(TextureContainerHeader) ||
+			!file.read((char*)fileIdentifier, sizeof(fileIdentifier)) || memcmp(fileIdentifier, identifier, sizeof(identifier)) != 0 ||
+			!file.read((char*)&header, sizeof(TextureContainerHeader)))
+			return false;
+
+		format = -1;
+		for (int i = 0; i < BLOCK_FORMAT_COUNT; i++)
+			if (TextureContainer::getVkFormat(i) == header.vkFormat)
+				format = i;
+
+		if (format < 0 || header.supercompressionScheme != 0 || header.faceCount != 1 || header.pixelDepth != 0 ||
+			header.pixelWidth == 0 || header.pixelHeight == 0 || header.levelCount == 0 ||
+			(int)header.levelCount > TextureContainer::getLevelCount(header.pixelWidth, header.pixelHeight))
+			return false;
+
+		width = header.pixelWidth;
+		height = header.pixelHeight;
+		layerCount = std::max(header.layerCount, 1u);
+
+		std::vector<TextureContainerLevel> levelIndex(header.levelCount);
+		if (!file.read((char*)&levelIndex[0], header.levelCount * sizeof(TextureContainerLevel)))
+			return false;
+
+		keyValues.clear();
+		if (header.kvdByteLength > 0) {
+
+			if ((size_t)header.kvdByteOffset + header.kvdByteLength > fileSize)
+				return false;
+
+			std::vector<char> keyValueData(header.kvdByteLength);
+			file.seekg(header.kvdByteOffset);
+			if (!file.read(&keyValueData[0], keyValueData.size()))
+				return false;
+
+			size_t position = 0;
+			while (position + 4 <= keyValueData.size()) {
+
+				unsigned int length;
+				memcpy(&length, &keyValueData[position], 4);
+				position += 4;
+				if (position + length > keyValueData.size())
+					return false;
+
+				std::string keyValue(&keyValueData[position], length);
+				size_t separator = keyValue.find('\0');
+				if (separator != std::string::npos) {
+					std::string value = keyValue.substr(separator + 1);
+					if (!value.empty() && value.back() == '\0')
+						value.pop_back();
+					keyValues[keyValue.substr(0, separator)] = value;
+				}
+				position = alignUp(position + length, 4);
+			}
+		}
+
+		levels.resize(header.levelCount);
+		for (unsigned int level = 0; level < header.levelCount; level++) {
+
+			size_t bytes = TextureContainer::getLevelBytes(level);
+			if (levelIndex[level].byteLength != bytes || levelIndex[level].byteOffset + bytes > fileSize)
+				return false;
+
+			levels[level].resize(bytes);
+			file.seekg(levelIndex[level].byteOffset);
+			if (!file.read((char*)&levels[level][0], bytes))
+				return false;
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+// Vulkan formats of the block formats, the vkFormat of the KTX2 header
+#define VK_FORMAT_BC1_RGB_UNORM_BLOCK 131
+#define VK_FORMAT_BC3_UNORM_BLOCK 137
+#define VK_FORMAT_BC4_UNORM_BLOCK 139
+#define VK_FORMAT_BC5_UNORM_BLOCK 141
+#define VK_FORMAT_BC7_UNORM_BLOCK 145
+
+namespace Core {
+
+	/*
+	* Header of a KTX2 file after its 12 byte identifier, with the index of the data format descriptor,
+	* key/value data and supercompression data. Level index follows, one TextureContainerLevel per level.
+	* Packed to 4 bytes, the 64 bit offsets are not 8 byte aligned in the file.
+	*/
+#pragma pack(push, 4)
+	struct TextureContainerHeader {
+
+		unsigned int vkFormat;
+		unsigned int typeSize;
+		unsigned int pixelWidth;
+		unsigned int pixelHeight;
+		unsigned int pixelDepth;
+		unsigned int layerCount;
+		unsigned int faceCount;
+		unsigned int levelCount;
+		unsigned int supercompressionScheme;
+		unsigned int dfdByteOffset;
+		unsigned int dfdByteLength;
+		unsigned int kvdByteOffset;
+		unsigned int kvdByteLength;
+		unsigned long long sgdByteOffset;
+		unsigned long long sgdByteLength;
+	};
+#pragma pack(pop)
+
+	struct TextureContainerLevel {
+
+		unsigned long long byteOffset;
+		unsigned long long byteLength;
+		unsigned long long uncompressedByteLength;
+	};
+
+	/*
+	* Block compressed texture array with its whole mip chain in a KTX2 file. Only what the cooker writes is read back:
+	* 2D textures or arrays of the BLOCK_FORMAT formats, one face, no supercompression.
+	* Levels are in memory from the largest, every level keeps the blocks of all layers one after another.
+	* Key/value data keeps strings, the cooker stores the stamp of the sources in it.
+	*/
+	class __declspec(dllexport) TextureContainer {
+
+	private:
+
+		static void writeDataFormatDescriptor(int format, std::vector<unsigned char>& descriptor);
+
+	public:
+
+		int format = 0;
+		int width = 0;
+		int height = 0;
+		int layerCount = 1;
+		std::vector<std::vector<unsigned char>> levels;
+		std::map<std::string, std::string> keyValues;
+
+		bool load(const std::string& path);
+		bool save(const std::string& path);
+		size_t getLevelBytes(int level);
+		static int getLevelCount(int width, int height);
+		static unsigned int getVkFormat(int format);
+	};
+}
@@ -0,0 +1,82 @@
+#include "pch.h"
+#include "threadpool.h"
+#include "profiler.h"
+
+namespace Core {
+
+	ThreadPool::ThreadPool(unsigned int threadCount) {
+
+		if (threadCount == 0)
+			threadCount = std::thread::hardware_concurrency();
+		if (threadCount == 0)
+			threadCount = 1;
+
+		for (unsigned int i = 0; i < threadCount; i++)
+			workers.push_back(std::thread(&ThreadPool::run, this));
+	}
+
+	ThreadPool::~ThreadPool() {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		taskCondition.notify_all();
+
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	void ThreadPool::submit(std::function<void()> task) {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push(std::move(task));
+			activeTasks++;
+		}
+		taskCondition.notify_one();
+	}
+
+	void ThreadPool::wait() {
+
+		std::unique_lock<std::mutex> lock(mutex);
+		idleCondition.wait(lock, [this] { return activeTasks == 0; });
+	}
+
+	unsigned int ThreadPool::getThreadCount() {
+
+		return workers.size();
+	}
+
+	/*
+	* Worker thread. Remaining tasks are still run when the pool is destroyed.
+	*/
+	void ThreadPool::run() {
+
+		PROFILE_THREAD("Pool worker");
+
+		while (true) {
+
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				taskCondition.wait(lock, [this] { return !running || !tasks.empty(); });
+
+				if (tasks.empty())
+					return;
+
+				task = std::move(tasks.front());
+				tasks.pop();
+			}
+
+			{
+				PROFILE_SCOPE("ThreadPool task");
+				task();
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--activeTasks == 0)
+				idleCondition.notify_all();
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+namespace Core {
+
+	/*
+	* Fixed number of worker threads that run submitted tasks in order of submission.
+	* wait() blocks until every task submitted so far is finished.
+	*/
+	class __declspec(dllexport) ThreadPool {
+
+	private:
+
+		std::vector<std::thread> workers;
+		std::queue<std::function<void()>> tasks;
+		std::mutex mutex;
+		std::condition_variable taskCondition;
+		std::condition_variable idleCondition;
+		unsigned int activeTasks = 0;
+		bool running = true;
+
+		void run();
+
+	public:
+
+		// 0 means one thread per hardware thread
+		ThreadPool(unsigned int threadCount = 0);
+		~ThreadPool();
+		void submit(std::function<void()> task);
+		void wait();
+		unsigned int getThreadCount();
+	};
+}
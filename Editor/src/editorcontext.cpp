@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "editorcontext.h"
 #include "scene.h"
+#include "profiler.h"
 
 using namespace Core;
 
@@ -28,6 +29,8 @@ namespace Editor {
 
 	void EditorContext::update(float dt) {
 
+		PROFILE_FUNCTION();
+
 		menu->update();
 		camera->update(dt);
 
@@ -1,7 +1,12 @@
 #include "pch.h"
 #include "menu.h"
 #include "editorcontext.h"
+#include "component/terrainstreamer.h"
+#include "component/terraintilecache.h"
+#include "component/terrainprefetcher.h"
+#include "gldispatch.h"
 #include "GLM/gtc/type_ptr.hpp"
+#include <algorithm>
 
 namespace Editor {
 
@@ -160,6 +165,7 @@ namespace Editor {
 		Menu::secondaryMenuBar();
 		Menu::createInspectorPanel();
 		Menu::createStatisticsPanel();
+		Menu::createProfilerPanel();
 		Menu::createHierarchyPanel();
 		Menu::createScenePanel();
 		ImGui::End();
@@ -290,16 +296,236 @@ namespace Editor {
 		ImGui::PopStyleVar();
 	}
 
+	/*
+	* Counters of the last COUNTERS_HISTORY frames as rolling graphs, the newest frame is on the right.
+	* Level counters are of the last frame, memory is what each category holds now.
+	*/
 	void Menu::createStatisticsPanel() {
 
 		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(5, 5));
 		ImGui::Begin("Statistics");
 		ImGui::TextColored(DEFAULT_TEXT_COLOR, "%.1f FPS", ImGui::GetIO().Framerate);
+
+		float graph[COUNTERS_HISTORY];
+		char overlay[64];
+		auto plot = [&](const char* label, const char* format, float (*value)(const CounterFrame&)) {
+			for (unsigned int age = 0; age < COUNTERS_HISTORY; age++)
+				graph[COUNTERS_HISTORY - 1 - age] = value(Counters::getFrame(age));
+			snprintf(overlay, sizeof(overlay), format, graph[COUNTERS_HISTORY - 1]);
+			ImGui::PlotLines(label, graph, COUNTERS_HISTORY, 0, overlay, 0.f, FLT_MAX, ImVec2(0, COUNTERS_GRAPH_HEIGHT));
+		};
+
+		// Blocks culled on the GPU are not read back, the triangles are of the blocks submitted to the culling pass
+		bool gpuCulling = Counters::get(COUNTER_GPU_CULLING) != 0;
+
+		ImGui::Separator();
+		plot("Frame time", "%.2f ms", [](const CounterFrame& frame) { return frame.frameTime; });
+		plot(gpuCulling ? "Triangles (submitted)###triangles" : "Triangles###triangles", "%.0f", [](const CounterFrame& frame) { return (float)frame.values[COUNTER_TRIANGLES]; });
+		plot("Streamed", "%.0f KB", [](const CounterFrame& frame) {
+			unsigned long long bytes = 0;
+			for (int level = 0; level < COUNTERS_MAX_LEVELS; level++)
+				bytes += frame.levelValues[LEVEL_COUNTER_STREAMED_BYTES][level];
+			return bytes / 1024.f;
+		});
+		plot("Full reloads", "%.0f", [](const CounterFrame& frame) { return (float)frame.values[COUNTER_FULL_RELOADS]; });
+
+		// frames of each bucket, since the last reset
+		float buckets[COUNTERS_HISTOGRAM_BUCKETS];
+		unsigned long long frames = 0;
+		for (int i = 0; i < COUNTERS_HISTOGRAM_BUCKETS; i++) {
+			buckets[i] = (float)Counters::histogram[i];
+			frames += Counters::histogram[i];
+		}
+		snprintf(overlay, sizeof(overlay), "%llu frames, %.1f ms to %.0f ms", frames, Counters::histogramEdges[0], Counters::histogramEdges[COUNTERS_HISTOGRAM_BUCKETS - 2]);
+		ImGui::PlotHistogram("Frame times", buckets, COUNTERS_HISTOGRAM_BUCKETS, 0, overlay, 0.f, FLT_MAX, ImVec2(0, COUNTERS_GRAPH_HEIGHT));
+		if (ImGui::Button("Reset histogram"))
+			Counters::resetHistogram();
+
+		ImGui::Separator();
+		if (gpuCulling)
+			ImGui::TextColored(DEFAULT_TEXT_COLOR, "Visible and culled blocks are unavailable with GPU culling");
+		if (ImGui::BeginTable("##levelCounters", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+
+			ImGui::TableSetupColumn("Level");
+			ImGui::TableSetupColumn("Visible blocks");
+			ImGui::TableSetupColumn("Culled blocks");
+			ImGui::TableSetupColumn("Streamed texels");
+			ImGui::TableSetupColumn("Streamed (KB)");
+			ImGui::TableHeadersRow();
+
+			for (int level = 0; level < CLIPMAP_LEVEL; level++) {
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%d", level);
+				if (gpuCulling) {
+					ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "-");
+					ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "-");
+				}
+				else {
+					ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%llu", Counters::getLevel(LEVEL_COUNTER_VISIBLE_BLOCKS, level));
+					ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%llu", Counters::getLevel(LEVEL_COUNTER_CULLED_BLOCKS, level));
+				}
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%llu", Counters::getLevel(LEVEL_COUNTER_STREAMED_TEXELS, level));
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%.1f", Counters::getLevel(LEVEL_COUNTER_STREAMED_BYTES, level) / 1024.f);
+			}
+
+			ImGui::EndTable();
+		}
+
+		ImGui::Separator();
+		ImGui::TextColored(DEFAULT_TEXT_COLOR, "Memory: CPU %.1f MB, GPU %.1f MB", Counters::getMemoryTotal(false) / (1024.f * 1024.f), Counters::getMemoryTotal(true) / (1024.f * 1024.f));
+		if (ImGui::BeginTable("##memoryCounters", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+
+			ImGui::TableSetupColumn("Category");
+			ImGui::TableSetupColumn("Where");
+			ImGui::TableSetupColumn("MB");
+			ImGui::TableHeadersRow();
+
+			for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, Counters::memoryNames[i]);
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, i < MEMORY_GPU_FIRST ? "CPU" : "GPU");
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%.2f", Counters::memory[i] / (1024.f * 1024.f));
+			}
+
+			ImGui::EndTable();
+		}
+
+		ImGui::Separator();
+		ImGui::Checkbox("GPU timers", &GPUTimer::enabled); ImGui::SameLine();
+		ImGui::Checkbox("Split terrain", &GPUTimer::splitTerrain); ImGui::SameLine();
+		ImGui::TextColored(DEFAULT_TEXT_COLOR, "%u read back, %u dropped", GPUTimer::resolvedFrames, GPUTimer::droppedFrames);
+
+		if (ImGui::BeginTable("##gpuTimers", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+
+			ImGui::TableSetupColumn("Pass");
+			ImGui::TableSetupColumn("Last (ms)");
+			ImGui::TableSetupColumn("Average (ms)");
+			ImGui::TableHeadersRow();
+
+			for (int i = 0; i < GPU_PASS_COUNT; i++) {
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, GPUTimer::passNames[i]);
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%.3f", GPUTimer::passTimes[i]);
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%.3f", GPUTimer::smoothedTimes[i]);
+			}
+
+			ImGui::EndTable();
+		}
+
 		ImGui::End();
 		ImGui::PopStyleVar();
 	}
 
 
+	/*
+	* Scopes of every thread in the last milliseconds, a nested scope is drawn below its parent.
+	* Pause keeps the snapshot so a spike can be looked at, the slowest scopes of the window are listed under it.
+	*/
+	void Menu::createProfilerPanel() {
+
+		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(5, 5));
+		ImGui::Begin("Profiler");
+
+		ImGui::Checkbox("Record", &Profiler::enabled); ImGui::SameLine();
+		ImGui::Checkbox("Pause", &profilerPaused); ImGui::SameLine();
+		ImGui::PushItemWidth(80);
+		ImGui::DragFloat("Window (ms)", &profilerWindow, 1.f, 5.f, 1000.f, "%.0f");
+		ImGui::PopItemWidth(); ImGui::SameLine();
+		if (ImGui::Button("Export trace"))
+			profilerExportStatus = Profiler::exportChromeTrace(PROFILER_TRACE_PATH) ? "Written to " PROFILER_TRACE_PATH : "Could not write " PROFILER_TRACE_PATH;
+		if (!profilerExportStatus.empty()) {
+			ImGui::SameLine();
+			ImGui::TextColored(DEFAULT_TEXT_COLOR, &profilerExportStatus[0]);
+		}
+
+		unsigned long long window = (unsigned long long)(profilerWindow * 1e6f);
+		if (!profilerPaused) {
+			profilerEnd = Profiler::now();
+			Profiler::collect(profilerEvents, profilerEnd - window);
+		}
+		unsigned long long windowStart = profilerEnd - window;
+
+		ImDrawList* drawList = ImGui::GetWindowDrawList();
+		const float rowHeight = ImGui::GetTextLineHeight() + 2.f;
+		float width = ImGui::GetContentRegionAvail().x;
+		float pixelsPerNs = width / window;
+
+		struct ScopeTotal {
+			unsigned int calls = 0;
+			float total = 0.f;
+			float max = 0.f;
+		};
+		std::map<std::string, ScopeTotal> totals;
+
+		for (ProfilerThreadEvents& thread : profilerEvents) {
+
+			unsigned int depth = 1;
+			for (ProfilerEvent& event : thread.events)
+				depth = std::max(depth, event.depth + 1);
+
+			ImGui::TextColored(DEFAULT_TEXT_COLOR, &thread.name[0]);
+			ImVec2 origin = ImGui::GetCursorScreenPos();
+			ImGui::Dummy(ImVec2(width, rowHeight * depth));
+			drawList->PushClipRect(origin, ImVec2(origin.x + width, origin.y + rowHeight * depth), true);
+
+			for (ProfilerEvent& event : thread.events) {
+
+				float duration = (event.end - event.start) * 1e-6f;
+				ScopeTotal& total = totals[event.name];
+				total.calls++;
+				total.total += duration;
+				total.max = std::max(total.max, duration);
+
+				float x0 = origin.x + ((long long)event.start - (long long)windowStart) * pixelsPerNs;
+				float x1 = std::max(origin.x + ((long long)event.end - (long long)windowStart) * pixelsPerNs, x0 + 1.f);
+				float y0 = origin.y + event.depth * rowHeight;
+				ImVec2 min(x0, y0);
+				ImVec2 max(x1, y0 + rowHeight - 1.f);
+
+				// same scope, same color
+				float hue = (std::hash<std::string>()(event.name) % 64) / 64.f;
+				drawList->AddRectFilled(min, max, ImColor::HSV(hue, 0.45f, 0.65f));
+				if (x1 - x0 > 30.f) {
+					drawList->PushClipRect(min, max, true);
+					drawList->AddText(ImVec2(x0 + 2.f, y0), IM_COL32(255, 255, 255, 255), event.name);
+					drawList->PopClipRect();
+				}
+
+				if (ImGui::IsMouseHoveringRect(min, max) && ImGui::IsWindowHovered())
+					ImGui::SetTooltip("%s\n%.3f ms", event.name, duration);
+			}
+
+			drawList->PopClipRect();
+		}
+
+		std::vector<std::pair<std::string, ScopeTotal>> slowest(totals.begin(), totals.end());
+		std::sort(slowest.begin(), slowest.end(), [](const std::pair<std::string, ScopeTotal>& a, const std::pair<std::string, ScopeTotal>& b) { return a.second.total > b.second.total; });
+		if (slowest.size() > PROFILER_TOP_SCOPES)
+			slowest.resize(PROFILER_TOP_SCOPES);
+
+		if (!slowest.empty() && ImGui::BeginTable("##profilerScopes", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+
+			ImGui::TableSetupColumn("Scope");
+			ImGui::TableSetupColumn("Calls");
+			ImGui::TableSetupColumn("Total (ms)");
+			ImGui::TableSetupColumn("Max (ms)");
+			ImGui::TableHeadersRow();
+
+			for (std::pair<std::string, ScopeTotal>& scope : slowest) {
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, &scope.first[0]);
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%u", scope.second.calls);
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%.3f", scope.second.total);
+				ImGui::TableNextColumn(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "%.3f", scope.second.max);
+			}
+
+			ImGui::EndTable();
+		}
+
+		ImGui::End();
+		ImGui::PopStyleVar();
+	}
+
 	void Menu::createHierarchyPanel() {
 
 		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(5, 5));
@@ -649,12 +875,73 @@ namespace Editor {
 			ImGui::TextColored(DEFAULT_TEXT_COLOR, "Show Bounds"); ImGui::SameLine();
 			ImGui::Checkbox("##showBounds", &terrain->showBounds);
 
+			ImGui::TextColored(DEFAULT_TEXT_COLOR, "GPU Culling"); ImGui::SameLine();
+			ImGui::Checkbox("##gpuCulling", &terrain->gpuCulling);
+
+			ImGui::TextColored(DEFAULT_TEXT_COLOR, "Fog"); ImGui::SameLine();
+			ImGui::Checkbox("##fog", &terrain->fog);
+			ImGui::SameLine(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "Debug Colors"); ImGui::SameLine();
+			ImGui::Checkbox("##debugColors", &terrain->debugColors);
+
+			ShaderManager* shaderManager = CoreContext::instance->shaderManager;
+			std::string shaderCacheStr = "Shader cache hits: " + std::to_string(shaderManager->cacheHits) + " Misses: " + std::to_string(shaderManager->cacheMisses) +
+				(shaderManager->parallelCompile ? " (parallel compile)" : "");
+			ImGui::TextColored(DEFAULT_TEXT_COLOR, &shaderCacheStr[0]);
+
+			std::string texturesStr = "Terrain textures: " + terrain->textureFormats + " (" + std::to_string(terrain->textureLoadDuration) + " ms)";
+			ImGui::TextColored(DEFAULT_TEXT_COLOR, &texturesStr[0]);
+
+			std::string materialUploadsStr = "Material uploads: " + std::to_string(terrain->materialUploads);
+			ImGui::TextColored(DEFAULT_TEXT_COLOR, &materialUploadsStr[0]);
+			std::string splatBakeStr = "Splat bake (ms): " + std::to_string(terrain->splatBakeDuration);
+			ImGui::TextColored(DEFAULT_TEXT_COLOR, &splatBakeStr[0]);
+
+			if (terrain->streamer) {
+				int streamBudget = terrain->streamer->bytesPerFrame / 1024;
+				ImGui::TextColored(DEFAULT_TEXT_COLOR, "Stream Budget (KB)"); ImGui::SameLine(); ImGui::PushItemWidth(itemWidth);
+				if (ImGui::DragInt("##streamBudget", &streamBudget, 16.f, 64, 65536))
+					terrain->streamer->bytesPerFrame = streamBudget * 1024;
+				std::string streamStr = "Streamed this frame (KB): " + std::to_string(terrain->streamer->uploadedBytes / 1024) + " Jobs in flight: " + std::to_string(terrain->streamer->jobsInFlight);
+				ImGui::TextColored(DEFAULT_TEXT_COLOR, &streamStr[0]);
+
+				RingBuffer* ring = terrain->streamer->ring;
+				std::string ringStr = ring ? "Upload ring stalls: " + std::to_string(ring->stallCount) + " (" + std::to_string(ring->stallDuration) + " us) Full: " + std::to_string(ring->fullCount) : "Upload ring: not supported";
+				ImGui::TextColored(DEFAULT_TEXT_COLOR, &ringStr[0]);
+			}
+
+			if (terrain->tileCache) {
+				TerrainTileCache* tileCache = terrain->tileCache;
+				std::string tileCacheStr = "Tile cache (MB): " + std::to_string(tileCache->residentBytes >> 20) + " / " + std::to_string(tileCache->capacity >> 20) +
+					" Hits: " + std::to_string(tileCache->hits) + " Misses: " + std::to_string(tileCache->misses) +
+					" Evictions: " + std::to_string(tileCache->evictions) + " Prefetches: " + std::to_string(tileCache->prefetches);
+				ImGui::TextColored(DEFAULT_TEXT_COLOR, &tileCacheStr[0]);
+			}
+
+			if (terrain->prefetcher) {
+				TerrainPrefetcher* prefetcher = terrain->prefetcher;
+				ImGui::TextColored(DEFAULT_TEXT_COLOR, "Prefetch"); ImGui::SameLine();
+				ImGui::Checkbox("##prefetch", &prefetcher->enabled);
+				ImGui::SameLine(); ImGui::TextColored(DEFAULT_TEXT_COLOR, "Horizon (s)"); ImGui::SameLine(); ImGui::PushItemWidth(itemWidth);
+				ImGui::DragFloat("##prefetchHorizon", &prefetcher->horizon, 0.05f, 0.1f, 10.0f, "%.2f");
+				std::string prefetchStr = "Prefetch hit rate: " + std::to_string((int)(prefetcher->getHitRate() * 100)) + "% Prefetched tiles: " + std::to_string(prefetcher->prefetchedTiles) +
+					" Wasted (MB): " + std::to_string(prefetcher->wastedBytes >> 20);
+				ImGui::TextColored(DEFAULT_TEXT_COLOR, &prefetchStr[0]);
+			}
+
 			glm::vec3 camPos = CoreContext::instance->scene->cameraInfo.camPos;
 			std::string camPosStr = "Camera Pos X: " + std::to_string(camPos.x) + " Y: " + std::to_string(camPos.y) + " Z: " + std::to_string(camPos.z);
 			ImGui::TextColored(DEFAULT_TEXT_COLOR, &camPosStr[0]);
 			std::string terrainRenderDurationStr = "Terrain render time (microseconds): " + std::to_string(CoreContext::instance->renderer->terrainRenderDuration);
 			ImGui::TextColored(DEFAULT_TEXT_COLOR, &terrainRenderDurationStr[0]);
 
+			if (GLDispatch::recording) {
+				const GLFrameStatistics& glFrame = GLDispatch::lastFrame;
+				std::string glCallsStr = "GL calls: " + std::to_string(glFrame.calls) + " Terrain: " + std::to_string(CoreContext::instance->renderer->terrainGLCalls) +
+					" Draws: " + std::to_string(glFrame.categoryCalls[GL_CALL_DRAW]) + " State: " + std::to_string(glFrame.categoryCalls[GL_CALL_STATE]) +
+					" Uniforms: " + std::to_string(glFrame.categoryCalls[GL_CALL_UNIFORM]) + " Uploaded (KB): " + std::to_string(glFrame.uploadedBytes >> 10);
+				ImGui::TextColored(DEFAULT_TEXT_COLOR, &glCallsStr[0]);
+			}
+
 			ImGui::TreePop();
 		}
 
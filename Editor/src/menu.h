@@ -7,11 +7,18 @@
 #include "imguizmo/imguizmo.h"
 
 #include "corecontext.h"
+#include "profiler.h"
+#include "gputimer.h"
+#include "counters.h"
 
 #define WHITE ImVec4(1.0f, 1.0f, 1.0f, 1.0f)
 #define DEFAULT_TEXT_COLOR ImVec4(0.8f, 0.8f, 0.8f, 1.0f)
 #define TEXT_SELECTED_COLOR ImVec4(0.2f, 0.72f, 0.95f, 1.f)
 
+#define PROFILER_TRACE_PATH "profile_trace.json"
+#define PROFILER_TOP_SCOPES 12
+#define COUNTERS_GRAPH_HEIGHT 50
+
 namespace Core {
 	
 	class Terrain;
@@ -56,6 +63,12 @@ namespace Editor {
 		bool environmentHolded = false;
 		bool environmentColored = false;
 
+		bool profilerPaused = false;
+		float profilerWindow = 50.f;	// ms
+		unsigned long long profilerEnd = 0;
+		std::vector<ProfilerThreadEvents> profilerEvents;
+		std::string profilerExportStatus;
+
 		void inputControl();
 
 
@@ -76,6 +89,7 @@ namespace Editor {
 		void mainMenuBar();
 		void secondaryMenuBar();
 		void createStatisticsPanel();
+		void createProfilerPanel();
 		void createScenePanel();
 		void createInspectorPanel();
 		void setTheme();